@@ -0,0 +1,146 @@
+#include <boost/filesystem.hpp>
+
+#include "archive_cache.h"
+
+using namespace saved_game_format_file;
+
+namespace {
+
+    // members are looked up by file and name together
+    std::string member_key(const std::string& filename, const std::string& subfile_name) {
+        std::string key(filename);
+        key.push_back('\0');
+        key.append(subfile_name);
+        return key;
+    }
+
+}
+
+bool ArchiveCache::stamp_file(const std::string& filename, file_stamp& stamp) {
+    boost::system::error_code fs_error;
+    uintmax_t file_size = boost::filesystem::file_size(filename, fs_error);
+    if (fs_error) {
+        return false;
+    }
+    std::time_t file_mtime = boost::filesystem::last_write_time(filename, fs_error);
+    if (fs_error) {
+        return false;
+    }
+    stamp.size = static_cast<int64_t>(file_size);
+    stamp.mtime = file_mtime;
+    return true;
+}
+
+std::shared_ptr<ArchiveCache::OpenArchive> ArchiveCache::Archive(const std::string& filename) {
+    std::lock_guard<std::mutex> guard(lock);
+    auto found = archive_lookup.find(filename);
+    if (found != archive_lookup.end()) {
+        archives.splice(archives.begin(), archives, found->second);
+        return found->second->second;
+    }
+
+    auto archive = std::make_shared<OpenArchive>();
+    archive->file.filename = filename;
+    archive->file.memory_mapped = memory_mapped;
+    archive->file.save_settings = save_settings;
+    archive->reader.filename = filename;
+    archive->reader.memory_mapped = memory_mapped;
+    archive->journal = EditJournal(filename);
+    archives.emplace_front(filename, archive);
+    archive_lookup[filename] = archives.begin();
+    // callers still holding an evicted archive keep it alive until done
+    while (archives.size() > max_archives && archives.size() > 1) {
+        archive_lookup.erase(archives.back().first);
+        archives.pop_back();
+    }
+    return archive;
+}
+
+std::shared_ptr<const std::string> ArchiveCache::Member(const std::string& filename, const std::string& subfile_name) {
+    file_stamp stamp;
+    if (!stamp_file(filename, stamp)) {
+        return nullptr;
+    }
+
+    std::string key = member_key(filename, subfile_name);
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        auto found = member_lookup.find(key);
+        if (found != member_lookup.end()) {
+            if (found->second->stamp == stamp) {
+                ++hits;
+                members.splice(members.begin(), members, found->second);
+                return found->second->data;
+            }
+            erase_member(found->second);
+        }
+        ++misses;
+    }
+
+    // decode outside the cache lock; readers of the same archive run in
+    // parallel on its shared snapshot
+    auto archive = Archive(filename);
+    auto data = std::make_shared<std::string>();
+    if (!archive->reader.EnsureCurrent()) {
+        return nullptr;
+    }
+    bool success = archive->reader.DumpSubfile(subfile_name, *data);
+    if (!success) {
+        return nullptr;
+    }
+
+    std::lock_guard<std::mutex> guard(lock);
+    // another reader may have got there first
+    auto found = member_lookup.find(key);
+    if (found != member_lookup.end()) {
+        erase_member(found->second);
+    }
+    cached_member member;
+    member.filename = filename;
+    member.key = key;
+    member.stamp = stamp;
+    member.data = data;
+    members.push_front(std::move(member));
+    member_lookup[key] = members.begin();
+    bytes += data->size();
+    evict();
+    return data;
+}
+
+void ArchiveCache::Invalidate(const std::string& filename) {
+    std::lock_guard<std::mutex> guard(lock);
+    for (auto position = members.begin(); position != members.end();) {
+        auto current = position++;
+        if (current->filename == filename) {
+            erase_member(current);
+        }
+    }
+}
+
+size_t ArchiveCache::Bytes() {
+    std::lock_guard<std::mutex> guard(lock);
+    return bytes;
+}
+
+size_t ArchiveCache::Hits() {
+    std::lock_guard<std::mutex> guard(lock);
+    return hits;
+}
+
+size_t ArchiveCache::Misses() {
+    std::lock_guard<std::mutex> guard(lock);
+    return misses;
+}
+
+void ArchiveCache::evict() {
+    // the newest member always stays, even if it alone is over budget
+    while (bytes > max_bytes && members.size() > 1) {
+        erase_member(std::prev(members.end()));
+    }
+}
+
+void ArchiveCache::erase_member(member_list::iterator position) {
+    bytes -= position->data->size();
+    member_lookup.erase(position->key);
+    members.erase(position);
+}
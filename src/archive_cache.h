@@ -0,0 +1,92 @@
+#ifndef SAVED_GAME_FORMAT_ARCHIVE_CACHE_H__
+#define SAVED_GAME_FORMAT_ARCHIVE_CACHE_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "archive_reader.h"
+#include "edit_journal.h"
+#include "save_settings.h"
+#include "sgf_file.h"
+
+namespace saved_game_format_file {
+
+    // Keeps recently used archives open (with their entry index) and their
+    // decoded members in memory for a long running process. Members are
+    // evicted least recently used first once max_bytes is exceeded; a
+    // member is dropped as soon as its file changes size or mtime on disk.
+    class ArchiveCache {
+        public:
+            // An open archive: reads go through the lock-free reader, writes
+            // through file under the lock, followed by reader.Refresh()
+            struct OpenArchive {
+                ArchiveReader reader{};
+                std::mutex lock{};
+                SavedGameFormatFile file{};
+                // pending edits of the save; loaded and used under the lock
+                EditJournal journal{};
+                bool journal_loaded{false};
+            };
+
+            ArchiveCache(size_t _max_bytes, size_t _max_archives) : max_bytes(_max_bytes), max_archives(_max_archives) {}
+
+            // open (or reuse) an archive; hold its lock while writing
+            std::shared_ptr<OpenArchive> Archive(const std::string& filename);
+            // decompressed member, read through the archive on a miss;
+            // binary members are kept encoded
+            std::shared_ptr<const std::string> Member(const std::string& filename, const std::string& subfile_name);
+            // forget every member of a file after it was written to
+            void Invalidate(const std::string& filename);
+
+            size_t Bytes();
+            size_t Hits();
+            size_t Misses();
+
+            // applied to archives as they are opened
+            bool memory_mapped{false};
+            SaveSettings save_settings{};
+
+        private:
+            struct file_stamp {
+                int64_t size{-1};
+                std::time_t mtime{0};
+                inline bool operator==(const file_stamp& other) const { return size == other.size && mtime == other.mtime; }
+            };
+
+            struct cached_member {
+                std::string filename{};
+                std::string key{};
+                file_stamp stamp{};
+                std::shared_ptr<const std::string> data{};
+            };
+
+            typedef std::list<cached_member> member_list;
+            typedef std::list<std::pair<std::string, std::shared_ptr<OpenArchive>>> archive_list;
+
+            static bool stamp_file(const std::string& filename, file_stamp& stamp);
+            void evict();
+            void erase_member(member_list::iterator position);
+
+            size_t max_bytes;
+            size_t max_archives;
+
+            std::mutex lock{};
+            // most recently used at the front
+            member_list members{};
+            std::unordered_map<std::string, member_list::iterator> member_lookup{};
+            archive_list archives{};
+            std::unordered_map<std::string, archive_list::iterator> archive_lookup{};
+            size_t bytes{0};
+            size_t hits{0};
+            size_t misses{0};
+    };
+
+}
+
+#endif //SAVED_GAME_FORMAT_ARCHIVE_CACHE_H__
@@ -0,0 +1,156 @@
+#include <atomic>
+#include <cerrno>
+#include <iostream>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <archive.h>
+
+#include "archive_reader.h"
+#include "archive_stream.h"
+#include "stats.h"
+#include "zip_file.h"
+
+using namespace saved_game_format_file;
+
+ArchiveReader::Snapshot::~Snapshot() {
+    if (descriptor >= 0) {
+        close(descriptor);
+    }
+}
+
+bool ArchiveReader::Refresh() {
+    std::lock_guard<std::mutex> guard(refresh_lock);
+    SGF_STATS_TIMER(TIMER_INDEX);
+
+    auto next = std::make_shared<Snapshot>();
+    next->descriptor = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+    if (next->descriptor < 0) {
+        std::cerr << "unable to open file " << filename << ", errno " << errno << std::endl;
+        return false;
+    }
+    // stamped from the descriptor, so it describes exactly what is indexed
+    struct stat file_stat;
+    if (fstat(next->descriptor, &file_stat) != 0) {
+        std::cerr << "unable to stat file " << filename << ", errno " << errno << std::endl;
+        return false;
+    }
+    next->size = static_cast<int64_t>(file_stat.st_size);
+    next->mtime = file_stat.st_mtime;
+    next->inode = static_cast<uint64_t>(file_stat.st_ino);
+    // the same file the descriptor holds, even if the path has since been
+    // renamed over
+    if (memory_mapped && !next->mapping.Open(next->descriptor)) {
+        std::cerr << "unable to map file " << filename << std::endl;
+        return false;
+    }
+
+    DescriptorByteSource file_source(next->descriptor);
+    MemoryByteSource memory_source(next->mapping.Data(), next->mapping.Size());
+    ByteSource& source = next->mapping.IsOpen() ? static_cast<ByteSource&>(memory_source) : file_source;
+
+    if (zip_file::ReadCentralDirectory(source, next->index)) {
+        next->index.format_code = ARCHIVE_FORMAT_ZIP;
+        next->index.filter_code = ARCHIVE_FILTER_NONE;
+    } else {
+        struct archive* archive_file = archive_stream::Open(source);
+        if (archive_file == nullptr) {
+            return false;
+        }
+        bool success = archive_stream::Index(archive_file, next->index);
+        archive_read_free(archive_file);
+        if (!success) {
+            return false;
+        }
+    }
+
+    std::atomic_store(&snapshot, std::shared_ptr<const Snapshot>(std::move(next)));
+    return true;
+}
+
+bool ArchiveReader::EnsureCurrent() {
+    auto current = Current();
+    if (current) {
+        struct stat file_stat;
+        if (stat(filename.c_str(), &file_stat) == 0
+            && static_cast<int64_t>(file_stat.st_size) == current->size
+            && file_stat.st_mtime == current->mtime
+            && static_cast<uint64_t>(file_stat.st_ino) == current->inode) {
+            return true;
+        }
+    }
+    return Refresh();
+}
+
+std::shared_ptr<const ArchiveReader::Snapshot> ArchiveReader::Current() const {
+    return std::atomic_load(&snapshot);
+}
+
+void ArchiveReader::ListFiles(path_listing& listing) const {
+    auto current = Current();
+    if (!current) {
+        return;
+    }
+    for (const auto& entry : current->index.Entries()) {
+        listing.push_back(entry.name);
+    }
+}
+
+bool ArchiveReader::StreamSubfile(const std::string& subfile_name, const size_hint& on_size, const data_sink& sink) const {
+    auto current = Current();
+    if (!current) {
+        std::cerr << "no index for " << filename << std::endl;
+        return false;
+    }
+    const ArchiveEntry* entry = current->index.Find(subfile_name);
+    if (entry == nullptr) {
+        std::cerr << "unable to locate " << subfile_name << " in " << filename << std::endl;
+        return false;
+    }
+
+    // sources are cheap views over the shared descriptor or mapping
+    DescriptorByteSource file_source(current->descriptor);
+    MemoryByteSource memory_source(current->mapping.Data(), current->mapping.Size());
+    ByteSource& source = current->mapping.IsOpen() ? static_cast<ByteSource&>(memory_source) : file_source;
+
+    SGF_STATS_TIMER(TIMER_DECOMPRESS);
+    bool success = false;
+    if (current->index.kind == ARCHIVE_KIND_ZIP && zip_file::CanReadEntry(*entry)) {
+        on_size(entry->uncompressed_size);
+        success = zip_file::ReadEntryData(source, *entry, sink);
+    } else {
+        struct archive* archive_file = archive_stream::Open(source);
+        if (archive_file == nullptr) {
+            return false;
+        }
+        success = archive_stream::ReadMember(archive_file, *entry, on_size, sink);
+        archive_read_free(archive_file);
+    }
+    if (!success) {
+        std::cerr << "Error reading " << subfile_name << " from " << filename << std::endl;
+    } else {
+        SGF_STATS_ADD(COUNTER_BYTES_IN, entry->uncompressed_size);
+    }
+    return success;
+}
+
+bool ArchiveReader::DumpSubfile(const std::string& subfile_name, std::string& data) const {
+    size_t initial_size = data.size();
+    bool success = StreamSubfile(
+        subfile_name,
+        [&data](int64_t entry_size) {
+            data.reserve(data.size() + static_cast<size_t>(entry_size));
+        },
+        [&data](const char* buffer, size_t buffer_size) {
+            data.append(buffer, buffer_size);
+            return true;
+        }
+    );
+    if (!success) {
+        // never hand back a partial member
+        data.resize(initial_size);
+    }
+    return success;
+}
@@ -0,0 +1,71 @@
+#ifndef SAVED_GAME_FORMAT_ARCHIVE_READER_H__
+#define SAVED_GAME_FORMAT_ARCHIVE_READER_H__
+
+#include <ctime>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "byte_source.h"
+#include "entry_index.h"
+
+namespace saved_game_format_file {
+
+    // Read-only handle on an archive that any number of threads may use at
+    // once. The file is opened (or mapped) a single time and read with
+    // positional reads; the entry index is an immutable snapshot that
+    // readers pick up with an atomic load and never lock. A writer calls
+    // Refresh after saving to publish a snapshot of the new file; readers
+    // still working on the old snapshot keep its descriptor alive until
+    // they are done.
+    class ArchiveReader {
+        public:
+            typedef std::deque<std::string> path_listing;
+            typedef std::function<void(int64_t entry_size)> size_hint;
+
+            // Everything a read needs, fixed at the time it was taken
+            struct Snapshot {
+                Snapshot() {}
+                ~Snapshot();
+                Snapshot(const Snapshot&) = delete;
+                Snapshot& operator=(const Snapshot&) = delete;
+
+                EntryIndex index{};
+                int descriptor{-1};
+                MappedFile mapping{};
+                int64_t size{-1};
+                std::time_t mtime{0};
+                // saves are replaced by renaming a new file over them
+                uint64_t inode{0};
+            };
+
+            ArchiveReader() {}
+            ArchiveReader(const std::string& _filename, bool _memory_mapped) : filename(_filename), memory_mapped(_memory_mapped) {}
+
+            // Open the file and index it, replacing the current snapshot.
+            // Only one refresh runs at a time; reads carry on meanwhile.
+            bool Refresh();
+            // Refresh if the file was replaced or changed size or mtime since
+            // the snapshot
+            bool EnsureCurrent();
+
+            std::shared_ptr<const Snapshot> Current() const;
+
+            void ListFiles(path_listing& listing) const;
+            bool StreamSubfile(const std::string& subfile_name, const size_hint& on_size, const data_sink& sink) const;
+            bool DumpSubfile(const std::string& subfile_name, std::string& data) const;
+
+            std::string filename{};
+            bool memory_mapped{false};
+
+        private:
+            std::shared_ptr<const Snapshot> snapshot{};
+            std::mutex refresh_lock{};
+    };
+
+}
+
+#endif //SAVED_GAME_FORMAT_ARCHIVE_READER_H__
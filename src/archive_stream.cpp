@@ -0,0 +1,244 @@
+#include <algorithm>
+#include <cstdio>
+#include <iostream>
+#include <vector>
+
+#include <archive_entry.h>
+
+#include "archive_stream.h"
+#include "binary_json.h"
+#include "stats.h"
+
+using namespace saved_game_format_file;
+
+namespace {
+
+    // bytes pulled per read from sources that can't be addressed
+    const size_t READ_BLOCK_SIZE = 64 * 1024;
+
+    // enough of a member to recognise binary_json's self-describe tag
+    const size_t BINARY_PREFIX_SIZE = 3;
+
+    struct stream_client {
+        ByteSource* source{nullptr};
+        int64_t size{0};
+        int64_t offset{0};
+        std::vector<unsigned char> buffer{};
+    };
+
+    la_ssize_t stream_read(struct archive*, void* client_data, const void** block) {
+        stream_client* client = static_cast<stream_client*>(client_data);
+        size_t length = static_cast<size_t>(std::min<int64_t>(client->size - client->offset, READ_BLOCK_SIZE));
+        if (length == 0) {
+            return 0;
+        }
+        const unsigned char* view = client->source->View(client->offset, length);
+        if (view == nullptr) {
+            client->buffer.resize(length);
+            if (!client->source->ReadAt(client->offset, client->buffer.data(), length)) {
+                return -1;
+            }
+            view = client->buffer.data();
+        }
+        *block = view;
+        client->offset += static_cast<int64_t>(length);
+        return static_cast<la_ssize_t>(length);
+    }
+
+    la_int64_t stream_seek(struct archive*, void* client_data, la_int64_t offset, int whence) {
+        stream_client* client = static_cast<stream_client*>(client_data);
+        int64_t target = offset;
+        if (whence == SEEK_CUR) {
+            target += client->offset;
+        } else if (whence == SEEK_END) {
+            target += client->size;
+        }
+        if (target < 0 || target > client->size) {
+            return ARCHIVE_FATAL;
+        }
+        client->offset = target;
+        return client->offset;
+    }
+
+    la_int64_t stream_skip(struct archive*, void* client_data, la_int64_t request) {
+        stream_client* client = static_cast<stream_client*>(client_data);
+        la_int64_t skipped = std::min<la_int64_t>(request, client->size - client->offset);
+        client->offset += skipped;
+        return skipped;
+    }
+
+    int stream_close(struct archive*, void* client_data) {
+        delete static_cast<stream_client*>(client_data);
+        return ARCHIVE_OK;
+    }
+
+    // Hand over the current entry's data block by block; a member is
+    // usually many blocks long
+    bool read_data(struct archive* archive_file, const data_sink& sink) {
+        bool success = true;
+        la_int64_t written = 0;
+        while (true) {
+            const void* buffer = nullptr;
+            size_t buffer_size = 0;
+            la_int64_t archive_offset = 0;
+
+            int aerr = archive_read_data_block(archive_file, &buffer, &buffer_size, &archive_offset);
+            if (aerr == ARCHIVE_EOF) {
+                break;
+            }
+            if (aerr < ARCHIVE_OK) {
+                std::cerr << "Error reading archive chunk: " << archive_error_string(archive_file) << std::endl;
+                success = false;
+                break;
+            }
+
+            // sparse members skip over holes; those read back as zeros
+            static const char zeros[4096] = {};
+            while (written < archive_offset && success) {
+                size_t hole = static_cast<size_t>(std::min<la_int64_t>(archive_offset - written, sizeof(zeros)));
+                success = sink(zeros, hole);
+                written += hole;
+            }
+            if (success && buffer_size != 0) {
+                success = sink(static_cast<const char*>(buffer), buffer_size);
+                written += buffer_size;
+            }
+            // a sink may stop early on purpose; callers report failures
+            if (!success) {
+                break;
+            }
+        }
+        return success;
+    }
+
+}
+
+struct archive* archive_stream::Open(ByteSource& source) {
+    struct archive* archive_file = archive_read_new();
+    archive_read_support_filter_all(archive_file);
+    archive_read_support_format_all(archive_file);
+
+    stream_client* client = new stream_client();
+    client->source = &source;
+    client->size = source.Size();
+    archive_read_set_callback_data(archive_file, client);
+    archive_read_set_read_callback(archive_file, stream_read);
+    archive_read_set_seek_callback(archive_file, stream_seek);
+    archive_read_set_skip_callback(archive_file, stream_skip);
+    archive_read_set_close_callback(archive_file, stream_close);
+
+    // the close callback owns the client from here on, even on failure
+    if (archive_read_open1(archive_file) != ARCHIVE_OK) {
+        std::cerr << "Error opening archive: " << archive_error_string(archive_file) << std::endl;
+        archive_read_free(archive_file);
+        return nullptr;
+    }
+    return archive_file;
+}
+
+bool archive_stream::Index(struct archive* archive_file, EntryIndex& index) {
+    int aerr = ARCHIVE_OK;
+    struct archive_entry* current_archive_entry = nullptr;
+    // a warning (say, a name the locale can't convert) still leaves a
+    // usable header, as it does when the archive is rewritten
+    while ((aerr = archive_read_next_header(archive_file, &current_archive_entry)) != ARCHIVE_EOF && aerr >= ARCHIVE_WARN) {
+        if (index.Empty()) {
+            // only known once the first header has been read
+            index.format_code = archive_format(archive_file);
+            index.filter_code = archive_filter_code(archive_file, 0);
+        }
+        ArchiveEntry entry;
+        entry.name = archive_entry_pathname(current_archive_entry);
+        entry.offset = archive_read_header_position(archive_file);
+        if (archive_entry_size_is_set(current_archive_entry)) {
+            entry.uncompressed_size = archive_entry_size(current_archive_entry);
+            entry.compressed_size = entry.uncompressed_size;
+        }
+        if (archive_entry_filetype(current_archive_entry) == AE_IFREG) {
+            // the stream is decoded on the way past anyway; the first bytes
+            // save reading the member again just to learn its encoding
+            char prefix[BINARY_PREFIX_SIZE];
+            la_ssize_t prefix_size = archive_read_data(archive_file, prefix, sizeof(prefix));
+            if (prefix_size < 0) {
+                std::cerr << "Error reading " << entry.name << ": " << archive_error_string(archive_file) << std::endl;
+                return false;
+            }
+            entry.binary = binary_json::IsEncoded(std::string_view(prefix, static_cast<size_t>(prefix_size)));
+        }
+        index.Add(entry);
+    }
+    if (aerr != ARCHIVE_EOF) {
+        std::cerr << "Error reading archive headers: " << archive_error_string(archive_file) << std::endl;
+        return false;
+    }
+    index.kind = ARCHIVE_KIND_STREAM;
+    return true;
+}
+
+bool archive_stream::ReadMember(struct archive* archive_file, const ArchiveEntry& entry, const std::function<void(int64_t)>& on_size, const data_sink& sink) {
+    bool found = false;
+    bool success = true;
+
+    // headers ahead of the entry are skipped without decoding their data,
+    // and nothing past it is read at all
+    struct archive_entry* current_archive_entry = nullptr;
+    size_t sequence = 0;
+    int aerr = ARCHIVE_OK;
+    while ((aerr = archive_read_next_header(archive_file, &current_archive_entry)) != ARCHIVE_EOF && aerr >= ARCHIVE_WARN) {
+        if (sequence++ != entry.sequence) {
+            SGF_STATS_ADD(COUNTER_ENTRIES_SKIPPED, 1);
+            continue;
+        }
+        found = true;
+        if (archive_entry_size_is_set(current_archive_entry)) {
+            on_size(archive_entry_size(current_archive_entry));
+        }
+
+        success = read_data(archive_file, sink);
+        break;
+    }
+    if (!found) {
+        std::cerr << "Error locating " << entry.name << std::endl;
+        success = false;
+    }
+    return success;
+}
+
+bool archive_stream::ReadMembers(struct archive* archive_file, const EntryIndex& index, const member_filter& wanted, const member_handler& on_member) {
+    const EntryIndex::entry_list& entries = index.Entries();
+    int aerr = ARCHIVE_OK;
+    struct archive_entry* current_archive_entry = nullptr;
+    size_t sequence = 0;
+    std::string data;
+    while ((aerr = archive_read_next_header(archive_file, &current_archive_entry)) != ARCHIVE_EOF && aerr >= ARCHIVE_WARN) {
+        if (sequence >= entries.size()) {
+            std::cerr << "Archive has more entries than its index" << std::endl;
+            return false;
+        }
+        const ArchiveEntry& entry = entries[sequence++];
+        if (!wanted(entry)) {
+            SGF_STATS_ADD(COUNTER_ENTRIES_SKIPPED, 1);
+            continue;
+        }
+        data.clear();
+        if (archive_entry_size_is_set(current_archive_entry)) {
+            data.reserve(static_cast<size_t>(archive_entry_size(current_archive_entry)));
+        }
+        bool success = read_data(archive_file, [&data](const char* buffer, size_t buffer_size) {
+            data.append(buffer, buffer_size);
+            return true;
+        });
+        if (!success) {
+            return false;
+        }
+        SGF_STATS_ADD(COUNTER_BYTES_IN, data.size());
+        if (!on_member(entry, data)) {
+            return false;
+        }
+    }
+    if (aerr != ARCHIVE_EOF) {
+        std::cerr << "Error reading archive headers: " << archive_error_string(archive_file) << std::endl;
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,45 @@
+#ifndef SAVED_GAME_FORMAT_ARCHIVE_STREAM_H__
+#define SAVED_GAME_FORMAT_ARCHIVE_STREAM_H__
+
+#include <cstdint>
+#include <functional>
+#include <string>
+
+#include <archive.h>
+
+#include "byte_source.h"
+#include "entry_index.h"
+
+namespace saved_game_format_file {
+
+    // libarchive helpers for the stream (non-ZIP) archives
+    namespace archive_stream {
+
+        // Open a libarchive reader over any ByteSource. Each reader keeps
+        // its own position, so several can share one source; addressable
+        // sources are handed to libarchive without copying.
+        struct archive* Open(ByteSource& source);
+
+        // One pass over the headers, recording every entry along with the
+        // input's format and filter codes; only the first bytes of each
+        // member are read, to tell binary ones apart
+        bool Index(struct archive* archive_file, EntryIndex& index);
+
+        // Skip to the entry by its position and deliver its data block by
+        // block, with holes in sparse members filled with zeros
+        bool ReadMember(struct archive* archive_file, const ArchiveEntry& entry, const std::function<void(int64_t)>& on_size, const data_sink& sink);
+
+        typedef std::function<bool(const ArchiveEntry& entry)> member_filter;
+        // given the whole member; may take the data, returns false to stop
+        typedef std::function<bool(const ArchiveEntry& entry, std::string& data)> member_handler;
+
+        // One pass over the archive delivering each wanted entry whole, in
+        // archive order. Entries are matched to the index by position, so
+        // the index must come from the same file.
+        bool ReadMembers(struct archive* archive_file, const EntryIndex& index, const member_filter& wanted, const member_handler& on_member);
+
+    }
+
+}
+
+#endif //SAVED_GAME_FORMAT_ARCHIVE_STREAM_H__
@@ -0,0 +1,123 @@
+#include <cerrno>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "atomic_file.h"
+
+using namespace saved_game_format_file;
+
+namespace {
+
+    std::string parent_directory(const std::string& path) {
+        size_t slash = path.find_last_of('/');
+        if (slash == std::string::npos) {
+            return ".";
+        }
+        if (slash == 0) {
+            return "/";
+        }
+        return path.substr(0, slash);
+    }
+
+}
+
+bool saved_game_format_file::SyncParentDirectory(const std::string& path) {
+    int directory = open(parent_directory(path).c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (directory < 0) {
+        std::cerr << "unable to open directory of " << path << ", errno " << errno << std::endl;
+        return false;
+    }
+    bool success = fsync(directory) == 0;
+    if (!success) {
+        std::cerr << "unable to sync directory of " << path << ", errno " << errno << std::endl;
+    }
+    close(directory);
+    return success;
+}
+
+AtomicFile::~AtomicFile() {
+    Abort();
+}
+
+FILE* AtomicFile::Open(const std::string& _target) {
+    Abort();
+    target = _target;
+
+    // same directory, so the rename never crosses file systems
+    std::string directory = parent_directory(target);
+    size_t slash = target.find_last_of('/');
+    std::string base = (slash == std::string::npos) ? target : target.substr(slash + 1);
+    std::string pattern = directory + "/." + base + ".XXXXXX";
+    std::vector<char> name(pattern.begin(), pattern.end());
+    name.push_back('\0');
+
+    int descriptor = mkstemp(name.data());
+    if (descriptor < 0) {
+        std::cerr << "unable to create temporary file for " << target << ", errno " << errno << std::endl;
+        return nullptr;
+    }
+    temporary = name.data();
+
+    // mkstemp creates the file private; match what it replaces, or what a
+    // plain fopen would have created
+    struct stat target_stat;
+    mode_t mode = 0;
+    if (stat(target.c_str(), &target_stat) == 0) {
+        mode = target_stat.st_mode & 07777;
+    } else {
+        mode_t mask = umask(0);
+        umask(mask);
+        mode = 0666 & ~mask;
+    }
+    fchmod(descriptor, mode);
+
+    file = fdopen(descriptor, "w+b");
+    if (file == nullptr) {
+        std::cerr << "unable to open temporary file " << temporary << ", errno " << errno << std::endl;
+        close(descriptor);
+        unlink(temporary.c_str());
+        temporary.clear();
+    }
+    return file;
+}
+
+bool AtomicFile::Commit() {
+    if (file == nullptr) {
+        return false;
+    }
+    bool success = fflush(file) == 0 && fsync(fileno(file)) == 0;
+    if (!success) {
+        std::cerr << "unable to sync " << temporary << ", errno " << errno << std::endl;
+    }
+    success = (fclose(file) == 0) && success;
+    file = nullptr;
+    if (!success) {
+        Abort();
+        return false;
+    }
+
+    if (rename(temporary.c_str(), target.c_str()) != 0) {
+        std::cerr << "unable to replace " << target << ", errno " << errno << std::endl;
+        Abort();
+        return false;
+    }
+    temporary.clear();
+    // the rename itself has to reach the disk too
+    return SyncParentDirectory(target);
+}
+
+void AtomicFile::Abort() {
+    if (file != nullptr) {
+        fclose(file);
+        file = nullptr;
+    }
+    if (!temporary.empty()) {
+        unlink(temporary.c_str());
+        temporary.clear();
+    }
+}
@@ -0,0 +1,43 @@
+#ifndef SAVED_GAME_FORMAT_ATOMIC_FILE_H__
+#define SAVED_GAME_FORMAT_ATOMIC_FILE_H__
+
+#include <cstdio>
+#include <string>
+
+namespace saved_game_format_file {
+
+    // Writes a file under a temporary name in the target's directory and
+    // only renames it over the target once the data is on disk, so the
+    // target is always either the old file or the complete new one.
+    class AtomicFile {
+        public:
+            AtomicFile() {}
+            // an uncommitted file is discarded
+            ~AtomicFile();
+
+            AtomicFile(const AtomicFile&) = delete;
+            AtomicFile& operator=(const AtomicFile&) = delete;
+
+            // Create the temporary file; the target's permissions are kept
+            // if it already exists
+            FILE* Open(const std::string& _target);
+            // flush, fsync, rename over the target and fsync the directory
+            bool Commit();
+            // close and remove the temporary file
+            void Abort();
+
+            inline FILE* File() const { return file; }
+            inline const std::string& TemporaryName() const { return temporary; }
+
+        private:
+            std::string target{};
+            std::string temporary{};
+            FILE* file{nullptr};
+    };
+
+    // fsync the directory holding path, making a rename in it durable
+    bool SyncParentDirectory(const std::string& path);
+
+}
+
+#endif //SAVED_GAME_FORMAT_ATOMIC_FILE_H__
@@ -0,0 +1,270 @@
+#include <algorithm>
+#include <iostream>
+#include <map>
+
+#include <boost/json.hpp>
+
+#include "batch_edit.h"
+#include "binary_json.h"
+#include "engine_text.h"
+#include "json_pointer.h"
+#include "options.h"
+#include "stats.h"
+
+using namespace saved_game_format_file;
+
+namespace {
+
+    // first arena block for tiny scripts
+    const size_t MINIMUM_ARENA_SIZE = 4096;
+
+    bool parse_edit(const boost::json::value& item, size_t position, KeyEdit& edit) {
+        const boost::json::object* fields = item.if_object();
+        if (fields == nullptr) {
+            std::cerr << "edit " << position << " is not an object" << std::endl;
+            return false;
+        }
+
+        const boost::json::value* subfile = fields->if_contains("subfile");
+        const boost::json::value* key = fields->if_contains("key");
+        if (subfile == nullptr || !subfile->is_string() || key == nullptr || !key->is_string()) {
+            std::cerr << "edit " << position << " needs a subfile and a key" << std::endl;
+            return false;
+        }
+        edit.subfile = std::string(subfile->as_string().data(), subfile->as_string().size());
+        edit.key = std::string(key->as_string().data(), key->as_string().size());
+
+        // same spelling as the update and add commands
+        std::string op = pcUpdate;
+        const boost::json::value* op_field = fields->if_contains("op");
+        if (op_field != nullptr && op_field->is_string()) {
+            op = std::string(op_field->as_string().data(), op_field->as_string().size());
+        }
+        if (op == pcUpdate) {
+            edit.op = KEY_EDIT_UPDATE;
+        } else if (op == pcAdd) {
+            edit.op = KEY_EDIT_ADD;
+        } else if (op == pcRemove) {
+            edit.op = KEY_EDIT_REMOVE;
+        } else {
+            std::cerr << "edit " << position << " has unknown op " << op << std::endl;
+            return false;
+        }
+
+        const boost::json::value* value = fields->if_contains("value");
+        if (value == nullptr && edit.op != KEY_EDIT_REMOVE) {
+            std::cerr << "edit " << position << " needs a value" << std::endl;
+            return false;
+        }
+        if (value != nullptr) {
+            edit.value_json = boost::json::serialize(*value);
+        }
+        return true;
+    }
+
+    // The engine's save text is edited in place through its index, which
+    // stays current from one edit to the next
+    bool apply_text_edit(EngineTextIndex& index, std::string& document, const KeyEdit& edit) {
+        bool success = false;
+        switch (edit.op) {
+            case KEY_EDIT_UPDATE:
+                success = index.Set(document, edit.key, edit.value_json, false);
+                break;
+            case KEY_EDIT_ADD:
+                success = index.Set(document, edit.key, edit.value_json, true);
+                break;
+            case KEY_EDIT_REMOVE:
+                success = index.Remove(document, edit.key);
+                break;
+        }
+        if (!success) {
+            std::cerr << "Unable to apply " << edit.key << " to " << edit.subfile << std::endl;
+        }
+        return success;
+    }
+
+}
+
+bool saved_game_format_file::ParseEditScript(std::string_view script, std::vector<KeyEdit>& edits) {
+    SGF_STATS_TIMER(TIMER_PARSE);
+    edits.clear();
+
+    size_t first = script.find_first_not_of(" \t\r\n");
+    if (first == std::string_view::npos) {
+        return true;
+    }
+
+    // every DOM built while reading the script comes out of one arena and
+    // is released in a single step; edits only keep their serialised text
+    boost::json::monotonic_resource arena(std::max<size_t>(script.size(), MINIMUM_ARENA_SIZE));
+    boost::json::storage_ptr storage(&arena);
+
+    if (script[first] == '[') {
+        boost::system::error_code json_parser_error;
+        boost::json::value document = boost::json::parse(
+            boost::json::string_view(script.data(), script.size()),
+            json_parser_error,
+            storage
+        );
+        if (json_parser_error) {
+            std::cerr << "Error parsing edit script: " << json_parser_error.message() << std::endl;
+            return false;
+        }
+        const boost::json::array& items = document.as_array();
+        edits.reserve(items.size());
+        for (const auto& item : items) {
+            KeyEdit edit;
+            if (!parse_edit(item, edits.size() + 1, edit)) {
+                return false;
+            }
+            edits.push_back(std::move(edit));
+        }
+        return true;
+    }
+
+    // JSONL: one edit per non-blank line
+    size_t line_number = 0;
+    while (!script.empty()) {
+        size_t line_end = script.find('\n');
+        std::string_view line = script.substr(0, line_end);
+        script.remove_prefix(line_end == std::string_view::npos ? script.size() : line_end + 1);
+        ++line_number;
+        if (line.find_first_not_of(" \t\r") == std::string_view::npos) {
+            continue;
+        }
+
+        boost::system::error_code json_parser_error;
+        boost::json::value item = boost::json::parse(
+            boost::json::string_view(line.data(), line.size()),
+            json_parser_error,
+            storage
+        );
+        if (json_parser_error) {
+            std::cerr << "Error parsing edit script line " << line_number << ": " << json_parser_error.message() << std::endl;
+            return false;
+        }
+        KeyEdit edit;
+        if (!parse_edit(item, line_number, edit)) {
+            return false;
+        }
+        edits.push_back(std::move(edit));
+    }
+    return true;
+}
+
+// Each edit splices the member's text, so unrelated keys keep their
+// exact bytes and nothing is parsed beyond the key's path
+bool saved_game_format_file::ApplyKeyEdit(std::string& document, std::string& scratch, const KeyEdit& edit) {
+    if (EngineTextIndex::Recognize(document)) {
+        EngineTextIndex index;
+        return index.Build(document) && apply_text_edit(index, document, edit);
+    }
+    std::string& updated = scratch;
+    bool success = false;
+    switch (edit.op) {
+        case KEY_EDIT_UPDATE:
+            success = json_pointer::Set(document, edit.key, edit.value_json, false, updated);
+            break;
+        case KEY_EDIT_ADD:
+            success = json_pointer::Set(document, edit.key, edit.value_json, true, updated);
+            break;
+        case KEY_EDIT_REMOVE:
+            success = json_pointer::Remove(document, edit.key, updated);
+            break;
+    }
+    if (!success) {
+        std::cerr << "Unable to apply " << edit.key << " to " << edit.subfile << std::endl;
+        return false;
+    }
+    document.swap(updated);
+    return true;
+}
+
+std::string saved_game_format_file::FormatKeyEdit(const KeyEdit& edit) {
+    const std::string* op = &pcUpdate;
+    if (edit.op == KEY_EDIT_ADD) {
+        op = &pcAdd;
+    } else if (edit.op == KEY_EDIT_REMOVE) {
+        op = &pcRemove;
+    }
+    std::string line = "{\"subfile\":" + json_pointer::Quote(edit.subfile)
+        + ",\"op\":\"" + *op + "\",\"key\":" + json_pointer::Quote(edit.key);
+    if (edit.op != KEY_EDIT_REMOVE) {
+        line += ",\"value\":" + edit.value_json;
+    }
+    line += "}";
+    return line;
+}
+
+bool saved_game_format_file::ApplyKeyEdits(SavedGameFormatFile& saved_game_file, const std::vector<KeyEdit>& edits, const std::string& output_file) {
+    // group by member so each one is decoded and re-encoded once
+    std::map<std::string, std::vector<const KeyEdit*>> by_subfile;
+    for (const auto& edit : edits) {
+        by_subfile[edit.subfile].push_back(&edit);
+    }
+
+    // edited members, kept alive until the archive is written. All of
+    // them come out of a single pass over the save, so a stream archive
+    // is decompressed once however many members the script touches.
+    std::map<std::string, std::string> edited;
+    bool read = saved_game_file.ReadSubfiles(
+        [&by_subfile](const ArchiveEntry& entry) {
+            return by_subfile.count(entry.name) != 0;
+        },
+        [&edited](const ArchiveEntry& entry, std::string& data) {
+            edited[entry.name].swap(data);
+            return true;
+        }
+    );
+    if (!read) {
+        std::cerr << "Unable to read " << saved_game_file.filename << std::endl;
+        return false;
+    }
+
+    SavedGameFormatFile::replacement_map replacements;
+    std::string scratch;
+    for (const auto& member : by_subfile) {
+        auto found = edited.find(member.first);
+        if (found == edited.end()) {
+            std::cerr << "Unable to read " << member.first << std::endl;
+            return false;
+        }
+        std::string& file_contents = found->second;
+        if (binary_json::IsEncoded(file_contents)) {
+            // edits splice JSON text; UpdateSubfiles encodes it again
+            std::string json;
+            if (!binary_json::ToJson(file_contents, json)) {
+                std::cerr << "Unable to decode " << member.first << std::endl;
+                return false;
+            }
+            file_contents.swap(json);
+        }
+
+        if (EngineTextIndex::Recognize(file_contents)) {
+            // indexed once for all of the member's edits
+            EngineTextIndex index;
+            if (!index.Build(file_contents)) {
+                std::cerr << "Unable to index " << member.first << std::endl;
+                return false;
+            }
+            for (const KeyEdit* edit : member.second) {
+                if (!apply_text_edit(index, file_contents, *edit)) {
+                    return false;
+                }
+            }
+        } else {
+            for (const KeyEdit* edit : member.second) {
+                if (!ApplyKeyEdit(file_contents, scratch, *edit)) {
+                    return false;
+                }
+            }
+        }
+        std::cout << "Edited " << member.first << ": " << member.second.size() << " edit(s)" << std::endl;
+        replacements[member.first] = file_contents;
+    }
+
+    if (replacements.empty()) {
+        return true;
+    }
+    return saved_game_file.UpdateSubfiles(output_file, replacements);
+}
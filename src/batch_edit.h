@@ -0,0 +1,53 @@
+#ifndef SAVED_GAME_FORMAT_BATCH_EDIT_H__
+#define SAVED_GAME_FORMAT_BATCH_EDIT_H__
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "sgf_file.h"
+
+namespace saved_game_format_file {
+
+    enum KeyEditOp {
+        // set a key that must already exist
+        KEY_EDIT_UPDATE=0,
+        // set a key, creating it if needed
+        KEY_EDIT_ADD,
+        // drop a key
+        KEY_EDIT_REMOVE,
+    };
+
+    struct KeyEdit {
+        std::string subfile{};
+        KeyEditOp op{KEY_EDIT_UPDATE};
+        // top-level key or JSON pointer
+        std::string key{};
+        // the value serialised once, ready to splice into the member
+        std::string value_json{};
+    };
+
+    // Parse an edit script: either a JSON array of edits or one edit object
+    // per line (JSONL), each shaped like
+    //     {"subfile": "...", "op": "update|add|remove", "key": "...", "value": ...}
+    // Edits are returned in script order.
+    bool ParseEditScript(std::string_view script, std::vector<KeyEdit>& edits);
+
+    // The inverse of ParseEditScript for a single edit: one JSONL line,
+    // without the trailing newline
+    std::string FormatKeyEdit(const KeyEdit& edit);
+
+    // Apply one edit to a member's text; scratch is swapped with document,
+    // so consecutive edits of a member reuse the same two buffers. The
+    // engine's save text (see engine_text.h) is edited in place instead.
+    bool ApplyKeyEdit(std::string& document, std::string& scratch, const KeyEdit& edit);
+
+    // Apply every edit with a single read pass over the archive, for every
+    // affected member at once, and a single write. Edits to the same
+    // member are applied in script order. Nothing is written unless every
+    // edit applies cleanly.
+    bool ApplyKeyEdits(SavedGameFormatFile& saved_game_file, const std::vector<KeyEdit>& edits, const std::string& output_file);
+
+}
+
+#endif //SAVED_GAME_FORMAT_BATCH_EDIT_H__
@@ -0,0 +1,779 @@
+#include <cerrno>
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+#include "binary_json.h"
+#include "json_pointer.h"
+
+using namespace saved_game_format_file;
+
+namespace {
+
+    const char SELF_DESCRIBE[] = "\xd9\xd9\xf7";
+    const size_t SELF_DESCRIBE_SIZE = 3;
+
+    const uint64_t TAG_EMBEDDED_JSON = 262;
+    const uint64_t TAG_SELF_DESCRIBE = 55799;
+
+    enum major_type {
+        MAJOR_UNSIGNED=0,
+        MAJOR_NEGATIVE,
+        MAJOR_BYTES,
+        MAJOR_TEXT,
+        MAJOR_ARRAY,
+        MAJOR_MAP,
+        MAJOR_TAG,
+        MAJOR_SIMPLE,
+    };
+
+    const uint64_t SIMPLE_FALSE = 20;
+    const uint64_t SIMPLE_TRUE = 21;
+    const uint64_t SIMPLE_NULL = 22;
+    // additional information values of major type 7
+    const unsigned char INFO_FLOAT32 = 26;
+    const unsigned char INFO_FLOAT64 = 27;
+
+    // deeper documents are refused rather than risking the stack
+    const size_t MAX_DEPTH = 512;
+    // the largest header: initial byte and an 8 byte argument
+    const size_t MAX_HEADER_SIZE = 9;
+
+    void append_header(std::string& out, unsigned char major, uint64_t argument) {
+        unsigned char initial = static_cast<unsigned char>(major << 5);
+        int argument_bytes = 0;
+        if (argument < 24) {
+            out.push_back(static_cast<char>(initial | argument));
+            return;
+        } else if (argument <= 0xff) {
+            out.push_back(static_cast<char>(initial | 24));
+            argument_bytes = 1;
+        } else if (argument <= 0xffff) {
+            out.push_back(static_cast<char>(initial | 25));
+            argument_bytes = 2;
+        } else if (argument <= 0xffffffffULL) {
+            out.push_back(static_cast<char>(initial | 26));
+            argument_bytes = 4;
+        } else {
+            out.push_back(static_cast<char>(initial | 27));
+            argument_bytes = 8;
+        }
+        for (int shift = (argument_bytes - 1) * 8; shift >= 0; shift -= 8) {
+            out.push_back(static_cast<char>((argument >> shift) & 0xff));
+        }
+    }
+
+    // fewest digits that read back as the same double
+    std::string shortest_double(double value) {
+        char text[32];
+        std::to_chars_result written = std::to_chars(text, text + sizeof(text), value);
+        return std::string(text, written.ptr);
+    }
+
+    class encoder {
+        public:
+            encoder(std::string_view _json, std::string& _out) : json(_json), out(_out) {}
+
+            bool encode_document() {
+                out.assign(SELF_DESCRIBE, SELF_DESCRIBE_SIZE);
+                if (!encode_value(0)) {
+                    return false;
+                }
+                skip_whitespace();
+                if (position != json.size()) {
+                    return fail("trailing text");
+                }
+                finish();
+                return true;
+            }
+
+        private:
+            // an object or array whose count is only known once it is closed
+            struct container {
+                size_t placeholder{0};
+                unsigned char major{0};
+                uint64_t count{0};
+            };
+
+            bool fail(const char* reason) {
+                std::cerr << "unable to encode JSON at offset " << position << ": " << reason << std::endl;
+                return false;
+            }
+
+            void skip_whitespace() {
+                while (position < json.size()) {
+                    char c = json[position];
+                    if (c != ' ' && c != '\t' && c != '\n' && c != '\r') {
+                        break;
+                    }
+                    ++position;
+                }
+            }
+
+            bool encode_value(size_t depth) {
+                skip_whitespace();
+                if (position >= json.size()) {
+                    return fail("unexpected end of document");
+                }
+                char c = json[position];
+                if (c == '{' || c == '[') {
+                    if (depth >= MAX_DEPTH) {
+                        return fail("nested too deeply");
+                    }
+                    return (c == '{') ? encode_object(depth) : encode_array(depth);
+                }
+                if (c == '"') {
+                    return encode_string();
+                }
+                if (c == '-' || (c >= '0' && c <= '9')) {
+                    return encode_number();
+                }
+                if (json.compare(position, 4, "true") == 0) {
+                    position += 4;
+                    append_header(out, MAJOR_SIMPLE, SIMPLE_TRUE);
+                    return true;
+                }
+                if (json.compare(position, 5, "false") == 0) {
+                    position += 5;
+                    append_header(out, MAJOR_SIMPLE, SIMPLE_FALSE);
+                    return true;
+                }
+                if (json.compare(position, 4, "null") == 0) {
+                    position += 4;
+                    append_header(out, MAJOR_SIMPLE, SIMPLE_NULL);
+                    return true;
+                }
+                return fail("unexpected character");
+            }
+
+            bool encode_object(size_t depth) {
+                ++position;
+                size_t opened = open_container(MAJOR_MAP);
+                uint64_t count = 0;
+                skip_whitespace();
+                if (position < json.size() && json[position] == '}') {
+                    ++position;
+                    return true;
+                }
+                while (true) {
+                    skip_whitespace();
+                    if (position >= json.size() || json[position] != '"') {
+                        return fail("expected a key");
+                    }
+                    if (!encode_string()) {
+                        return false;
+                    }
+                    skip_whitespace();
+                    if (position >= json.size() || json[position] != ':') {
+                        return fail("expected ':'");
+                    }
+                    ++position;
+                    if (!encode_value(depth + 1)) {
+                        return false;
+                    }
+                    ++count;
+                    skip_whitespace();
+                    if (position < json.size() && json[position] == ',') {
+                        ++position;
+                        continue;
+                    }
+                    if (position < json.size() && json[position] == '}') {
+                        ++position;
+                        break;
+                    }
+                    return fail("expected ',' or '}'");
+                }
+                containers[opened].count = count;
+                return true;
+            }
+
+            bool encode_array(size_t depth) {
+                ++position;
+                size_t opened = open_container(MAJOR_ARRAY);
+                uint64_t count = 0;
+                skip_whitespace();
+                if (position < json.size() && json[position] == ']') {
+                    ++position;
+                    return true;
+                }
+                while (true) {
+                    if (!encode_value(depth + 1)) {
+                        return false;
+                    }
+                    ++count;
+                    skip_whitespace();
+                    if (position < json.size() && json[position] == ',') {
+                        ++position;
+                        continue;
+                    }
+                    if (position < json.size() && json[position] == ']') {
+                        ++position;
+                        break;
+                    }
+                    return fail("expected ',' or ']'");
+                }
+                containers[opened].count = count;
+                return true;
+            }
+
+            bool encode_string() {
+                text.clear();
+                if (!read_string(text)) {
+                    return fail("malformed string");
+                }
+                append_header(out, MAJOR_TEXT, text.size());
+                out.append(text);
+                return true;
+            }
+
+            bool encode_number() {
+                size_t start = position;
+                while (position < json.size()) {
+                    char c = json[position];
+                    if ((c < '0' || c > '9') && c != '-' && c != '+' && c != '.' && c != 'e' && c != 'E') {
+                        break;
+                    }
+                    ++position;
+                }
+                std::string literal(json.substr(start, position - start));
+                char* end = nullptr;
+
+                if (literal.find_first_of(".eE") == std::string::npos) {
+                    // integers only if they render back the same ("-0" and
+                    // leading zeros don't)
+                    errno = 0;
+                    if (literal[0] == '-') {
+                        long long value = strtoll(literal.c_str(), &end, 10);
+                        if (errno == 0 && *end == '\0' && std::to_string(value) == literal) {
+                            append_header(out, (value < 0) ? MAJOR_NEGATIVE : MAJOR_UNSIGNED,
+                                (value < 0) ? static_cast<uint64_t>(-(value + 1)) : static_cast<uint64_t>(value));
+                            return true;
+                        }
+                    } else {
+                        unsigned long long value = strtoull(literal.c_str(), &end, 10);
+                        if (errno == 0 && *end == '\0' && std::to_string(value) == literal) {
+                            append_header(out, MAJOR_UNSIGNED, value);
+                            return true;
+                        }
+                    }
+                }
+
+                // from_chars takes no leading '+', which JSON doesn't allow either
+                double value = 0;
+                std::from_chars_result parsed = std::from_chars(literal.data(), literal.data() + literal.size(), value);
+                if (parsed.ec == std::errc::invalid_argument || parsed.ptr != literal.data() + literal.size()) {
+                    return fail("malformed number");
+                }
+                if (parsed.ec == std::errc() && shortest_double(value) == literal) {
+                    uint64_t bits = 0;
+                    memcpy(&bits, &value, sizeof(bits));
+                    out.push_back(static_cast<char>((MAJOR_SIMPLE << 5) | INFO_FLOAT64));
+                    for (int shift = 56; shift >= 0; shift -= 8) {
+                        out.push_back(static_cast<char>((bits >> shift) & 0xff));
+                    }
+                    return true;
+                }
+                // a spelling a double can't reproduce is kept as written
+                append_header(out, MAJOR_TAG, TAG_EMBEDDED_JSON);
+                append_header(out, MAJOR_TEXT, literal.size());
+                out.append(literal);
+                return true;
+            }
+
+            // with the opening quote at position; leaves position past the
+            // closing one
+            bool read_string(std::string& value) {
+                ++position;
+                while (position < json.size()) {
+                    size_t run = position;
+                    while (run < json.size() && json[run] != '"' && json[run] != '\\') {
+                        ++run;
+                    }
+                    value.append(json.substr(position, run - position));
+                    position = run;
+                    if (position >= json.size()) {
+                        break;
+                    }
+                    char c = json[position++];
+                    if (c == '"') {
+                        return true;
+                    }
+                    if (position >= json.size()) {
+                        return false;
+                    }
+                    char escaped = json[position++];
+                    switch (escaped) {
+                        case 'u': {
+                            uint32_t code_point = 0;
+                            if (!read_hex4(code_point)) {
+                                return false;
+                            }
+                            // surrogate pair
+                            if (code_point >= 0xd800 && code_point < 0xdc00
+                                && position + 1 < json.size() && json[position] == '\\' && json[position + 1] == 'u') {
+                                position += 2;
+                                uint32_t low = 0;
+                                if (!read_hex4(low) || low < 0xdc00 || low >= 0xe000) {
+                                    return false;
+                                }
+                                code_point = 0x10000 + ((code_point - 0xd800) << 10) + (low - 0xdc00);
+                            }
+                            append_utf8(value, code_point);
+                            break;
+                        }
+                        case 'b': value.push_back('\b'); break;
+                        case 'f': value.push_back('\f'); break;
+                        case 'n': value.push_back('\n'); break;
+                        case 'r': value.push_back('\r'); break;
+                        case 't': value.push_back('\t'); break;
+                        default: value.push_back(escaped); break;
+                    }
+                }
+                return false;
+            }
+
+            bool read_hex4(uint32_t& value) {
+                if (position + 4 > json.size()) {
+                    return false;
+                }
+                value = 0;
+                for (int i = 0; i < 4; ++i) {
+                    char c = json[position++];
+                    value <<= 4;
+                    if (c >= '0' && c <= '9') {
+                        value |= c - '0';
+                    } else if (c >= 'a' && c <= 'f') {
+                        value |= c - 'a' + 10;
+                    } else if (c >= 'A' && c <= 'F') {
+                        value |= c - 'A' + 10;
+                    } else {
+                        return false;
+                    }
+                }
+                return true;
+            }
+
+            static void append_utf8(std::string& value, uint32_t code_point) {
+                if (code_point < 0x80) {
+                    value.push_back(static_cast<char>(code_point));
+                } else if (code_point < 0x800) {
+                    value.push_back(static_cast<char>(0xc0 | (code_point >> 6)));
+                    value.push_back(static_cast<char>(0x80 | (code_point & 0x3f)));
+                } else if (code_point < 0x10000) {
+                    value.push_back(static_cast<char>(0xe0 | (code_point >> 12)));
+                    value.push_back(static_cast<char>(0x80 | ((code_point >> 6) & 0x3f)));
+                    value.push_back(static_cast<char>(0x80 | (code_point & 0x3f)));
+                } else {
+                    value.push_back(static_cast<char>(0xf0 | (code_point >> 18)));
+                    value.push_back(static_cast<char>(0x80 | ((code_point >> 12) & 0x3f)));
+                    value.push_back(static_cast<char>(0x80 | ((code_point >> 6) & 0x3f)));
+                    value.push_back(static_cast<char>(0x80 | (code_point & 0x3f)));
+                }
+            }
+
+            // room for the largest header; finish() shrinks it to fit
+            size_t open_container(unsigned char major) {
+                container opened;
+                opened.placeholder = out.size();
+                opened.major = major;
+                containers.push_back(opened);
+                out.append(MAX_HEADER_SIZE, '\0');
+                return containers.size() - 1;
+            }
+
+            // Write the real headers over the placeholders in one pass;
+            // containers were opened in document order, so their
+            // placeholders are already sorted
+            void finish() {
+                if (containers.empty()) {
+                    return;
+                }
+                std::string compact;
+                compact.reserve(out.size());
+                size_t copied = 0;
+                for (const auto& opened : containers) {
+                    compact.append(out, copied, opened.placeholder - copied);
+                    append_header(compact, opened.major, opened.count);
+                    copied = opened.placeholder + MAX_HEADER_SIZE;
+                }
+                compact.append(out, copied, std::string::npos);
+                out.swap(compact);
+            }
+
+            std::string_view json;
+            size_t position{0};
+            std::string& out;
+            std::vector<container> containers{};
+            // the string being decoded
+            std::string text{};
+    };
+
+    class decoder {
+        public:
+            decoder(std::string_view _data) : data(_data) {}
+
+            bool read_header(unsigned char& major, unsigned char& info, uint64_t& argument) {
+                if (position >= data.size()) {
+                    return false;
+                }
+                unsigned char initial = static_cast<unsigned char>(data[position++]);
+                major = initial >> 5;
+                info = initial & 0x1f;
+                if (info < 24) {
+                    argument = info;
+                    return true;
+                }
+                if (info > 27) {
+                    // indefinite lengths and reserved values are never written
+                    return false;
+                }
+                size_t argument_bytes = size_t(1) << (info - 24);
+                if (data.size() - position < argument_bytes) {
+                    return false;
+                }
+                argument = 0;
+                for (size_t i = 0; i < argument_bytes; ++i) {
+                    argument = (argument << 8) | static_cast<unsigned char>(data[position++]);
+                }
+                return true;
+            }
+
+            // Leaves position past the text string, which must be next
+            bool read_text(std::string_view& text) {
+                unsigned char major = 0;
+                unsigned char info = 0;
+                uint64_t argument = 0;
+                if (!read_header(major, info, argument) || major != MAJOR_TEXT || argument > data.size() - position) {
+                    return false;
+                }
+                text = data.substr(position, static_cast<size_t>(argument));
+                position += static_cast<size_t>(argument);
+                return true;
+            }
+
+            void skip_self_describe() {
+                while (data.compare(position, SELF_DESCRIBE_SIZE, SELF_DESCRIBE) == 0) {
+                    position += SELF_DESCRIBE_SIZE;
+                }
+            }
+
+            // Walk over one item by counting what is still owed, so nesting
+            // costs no stack
+            bool skip_item() {
+                uint64_t pending = 1;
+                while (pending > 0) {
+                    --pending;
+                    unsigned char major = 0;
+                    unsigned char info = 0;
+                    uint64_t argument = 0;
+                    if (!read_header(major, info, argument)) {
+                        return false;
+                    }
+                    // every item takes at least a byte, which bounds the counts
+                    uint64_t remaining = data.size() - position;
+                    switch (major) {
+                        case MAJOR_BYTES:
+                        case MAJOR_TEXT:
+                            if (argument > remaining) {
+                                return false;
+                            }
+                            position += static_cast<size_t>(argument);
+                            break;
+                        case MAJOR_ARRAY:
+                            if (argument > remaining) {
+                                return false;
+                            }
+                            pending += argument;
+                            break;
+                        case MAJOR_MAP:
+                            if (argument > remaining / 2) {
+                                return false;
+                            }
+                            pending += 2 * argument;
+                            break;
+                        case MAJOR_TAG:
+                            ++pending;
+                            break;
+                        default:
+                            break;
+                    }
+                }
+                return true;
+            }
+
+            bool render(std::string& json, size_t depth) {
+                unsigned char major = 0;
+                unsigned char info = 0;
+                uint64_t argument = 0;
+                if (depth >= MAX_DEPTH || !read_header(major, info, argument)) {
+                    return false;
+                }
+                switch (major) {
+                    case MAJOR_UNSIGNED:
+                        json.append(std::to_string(argument));
+                        return true;
+                    case MAJOR_NEGATIVE:
+                        // the value is -1 - argument
+                        json.push_back('-');
+                        json.append((argument == UINT64_MAX) ? std::string("18446744073709551616") : std::to_string(argument + 1));
+                        return true;
+                    case MAJOR_TEXT:
+                        if (argument > data.size() - position) {
+                            return false;
+                        }
+                        json.append(json_pointer::Quote(data.substr(position, static_cast<size_t>(argument))));
+                        position += static_cast<size_t>(argument);
+                        return true;
+                    case MAJOR_ARRAY:
+                        json.push_back('[');
+                        for (uint64_t i = 0; i < argument; ++i) {
+                            if (i > 0) {
+                                json.push_back(',');
+                            }
+                            if (!render(json, depth + 1)) {
+                                return false;
+                            }
+                        }
+                        json.push_back(']');
+                        return true;
+                    case MAJOR_MAP:
+                        json.push_back('{');
+                        for (uint64_t i = 0; i < argument; ++i) {
+                            std::string_view key;
+                            if (!read_text(key)) {
+                                return false;
+                            }
+                            if (i > 0) {
+                                json.push_back(',');
+                            }
+                            json.append(json_pointer::Quote(key));
+                            json.push_back(':');
+                            if (!render(json, depth + 1)) {
+                                return false;
+                            }
+                        }
+                        json.push_back('}');
+                        return true;
+                    case MAJOR_TAG:
+                        if (argument == TAG_SELF_DESCRIBE) {
+                            return render(json, depth + 1);
+                        }
+                        if (argument == TAG_EMBEDDED_JSON) {
+                            std::string_view literal;
+                            if (!read_text(literal)) {
+                                return false;
+                            }
+                            json.append(literal);
+                            return true;
+                        }
+                        return false;
+                    case MAJOR_SIMPLE:
+                        return render_simple(json, info, argument);
+                    default:
+                        // byte strings have no JSON form and are never written
+                        return false;
+                }
+            }
+
+            std::string_view data;
+            size_t position{0};
+
+        private:
+            bool render_simple(std::string& json, unsigned char info, uint64_t argument) {
+                double value = 0;
+                if (info == INFO_FLOAT64) {
+                    memcpy(&value, &argument, sizeof(value));
+                } else if (info == INFO_FLOAT32) {
+                    uint32_t bits = static_cast<uint32_t>(argument);
+                    float single = 0;
+                    memcpy(&single, &bits, sizeof(single));
+                    value = single;
+                } else if (argument == SIMPLE_FALSE) {
+                    json.append("false");
+                    return true;
+                } else if (argument == SIMPLE_TRUE) {
+                    json.append("true");
+                    return true;
+                } else if (argument == SIMPLE_NULL) {
+                    json.append("null");
+                    return true;
+                } else {
+                    return false;
+                }
+                if (!std::isfinite(value)) {
+                    return false;
+                }
+                json.append(shortest_double(value));
+                return true;
+            }
+    };
+
+    const std::string WILDCARD("*");
+
+    // Collect every item below the decoder's that matches tokens from
+    // depth on, consuming the whole item either way
+    bool match_all(decoder& document, const std::vector<std::string>& tokens, size_t depth, std::string& pointer, json_pointer::match_list& matches) {
+        document.skip_self_describe();
+        size_t begin = document.position;
+        if (depth == tokens.size()) {
+            if (!document.skip_item()) {
+                return false;
+            }
+            matches.emplace_back(pointer, document.data.substr(begin, document.position - begin));
+            return true;
+        }
+
+        unsigned char major = 0;
+        unsigned char info = 0;
+        uint64_t count = 0;
+        if (!document.read_header(major, info, count)) {
+            return false;
+        }
+        const std::string& token = tokens[depth];
+        bool wildcard = (token == WILDCARD);
+        size_t pointer_size = pointer.size();
+        if (major == MAJOR_MAP) {
+            for (uint64_t i = 0; i < count; ++i) {
+                std::string_view key;
+                if (!document.read_text(key)) {
+                    return false;
+                }
+                if (wildcard || key == token) {
+                    pointer.push_back('/');
+                    pointer.append(json_pointer::Escape(key));
+                    if (!match_all(document, tokens, depth + 1, pointer, matches)) {
+                        return false;
+                    }
+                    pointer.resize(pointer_size);
+                } else if (!document.skip_item()) {
+                    return false;
+                }
+            }
+            return true;
+        }
+        if (major == MAJOR_ARRAY) {
+            for (uint64_t i = 0; i < count; ++i) {
+                if (wildcard || token == std::to_string(i)) {
+                    pointer.push_back('/');
+                    pointer.append(std::to_string(i));
+                    if (!match_all(document, tokens, depth + 1, pointer, matches)) {
+                        return false;
+                    }
+                    pointer.resize(pointer_size);
+                } else if (!document.skip_item()) {
+                    return false;
+                }
+            }
+            return true;
+        }
+        // primitives have nothing to descend into
+        document.position = begin;
+        return document.skip_item();
+    }
+
+}
+
+bool binary_json::IsEncoded(std::string_view data) {
+    return data.compare(0, SELF_DESCRIBE_SIZE, SELF_DESCRIBE) == 0;
+}
+
+bool binary_json::FromJson(std::string_view json, std::string& encoded) {
+    encoder document(json, encoded);
+    if (!document.encode_document()) {
+        encoded.clear();
+        return false;
+    }
+    return true;
+}
+
+bool binary_json::ToJson(std::string_view encoded, std::string& json) {
+    json.clear();
+    decoder document(encoded);
+    if (!document.render(json, 0) || document.position != encoded.size()) {
+        std::cerr << "malformed binary member at offset " << document.position << std::endl;
+        json.clear();
+        return false;
+    }
+    return true;
+}
+
+bool binary_json::Find(std::string_view encoded, std::string_view pointer, std::string_view& item) {
+    std::vector<std::string> tokens;
+    if (!json_pointer::Parse(pointer, tokens)) {
+        return false;
+    }
+
+    decoder document(encoded);
+    for (const auto& token : tokens) {
+        document.skip_self_describe();
+        unsigned char major = 0;
+        unsigned char info = 0;
+        uint64_t count = 0;
+        if (!document.read_header(major, info, count)) {
+            return false;
+        }
+        if (major == MAJOR_MAP) {
+            bool found = false;
+            for (uint64_t i = 0; i < count && !found; ++i) {
+                std::string_view key;
+                if (!document.read_text(key)) {
+                    return false;
+                }
+                found = (key == token);
+                if (!found && !document.skip_item()) {
+                    return false;
+                }
+            }
+            if (!found) {
+                return false;
+            }
+        } else if (major == MAJOR_ARRAY) {
+            // a plain decimal index; "-" and leading zeros name nothing
+            if (token.empty() || token.size() > 19 || token.find_first_not_of("0123456789") != std::string::npos
+                || (token.size() > 1 && token[0] == '0')) {
+                return false;
+            }
+            uint64_t element = std::stoull(token);
+            if (element >= count) {
+                return false;
+            }
+            for (uint64_t i = 0; i < element; ++i) {
+                if (!document.skip_item()) {
+                    return false;
+                }
+            }
+        } else {
+            return false;
+        }
+    }
+
+    document.skip_self_describe();
+    size_t start = document.position;
+    if (!document.skip_item()) {
+        return false;
+    }
+    item = encoded.substr(start, document.position - start);
+    return true;
+}
+
+bool binary_json::FindAll(std::string_view encoded, std::string_view pattern, json_pointer::match_list& matches) {
+    matches.clear();
+    std::vector<std::string> tokens;
+    if (!json_pointer::Parse(pattern, tokens)) {
+        std::cerr << "Invalid JSON pointer " << pattern << std::endl;
+        return false;
+    }
+
+    decoder document(encoded);
+    std::string pointer;
+    if (!match_all(document, tokens, 0, pointer, matches)) {
+        std::cerr << "malformed binary member at offset " << document.position << std::endl;
+        matches.clear();
+        return false;
+    }
+    return true;
+}
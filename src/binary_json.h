@@ -0,0 +1,48 @@
+#ifndef SAVED_GAME_FORMAT_BINARY_JSON_H__
+#define SAVED_GAME_FORMAT_BINARY_JSON_H__
+
+#include <string>
+#include <string_view>
+
+#include "json_pointer.h"
+
+namespace saved_game_format_file {
+
+    // JSON members stored as CBOR (RFC 8949). Objects and arrays carry their
+    // item counts and strings their lengths, so a field is reached by
+    // hopping over headers instead of scanning text, and nothing needs
+    // unescaping on the way. Encoded members start with the self-describe
+    // tag (d9 d9 f7), which no JSON text can begin with, so both kinds can
+    // sit side by side in a save.
+    //
+    // Integers that fit 64 bits are stored as integers and other numbers as
+    // doubles when that renders back to the same literal; anything else
+    // (1.0, 1e5, huge integers) keeps its literal under the embedded JSON
+    // tag 262. Converting back therefore gives the same values and number
+    // spellings, though insignificant whitespace and string escapes are
+    // not preserved.
+    namespace binary_json {
+
+        // data starts with the self-describe tag
+        bool IsEncoded(std::string_view data);
+
+        // Encode a JSON document, self-describe tag included
+        bool FromJson(std::string_view json, std::string& encoded);
+
+        // Compact JSON text of an encoded document, or of a single item as
+        // returned by Find
+        bool ToJson(std::string_view encoded, std::string& json);
+
+        // The encoded item a JSON pointer refers to (see json_pointer::Parse
+        // for the accepted forms); only the headers on the way are read
+        bool Find(std::string_view encoded, std::string_view pointer, std::string_view& item);
+
+        // Every item a pattern refers to, "*" tokens included, the way
+        // json_pointer::FindAll does for text
+        bool FindAll(std::string_view encoded, std::string_view pattern, json_pointer::match_list& matches);
+
+    }
+
+}
+
+#endif //SAVED_GAME_FORMAT_BINARY_JSON_H__
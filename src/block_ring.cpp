@@ -0,0 +1,109 @@
+#include <algorithm>
+#include <cstring>
+
+#include "block_ring.h"
+
+using namespace saved_game_format_file;
+
+BlockRing::BlockRing(size_t buffer_count, size_t buffer_size) : blocks(std::max<size_t>(buffer_count, 1)) {
+    for (size_t i = 0; i < blocks.size(); ++i) {
+        blocks[i].data.resize(std::max<size_t>(buffer_size, 1));
+        free_blocks.push_back(i);
+    }
+}
+
+void BlockRing::Announce(int64_t size) {
+    std::lock_guard<std::mutex> guard(lock);
+    announced_size = size;
+    changed.notify_all();
+}
+
+bool BlockRing::Write(const char* data, size_t length) {
+    while (length > 0) {
+        if (!filling) {
+            std::unique_lock<std::mutex> guard(lock);
+            changed.wait(guard, [this]() { return !free_blocks.empty() || consumer_stopped; });
+            if (consumer_stopped) {
+                return false;
+            }
+            current = free_blocks.front();
+            free_blocks.pop_front();
+            blocks[current].used = 0;
+            filling = true;
+        }
+
+        // the block is the producer's alone until it is published
+        block& target = blocks[current];
+        size_t copied = std::min(length, target.data.size() - target.used);
+        memcpy(target.data.data() + target.used, data, copied);
+        target.used += copied;
+        data += copied;
+        length -= copied;
+
+        if (target.used == target.data.size()) {
+            std::lock_guard<std::mutex> guard(lock);
+            full_blocks.push_back(current);
+            filling = false;
+            changed.notify_all();
+            if (consumer_stopped) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+void BlockRing::Close(bool success) {
+    std::lock_guard<std::mutex> guard(lock);
+    if (filling) {
+        if (blocks[current].used > 0) {
+            full_blocks.push_back(current);
+        } else {
+            free_blocks.push_back(current);
+        }
+        filling = false;
+    }
+    closed = true;
+    producer_success = success;
+    changed.notify_all();
+}
+
+bool BlockRing::Drain(const std::function<void(int64_t size)>& on_size, const data_sink& sink) {
+    bool size_delivered = false;
+    bool sink_success = true;
+    while (true) {
+        size_t next = 0;
+        int64_t size = -1;
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            changed.wait(guard, [this, size_delivered]() {
+                return !full_blocks.empty() || closed || (!size_delivered && announced_size >= 0);
+            });
+            // announced before any data was written, so it is seen first
+            if (!size_delivered && announced_size >= 0) {
+                size = announced_size;
+            } else if (!full_blocks.empty()) {
+                next = full_blocks.front();
+                full_blocks.pop_front();
+            } else {
+                return producer_success;
+            }
+        }
+        if (size >= 0) {
+            size_delivered = true;
+            on_size(size);
+            continue;
+        }
+
+        sink_success = sink(blocks[next].data.data(), blocks[next].used);
+        std::lock_guard<std::mutex> guard(lock);
+        free_blocks.push_back(next);
+        if (!sink_success) {
+            consumer_stopped = true;
+        }
+        changed.notify_all();
+        if (!sink_success) {
+            return false;
+        }
+    }
+}
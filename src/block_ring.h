@@ -0,0 +1,65 @@
+#ifndef SAVED_GAME_FORMAT_BLOCK_RING_H__
+#define SAVED_GAME_FORMAT_BLOCK_RING_H__
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+#include "byte_source.h"
+
+namespace saved_game_format_file {
+
+    // A fixed ring of reusable buffers between one producer thread and one
+    // consumer thread. The producer copies data in and blocks once every
+    // buffer is full; the consumer hands whole buffers to a sink and gives
+    // them back. Nothing is allocated once the buffers exist, and memory
+    // stays bounded however far apart the two run.
+    class BlockRing {
+        public:
+            BlockRing(size_t buffer_count, size_t buffer_size);
+
+            BlockRing(const BlockRing&) = delete;
+            BlockRing& operator=(const BlockRing&) = delete;
+
+            // Producer side. Write returns false once the consumer stopped.
+            // The size, if announced, reaches the consumer before any data.
+            void Announce(int64_t size);
+            bool Write(const char* data, size_t length);
+            // publish what is left; success is what Drain reports
+            void Close(bool success);
+
+            // Consumer side: feed every buffer to the sink until the
+            // producer closes. Stops the producer if the sink returns
+            // false. True only if both ends succeeded.
+            bool Drain(const std::function<void(int64_t size)>& on_size, const data_sink& sink);
+
+        private:
+            struct block {
+                std::vector<char> data{};
+                size_t used{0};
+            };
+
+            std::vector<block> blocks{};
+            // indices into blocks
+            std::deque<size_t> free_blocks{};
+            std::deque<size_t> full_blocks{};
+            // block the producer is filling, if any; only it touches these
+            bool filling{false};
+            size_t current{0};
+
+            int64_t announced_size{-1};
+            bool closed{false};
+            bool producer_success{false};
+            bool consumer_stopped{false};
+
+            std::mutex lock{};
+            std::condition_variable changed{};
+    };
+
+}
+
+#endif //SAVED_GAME_FORMAT_BLOCK_RING_H__
@@ -0,0 +1,122 @@
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "byte_source.h"
+
+using namespace saved_game_format_file;
+
+int64_t FileByteSource::Size() {
+    if (fseeko(data_file, 0, SEEK_END) != 0) {
+        std::cerr << "unable to set file pointer, errno " << errno << std::endl;
+        return -1;
+    }
+    return ftello(data_file);
+}
+
+bool FileByteSource::ReadAt(int64_t offset, void* buffer, size_t length) {
+    // positional reads leave the FILE's own position alone, so several
+    // threads can read members of the same archive at once
+    DescriptorByteSource source(fileno(data_file));
+    return source.ReadAt(offset, buffer, length);
+}
+
+int64_t DescriptorByteSource::Size() {
+    struct stat file_stat;
+    if (fstat(descriptor, &file_stat) != 0) {
+        std::cerr << "unable to stat file, errno " << errno << std::endl;
+        return -1;
+    }
+    return static_cast<int64_t>(file_stat.st_size);
+}
+
+bool DescriptorByteSource::ReadAt(int64_t offset, void* buffer, size_t length) {
+    char* output = static_cast<char*>(buffer);
+    while (length > 0) {
+        ssize_t bytes_read = pread(descriptor, output, length, offset);
+        if (bytes_read < 0 && errno == EINTR) {
+            continue;
+        }
+        if (bytes_read <= 0) {
+            if (bytes_read < 0) {
+                std::cerr << "unable to read file, errno " << errno << std::endl;
+            }
+            return false;
+        }
+        output += bytes_read;
+        offset += bytes_read;
+        length -= static_cast<size_t>(bytes_read);
+    }
+    return true;
+}
+
+bool MemoryByteSource::ReadAt(int64_t offset, void* buffer, size_t length) {
+    const unsigned char* source = View(offset, length);
+    if (source == nullptr) {
+        return false;
+    }
+    memcpy(buffer, source, length);
+    return true;
+}
+
+const unsigned char* MemoryByteSource::View(int64_t offset, size_t length) {
+    if (offset < 0 || static_cast<size_t>(offset) > size || length > size - static_cast<size_t>(offset)) {
+        return nullptr;
+    }
+    return data + offset;
+}
+
+MappedFile::~MappedFile() {
+    Close();
+}
+
+bool MappedFile::Open(const std::string& _filename) {
+    int fd = open(_filename.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        Close();
+        std::cerr << "unable to open data file. errno: " << errno << std::endl;
+        return false;
+    }
+    bool success = Open(fd);
+    // the mapping keeps the file alive on its own
+    close(fd);
+    return success;
+}
+
+bool MappedFile::Open(int descriptor) {
+    Close();
+
+    struct stat file_status;
+    if (fstat(descriptor, &file_status) != 0) {
+        std::cerr << "unable to stat data file. errno: " << errno << std::endl;
+        return false;
+    }
+
+    size = static_cast<size_t>(file_status.st_size);
+    if (size != 0) {
+        void* mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+        if (mapping == MAP_FAILED) {
+            std::cerr << "unable to map data file. errno: " << errno << std::endl;
+            size = 0;
+            return false;
+        }
+        data = static_cast<const unsigned char*>(mapping);
+    }
+
+    mapped = true;
+    return true;
+}
+
+void MappedFile::Close() {
+    if (data != nullptr) {
+        munmap(const_cast<unsigned char*>(data), size);
+    }
+    data = nullptr;
+    size = 0;
+    mapped = false;
+}
@@ -0,0 +1,93 @@
+#ifndef SAVED_GAME_FORMAT_BYTE_SOURCE_H__
+#define SAVED_GAME_FORMAT_BYTE_SOURCE_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <string>
+
+namespace saved_game_format_file {
+
+    // Receives decoded data a block at a time; return false to stop
+    typedef std::function<bool(const char* buffer, size_t length)> data_sink;
+
+    // Random access to the raw bytes of an archive
+    class ByteSource {
+        public:
+            virtual ~ByteSource() {}
+
+            virtual int64_t Size() = 0;
+            virtual bool ReadAt(int64_t offset, void* buffer, size_t length) = 0;
+
+            // Pointer straight into the source, or nullptr if the source is
+            // not addressable (or the range is out of bounds)
+            virtual const unsigned char* View(int64_t /*offset*/, size_t /*length*/) { return nullptr; }
+    };
+
+    // ReadAt is safe to call from several threads at once
+    class FileByteSource : public ByteSource {
+        public:
+            FileByteSource(FILE* _data_file) : data_file(_data_file) {}
+
+            int64_t Size() override;
+            bool ReadAt(int64_t offset, void* buffer, size_t length) override;
+
+        private:
+            FILE* data_file;
+    };
+
+    // Positional reads from a raw descriptor; the descriptor's own offset
+    // is never used, so any number of threads may share one
+    class DescriptorByteSource : public ByteSource {
+        public:
+            DescriptorByteSource(int _descriptor) : descriptor(_descriptor) {}
+
+            int64_t Size() override;
+            bool ReadAt(int64_t offset, void* buffer, size_t length) override;
+
+        private:
+            int descriptor;
+    };
+
+    class MemoryByteSource : public ByteSource {
+        public:
+            MemoryByteSource(const unsigned char* _data, size_t _size) : data(_data), size(_size) {}
+
+            inline int64_t Size() override { return static_cast<int64_t>(size); }
+            bool ReadAt(int64_t offset, void* buffer, size_t length) override;
+            const unsigned char* View(int64_t offset, size_t length) override;
+
+        private:
+            const unsigned char* data;
+            size_t size;
+    };
+
+    // Read-only private mapping of a whole file
+    class MappedFile {
+        public:
+            MappedFile() {}
+            ~MappedFile();
+
+            MappedFile(const MappedFile&) = delete;
+            MappedFile& operator=(const MappedFile&) = delete;
+
+            bool Open(const std::string& _filename);
+            // Map the file behind an open descriptor, which stays the
+            // caller's to close
+            bool Open(int descriptor);
+            void Close();
+
+            inline bool IsOpen() const { return mapped; }
+            inline const unsigned char* Data() const { return data; }
+            inline size_t Size() const { return size; }
+
+        private:
+            const unsigned char* data{nullptr};
+            size_t size{0};
+            bool mapped{false};
+    };
+
+}
+
+#endif //SAVED_GAME_FORMAT_BYTE_SOURCE_H__
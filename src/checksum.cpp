@@ -0,0 +1,139 @@
+#include <algorithm>
+#include <climits>
+
+#include <zlib.h>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define SGF_CRC32_PCLMUL 1
+#include <immintrin.h>
+#endif
+
+#include "checksum.h"
+
+using namespace saved_game_format_file;
+
+namespace {
+
+    // zlib takes 32 bit lengths
+    uint32_t crc32_zlib(uint32_t crc, const unsigned char* data, size_t length) {
+        while (length > 0) {
+            uInt chunk = static_cast<uInt>(std::min<size_t>(length, UINT_MAX));
+            crc = static_cast<uint32_t>(crc32(crc, data, chunk));
+            data += chunk;
+            length -= chunk;
+        }
+        return crc;
+    }
+
+#if defined(SGF_CRC32_PCLMUL)
+
+    // below this the folding setup costs more than it saves
+    const size_t PCLMUL_MINIMUM = 64;
+
+    // Folding constants for the bit-reflected CRC-32 polynomial
+    // 0x04c11db7, from Intel's "Fast CRC Computation for Generic
+    // Polynomials Using PCLMULQDQ Instruction": x^(4*128+32) and
+    // x^(4*128-32) mod P fold four lanes 64 bytes ahead, the next pair
+    // folds one lane into the next, then 64 bits down to 32 and a Barrett
+    // reduction by P and its quotient mu.
+    alignas(16) const uint64_t FOLD_BY_4[2] = { 0x0154442bd4, 0x01c6e41596 };
+    alignas(16) const uint64_t FOLD_BY_1[2] = { 0x01751997d0, 0x00ccaa009e };
+    alignas(16) const uint64_t FOLD_64[2] = { 0x0163cd6124, 0x0000000000 };
+    alignas(16) const uint64_t BARRETT[2] = { 0x01db710641, 0x01f7011641 };
+
+    // length is a multiple of 16, at least 64; crc is the inverted
+    // running state, and so is the result
+    __attribute__((target("pclmul,sse4.1")))
+    uint32_t crc32_fold(uint32_t crc, const unsigned char* data, size_t length) {
+        __m128i x1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 0x00));
+        __m128i x2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 0x10));
+        __m128i x3 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 0x20));
+        __m128i x4 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 0x30));
+        x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(static_cast<int>(crc)));
+        __m128i k = _mm_load_si128(reinterpret_cast<const __m128i*>(FOLD_BY_4));
+        data += 64;
+        length -= 64;
+
+        // four independent lanes keep the multipliers busy
+        while (length >= 64) {
+            __m128i x5 = _mm_clmulepi64_si128(x1, k, 0x00);
+            __m128i x6 = _mm_clmulepi64_si128(x2, k, 0x00);
+            __m128i x7 = _mm_clmulepi64_si128(x3, k, 0x00);
+            __m128i x8 = _mm_clmulepi64_si128(x4, k, 0x00);
+            x1 = _mm_clmulepi64_si128(x1, k, 0x11);
+            x2 = _mm_clmulepi64_si128(x2, k, 0x11);
+            x3 = _mm_clmulepi64_si128(x3, k, 0x11);
+            x4 = _mm_clmulepi64_si128(x4, k, 0x11);
+            x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 0x00)));
+            x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 0x10)));
+            x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 0x20)));
+            x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 0x30)));
+            data += 64;
+            length -= 64;
+        }
+
+        // fold the lanes into one, then the remaining 16 byte blocks
+        k = _mm_load_si128(reinterpret_cast<const __m128i*>(FOLD_BY_1));
+        __m128i lanes[3] = { x2, x3, x4 };
+        for (const __m128i& lane : lanes) {
+            __m128i low = _mm_clmulepi64_si128(x1, k, 0x00);
+            x1 = _mm_clmulepi64_si128(x1, k, 0x11);
+            x1 = _mm_xor_si128(_mm_xor_si128(x1, lane), low);
+        }
+        while (length >= 16) {
+            __m128i low = _mm_clmulepi64_si128(x1, k, 0x00);
+            x1 = _mm_clmulepi64_si128(x1, k, 0x11);
+            x1 = _mm_xor_si128(_mm_xor_si128(x1, _mm_loadu_si128(reinterpret_cast<const __m128i*>(data))), low);
+            data += 16;
+            length -= 16;
+        }
+
+        // 128 bits down to 64
+        __m128i mask = _mm_setr_epi32(~0, 0, ~0, 0);
+        x2 = _mm_clmulepi64_si128(x1, k, 0x10);
+        x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+        k = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(FOLD_64));
+        x2 = _mm_srli_si128(x1, 4);
+        x1 = _mm_and_si128(x1, mask);
+        x1 = _mm_xor_si128(_mm_clmulepi64_si128(x1, k, 0x00), x2);
+
+        // Barrett reduction to 32
+        k = _mm_load_si128(reinterpret_cast<const __m128i*>(BARRETT));
+        x2 = _mm_and_si128(x1, mask);
+        x2 = _mm_clmulepi64_si128(x2, k, 0x10);
+        x2 = _mm_and_si128(x2, mask);
+        x2 = _mm_clmulepi64_si128(x2, k, 0x00);
+        x1 = _mm_xor_si128(x1, x2);
+        return static_cast<uint32_t>(_mm_extract_epi32(x1, 1));
+    }
+
+    bool has_pclmul() {
+        static const bool supported = __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1");
+        return supported;
+    }
+
+#endif
+
+}
+
+uint32_t checksum::Crc32(uint32_t crc, const void* data, size_t length) {
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+#if defined(SGF_CRC32_PCLMUL)
+    if (length >= PCLMUL_MINIMUM && has_pclmul()) {
+        size_t folded = length & ~static_cast<size_t>(15);
+        crc = ~crc32_fold(~crc, bytes, folded);
+        bytes += folded;
+        length -= folded;
+    }
+#endif
+    return crc32_zlib(crc, bytes, length);
+}
+
+const char* checksum::Crc32Implementation() {
+#if defined(SGF_CRC32_PCLMUL)
+    if (has_pclmul()) {
+        return "pclmul";
+    }
+#endif
+    return "zlib";
+}
@@ -0,0 +1,26 @@
+#ifndef SAVED_GAME_FORMAT_CHECKSUM_H__
+#define SAVED_GAME_FORMAT_CHECKSUM_H__
+
+#include <cstddef>
+#include <cstdint>
+
+namespace saved_game_format_file {
+
+    namespace checksum {
+
+        // The CRC-32 of ZIP and gzip (zlib's crc32), continuing from crc;
+        // start from 0. On x86-64 processors with carry-less multiply
+        // (PCLMULQDQ) and SSE4.1 the bulk of the data is folded 64 bytes
+        // at a time, several times faster than zlib's tables; anything
+        // else, and the last few bytes, goes through zlib. The choice is
+        // made once at run time, so the build needs no special flags.
+        uint32_t Crc32(uint32_t crc, const void* data, size_t length);
+
+        // "pclmul" or "zlib", for reports
+        const char* Crc32Implementation();
+
+    }
+
+}
+
+#endif //SAVED_GAME_FORMAT_CHECKSUM_H__
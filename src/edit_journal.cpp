@@ -0,0 +1,235 @@
+#include <cerrno>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "atomic_file.h"
+#include "binary_json.h"
+#include "edit_journal.h"
+#include "json_pointer.h"
+
+using namespace saved_game_format_file;
+
+namespace {
+
+    const int64_t JOURNAL_VERSION = 1;
+
+    bool write_all(int descriptor, const std::string& data) {
+        size_t written = 0;
+        while (written < data.size()) {
+            ssize_t count = write(descriptor, data.data() + written, data.size() - written);
+            if (count < 0 && errno == EINTR) {
+                continue;
+            }
+            if (count <= 0) {
+                return false;
+            }
+            written += static_cast<size_t>(count);
+        }
+        return true;
+    }
+
+}
+
+bool EditJournal::stamp_save(save_stamp& stamp) const {
+    struct stat save_stat;
+    if (stat(save.c_str(), &save_stat) != 0) {
+        std::cerr << "unable to stat " << save << ", errno " << errno << std::endl;
+        return false;
+    }
+    stamp.inode = static_cast<uint64_t>(save_stat.st_ino);
+    stamp.size = static_cast<int64_t>(save_stat.st_size);
+    return true;
+}
+
+bool EditJournal::truncate_journal() {
+    int descriptor = open(filename.c_str(), O_WRONLY | O_CLOEXEC);
+    if (descriptor < 0) {
+        // nothing to empty
+        return errno == ENOENT;
+    }
+    bool success = ftruncate(descriptor, 0) == 0 && fsync(descriptor) == 0;
+    if (!success) {
+        std::cerr << "unable to empty " << filename << ", errno " << errno << std::endl;
+    }
+    close(descriptor);
+    return success;
+}
+
+bool EditJournal::Load() {
+    pending.clear();
+    base = save_stamp();
+
+    std::ifstream journal_stream(filename, std::ios::binary);
+    if (!journal_stream) {
+        return true;
+    }
+    std::string journal((std::istreambuf_iterator<char>(journal_stream)), std::istreambuf_iterator<char>());
+    journal_stream.close();
+
+    // everything after the last newline is an append that never finished
+    size_t complete = journal.rfind('\n');
+    complete = (complete == std::string::npos) ? 0 : complete + 1;
+    if (complete != journal.size()) {
+        std::cerr << "dropping " << (journal.size() - complete) << " bytes of an incomplete edit from " << filename << std::endl;
+        if (truncate(filename.c_str(), static_cast<off_t>(complete)) != 0) {
+            std::cerr << "unable to truncate " << filename << ", errno " << errno << std::endl;
+            return false;
+        }
+        journal.resize(complete);
+    }
+    if (journal.empty()) {
+        return true;
+    }
+
+    // the header is ours and flat; read its fields without a DOM
+    size_t header_end = journal.find('\n');
+    std::string_view header = std::string_view(journal).substr(0, header_end);
+    std::string_view version;
+    std::string_view inode;
+    std::string_view size;
+    if (!json_pointer::Find(header, "/journal", version)
+        || !json_pointer::Find(header, "/inode", inode)
+        || !json_pointer::Find(header, "/size", size)) {
+        std::cerr << filename << " is not an edit journal" << std::endl;
+        return false;
+    }
+    if (version != std::to_string(JOURNAL_VERSION)) {
+        std::cerr << filename << " has an unsupported journal version " << version << std::endl;
+        return false;
+    }
+    try {
+        base.inode = std::stoull(std::string(inode));
+        base.size = std::stoll(std::string(size));
+    } catch (const std::exception&) {
+        std::cerr << filename << " has a damaged header" << std::endl;
+        return false;
+    }
+
+    save_stamp current;
+    if (!stamp_save(current)) {
+        return false;
+    }
+    if (!(current == base)) {
+        // the save was replaced after the journal was started: a checkpoint
+        // already holds these edits
+        std::cerr << "discarding " << filename << ", its edits predate the current " << save << std::endl;
+        base = save_stamp();
+        return truncate_journal();
+    }
+
+    return ParseEditScript(std::string_view(journal).substr(header_end + 1), pending);
+}
+
+bool EditJournal::Append(const KeyEdit& edit) {
+    std::string record;
+    if (pending.empty()) {
+        // a fresh journal records the save it applies to
+        if (!stamp_save(base)) {
+            return false;
+        }
+        record = "{\"journal\":" + std::to_string(JOURNAL_VERSION)
+            + ",\"inode\":" + std::to_string(base.inode)
+            + ",\"size\":" + std::to_string(base.size) + "}\n";
+    }
+    record += FormatKeyEdit(edit);
+    record.push_back('\n');
+
+    int flags = O_WRONLY | O_CREAT | O_CLOEXEC | (pending.empty() ? O_TRUNC : O_APPEND);
+    int descriptor = open(filename.c_str(), flags, 0666);
+    if (descriptor < 0) {
+        std::cerr << "unable to open " << filename << ", errno " << errno << std::endl;
+        return false;
+    }
+    // a single write, synced before the edit counts as saved
+    bool success = write_all(descriptor, record) && fdatasync(descriptor) == 0;
+    if (!success) {
+        std::cerr << "unable to append to " << filename << ", errno " << errno << std::endl;
+    }
+    close(descriptor);
+    // the journal's directory entry has to survive a crash as well
+    if (success && pending.empty()) {
+        success = SyncParentDirectory(filename);
+    }
+    if (success) {
+        pending.push_back(edit);
+    }
+    return success;
+}
+
+bool EditJournal::HasPending(const std::string& subfile_name) const {
+    for (const auto& edit : pending) {
+        if (edit.subfile == subfile_name) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool EditJournal::Overlay(const std::string& subfile_name, std::string& contents) const {
+    std::string scratch;
+    for (const auto& edit : pending) {
+        if (edit.subfile == subfile_name && !ApplyKeyEdit(contents, scratch, edit)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool EditJournal::OverlayStored(const std::string& subfile_name, std::string& contents) const {
+    if (!HasPending(subfile_name)) {
+        return true;
+    }
+    if (!binary_json::IsEncoded(contents)) {
+        return Overlay(subfile_name, contents);
+    }
+    std::string json;
+    if (!binary_json::ToJson(contents, json) || !Overlay(subfile_name, json)) {
+        return false;
+    }
+    // as UpdateSubfiles does, an edit that breaks the JSON keeps it as text
+    std::string encoded;
+    contents.swap(binary_json::FromJson(json, encoded) ? encoded : json);
+    return true;
+}
+
+bool EditJournal::Checkpoint(SavedGameFormatFile& saved_game_file) {
+    if (pending.empty()) {
+        return true;
+    }
+
+    // the journal is only emptied once the save has been replaced, which
+    // needs the rename; an in-place append would look like the same file
+    bool atomic_save = saved_game_file.atomic_save;
+    saved_game_file.atomic_save = true;
+    bool success = ApplyKeyEdits(saved_game_file, pending, "");
+    saved_game_file.atomic_save = atomic_save;
+    if (!success) {
+        std::cerr << "Unable to checkpoint " << filename << " into " << save << std::endl;
+        return false;
+    }
+
+    pending.clear();
+    base = save_stamp();
+    return truncate_journal();
+}
+
+bool EditJournal::Export(SavedGameFormatFile& saved_game_file, const std::vector<KeyEdit>& more_edits, const std::string& output_file) const {
+    // replacing the save would orphan the journal; that is a checkpoint
+    if (output_file.empty() || output_file == saved_game_file.filename) {
+        std::cerr << "Unable to export " << filename << " over " << save << std::endl;
+        return false;
+    }
+    std::vector<KeyEdit> edits(pending);
+    edits.insert(edits.end(), more_edits.begin(), more_edits.end());
+    if (!ApplyKeyEdits(saved_game_file, edits, output_file)) {
+        std::cerr << "Unable to export " << filename << " into " << output_file << std::endl;
+        return false;
+    }
+    return true;
+}
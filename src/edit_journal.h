@@ -0,0 +1,75 @@
+#ifndef SAVED_GAME_FORMAT_EDIT_JOURNAL_H__
+#define SAVED_GAME_FORMAT_EDIT_JOURNAL_H__
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "batch_edit.h"
+#include "sgf_file.h"
+
+namespace saved_game_format_file {
+
+    // Append-only log of key edits kept beside a save as <save>.journal.
+    // A frequent save appends and syncs one line per edit instead of
+    // rewriting the archive; Checkpoint later folds the pending edits into
+    // the archive with a single atomic save and empties the log.
+    //
+    // The first line records which file the edits apply to (inode and size
+    // of the save; every checkpoint renames a new file into place). A checkpoint that replaced the save but was
+    // interrupted before emptying the log leaves a journal whose record no
+    // longer matches; Load discards it rather than applying it twice. The
+    // remaining lines use the batch command's JSONL edit format, and a
+    // line torn by a crash part way through an append is dropped.
+    //
+    // Not thread-safe; callers serialise access to a save's journal.
+    class EditJournal {
+        public:
+            EditJournal() {}
+            EditJournal(const std::string& save_filename) : filename(save_filename + ".journal"), save(save_filename) {}
+
+            // Read the pending edits; a missing journal has none. Load before
+            // appending, a journal with nothing pending is started afresh.
+            bool Load();
+            // Write an edit through to disk before returning
+            bool Append(const KeyEdit& edit);
+            // Apply the pending edits of subfile_name to its contents
+            bool Overlay(const std::string& subfile_name, std::string& contents) const;
+            // As Overlay, for a member as stored: binary members are edited
+            // as JSON and encoded again, the way a checkpoint stores them
+            bool OverlayStored(const std::string& subfile_name, std::string& contents) const;
+            // Apply every pending edit to the save and empty the journal
+            bool Checkpoint(SavedGameFormatFile& saved_game_file);
+            // Write the save with every pending edit, then more_edits,
+            // applied to output_file, another file; the save and the
+            // journal are left as they are
+            bool Export(SavedGameFormatFile& saved_game_file, const std::vector<KeyEdit>& more_edits, const std::string& output_file) const;
+
+            inline const std::vector<KeyEdit>& Pending() const { return pending; }
+            inline bool Empty() const { return pending.empty(); }
+            bool HasPending(const std::string& subfile_name) const;
+
+            std::string filename{};
+            // the save the edits apply to
+            std::string save{};
+
+        private:
+            struct save_stamp {
+                uint64_t inode{0};
+                int64_t size{-1};
+                inline bool operator==(const save_stamp& other) const {
+                    return inode == other.inode && size == other.size;
+                }
+            };
+
+            bool stamp_save(save_stamp& stamp) const;
+            bool truncate_journal();
+
+            std::vector<KeyEdit> pending{};
+            // stamp of the save the pending edits were journaled against
+            save_stamp base{};
+    };
+
+}
+
+#endif //SAVED_GAME_FORMAT_EDIT_JOURNAL_H__
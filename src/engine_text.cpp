@@ -0,0 +1,973 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "engine_text.h"
+#include "json_pointer.h"
+#include "stats.h"
+
+using namespace saved_game_format_file;
+
+namespace {
+
+    const std::string WILDCARD = "*";
+    // value index that appends
+    const std::string APPEND = "-";
+
+    const std::string_view SECTION_DATA = "data";
+    const std::string_view SECTION_BEGIN = "begin";
+    const std::string_view NUMBERS_SECTION = "mission";
+    const std::string_view STRINGS_SECTION = "missionstring";
+
+    const std::string FIELD_SYSTEM = "system";
+    const std::string FIELD_CREDITS = "credits";
+    const std::string FIELD_SHIP = "ship";
+    const std::string FIELD_POSITION = "position";
+    const size_t POSITION_FIELDS = 3;
+
+    // the header line is a system, credits, a ship and three coordinates;
+    // Recognize gives up past this rather than hunt through a large member
+    const size_t HEADER_LIMIT = 4096;
+
+    // digits counts are read into a size_t; more than this could overflow
+    const size_t MAX_DIGITS = 18;
+
+    // Offsets of every '\n' in data. With SSE2, 64 bytes are compared per
+    // step and folded into one bit mask, so the loop stops only where a
+    // line ends. Otherwise memchr does the scanning.
+    void find_newlines(const char* data, size_t size, std::vector<size_t>& newlines) {
+        size_t position = 0;
+#if defined(__SSE2__)
+        const __m128i newline = _mm_set1_epi8('\n');
+        auto block_mask = [&newline](const char* block) {
+            __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(block));
+            return static_cast<uint64_t>(static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, newline))));
+        };
+        for (; position + 64 <= size; position += 64) {
+            const char* block = data + position;
+            uint64_t mask = block_mask(block)
+                | (block_mask(block + 16) << 16)
+                | (block_mask(block + 32) << 32)
+                | (block_mask(block + 48) << 48);
+            while (mask != 0) {
+                newlines.push_back(position + __builtin_ctzll(mask));
+                mask &= mask - 1;
+            }
+        }
+#endif
+        while (position < size) {
+            const void* found = std::memchr(data + position, '\n', size - position);
+            if (found == nullptr) {
+                break;
+            }
+            size_t offset = static_cast<size_t>(static_cast<const char*>(found) - data);
+            newlines.push_back(offset);
+            position = offset + 1;
+        }
+    }
+
+    inline size_t line_begin(const std::vector<size_t>& newlines, size_t line) {
+        return (line == 0) ? 0 : newlines[line - 1] + 1;
+    }
+
+    inline size_t line_end(const std::vector<size_t>& newlines, size_t size, size_t line) {
+        return (line < newlines.size()) ? newlines[line] : size;
+    }
+
+    // decimal digits at position, which is moved past them
+    bool read_count(std::string_view document, size_t& position, size_t limit, size_t& value) {
+        size_t start = position;
+        value = 0;
+        while (position < limit && document[position] >= '0' && document[position] <= '9') {
+            if (position - start == MAX_DIGITS) {
+                return false;
+            }
+            value = value * 10 + static_cast<size_t>(document[position] - '0');
+            ++position;
+        }
+        return position > start;
+    }
+
+    // "<player> <name> data|begin", then a space or the end of the line
+    bool read_section_line(std::string_view document, size_t begin, size_t end, size_t& name_begin, size_t& name_end, size_t& body) {
+        size_t position = begin;
+        size_t player = 0;
+        if (!read_count(document, position, end, player) || position >= end || document[position] != ' ') {
+            return false;
+        }
+        name_begin = ++position;
+        while (position < end && document[position] != ' ') {
+            ++position;
+        }
+        name_end = position;
+        if (name_end == name_begin || position >= end) {
+            return false;
+        }
+        std::string_view rest = document.substr(position + 1, end - position - 1);
+        for (std::string_view kind : {SECTION_DATA, SECTION_BEGIN}) {
+            if (rest.substr(0, kind.size()) == kind && (rest.size() == kind.size() || rest[kind.size()] == ' ')) {
+                body = position + 1 + kind.size();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // "<key length> <key><value count> " from begin; position is left on
+    // the first value
+    bool read_variable_header(std::string_view document, size_t begin, size_t limit, size_t& key_begin, size_t& key_end, size_t& count, size_t& position) {
+        position = begin;
+        size_t key_length = 0;
+        if (!read_count(document, position, limit, key_length) || position >= limit || document[position] != ' ') {
+            return false;
+        }
+        key_begin = ++position;
+        if (limit - position < key_length) {
+            return false;
+        }
+        position += key_length;
+        key_end = position;
+        if (!read_count(document, position, limit, count) || position >= limit || document[position] != ' ') {
+            return false;
+        }
+        ++position;
+        return true;
+    }
+
+    // One value from position: a string's "<length> <bytes>", or a number
+    // up to the space that ends it
+    bool read_value(std::string_view document, bool strings, size_t& position, size_t limit, size_t& value_begin, size_t& value_end) {
+        if (strings) {
+            size_t length = 0;
+            if (!read_count(document, position, limit, length) || position >= limit || document[position] != ' ') {
+                return false;
+            }
+            value_begin = ++position;
+            if (limit - position < length) {
+                return false;
+            }
+            position += length;
+            value_end = position;
+            return true;
+        }
+        value_begin = position;
+        while (position < limit && document[position] != ' ') {
+            ++position;
+        }
+        value_end = position;
+        if (value_end == value_begin || position >= limit) {
+            return false;
+        }
+        ++position;
+        return true;
+    }
+
+    // A section that holds one "<length> <bytes>" string, as the stardate
+    // and python sections do; the string may span lines
+    bool read_string_body(std::string_view document, size_t body, size_t limit, size_t& prefix_begin, size_t& value_begin, size_t& value_end) {
+        prefix_begin = body;
+        if (prefix_begin < limit && document[prefix_begin] == ' ') {
+            ++prefix_begin;
+        }
+        size_t position = prefix_begin;
+        if (!read_value(document, true, position, limit, value_begin, value_end)) {
+            return false;
+        }
+        while (position < limit && document[position] == ' ') {
+            ++position;
+        }
+        return position == limit || document[position] == '\n';
+    }
+
+    // RFC 8259 number
+    bool json_number(std::string_view text) {
+        size_t i = 0;
+        auto digits = [&text, &i]() {
+            size_t start = i;
+            while (i < text.size() && text[i] >= '0' && text[i] <= '9') {
+                ++i;
+            }
+            return i > start;
+        };
+        if (i < text.size() && text[i] == '-') {
+            ++i;
+        }
+        if (i < text.size() && text[i] == '0') {
+            ++i;
+        } else if (!digits()) {
+            return false;
+        }
+        if (i < text.size() && text[i] == '.') {
+            ++i;
+            if (!digits()) {
+                return false;
+            }
+        }
+        if (i < text.size() && (text[i] == 'e' || text[i] == 'E')) {
+            ++i;
+            if (i < text.size() && (text[i] == '+' || text[i] == '-')) {
+                ++i;
+            }
+            if (!digits()) {
+                return false;
+            }
+        }
+        return i == text.size();
+    }
+
+    // numbers are handed back as spelled; anything JSON wouldn't take
+    // (nan, inf) becomes a string
+    std::string number_json(std::string_view token) {
+        return json_number(token) ? std::string(token) : json_pointer::Quote(token);
+    }
+
+    // canonical array index: digits without leading zeros
+    bool parse_index(const std::string& token, size_t& index) {
+        if (token.empty() || token.size() > MAX_DIGITS || (token.size() > 1 && token[0] == '0')) {
+            return false;
+        }
+        size_t position = 0;
+        return read_count(token, position, token.size(), index) && position == token.size();
+    }
+
+    std::string_view trim(std::string_view text) {
+        size_t first = text.find_first_not_of(" \t\r\n");
+        if (first == std::string_view::npos) {
+            return std::string_view();
+        }
+        size_t last = text.find_last_not_of(" \t\r\n");
+        return text.substr(first, last - first + 1);
+    }
+
+    // A JSON value as the text the engine stores: a string's characters,
+    // or a number as it is spelled. Numbers are also taken quoted, since
+    // --write_value quotes everything.
+    bool plain_value(std::string_view value_json, bool number, std::string& text) {
+        std::string_view literal = trim(value_json);
+        if (!literal.empty() && literal[0] == '"') {
+            return json_pointer::Unquote(literal, text) && (!number || json_number(text));
+        }
+        text.assign(literal);
+        return json_number(text);
+    }
+
+    // a JSON array of values, or a single one
+    bool plain_values(std::string_view value_json, bool number, std::vector<std::string>& texts) {
+        texts.clear();
+        std::string_view literal = trim(value_json);
+        if (literal.empty() || literal[0] != '[') {
+            texts.emplace_back();
+            return plain_value(literal, number, texts.back());
+        }
+        json_pointer::match_list elements;
+        if (literal.back() != ']' || !json_pointer::FindAll(literal, "/*", elements)) {
+            return false;
+        }
+        // FindAll has no matches for a malformed array either
+        if (elements.empty() && !trim(literal.substr(1, literal.size() - 2)).empty()) {
+            return false;
+        }
+        texts.resize(elements.size());
+        for (size_t i = 0; i < elements.size(); ++i) {
+            if (!plain_value(elements[i].second, number, texts[i])) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    std::string encode_value(const std::string& text, bool strings) {
+        return strings ? std::to_string(text.size()) + " " + text : text + " ";
+    }
+
+    std::string encode_variable(const std::string& key, const std::vector<std::string>& texts, bool strings) {
+        std::string line = std::to_string(key.size()) + " " + key + std::to_string(texts.size()) + " ";
+        for (const auto& text : texts) {
+            line.append(encode_value(text, strings));
+        }
+        return line;
+    }
+
+}
+
+bool EngineTextIndex::Recognize(std::string_view document) {
+    std::string_view head = document.substr(0, HEADER_LIMIT);
+    size_t header_end = head.find('\n');
+    if (header_end == std::string_view::npos) {
+        return false;
+    }
+    EngineTextIndex probe;
+    if (!probe.index_header(document, header_end)) {
+        return false;
+    }
+    size_t next_end = document.find('\n', header_end + 1);
+    if (next_end == std::string_view::npos) {
+        next_end = document.size();
+    }
+    size_t name_begin = 0;
+    size_t name_end = 0;
+    size_t body = 0;
+    return read_section_line(document, header_end + 1, next_end, name_begin, name_end, body);
+}
+
+bool EngineTextIndex::index_header(std::string_view document, size_t header_end) {
+    std::string_view line = document.substr(0, header_end);
+    size_t first = line.find('^');
+    size_t second = (first == std::string_view::npos) ? first : line.find('^', first + 1);
+    if (second == std::string_view::npos) {
+        return false;
+    }
+    system = {0, first};
+    credits = {first + 1, second};
+    // the ship name runs up to the three coordinates
+    size_t end = header_end;
+    for (size_t i = POSITION_FIELDS; i-- > 0;) {
+        size_t space = line.rfind(' ', end - 1);
+        if (space == std::string_view::npos || space <= second || space + 1 == end) {
+            return false;
+        }
+        position[i] = {space + 1, end};
+        end = space;
+    }
+    ship = {second + 1, end};
+    return end > second + 1;
+}
+
+bool EngineTextIndex::Build(std::string_view document) {
+    SGF_STATS_TIMER(TIMER_PARSE);
+    sections.clear();
+    std::vector<size_t> newlines;
+    newlines.reserve(document.size() / 64 + 1);
+    find_newlines(document.data(), document.size(), newlines);
+
+    if (!index_header(document, line_end(newlines, document.size(), 0))) {
+        std::cerr << "Not an engine save: no header line" << std::endl;
+        return false;
+    }
+    // lines inside a string section's text can't start a section
+    size_t text_end = 0;
+    size_t line = 1;
+    while (line <= newlines.size()) {
+        size_t begin = line_begin(newlines, line);
+        size_t end = line_end(newlines, document.size(), line);
+        size_t name_begin = 0;
+        size_t name_end = 0;
+        size_t body = 0;
+        if (begin < text_end || !read_section_line(document, begin, end, name_begin, name_end, body)) {
+            if (sections.empty()) {
+                std::cerr << "Not an engine save: no section after the header" << std::endl;
+                return false;
+            }
+            ++line;
+            continue;
+        }
+        if (!sections.empty()) {
+            sections.back().next = begin;
+        }
+
+        section found;
+        found.name.assign(document.substr(name_begin, name_end - name_begin));
+        found.body = body;
+        found.next = document.size();
+        if (found.name == STRINGS_SECTION) {
+            found.kind = SECTION_STRINGS;
+        } else if (found.name == NUMBERS_SECTION) {
+            found.kind = SECTION_NUMBERS;
+        }
+        if (found.kind == SECTION_TEXT) {
+            size_t prefix_begin = 0;
+            size_t value_begin = 0;
+            if (read_string_body(document, body, document.size(), prefix_begin, value_begin, text_end)) {
+                ++text_end;
+            }
+            ++line;
+        } else if (!index_variables(document, newlines, line, found)) {
+            std::cerr << "Malformed " << found.name << " section" << std::endl;
+            return false;
+        }
+        sections.push_back(std::move(found));
+    }
+    if (sections.empty()) {
+        std::cerr << "Not an engine save: no section after the header" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Variables normally sit one to a line, so the line breaks found up front
+// are all it takes: each line's key is read, and the declared count and
+// the section line that follows confirm no value held a line break. If
+// they don't, every value is stepped over by its length instead.
+bool EngineTextIndex::index_variables(std::string_view document, const std::vector<size_t>& newlines, size_t& line, section& found) {
+    size_t end = line_end(newlines, document.size(), line);
+    size_t position = found.body;
+    while (position < end && document[position] == ' ') {
+        ++position;
+    }
+    found.count.begin = position;
+    size_t declared = 0;
+    if (!read_count(document, position, end, declared)) {
+        return false;
+    }
+    found.count.end = position;
+    while (position < end && document[position] == ' ') {
+        ++position;
+    }
+    if (position != end) {
+        return false;
+    }
+    found.variables_begin = end;
+    found.variables_end = end;
+
+    auto key_of = [document](const variable& item) {
+        return document.substr(item.key.begin, item.key.end - item.key.begin);
+    };
+    // checked while each key is at hand
+    bool sorted = true;
+    bool lines_match = line + declared <= newlines.size();
+    if (lines_match) {
+        found.variables.reserve(declared);
+    }
+    for (size_t i = 1; lines_match && i <= declared; ++i) {
+        variable item;
+        item.begin = line_begin(newlines, line + i);
+        item.end = line_end(newlines, document.size(), line + i);
+        size_t count = 0;
+        size_t first_value = 0;
+        lines_match = read_variable_header(document, item.begin, item.end, item.key.begin, item.key.end, count, first_value);
+        sorted = sorted && (found.variables.empty() || key_of(found.variables.back()) < key_of(item));
+        found.variables.push_back(item);
+    }
+    if (lines_match) {
+        size_t after = line + declared + 1;
+        size_t name_begin = 0;
+        size_t name_end = 0;
+        size_t body = 0;
+        lines_match = after > newlines.size()
+            || line_begin(newlines, after) == document.size()
+            || read_section_line(document, line_begin(newlines, after), line_end(newlines, document.size(), after), name_begin, name_end, body);
+    }
+    if (lines_match) {
+        if (declared > 0) {
+            found.variables_end = found.variables.back().end;
+        }
+        line += declared + 1;
+    } else {
+        found.variables.clear();
+        if (!walk_variables(document, declared, found)) {
+            return false;
+        }
+        line = static_cast<size_t>(std::lower_bound(newlines.begin(), newlines.end(), found.variables_end) - newlines.begin()) + 1;
+        sorted = false;
+    }
+
+    // the engine writes them in key order; anything else is sorted here
+    auto key_less = [&key_of](const variable& left, const variable& right) {
+        return key_of(left) < key_of(right);
+    };
+    if (!sorted && !std::is_sorted(found.variables.begin(), found.variables.end(), key_less)) {
+        std::stable_sort(found.variables.begin(), found.variables.end(), key_less);
+    }
+    return true;
+}
+
+bool EngineTextIndex::walk_variables(std::string_view document, size_t declared, section& found) const {
+    bool strings = found.kind == SECTION_STRINGS;
+    size_t position = found.variables_begin;
+    found.variables.reserve(declared);
+    for (size_t i = 0; i < declared; ++i) {
+        if (position >= document.size() || document[position] != '\n') {
+            return false;
+        }
+        variable item;
+        item.begin = ++position;
+        size_t count = 0;
+        if (!read_variable_header(document, item.begin, document.size(), item.key.begin, item.key.end, count, position)) {
+            return false;
+        }
+        for (size_t j = 0; j < count; ++j) {
+            size_t value_begin = 0;
+            size_t value_end = 0;
+            if (!read_value(document, strings, position, document.size(), value_begin, value_end)) {
+                return false;
+            }
+        }
+        item.end = position;
+        found.variables.push_back(item);
+    }
+    if (position < document.size() && document[position] != '\n') {
+        return false;
+    }
+    found.variables_end = position;
+    return true;
+}
+
+bool EngineTextIndex::parse_elements(std::string_view document, const section& owner, const variable& item, text_span& count, std::vector<element>& elements) const {
+    bool strings = owner.kind == SECTION_STRINGS;
+    size_t key_begin = 0;
+    size_t key_end = 0;
+    size_t declared = 0;
+    size_t position = item.begin;
+    elements.clear();
+    bool parsed = read_variable_header(document, item.begin, item.end, key_begin, key_end, declared, position);
+    if (parsed) {
+        count.end = position - 1;
+        count.begin = count.end;
+        while (count.begin > key_end && document[count.begin - 1] >= '0' && document[count.begin - 1] <= '9') {
+            --count.begin;
+        }
+        elements.reserve(declared);
+    }
+    for (size_t i = 0; parsed && i < declared; ++i) {
+        element value;
+        value.begin = position;
+        parsed = read_value(document, strings, position, item.end, value.value.begin, value.value.end);
+        value.end = position;
+        elements.push_back(value);
+    }
+    if (!parsed || position != item.end) {
+        std::cerr << "Malformed variable " << document.substr(item.key.begin, item.key.end - item.key.begin)
+            << " in section " << owner.name << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool EngineTextIndex::render_section(std::string_view document, const section& owner, std::string& json) const {
+    if (owner.kind == SECTION_TEXT) {
+        size_t prefix_begin = 0;
+        size_t value_begin = 0;
+        size_t value_end = 0;
+        if (read_string_body(document, owner.body, owner.next, prefix_begin, value_begin, value_end)) {
+            json = json_pointer::Quote(document.substr(value_begin, value_end - value_begin));
+            return true;
+        }
+        std::string_view text = document.substr(owner.body, owner.next - owner.body);
+        if (!text.empty() && text.front() == ' ') {
+            text.remove_prefix(1);
+        }
+        if (!text.empty() && text.back() == '\n') {
+            text.remove_suffix(1);
+        }
+        json = json_pointer::Quote(text);
+        return true;
+    }
+
+    json = "{";
+    text_span count;
+    std::vector<element> elements;
+    for (const auto& item : owner.variables) {
+        if (!parse_elements(document, owner, item, count, elements)) {
+            return false;
+        }
+        if (json.size() > 1) {
+            json.push_back(',');
+        }
+        json.append(json_pointer::Quote(document.substr(item.key.begin, item.key.end - item.key.begin)));
+        json.push_back(':');
+        json.append(render_variable(document, owner, elements));
+    }
+    json.push_back('}');
+    return true;
+}
+
+std::string EngineTextIndex::render_variable(std::string_view document, const section& owner, const std::vector<element>& elements) const {
+    std::string json = "[";
+    for (const auto& value : elements) {
+        if (json.size() > 1) {
+            json.push_back(',');
+        }
+        json.append(render_value(document, owner, value));
+    }
+    json.push_back(']');
+    return json;
+}
+
+std::string EngineTextIndex::render_value(std::string_view document, const section& owner, const element& value) const {
+    std::string_view text = document.substr(value.value.begin, value.value.end - value.value.begin);
+    return (owner.kind == SECTION_STRINGS) ? json_pointer::Quote(text) : number_json(text);
+}
+
+const EngineTextIndex::section* EngineTextIndex::find_section(std::string_view name) const {
+    for (const auto& owner : sections) {
+        if (owner.name == name) {
+            return &owner;
+        }
+    }
+    return nullptr;
+}
+
+EngineTextIndex::section* EngineTextIndex::find_section(std::string_view name) {
+    return const_cast<section*>(static_cast<const EngineTextIndex*>(this)->find_section(name));
+}
+
+bool EngineTextIndex::find_variable(std::string_view document, const section& owner, std::string_view key, size_t& index) const {
+    auto found = std::lower_bound(
+        owner.variables.begin(), owner.variables.end(), key,
+        [document](const variable& item, std::string_view wanted) {
+            return document.substr(item.key.begin, item.key.end - item.key.begin) < wanted;
+        }
+    );
+    index = static_cast<size_t>(found - owner.variables.begin());
+    return found != owner.variables.end() && document.substr(found->key.begin, found->key.end - found->key.begin) == key;
+}
+
+bool EngineTextIndex::collect(std::string_view document, const std::vector<std::string>& tokens, bool wildcards, match_list& matches) const {
+    if (tokens.empty()) {
+        return true;
+    }
+    auto any = [wildcards](const std::string& token) {
+        return wildcards && token == WILDCARD;
+    };
+    auto matches_token = [&any](const std::string& token, std::string_view name) {
+        return any(token) || token == name;
+    };
+    auto text_of = [document](const text_span& span) {
+        return document.substr(span.begin, span.end - span.begin);
+    };
+
+    if (tokens.size() == 1) {
+        if (matches_token(tokens[0], FIELD_SYSTEM)) {
+            matches.emplace_back("/" + FIELD_SYSTEM, json_pointer::Quote(text_of(system)));
+        }
+        if (matches_token(tokens[0], FIELD_CREDITS)) {
+            matches.emplace_back("/" + FIELD_CREDITS, number_json(text_of(credits)));
+        }
+        if (matches_token(tokens[0], FIELD_SHIP)) {
+            matches.emplace_back("/" + FIELD_SHIP, json_pointer::Quote(text_of(ship)));
+        }
+    }
+    if (matches_token(tokens[0], FIELD_POSITION) && tokens.size() <= 2) {
+        std::string coordinates = "[";
+        for (size_t i = 0; i < POSITION_FIELDS; ++i) {
+            std::string coordinate = number_json(text_of(position[i]));
+            size_t index = 0;
+            if (tokens.size() == 2 && (any(tokens[1]) || (parse_index(tokens[1], index) && index == i))) {
+                matches.emplace_back("/" + FIELD_POSITION + "/" + std::to_string(i), coordinate);
+            }
+            coordinates.append(i ? "," : "").append(coordinate);
+        }
+        if (tokens.size() == 1) {
+            matches.emplace_back("/" + FIELD_POSITION, coordinates + "]");
+        }
+    }
+
+    text_span count;
+    std::vector<element> elements;
+    for (const auto& owner : sections) {
+        if (!matches_token(tokens[0], owner.name)) {
+            continue;
+        }
+        std::string pointer = "/" + json_pointer::Escape(owner.name);
+        if (tokens.size() == 1) {
+            std::string json;
+            if (!render_section(document, owner, json)) {
+                return false;
+            }
+            matches.emplace_back(pointer, std::move(json));
+            continue;
+        }
+        if (owner.kind == SECTION_TEXT || tokens.size() > 3) {
+            continue;
+        }
+
+        size_t first = 0;
+        size_t last = owner.variables.size();
+        if (!any(tokens[1])) {
+            if (!find_variable(document, owner, tokens[1], first)) {
+                continue;
+            }
+            last = first + 1;
+        }
+        for (size_t i = first; i < last; ++i) {
+            const variable& item = owner.variables[i];
+            if (!parse_elements(document, owner, item, count, elements)) {
+                return false;
+            }
+            std::string variable_pointer = pointer + "/" + json_pointer::Escape(text_of(item.key));
+            if (tokens.size() == 2) {
+                matches.emplace_back(variable_pointer, render_variable(document, owner, elements));
+                continue;
+            }
+            for (size_t j = 0; j < elements.size(); ++j) {
+                size_t index = 0;
+                if (any(tokens[2]) || (parse_index(tokens[2], index) && index == j)) {
+                    matches.emplace_back(variable_pointer + "/" + std::to_string(j), render_value(document, owner, elements[j]));
+                }
+            }
+        }
+    }
+    return true;
+}
+
+bool EngineTextIndex::Find(std::string_view document, std::string_view pointer, std::string& value_json) const {
+    SGF_STATS_TIMER(TIMER_PARSE);
+    std::vector<std::string> tokens;
+    if (!json_pointer::Parse(pointer, tokens)) {
+        std::cerr << "Invalid JSON pointer " << pointer << std::endl;
+        return false;
+    }
+    match_list matches;
+    if (!collect(document, tokens, false, matches)) {
+        return false;
+    }
+    if (matches.empty()) {
+        std::cerr << "Unable to locate " << pointer << std::endl;
+        return false;
+    }
+    value_json.swap(matches.front().second);
+    return true;
+}
+
+bool EngineTextIndex::FindAll(std::string_view document, std::string_view pattern, match_list& matches) const {
+    SGF_STATS_TIMER(TIMER_PARSE);
+    matches.clear();
+    std::vector<std::string> tokens;
+    if (!json_pointer::Parse(pattern, tokens)) {
+        std::cerr << "Invalid JSON pointer " << pattern << std::endl;
+        return false;
+    }
+    return collect(document, tokens, true, matches);
+}
+
+bool EngineTextIndex::Set(std::string& document, std::string_view pointer, std::string_view value_json, bool create) {
+    SGF_STATS_TIMER(TIMER_SERIALIZE);
+    std::vector<std::string> tokens;
+    if (!json_pointer::Parse(pointer, tokens)) {
+        std::cerr << "Invalid JSON pointer " << pointer << std::endl;
+        return false;
+    }
+    if (tokens.empty()) {
+        std::cerr << "Unable to replace the whole save text" << std::endl;
+        return false;
+    }
+    auto invalid = [&pointer, &value_json]() {
+        std::cerr << "Invalid value " << value_json << " for " << pointer << std::endl;
+        return false;
+    };
+    auto missing = [&pointer]() {
+        std::cerr << "Unable to locate " << pointer << std::endl;
+        return false;
+    };
+
+    // header fields end at '^' or ' ', so they can't hold those
+    std::string text;
+    if (tokens.size() == 1 && (tokens[0] == FIELD_SYSTEM || tokens[0] == FIELD_SHIP || tokens[0] == FIELD_CREDITS)) {
+        bool number = tokens[0] == FIELD_CREDITS;
+        const char* reserved = (tokens[0] == FIELD_SYSTEM) ? "^\n" : "^ \n";
+        if (!plain_value(value_json, number, text) || text.empty() || text.find_first_of(reserved) != std::string::npos) {
+            return invalid();
+        }
+        text_span& field = (tokens[0] == FIELD_SYSTEM) ? system : (number ? credits : ship);
+        splice(document, field.begin, field.end, text);
+        return true;
+    }
+    if (tokens[0] == FIELD_POSITION) {
+        size_t index = 0;
+        if (tokens.size() == 2 && parse_index(tokens[1], index) && index < POSITION_FIELDS) {
+            if (!plain_value(value_json, true, text)) {
+                return invalid();
+            }
+            splice(document, position[index].begin, position[index].end, text);
+            return true;
+        }
+        std::vector<std::string> coordinates;
+        if (tokens.size() != 1) {
+            return missing();
+        }
+        if (!plain_values(value_json, true, coordinates) || coordinates.size() != POSITION_FIELDS) {
+            return invalid();
+        }
+        for (size_t i = 0; i < POSITION_FIELDS; ++i) {
+            splice(document, position[i].begin, position[i].end, coordinates[i]);
+        }
+        return true;
+    }
+
+    section* owner = find_section(tokens[0]);
+    if (owner == nullptr) {
+        return missing();
+    }
+    if (owner->kind == SECTION_TEXT) {
+        size_t prefix_begin = 0;
+        size_t value_begin = 0;
+        size_t value_end = 0;
+        if (tokens.size() != 1) {
+            return missing();
+        }
+        if (!read_string_body(document, owner->body, owner->next, prefix_begin, value_begin, value_end)) {
+            std::cerr << "Section " << owner->name << " isn't a single string and can only be read" << std::endl;
+            return false;
+        }
+        if (!plain_value(value_json, false, text)) {
+            return invalid();
+        }
+        splice(document, prefix_begin, value_end, encode_value(text, true));
+        return true;
+    }
+    if (tokens.size() == 1) {
+        std::cerr << "Set the variables of " << owner->name << " one at a time" << std::endl;
+        return false;
+    }
+    if (tokens.size() > 3) {
+        return missing();
+    }
+
+    bool strings = owner->kind == SECTION_STRINGS;
+    size_t index = 0;
+    bool exists = find_variable(document, *owner, tokens[1], index);
+    if (tokens.size() == 2) {
+        std::vector<std::string> texts;
+        if (!plain_values(value_json, !strings, texts)) {
+            return invalid();
+        }
+        std::string line = encode_variable(tokens[1], texts, strings);
+        if (exists) {
+            variable& item = owner->variables[index];
+            splice(document, item.begin, item.end, line);
+            return true;
+        }
+        if (!create) {
+            return missing();
+        }
+
+        // in front of the variable that follows it in key order, or after
+        // the last one
+        variable added;
+        if (index < owner->variables.size()) {
+            added.begin = owner->variables[index].begin;
+            splice(document, added.begin, added.begin, line + "\n");
+        } else {
+            added.begin = owner->variables_end + 1;
+            splice(document, owner->variables_end, owner->variables_end, "\n" + line, added.begin);
+            owner->variables_end = added.begin + line.size();
+            if (owner->next < added.begin) {
+                // the last section, running to the end of the text
+                owner->next = document.size();
+            }
+        }
+        added.end = added.begin + line.size();
+        added.key.begin = added.begin + std::to_string(tokens[1].size()).size() + 1;
+        added.key.end = added.key.begin + tokens[1].size();
+        owner->variables.insert(owner->variables.begin() + index, added);
+        splice(document, owner->count.begin, owner->count.end, std::to_string(owner->variables.size()));
+        return true;
+    }
+
+    if (!exists) {
+        return missing();
+    }
+    text_span count;
+    std::vector<element> elements;
+    if (!parse_elements(document, *owner, owner->variables[index], count, elements)) {
+        return false;
+    }
+    if (!plain_value(value_json, !strings, text)) {
+        return invalid();
+    }
+    size_t element_index = 0;
+    bool numbered = parse_index(tokens[2], element_index);
+    if (numbered && element_index < elements.size()) {
+        splice(document, elements[element_index].begin, elements[element_index].end, encode_value(text, strings));
+        return true;
+    }
+    if (!create || !(tokens[2] == APPEND || (numbered && element_index == elements.size()))) {
+        return missing();
+    }
+    size_t end = owner->variables[index].end;
+    splice(document, end, end, encode_value(text, strings));
+    splice(document, count.begin, count.end, std::to_string(elements.size() + 1));
+    return true;
+}
+
+bool EngineTextIndex::Remove(std::string& document, std::string_view pointer) {
+    SGF_STATS_TIMER(TIMER_SERIALIZE);
+    std::vector<std::string> tokens;
+    if (!json_pointer::Parse(pointer, tokens)) {
+        std::cerr << "Invalid JSON pointer " << pointer << std::endl;
+        return false;
+    }
+    section* owner = tokens.empty() ? nullptr : find_section(tokens[0]);
+    size_t index = 0;
+    if (owner == nullptr || owner->kind == SECTION_TEXT || tokens.size() < 2 || tokens.size() > 3
+        || !find_variable(document, *owner, tokens[1], index)) {
+        std::cerr << "Unable to remove " << pointer << std::endl;
+        return false;
+    }
+
+    if (tokens.size() == 2) {
+        // with the line break in front of it
+        variable removed = owner->variables[index];
+        owner->variables.erase(owner->variables.begin() + index);
+        splice(document, removed.begin - 1, removed.end, "");
+        splice(document, owner->count.begin, owner->count.end, std::to_string(owner->variables.size()));
+        return true;
+    }
+
+    text_span count;
+    std::vector<element> elements;
+    size_t element_index = 0;
+    if (!parse_elements(document, *owner, owner->variables[index], count, elements)) {
+        return false;
+    }
+    if (!parse_index(tokens[2], element_index) || element_index >= elements.size()) {
+        std::cerr << "Unable to remove " << pointer << std::endl;
+        return false;
+    }
+    splice(document, elements[element_index].begin, elements[element_index].end, "");
+    splice(document, count.begin, count.end, std::to_string(elements.size() - 1));
+    return true;
+}
+
+size_t EngineTextIndex::Variables() const {
+    size_t total = 0;
+    for (const auto& owner : sections) {
+        total += owner.variables.size();
+    }
+    return total;
+}
+
+void EngineTextIndex::splice(std::string& document, size_t begin, size_t end, std::string_view text) {
+    splice(document, begin, end, text, end);
+}
+
+void EngineTextIndex::splice(std::string& document, size_t begin, size_t end, std::string_view text, size_t shift_from) {
+    document.replace(begin, end - begin, text.data(), text.size());
+    if (text.size() == end - begin) {
+        return;
+    }
+    // unsigned wrap-around makes the same addition move offsets back
+    size_t delta = text.size() - (end - begin);
+    auto shift = [shift_from, delta](size_t& offset) {
+        if (offset >= shift_from) {
+            offset += delta;
+        }
+    };
+    auto shift_span = [&shift](text_span& span) {
+        shift(span.begin);
+        shift(span.end);
+    };
+    shift_span(system);
+    shift_span(credits);
+    shift_span(ship);
+    for (auto& coordinate : position) {
+        shift_span(coordinate);
+    }
+    for (auto& owner : sections) {
+        shift(owner.body);
+        shift(owner.next);
+        shift_span(owner.count);
+        shift(owner.variables_begin);
+        shift(owner.variables_end);
+        for (auto& item : owner.variables) {
+            shift(item.begin);
+            shift(item.end);
+            shift_span(item.key);
+        }
+    }
+}
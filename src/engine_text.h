@@ -0,0 +1,144 @@
+#ifndef SAVED_GAME_FORMAT_ENGINE_TEXT_H__
+#define SAVED_GAME_FORMAT_ENGINE_TEXT_H__
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace saved_game_format_file {
+
+    // The engine's own line-based save text (the `data` member):
+    //
+    //     Crucible/Cephid_17^5957.128418^Llama.begin 1199.5 -89.3 -1099.2
+    //     0 stardate data 10 0.0000:003
+    //     0 mission data  0
+    //     0 missionstring data 91557
+    //     4 FF:1141 12 Base_Sol/Sol25 Base_Sol/Proxima_Centauri...
+    //     ...
+    //     0 factions begin 1 0 0 ...
+    //
+    // The first line holds the star system, credits, ship and position.
+    // Each section starts with "<player> <name> data|begin". The mission
+    // (numbers) and missionstring sections declare a variable count, then
+    // hold one variable per line as "<key length> <key><value count> ",
+    // followed by the values: space-terminated numbers, or for strings
+    // "<length> <bytes>" with nothing in between. Other sections are
+    // kept as text.
+    //
+    // Keys are JSON pointers, the same as for JSON members:
+    //     /credits, /system, /ship, /position/0
+    //     /stardate                      a section's text
+    //     /missionstring/<key>           every value of a variable
+    //     /missionstring/<key>/3         one of them
+    // '/' in variable names is written ~1 (SS:Zzyqqh~1Ztlbzz[34]).
+    // Values come back as JSON. Strings are quoted, and numbers are
+    // returned as they are spelled in the text.
+    //
+    // Build finds the line breaks with a vectorised scan and reads only
+    // each variable's key. Values are decoded only when a lookup reaches
+    // them. Edits are spliced into the document in place. The index keeps
+    // up with every edit, so a batch of edits to one member is indexed once.
+    class EngineTextIndex {
+        public:
+            // concrete pointer -> value as JSON
+            typedef std::vector<std::pair<std::string, std::string>> match_list;
+
+            EngineTextIndex() {}
+
+            // The document starts with the engine's header line and a section
+            static bool Recognize(std::string_view document);
+
+            bool Build(std::string_view document);
+
+            // JSON of the value the pointer refers to
+            bool Find(std::string_view document, std::string_view pointer, std::string& value_json) const;
+            // Every value a pattern refers to, "*" tokens included, the way
+            // json_pointer::FindAll does for JSON
+            bool FindAll(std::string_view document, std::string_view pattern, match_list& matches) const;
+
+            // Replace a header field, a string section, a variable (JSON
+            // array, or a single value) or one of its values. With create
+            // set, a missing variable is added in key order and a value
+            // index of "-" or the value count appends.
+            bool Set(std::string& document, std::string_view pointer, std::string_view value_json, bool create);
+            // Drop a variable or one of its values
+            bool Remove(std::string& document, std::string_view pointer);
+
+            inline size_t Sections() const { return sections.size(); }
+            size_t Variables() const;
+
+        private:
+            enum section_kind {
+                SECTION_TEXT=0,
+                SECTION_NUMBERS,
+                SECTION_STRINGS,
+            };
+
+            struct text_span {
+                size_t begin{0};
+                size_t end{0};
+            };
+
+            struct variable {
+                // line without its '\n'
+                size_t begin{0};
+                size_t end{0};
+                text_span key{};
+            };
+
+            // one value of a variable; a string value's bytes follow its
+            // length prefix, which starts the element
+            struct element {
+                size_t begin{0};
+                text_span value{};
+                size_t end{0};
+            };
+
+            struct section {
+                std::string name{};
+                section_kind kind{SECTION_TEXT};
+                // right after "data" or "begin"
+                size_t body{0};
+                // start of the next section's line, or the document's end
+                size_t next{0};
+                // variable sections: the declared count, and where the
+                // variable lines start and stop (in document order)
+                text_span count{};
+                size_t variables_begin{0};
+                size_t variables_end{0};
+                // sorted by key
+                std::vector<variable> variables{};
+            };
+
+            bool index_header(std::string_view document, size_t header_end);
+            bool index_variables(std::string_view document, const std::vector<size_t>& newlines, size_t& line, section& found);
+            bool walk_variables(std::string_view document, size_t declared, section& found) const;
+            bool parse_elements(std::string_view document, const section& owner, const variable& item, text_span& count, std::vector<element>& elements) const;
+
+            bool collect(std::string_view document, const std::vector<std::string>& tokens, bool wildcards, match_list& matches) const;
+            bool render_section(std::string_view document, const section& owner, std::string& json) const;
+            std::string render_variable(std::string_view document, const section& owner, const std::vector<element>& elements) const;
+            std::string render_value(std::string_view document, const section& owner, const element& value) const;
+
+            const section* find_section(std::string_view name) const;
+            section* find_section(std::string_view name);
+            // variables[index] has the key, or would if it were added there
+            bool find_variable(std::string_view document, const section& owner, std::string_view key, size_t& index) const;
+
+            // replace [begin, end) and move every offset from shift_from on
+            void splice(std::string& document, size_t begin, size_t end, std::string_view text, size_t shift_from);
+            void splice(std::string& document, size_t begin, size_t end, std::string_view text);
+
+            // header: system^credits^ship x y z
+            text_span system{};
+            text_span credits{};
+            text_span ship{};
+            text_span position[3]{};
+            std::vector<section> sections{};
+    };
+
+}
+
+#endif //SAVED_GAME_FORMAT_ENGINE_TEXT_H__
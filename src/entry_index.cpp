@@ -0,0 +1,33 @@
+#include "entry_index.h"
+
+using namespace saved_game_format_file;
+
+void EntryIndex::Clear() {
+    kind = ARCHIVE_KIND_UNKNOWN;
+    format_code = 0;
+    filter_code = 0;
+    directory_offset = -1;
+    directory_size = 0;
+    base_offset = 0;
+    zip64 = false;
+    comment.clear();
+    entries.clear();
+    lookup.clear();
+}
+
+void EntryIndex::Add(const ArchiveEntry& entry) {
+    ArchiveEntry value(entry);
+    value.sequence = entries.size();
+    // later entries with the same name shadow earlier ones, same as
+    // extracting the archive would
+    lookup[value.name] = value.sequence;
+    entries.push_back(value);
+}
+
+const ArchiveEntry* EntryIndex::Find(const std::string& name) const {
+    auto location = lookup.find(name);
+    if (location == lookup.end()) {
+        return nullptr;
+    }
+    return &entries[location->second];
+}
@@ -0,0 +1,78 @@
+#ifndef SAVED_GAME_FORMAT_ENTRY_INDEX_H__
+#define SAVED_GAME_FORMAT_ENTRY_INDEX_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace saved_game_format_file {
+
+    enum ArchiveKind {
+        ARCHIVE_KIND_UNKNOWN=0,
+        // ZIP container; members can be located via the central directory
+        ARCHIVE_KIND_ZIP,
+        // anything else libarchive can read (tar.*, cpio, ...); members
+        // can only be reached by reading the stream from the start
+        ARCHIVE_KIND_STREAM,
+    };
+
+    struct ArchiveEntry {
+        std::string name{};
+        // position of the entry within the archive
+        size_t sequence{0};
+        // ZIP: offset of the local file header in the file
+        // stream archives: offset of the header in the decompressed stream
+        int64_t offset{-1};
+        int64_t compressed_size{0};
+        int64_t uncompressed_size{0};
+        uint32_t crc32{0};
+        bool has_crc{false};
+        // ZIP compression method (0 = stored, 8 = deflate)
+        uint16_t method{0};
+        // ZIP general purpose bit flags
+        uint16_t flags{0};
+        // stream archives: the data starts with binary_json's self-describe
+        // tag, seen while indexing; ZIP members are read when asked
+        bool binary{false};
+        // ZIP: the raw central directory record, re-emitted on update
+        std::string central_record{};
+    };
+
+    class EntryIndex {
+        public:
+            typedef std::vector<ArchiveEntry> entry_list;
+
+            EntryIndex() {}
+
+            void Clear();
+            void Add(const ArchiveEntry& entry);
+            const ArchiveEntry* Find(const std::string& name) const;
+
+            inline const entry_list& Entries() const { return entries; }
+            inline size_t Size() const { return entries.size(); }
+            inline bool Empty() const { return entries.empty(); }
+
+            ArchiveKind kind{ARCHIVE_KIND_UNKNOWN};
+            // libarchive format and outermost filter codes of the input
+            int format_code{0};
+            int filter_code{0};
+
+            // ZIP only: where the central directory lives
+            int64_t directory_offset{-1};
+            int64_t directory_size{0};
+            // bytes in front of the archive proper (e.g. self-extracting stubs)
+            int64_t base_offset{0};
+            // true if any ZIP64 structures were needed to describe the archive
+            bool zip64{false};
+            std::string comment{};
+
+        private:
+            entry_list entries{};
+            std::unordered_map<std::string, size_t> lookup{};
+    };
+
+}
+
+#endif //SAVED_GAME_FORMAT_ENTRY_INDEX_H__
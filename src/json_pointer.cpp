@@ -0,0 +1,625 @@
+#include <cstdint>
+#include <cstdio>
+#include <iostream>
+
+#include "json_pointer.h"
+#include "stats.h"
+
+using namespace saved_game_format_file;
+
+namespace {
+
+    const size_t NOT_FOUND = std::string_view::npos;
+
+    // Where a pointer led in the document
+    struct location {
+        // the value's bytes, if it exists
+        bool found{false};
+        size_t begin{NOT_FOUND};
+        size_t end{NOT_FOUND};
+        // object member key, or the array element itself; unset when the
+        // pointer is the whole document
+        size_t member_begin{NOT_FOUND};
+        // comma in front of the member, if it isn't the first
+        size_t previous_comma{NOT_FOUND};
+
+        // only the last token was missing: where its container closes
+        bool parent_found{false};
+        bool parent_is_array{false};
+        bool parent_empty{false};
+        size_t parent_close{NOT_FOUND};
+    };
+
+    // Just enough of a JSON tokenizer to step over values without
+    // building them
+    class scanner {
+        public:
+            scanner(std::string_view _document) : document(_document) {}
+
+            void skip_whitespace() {
+                while (position < document.size()) {
+                    char c = document[position];
+                    if (c != ' ' && c != '\t' && c != '\n' && c != '\r') {
+                        break;
+                    }
+                    ++position;
+                }
+            }
+
+            inline bool at(char c) const {
+                return position < document.size() && document[position] == c;
+            }
+
+            bool expect(char c) {
+                skip_whitespace();
+                if (!at(c)) {
+                    return false;
+                }
+                ++position;
+                return true;
+            }
+
+            // at an opening quote; decodes into text when it is not null
+            bool read_string(std::string* text) {
+                if (!at('"')) {
+                    return false;
+                }
+                ++position;
+                while (position < document.size()) {
+                    char c = document[position++];
+                    if (c == '"') {
+                        return true;
+                    }
+                    if (c != '\\') {
+                        if (text != nullptr) {
+                            text->push_back(c);
+                        }
+                        continue;
+                    }
+                    if (position >= document.size()) {
+                        return false;
+                    }
+                    char escaped = document[position++];
+                    if (escaped == 'u') {
+                        uint32_t code_point = 0;
+                        if (!read_hex4(code_point)) {
+                            return false;
+                        }
+                        // surrogate pair
+                        if (code_point >= 0xd800 && code_point < 0xdc00
+                            && position + 1 < document.size() && document[position] == '\\' && document[position + 1] == 'u') {
+                            position += 2;
+                            uint32_t low = 0;
+                            if (!read_hex4(low) || low < 0xdc00 || low >= 0xe000) {
+                                return false;
+                            }
+                            code_point = 0x10000 + ((code_point - 0xd800) << 10) + (low - 0xdc00);
+                        }
+                        if (text != nullptr) {
+                            append_utf8(*text, code_point);
+                        }
+                        continue;
+                    }
+                    if (text == nullptr) {
+                        continue;
+                    }
+                    switch (escaped) {
+                        case 'b': text->push_back('\b'); break;
+                        case 'f': text->push_back('\f'); break;
+                        case 'n': text->push_back('\n'); break;
+                        case 'r': text->push_back('\r'); break;
+                        case 't': text->push_back('\t'); break;
+                        default: text->push_back(escaped); break;
+                    }
+                }
+                return false;
+            }
+
+            // any value; leaves the position just past it
+            bool skip_value() {
+                skip_whitespace();
+                if (position >= document.size()) {
+                    return false;
+                }
+                char c = document[position];
+                if (c == '"') {
+                    return read_string(nullptr);
+                }
+                if (c == '{' || c == '[') {
+                    // brackets only need counting once strings are skipped
+                    size_t depth = 0;
+                    while (position < document.size()) {
+                        c = document[position];
+                        if (c == '"') {
+                            if (!read_string(nullptr)) {
+                                return false;
+                            }
+                            continue;
+                        }
+                        ++position;
+                        if (c == '{' || c == '[') {
+                            ++depth;
+                        } else if (c == '}' || c == ']') {
+                            if (--depth == 0) {
+                                return true;
+                            }
+                        }
+                    }
+                    return false;
+                }
+                // number, true, false or null
+                size_t start = position;
+                while (position < document.size()) {
+                    c = document[position];
+                    if (c == ',' || c == '}' || c == ']' || c == ' ' || c == '\t' || c == '\n' || c == '\r') {
+                        break;
+                    }
+                    ++position;
+                }
+                return position != start;
+            }
+
+            std::string_view document;
+            size_t position{0};
+
+        private:
+            bool read_hex4(uint32_t& value) {
+                if (position + 4 > document.size()) {
+                    return false;
+                }
+                value = 0;
+                for (int i = 0; i < 4; ++i) {
+                    char c = document[position++];
+                    value <<= 4;
+                    if (c >= '0' && c <= '9') {
+                        value |= c - '0';
+                    } else if (c >= 'a' && c <= 'f') {
+                        value |= c - 'a' + 10;
+                    } else if (c >= 'A' && c <= 'F') {
+                        value |= c - 'A' + 10;
+                    } else {
+                        return false;
+                    }
+                }
+                return true;
+            }
+
+            static void append_utf8(std::string& text, uint32_t code_point) {
+                if (code_point < 0x80) {
+                    text.push_back(static_cast<char>(code_point));
+                } else if (code_point < 0x800) {
+                    text.push_back(static_cast<char>(0xc0 | (code_point >> 6)));
+                    text.push_back(static_cast<char>(0x80 | (code_point & 0x3f)));
+                } else if (code_point < 0x10000) {
+                    text.push_back(static_cast<char>(0xe0 | (code_point >> 12)));
+                    text.push_back(static_cast<char>(0x80 | ((code_point >> 6) & 0x3f)));
+                    text.push_back(static_cast<char>(0x80 | (code_point & 0x3f)));
+                } else {
+                    text.push_back(static_cast<char>(0xf0 | (code_point >> 18)));
+                    text.push_back(static_cast<char>(0x80 | ((code_point >> 12) & 0x3f)));
+                    text.push_back(static_cast<char>(0x80 | ((code_point >> 6) & 0x3f)));
+                    text.push_back(static_cast<char>(0x80 | (code_point & 0x3f)));
+                }
+            }
+    };
+
+    // array index token: digits without leading zeros
+    bool parse_index(const std::string& token, size_t& index) {
+        if (token.empty() || (token.size() > 1 && token[0] == '0')) {
+            return false;
+        }
+        index = 0;
+        for (char c : token) {
+            if (c < '0' || c > '9') {
+                return false;
+            }
+            index = index * 10 + static_cast<size_t>(c - '0');
+        }
+        return true;
+    }
+
+    // Walk the document token by token, skipping every sibling on the way
+    // and stopping as soon as the target is reached
+    bool locate(std::string_view document, const std::vector<std::string>& tokens, location& result) {
+        scanner scan(document);
+        scan.skip_whitespace();
+
+        for (size_t depth = 0; depth < tokens.size(); ++depth) {
+            const std::string& token = tokens[depth];
+            bool last = (depth + 1 == tokens.size());
+            bool descended = false;
+            size_t previous_comma = NOT_FOUND;
+
+            if (scan.at('{')) {
+                ++scan.position;
+                scan.skip_whitespace();
+                bool empty = scan.at('}');
+                while (!empty) {
+                    scan.skip_whitespace();
+                    size_t member_begin = scan.position;
+                    std::string key;
+                    if (!scan.read_string(&key) || !scan.expect(':')) {
+                        return false;
+                    }
+                    scan.skip_whitespace();
+                    if (key == token) {
+                        result.member_begin = member_begin;
+                        result.previous_comma = previous_comma;
+                        descended = true;
+                        break;
+                    }
+                    if (!scan.skip_value()) {
+                        return false;
+                    }
+                    scan.skip_whitespace();
+                    if (scan.at(',')) {
+                        previous_comma = scan.position++;
+                        continue;
+                    }
+                    if (scan.at('}')) {
+                        break;
+                    }
+                    return false;
+                }
+                if (!descended) {
+                    if (!last || !scan.at('}')) {
+                        return false;
+                    }
+                    result.parent_found = true;
+                    result.parent_is_array = false;
+                    result.parent_empty = empty;
+                    result.parent_close = scan.position;
+                    return true;
+                }
+            } else if (scan.at('[')) {
+                ++scan.position;
+                scan.skip_whitespace();
+                bool empty = scan.at(']');
+                size_t index = 0;
+                bool append = (token == "-");
+                if (!append && !parse_index(token, index)) {
+                    return false;
+                }
+                size_t count = 0;
+                while (!empty) {
+                    scan.skip_whitespace();
+                    if (!append && count == index) {
+                        result.member_begin = scan.position;
+                        result.previous_comma = previous_comma;
+                        descended = true;
+                        break;
+                    }
+                    if (!scan.skip_value()) {
+                        return false;
+                    }
+                    ++count;
+                    scan.skip_whitespace();
+                    if (scan.at(',')) {
+                        previous_comma = scan.position++;
+                        continue;
+                    }
+                    if (scan.at(']')) {
+                        break;
+                    }
+                    return false;
+                }
+                if (!descended) {
+                    if (!last || !scan.at(']') || !(append || index == count)) {
+                        return false;
+                    }
+                    result.parent_found = true;
+                    result.parent_is_array = true;
+                    result.parent_empty = empty;
+                    result.parent_close = scan.position;
+                    return true;
+                }
+            } else {
+                // primitives have nothing to descend into
+                return false;
+            }
+        }
+
+        scan.skip_whitespace();
+        result.begin = scan.position;
+        if (!scan.skip_value()) {
+            return false;
+        }
+        result.end = scan.position;
+        result.found = true;
+        return true;
+    }
+
+    const std::string WILDCARD("*");
+
+    // Collect every value below the scanner's that matches tokens from
+    // depth on. Consumes the whole value either way, so the caller can
+    // carry on with its siblings.
+    bool match_all(scanner& scan, const std::vector<std::string>& tokens, size_t depth, std::string& pointer, json_pointer::match_list& matches) {
+        scan.skip_whitespace();
+        if (depth == tokens.size()) {
+            size_t begin = scan.position;
+            if (!scan.skip_value()) {
+                return false;
+            }
+            matches.emplace_back(pointer, scan.document.substr(begin, scan.position - begin));
+            return true;
+        }
+
+        const std::string& token = tokens[depth];
+        bool wildcard = (token == WILDCARD);
+        size_t pointer_size = pointer.size();
+        if (scan.at('{')) {
+            ++scan.position;
+            scan.skip_whitespace();
+            if (scan.at('}')) {
+                ++scan.position;
+                return true;
+            }
+            std::string key;
+            while (true) {
+                scan.skip_whitespace();
+                key.clear();
+                if (!scan.read_string(&key) || !scan.expect(':')) {
+                    return false;
+                }
+                if (wildcard || key == token) {
+                    pointer.push_back('/');
+                    pointer.append(json_pointer::Escape(key));
+                    if (!match_all(scan, tokens, depth + 1, pointer, matches)) {
+                        return false;
+                    }
+                    pointer.resize(pointer_size);
+                } else if (!scan.skip_value()) {
+                    return false;
+                }
+                if (scan.expect(',')) {
+                    continue;
+                }
+                return scan.expect('}');
+            }
+        }
+        if (scan.at('[')) {
+            ++scan.position;
+            scan.skip_whitespace();
+            if (scan.at(']')) {
+                ++scan.position;
+                return true;
+            }
+            size_t index = 0;
+            bool indexed = !wildcard && parse_index(token, index);
+            for (size_t count = 0; ; ++count) {
+                if (wildcard || (indexed && count == index)) {
+                    pointer.push_back('/');
+                    pointer.append(std::to_string(count));
+                    if (!match_all(scan, tokens, depth + 1, pointer, matches)) {
+                        return false;
+                    }
+                    pointer.resize(pointer_size);
+                } else if (!scan.skip_value()) {
+                    return false;
+                }
+                if (scan.expect(',')) {
+                    continue;
+                }
+                return scan.expect(']');
+            }
+        }
+        // primitives have nothing to descend into
+        return scan.skip_value();
+    }
+
+    bool locate_pointer(std::string_view document, std::string_view pointer, location& result) {
+        SGF_STATS_TIMER(TIMER_PARSE);
+        std::vector<std::string> tokens;
+        if (!json_pointer::Parse(pointer, tokens)) {
+            std::cerr << "Invalid JSON pointer " << pointer << std::endl;
+            return false;
+        }
+        if (!locate(document, tokens, result)) {
+            std::cerr << "Unable to locate " << pointer << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+}
+
+bool json_pointer::Parse(std::string_view pointer, std::vector<std::string>& tokens) {
+    tokens.clear();
+    if (pointer.empty()) {
+        return true;
+    }
+    if (pointer[0] != '/') {
+        tokens.emplace_back(pointer);
+        return true;
+    }
+
+    std::string token;
+    for (size_t i = 1; i <= pointer.size(); ++i) {
+        if (i == pointer.size() || pointer[i] == '/') {
+            tokens.push_back(token);
+            token.clear();
+            continue;
+        }
+        if (pointer[i] != '~') {
+            token.push_back(pointer[i]);
+            continue;
+        }
+        if (i + 1 >= pointer.size() || (pointer[i + 1] != '0' && pointer[i + 1] != '1')) {
+            return false;
+        }
+        token.push_back(pointer[i + 1] == '0' ? '~' : '/');
+        ++i;
+    }
+    return true;
+}
+
+bool json_pointer::Find(std::string_view document, std::string_view pointer, std::string_view& value) {
+    location result;
+    if (!locate_pointer(document, pointer, result)) {
+        return false;
+    }
+    if (!result.found) {
+        std::cerr << "Unable to locate " << pointer << std::endl;
+        return false;
+    }
+    value = document.substr(result.begin, result.end - result.begin);
+    return true;
+}
+
+bool json_pointer::FindAll(std::string_view document, std::string_view pattern, match_list& matches) {
+    SGF_STATS_TIMER(TIMER_PARSE);
+    matches.clear();
+    std::vector<std::string> tokens;
+    if (!Parse(pattern, tokens)) {
+        std::cerr << "Invalid JSON pointer " << pattern << std::endl;
+        return false;
+    }
+
+    std::string pointer;
+    bool wildcard = false;
+    for (const auto& token : tokens) {
+        wildcard = wildcard || (token == WILDCARD);
+        pointer.push_back('/');
+        pointer.append(Escape(token));
+    }
+    if (!wildcard) {
+        // a single path; stop as soon as it is found
+        location result;
+        if (locate(document, tokens, result) && result.found) {
+            matches.emplace_back(pointer, document.substr(result.begin, result.end - result.begin));
+        }
+        return true;
+    }
+
+    // a document that isn't JSON simply has no matches
+    scanner scan(document);
+    pointer.clear();
+    if (!match_all(scan, tokens, 0, pointer, matches)) {
+        matches.clear();
+    }
+    return true;
+}
+
+std::string json_pointer::Escape(std::string_view token) {
+    std::string escaped;
+    escaped.reserve(token.size());
+    for (char c : token) {
+        if (c == '~') {
+            escaped.append("~0");
+        } else if (c == '/') {
+            escaped.append("~1");
+        } else {
+            escaped.push_back(c);
+        }
+    }
+    return escaped;
+}
+
+bool json_pointer::Set(std::string_view document, std::string_view pointer, std::string_view value_json, bool create, std::string& output) {
+    location result;
+    if (!locate_pointer(document, pointer, result)) {
+        return false;
+    }
+
+    SGF_STATS_TIMER(TIMER_SERIALIZE);
+    output.clear();
+    if (result.found) {
+        output.reserve(document.size() - (result.end - result.begin) + value_json.size());
+        output.append(document.substr(0, result.begin));
+        output.append(value_json);
+        output.append(document.substr(result.end));
+        return true;
+    }
+    if (!create) {
+        std::cerr << "Unable to locate " << pointer << std::endl;
+        return false;
+    }
+
+    // added just in front of the parent's closing bracket
+    std::string member;
+    if (!result.parent_empty) {
+        member.push_back(',');
+    }
+    if (!result.parent_is_array) {
+        std::vector<std::string> tokens;
+        Parse(pointer, tokens);
+        member.append(Quote(tokens.back()));
+        member.push_back(':');
+    }
+    member.append(value_json);
+
+    output.reserve(document.size() + member.size());
+    output.append(document.substr(0, result.parent_close));
+    output.append(member);
+    output.append(document.substr(result.parent_close));
+    return true;
+}
+
+bool json_pointer::Remove(std::string_view document, std::string_view pointer, std::string& output) {
+    location result;
+    if (!locate_pointer(document, pointer, result)) {
+        return false;
+    }
+    // the document itself has no container to be removed from
+    if (!result.found || result.member_begin == NOT_FOUND) {
+        std::cerr << "Unable to remove " << pointer << std::endl;
+        return false;
+    }
+    SGF_STATS_TIMER(TIMER_SERIALIZE);
+
+    // take a comma with it so the container stays valid: the one after
+    // the member if there is one, otherwise the one in front
+    size_t erase_begin = result.member_begin;
+    size_t erase_end = result.end;
+    scanner scan(document);
+    scan.position = result.end;
+    scan.skip_whitespace();
+    if (scan.at(',')) {
+        ++scan.position;
+        scan.skip_whitespace();
+        erase_end = scan.position;
+    } else if (result.previous_comma != NOT_FOUND) {
+        erase_begin = result.previous_comma;
+    }
+
+    output.clear();
+    output.reserve(document.size() - (erase_end - erase_begin));
+    output.append(document.substr(0, erase_begin));
+    output.append(document.substr(erase_end));
+    return true;
+}
+
+std::string json_pointer::Quote(std::string_view text) {
+    std::string quoted;
+    quoted.reserve(text.size() + 2);
+    quoted.push_back('"');
+    for (char c : text) {
+        switch (c) {
+            case '"': quoted.append("\\\""); break;
+            case '\\': quoted.append("\\\\"); break;
+            case '\b': quoted.append("\\b"); break;
+            case '\f': quoted.append("\\f"); break;
+            case '\n': quoted.append("\\n"); break;
+            case '\r': quoted.append("\\r"); break;
+            case '\t': quoted.append("\\t"); break;
+            default:
+                if (static_cast<unsigned char>(c) < 0x20) {
+                    char escaped[8];
+                    snprintf(escaped, sizeof(escaped), "\\u%04x", static_cast<unsigned int>(static_cast<unsigned char>(c)));
+                    quoted.append(escaped);
+                } else {
+                    quoted.push_back(c);
+                }
+                break;
+        }
+    }
+    quoted.push_back('"');
+    return quoted;
+}
+
+bool json_pointer::Unquote(std::string_view literal, std::string& text) {
+    text.clear();
+    scanner scan(literal);
+    return scan.read_string(&text) && scan.position == literal.size();
+}
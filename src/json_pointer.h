@@ -0,0 +1,55 @@
+#ifndef SAVED_GAME_FORMAT_JSON_POINTER_H__
+#define SAVED_GAME_FORMAT_JSON_POINTER_H__
+
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace saved_game_format_file {
+
+    // RFC 6901 JSON pointers resolved against the raw text of a document.
+    // The document is only scanned as far as the target, and nothing is
+    // parsed into a DOM: reads hand back the value's own bytes and writes
+    // splice new text in, leaving every other byte exactly as it was.
+    namespace json_pointer {
+
+        // Split a pointer ("/ships/0/name") into unescaped reference tokens.
+        // Anything not starting with '/' is taken as a single top-level key,
+        // which is what --read_key and --write_key always accepted.
+        bool Parse(std::string_view pointer, std::vector<std::string>& tokens);
+
+        // Raw JSON text of the value the pointer refers to
+        bool Find(std::string_view document, std::string_view pointer, std::string_view& value);
+
+        // concrete pointer -> raw value
+        typedef std::vector<std::pair<std::string, std::string_view>> match_list;
+
+        // Every value a pattern refers to, in document order. A "*" token
+        // matches each member of an object or element of an array
+        // ("/ships/*/name"); without one this is Find, minus the complaint
+        // when nothing matches.
+        bool FindAll(std::string_view document, std::string_view pattern, match_list& matches);
+
+        // token as it appears in a pointer, with '~' and '/' escaped
+        std::string Escape(std::string_view token);
+
+        // Replace the value with value_json. With create set, a missing
+        // last token is added to its object, or appended to its array when
+        // it is "-" or the array's length.
+        bool Set(std::string_view document, std::string_view pointer, std::string_view value_json, bool create, std::string& output);
+
+        // Drop the value along with its key and separating comma
+        bool Remove(std::string_view document, std::string_view pointer, std::string& output);
+
+        // text as a JSON string literal, quotes included
+        std::string Quote(std::string_view text);
+
+        // the text of a JSON string literal; the inverse of Quote
+        bool Unquote(std::string_view literal, std::string& text);
+
+    }
+
+}
+
+#endif //SAVED_GAME_FORMAT_JSON_POINTER_H__
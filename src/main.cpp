@@ -1,11 +1,16 @@
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
 #include <exception>
+#include <fstream>
 #include <iostream>
+#include <iterator>
 #include <optional>
 #include <string>
+#include <string_view>
 #include <vector>
 
 #include <boost/any.hpp>
-#include <boost/json.hpp>
 #include <boost/lexical_cast.hpp>
 #include <boost/program_options/options_description.hpp>
 #include <boost/program_options/value_semantic.hpp>
@@ -13,8 +18,23 @@
 #include <boost/program_options/variables_map.hpp>
 #include <boost/system/error_code.hpp>
 
+#include "archive_cache.h"
+#include "atomic_file.h"
+#include "batch_edit.h"
+#include "binary_json.h"
+#include "checksum.h"
+#include "edit_journal.h"
+#include "engine_text.h"
+#include "json_pointer.h"
 #include "options.h"
+#include "save_bulk.h"
+#include "save_delta.h"
+#include "save_query.h"
+#include "save_store.h"
+#include "save_verify.h"
+#include "server.h"
 #include "sgf_file.h"
+#include "stats.h"
 
 enum SGFErrorCodes {
     SGF_OKAY = 0,
@@ -23,12 +43,51 @@ enum SGFErrorCodes {
     SGF_LOAD_FILE_FAILED,
 };
 
+namespace {
+
+    // an edit script from a file, or stdin for "-"
+    bool read_edit_script(const std::string& batch_file, std::string& script) {
+        if (batch_file == "-") {
+            script.assign(std::istreambuf_iterator<char>(std::cin), std::istreambuf_iterator<char>());
+            return true;
+        }
+        std::ifstream script_stream(batch_file, std::ios::binary);
+        if (!script_stream) {
+            std::cerr << "Unable to open edit script " << batch_file << std::endl;
+            return false;
+        }
+        script.assign(std::istreambuf_iterator<char>(script_stream), std::istreambuf_iterator<char>());
+        return true;
+    }
+
+}
+
 int main(int argc, const char* argv[]) {
     ProgramCommand command;
     saved_game_format_file::SavedGameFormatFile saved_game_file;
     std::string internal_file;
     std::string read_key;
     std::string output_file;
+    std::string batch_file;
+    std::string socket_path;
+    size_t cache_bytes = 0;
+    size_t cache_archives = 0;
+    size_t max_clients = 0;
+    bool append_in_place = false;
+    bool use_journal = false;
+    bool check_contents = false;
+    size_t checkpoint_edits = 0;
+    unsigned int checkpoint_interval = 0;
+    std::string stats_format;
+    std::string store_directory;
+    std::string snapshot_name;
+    std::string target_file;
+    std::string patch_file;
+    std::string read_range;
+    std::string match_value;
+    std::string bulk_source;
+    size_t bulk_jobs = 0;
+    size_t bulk_memory = 0;
     std::pair<std::string, std::string> kv_pair;
 
     boost::program_options::options_description arg_descriptions("Allowed arguments");
@@ -39,35 +98,180 @@ int main(int argc, const char* argv[]) {
             boost::program_options::value<std::string>(&saved_game_file.filename),
             "file to operate on"
         )
+        (
+            "files",
+            boost::program_options::value<std::string>(&bulk_source),
+            "run list, dump, update, add, batch, recompress or verify over many saves instead of --file: every file below a directory, or a file listing one save per line (- reads stdin)"
+        )
+        (
+            "jobs",
+            boost::program_options::value<size_t>(&bulk_jobs)->default_value(0),
+            "saves --files processes at once; 0 uses every hardware thread"
+        )
+        (
+            "bulk_memory",
+            boost::program_options::value<size_t>(&bulk_memory)->default_value(512 * 1024 * 1024),
+            "archive and member bytes --files keeps in flight; workers wait for room before opening another save"
+        )
+        (
+            "mmap",
+            boost::program_options::bool_switch(&saved_game_file.memory_mapped),
+            "memory-map the file instead of reading it through stdio"
+        )
         (
             "command",
             boost::program_options::value<ProgramCommand>(&command)->default_value(COMMAND_DUMP),
-            "command to perform: [update, add, dump]"
+            "command to perform: [update, add, dump, list, query, verify, compact, recompress, batch, checkpoint, diff, patch, store, restore, serve]"
         )
         (
             "subfile",
             boost::program_options::value<std::string>(&internal_file),
-            "internal file to read"
+            "internal file to read; query searches the members whose names start with it"
         )
         (
             "read_key",
             boost::program_options::value<std::string>(&read_key),
-            "key to read from file"
+            "key to read from file; a JSON pointer (/ships/0/name) reaches nested values, and for query a * token matches every key or element; the engine's data text takes /credits, /stardate or /missionstring/<variable>[/<index>]"
+        )
+        (
+            "match_value",
+            boost::program_options::value<std::string>(&match_value),
+            "value the query command's key must have; without it the key only has to exist"
+        )
+        (
+            "range",
+            boost::program_options::value<std::string>(&read_range),
+            "dump only bytes <offset>:<length> of the subfile; framed ZIP members (--frame_size) are decoded from the nearest frame"
         )
         (
             "write_key",
             boost::program_options::value<std::string>(&kv_pair.first),
-            "key within the file to write"
+            "key within the file to write; a JSON pointer (/ships/0/name) reaches nested values"
         )
         (
             "write_value",
             boost::program_options::value<std::string>(&kv_pair.second),
             "value to update the key to"
         )
+        (
+            "batch",
+            boost::program_options::value<std::string>(&batch_file),
+            "edit script for the batch command, a JSON array or JSONL of {subfile, op, key, value}; - reads stdin"
+        )
         (
             "output",
             boost::program_options::value<std::string>(&output_file),
-            "optional file to save data to"
+            "optional file to save data to; without it the file itself is replaced once the new copy is complete"
+        )
+        (
+            "append_in_place",
+            boost::program_options::bool_switch(&append_in_place),
+            "update ZIP files by appending to them instead of writing a new copy; faster, but a crash part way through can leave the file unreadable"
+        )
+        (
+            "check_contents",
+            boost::program_options::bool_switch(&check_contents),
+            "verify also parses .json members as JSON, binary members as CBOR and the engine's data text"
+        )
+        (
+            "verify_on_save",
+            boost::program_options::bool_switch(&saved_game_file.verify_on_save),
+            "decode and check every member before writing the file, and refuse to save over damage"
+        )
+        (
+            "journal",
+            boost::program_options::bool_switch(&use_journal),
+            "append update and add edits to <file>.journal instead of saving the file; dump sees them and checkpoint folds them in"
+        )
+        (
+            "checkpoint_edits",
+            boost::program_options::value<size_t>(&checkpoint_edits)->default_value(64),
+            "journaled edits that trigger a checkpoint; 0 leaves it to the checkpoint command"
+        )
+        (
+            "checkpoint_interval",
+            boost::program_options::value<unsigned int>(&checkpoint_interval)->default_value(30),
+            "seconds between the serve command's background checkpoints of journaled saves"
+        )
+        (
+            "target",
+            boost::program_options::value<std::string>(&target_file),
+            "save the diff command compares --file against"
+        )
+        (
+            "patch",
+            boost::program_options::value<std::string>(&patch_file),
+            "patch file the diff command writes and the patch command applies to --file"
+        )
+        (
+            "store",
+            boost::program_options::value<std::string>(&store_directory),
+            "directory of the deduplicated snapshot store used by the store and restore commands"
+        )
+        (
+            "snapshot",
+            boost::program_options::value<std::string>(&snapshot_name),
+            "snapshot name to store the file as, or to restore to --output; restore without it lists the snapshots"
+        )
+        (
+            "format",
+            boost::program_options::value<saved_game_format_file::SaveFormat>(&saved_game_file.save_settings.format)->default_value(saved_game_format_file::SAVE_FORMAT_AUTO),
+            "container for saved files: [auto, zip, gnutar, pax, ustar, cpio]"
+        )
+        (
+            "codec",
+            boost::program_options::value<saved_game_format_file::SaveCodec>(&saved_game_file.save_settings.codec)->default_value(saved_game_format_file::SAVE_CODEC_AUTO),
+            "compression for saved files: [auto, none, gzip, bzip2, xz, zstd, lz4]; ZIP members can only be none or gzip (deflate)"
+        )
+        (
+            "level",
+            boost::program_options::value<int>(&saved_game_file.save_settings.level)->default_value(saved_game_format_file::SAVE_LEVEL_DEFAULT),
+            "compression level for saved files; unchanged ZIP members keep theirs"
+        )
+        (
+            "threads",
+            boost::program_options::value<unsigned int>(&saved_game_file.save_settings.threads)->default_value(0),
+            "threads used to compress saved files and to search members for query; 0 uses every hardware thread"
+        )
+        (
+            "frame_size",
+            boost::program_options::value<size_t>(&saved_game_file.save_settings.frame_size)->default_value(0),
+            "ZIP saves only: deflate members in independently decodable frames of this many bytes so --range reads skip ahead; 0 turns framing off"
+        )
+        (
+            "encoding",
+            boost::program_options::value<saved_game_format_file::MemberEncoding>(&saved_game_file.save_settings.encoding)->default_value(saved_game_format_file::MEMBER_ENCODING_AUTO),
+            "encoding of .json members in saved files: [auto, json, cbor]; auto keeps each member's own, cbor members are read without parsing text and dumped as JSON"
+        )
+        (
+            "socket",
+            boost::program_options::value<std::string>(&socket_path)->default_value("saved-game-format.sock"),
+            "UNIX socket the serve command listens on"
+        )
+        (
+            "cache_bytes",
+            boost::program_options::value<size_t>(&cache_bytes)->default_value(64 * 1024 * 1024),
+            "decoded member bytes the serve command keeps in memory"
+        )
+        (
+            "cache_archives",
+            boost::program_options::value<size_t>(&cache_archives)->default_value(16),
+            "archives the serve command keeps open"
+        )
+        (
+            "max_clients",
+            boost::program_options::value<size_t>(&max_clients)->default_value(64),
+            "clients the serve command answers at once; later connections wait for one to leave"
+        )
+        (
+            "stats",
+            boost::program_options::value<std::string>(&stats_format)->default_value(stNone),
+            "report per-phase timings and byte counts when the command finishes: [none, json]"
+        )
+        (
+            "compact_threshold",
+            boost::program_options::value<double>(&saved_game_file.compact_threshold)->default_value(0.5),
+            "fraction of a ZIP file that may be dead space before an in-place update compacts it"
         )
     ;
 
@@ -83,11 +287,155 @@ int main(int argc, const char* argv[]) {
     }
 
     boost::program_options::notify(vm);
+    if (stats_format != stNone && stats_format != stJson) {
+        std::cerr << "Error: unknown stats format " << stats_format << std::endl;
+        std::cout << arg_descriptions << std::endl;
+        return SGF_INVALID_PARAMETER;
+    }
+    saved_game_file.atomic_save = !append_in_place;
 
     if (vm.count("help")) {
         std::cerr << "Dumping help screen" << std::endl;
         std::cout << arg_descriptions << std::endl;
         return SGF_OKAY;
+    } else if (command == COMMAND_SERVE) {
+        // files are named per request
+        saved_game_format_file::ArchiveCache cache(cache_bytes, cache_archives);
+        cache.memory_mapped = saved_game_file.memory_mapped;
+        cache.save_settings = saved_game_file.save_settings;
+        saved_game_format_file::SaveServer server(cache);
+        server.journal = use_journal;
+        server.checkpoint_interval = checkpoint_interval;
+        server.max_clients = max_clients;
+        return server.Run(socket_path) ? SGF_OKAY : SGF_INVALID_PARAMETER;
+    } else if (command == COMMAND_RESTORE) {
+        // the snapshot names the save
+        if (!vm.count("store")) {
+            std::cerr << "Missing store" << std::endl;
+            std::cout << arg_descriptions << std::endl;
+            return SGF_INVALID_PARAMETER;
+        }
+        saved_game_format_file::SaveStore store(store_directory);
+        if (!store.Open()) {
+            return SGF_LOAD_FILE_FAILED;
+        }
+        if (!vm.count("snapshot")) {
+            std::vector<std::string> snapshots;
+            if (!store.ListSnapshots(snapshots)) {
+                return SGF_LOAD_FILE_FAILED;
+            }
+            std::cout << "Snapshot Count: " << snapshots.size() << std::endl;
+            for (const auto& snapshot : snapshots) {
+                std::cout << "\t" << snapshot << std::endl;
+            }
+            return SGF_OKAY;
+        }
+        if (output_file.empty()) {
+            std::cerr << "Missing output file" << std::endl;
+            std::cout << arg_descriptions << std::endl;
+            return SGF_INVALID_PARAMETER;
+        }
+        std::cout << "Restoring Snapshot: " << snapshot_name << std::endl;
+        return store.Get(snapshot_name, output_file) ? SGF_OKAY : SGF_LOAD_FILE_FAILED;
+    } else if (vm.count("files")) {
+        // every save is rewritten where it is, so there is no one output
+        if (!output_file.empty()) {
+            std::cerr << "--output can't be used with --files" << std::endl;
+            return SGF_INVALID_PARAMETER;
+        }
+        saved_game_format_file::BulkJob job;
+        job.subfile = internal_file;
+        job.save_settings = saved_game_file.save_settings;
+        job.memory_mapped = saved_game_file.memory_mapped;
+        job.atomic_save = saved_game_file.atomic_save;
+        job.verify_on_save = saved_game_file.verify_on_save;
+        job.check_contents = check_contents;
+        job.threads = bulk_jobs;
+        job.memory_limit = static_cast<int64_t>(bulk_memory);
+        switch (command) {
+            case COMMAND_LIST:
+                job.operation = saved_game_format_file::BULK_LIST;
+                break;
+            case COMMAND_DUMP:
+                job.operation = saved_game_format_file::BULK_DUMP;
+                job.key = read_key;
+                break;
+            case COMMAND_UPDATE:
+            case COMMAND_ADD:
+                {
+                    job.operation = saved_game_format_file::BULK_EDIT;
+                    saved_game_format_file::KeyEdit edit;
+                    edit.subfile = internal_file;
+                    edit.op = (command == COMMAND_ADD) ? saved_game_format_file::KEY_EDIT_ADD : saved_game_format_file::KEY_EDIT_UPDATE;
+                    edit.key = kv_pair.first;
+                    edit.value_json = saved_game_format_file::json_pointer::Quote(kv_pair.second);
+                    job.edits.push_back(edit);
+                }
+                break;
+            case COMMAND_BATCH:
+                {
+                    job.operation = saved_game_format_file::BULK_EDIT;
+                    std::string script;
+                    if (!read_edit_script(batch_file, script) || !saved_game_format_file::ParseEditScript(script, job.edits)) {
+                        return SGF_INVALID_PARAMETER;
+                    }
+                }
+                break;
+            case COMMAND_RECOMPRESS:
+                job.operation = saved_game_format_file::BULK_RECOMPRESS;
+                job.save_settings.recompress = true;
+                break;
+            case COMMAND_VERIFY:
+                job.operation = saved_game_format_file::BULK_VERIFY;
+                break;
+            default:
+                std::cerr << "--files runs list, dump, update, add, batch, recompress or verify, not " << command << std::endl;
+                return SGF_INVALID_PARAMETER;
+        }
+        if (job.operation == saved_game_format_file::BULK_DUMP && internal_file.empty()) {
+            std::cerr << "Missing subfile to dump" << std::endl;
+            return SGF_INVALID_PARAMETER;
+        }
+
+        std::vector<std::string> files;
+        if (!saved_game_format_file::CollectSaves(bulk_source, files)) {
+            return SGF_MISSING_INPUT_FILE;
+        }
+        std::cout << "Processing Files: " << bulk_source << std::endl;
+        std::cout << "Command: " << command << std::endl;
+        std::cout << "Save Count: " << files.size() << std::endl;
+
+        // each save's output in one piece, as it finishes
+        saved_game_format_file::BulkStats bulk_stats;
+        SGF_STATS_NAMED_TIMER(bulk_timer, TIMER_COMMAND);
+        bool success = saved_game_format_file::RunBulk(
+            files, job,
+            [](const saved_game_format_file::BulkResult& result) {
+                if (!result.success) {
+                    std::cerr << "Failed " << result.filename << ": " << result.error << std::endl;
+                }
+                std::cout << result.output << std::flush;
+            },
+            bulk_stats
+        );
+        SGF_STATS_STOP(bulk_timer);
+
+        double seconds = (bulk_stats.seconds > 0) ? bulk_stats.seconds : 1e-9;
+        std::cout << "Saves: " << bulk_stats.saves << std::endl;
+        std::cout << "Succeeded: " << bulk_stats.succeeded << std::endl;
+        std::cout << "Failed: " << bulk_stats.failed << std::endl;
+        for (const auto& failure : bulk_stats.failures) {
+            std::cout << "\t" << failure << std::endl;
+        }
+        std::cout << "Archive Bytes: " << bulk_stats.bytes << std::endl;
+        std::cout << "Seconds: " << bulk_stats.seconds << std::endl;
+        std::cout << "Saves Per Second: " << bulk_stats.saves / seconds << std::endl;
+        std::cout << "MiB Per Second: " << bulk_stats.bytes / seconds / (1024 * 1024) << std::endl;
+        std::cout << "Steals: " << bulk_stats.steals << std::endl;
+        if (stats_format == stJson) {
+            std::cout << saved_game_format_file::stats::Json() << std::endl;
+        }
+        return success ? SGF_OKAY : SGF_LOAD_FILE_FAILED;
     } else if (!vm.count("file")) {
         std::cerr << "Missing input file" << std::endl;
         std::cout << arg_descriptions << std::endl;
@@ -107,6 +455,29 @@ int main(int argc, const char* argv[]) {
     std::cout << "[optional] Write Value: " << kv_pair.second << std::endl;
     std::cout << "[optional] Output File: " << output_file << std::endl;
 
+    // edits journaled by earlier runs; anything that replaces the save
+    // folds them in first, since they would be stale afterwards. Writing
+    // to --output applies them to the output instead, and everything else
+    // overlays them in memory.
+    saved_game_format_file::EditJournal journal(saved_game_file.filename);
+    if (!journal.Load()) {
+        std::cerr << "Unable to read " << journal.filename << std::endl;
+        return SGF_LOAD_FILE_FAILED;
+    }
+    bool writes_file = command == COMMAND_COMPACT || command == COMMAND_RECOMPRESS || command == COMMAND_BATCH || command == COMMAND_PATCH
+        || (!use_journal && (command == COMMAND_UPDATE || command == COMMAND_ADD));
+    bool replaces_file = output_file.empty() || output_file == saved_game_file.filename;
+    bool exports_journal = writes_file && !replaces_file && !journal.Empty();
+    if (writes_file && replaces_file && !journal.Empty()) {
+        std::cout << "Checkpointing " << journal.Pending().size() << " journaled edit(s)" << std::endl;
+        if (!journal.Checkpoint(saved_game_file)) {
+            return SGF_LOAD_FILE_FAILED;
+        }
+    }
+
+    // commands whose failure the caller has to be able to act on
+    int exit_code = SGF_OKAY;
+    SGF_STATS_NAMED_TIMER(command_timer, TIMER_COMMAND);
     switch (command) {
         case COMMAND_LIST:
             {
@@ -125,6 +496,9 @@ int main(int argc, const char* argv[]) {
                 std::string file_contents;
                 saved_game_format_file::SavedGameFormatFile::path_listing file_list;
                 saved_game_file.DumpSubfile(internal_file, file_contents);
+                if (!journal.Overlay(internal_file, file_contents)) {
+                    break;
+                }
                 std::cout << "File Contents Size: " << file_contents.size() << std::endl;
                 std::cout << "---------------------------------------------------------------" << std::endl;
                 std::cout << "Begin File Contents " << std::endl;
@@ -134,32 +508,45 @@ int main(int argc, const char* argv[]) {
                 std::cout << "End File Contents " << std::endl;
                 std::cout << "---------------------------------------------------------------" << std::endl;
 
-                boost::system::error_code json_parser_error;
-                boost::json::value json_data = boost::json::parse(file_contents.c_str(), json_parser_error);
-                if (json_parser_error) {
-                    std::cerr << "Error parsing JSON content: " << json_parser_error.message() << std::endl;
+                // only the key's bytes change; the rest of the member is
+                // carried over exactly as it was
+                saved_game_format_file::KeyEdit edit;
+                edit.subfile = internal_file;
+                edit.op = saved_game_format_file::KEY_EDIT_UPDATE;
+                edit.key = kv_pair.first;
+                edit.value_json = saved_game_format_file::json_pointer::Quote(kv_pair.second);
+                std::string scratch;
+                if (!saved_game_format_file::ApplyKeyEdit(file_contents, scratch, edit)) {
+                    std::cerr << "Unable to locate key " << kv_pair.first << std::endl;
                     break;
                 }
-                std::cout << "Parsed JSON data" << std::endl;
-                std::cout << "JSON data: " << json_data << std::endl;
+                std::cout << "Updated Key: " << kv_pair.first << std::endl;
 
-                try {
-                    boost::json::object& jd_obj = json_data.as_object();
-                    auto jd_value = jd_obj.contains(kv_pair.first);
-                    if (!jd_value) {
-                        std::cerr << "Unable to locate key " << kv_pair.first << std::endl;
+                if (use_journal) {
+                    if (!journal.Append(edit)) {
+                        std::cerr << "Unable to journal " << kv_pair.first << std::endl;
+                        exit_code = SGF_LOAD_FILE_FAILED;
                         break;
                     }
-
-                    jd_obj[kv_pair.first] = kv_pair.second;
-                } catch (const std::exception& e) {
-                    std::cerr << "[UPDATE] JSON Decode Error: " << e.what() << std::endl;
+                    std::cout << "Journaled Edits: " << journal.Pending().size() << std::endl;
+                    if (checkpoint_edits && journal.Pending().size() >= checkpoint_edits
+                        && !journal.Checkpoint(saved_game_file)) {
+                        std::cerr << "Unable to checkpoint " << journal.filename << std::endl;
+                        exit_code = SGF_LOAD_FILE_FAILED;
+                    }
+                    break;
+                }
+                if (exports_journal) {
+                    if (!journal.Export(saved_game_file, {edit}, output_file)) {
+                        std::cerr << "Unable to write " << output_file << std::endl;
+                        exit_code = SGF_LOAD_FILE_FAILED;
+                    }
+                    break;
+                }
+                if (!saved_game_file.UpdateSubfile(output_file, internal_file, file_contents)) {
+                    std::cerr << "Unable to save " << saved_game_file.filename << std::endl;
+                    exit_code = SGF_LOAD_FILE_FAILED;
                 }
-                std::cout << "Updated JSON: " << json_data << std::endl;
-
-                std::string updated_data = boost::json::serialize(json_data);
-
-                saved_game_file.UpdateSubfile(output_file, internal_file, updated_data);
             }
             break;
         case COMMAND_ADD:
@@ -168,6 +555,9 @@ int main(int argc, const char* argv[]) {
                 std::string file_contents;
                 saved_game_format_file::SavedGameFormatFile::path_listing file_list;
                 saved_game_file.DumpSubfile(internal_file, file_contents);
+                if (!journal.Overlay(internal_file, file_contents)) {
+                    break;
+                }
                 std::cout << "File Contents Size: " << file_contents.size() << std::endl;
                 std::cout << "---------------------------------------------------------------" << std::endl;
                 std::cout << "Begin File Contents " << std::endl;
@@ -177,65 +567,427 @@ int main(int argc, const char* argv[]) {
                 std::cout << "End File Contents " << std::endl;
                 std::cout << "---------------------------------------------------------------" << std::endl;
 
-                boost::system::error_code json_parser_error;
-                boost::json::value json_data = boost::json::parse(file_contents.c_str(), json_parser_error);
-                if (json_parser_error) {
-                    std::cerr << "Error parsing JSON content: " << json_parser_error.message() << std::endl;
+                saved_game_format_file::KeyEdit edit;
+                edit.subfile = internal_file;
+                edit.op = saved_game_format_file::KEY_EDIT_ADD;
+                edit.key = kv_pair.first;
+                edit.value_json = saved_game_format_file::json_pointer::Quote(kv_pair.second);
+                std::string scratch;
+                if (!saved_game_format_file::ApplyKeyEdit(file_contents, scratch, edit)) {
+                    std::cerr << "[ADD] Unable to add key " << kv_pair.first << std::endl;
                     break;
                 }
-                std::cout << "Parsed JSON data" << std::endl;
-                std::cout << "JSON data: " << json_data << std::endl;
+                std::cout << "Added Key: " << kv_pair.first << std::endl;
 
-                try {
-                    boost::json::object& jd_obj = json_data.as_object();
-                    jd_obj[kv_pair.first] = kv_pair.second;
-                } catch (const std::exception& e) {
-                    std::cerr << "[ADD] JSON Decode Error: " << e.what() << std::endl;
+                if (use_journal) {
+                    if (!journal.Append(edit)) {
+                        std::cerr << "Unable to journal " << kv_pair.first << std::endl;
+                        exit_code = SGF_LOAD_FILE_FAILED;
+                        break;
+                    }
+                    std::cout << "Journaled Edits: " << journal.Pending().size() << std::endl;
+                    if (checkpoint_edits && journal.Pending().size() >= checkpoint_edits
+                        && !journal.Checkpoint(saved_game_file)) {
+                        std::cerr << "Unable to checkpoint " << journal.filename << std::endl;
+                        exit_code = SGF_LOAD_FILE_FAILED;
+                    }
+                    break;
+                }
+                if (exports_journal) {
+                    if (!journal.Export(saved_game_file, {edit}, output_file)) {
+                        std::cerr << "Unable to write " << output_file << std::endl;
+                        exit_code = SGF_LOAD_FILE_FAILED;
+                    }
+                    break;
+                }
+                if (!saved_game_file.UpdateSubfile(output_file, internal_file, file_contents)) {
+                    std::cerr << "Unable to save " << saved_game_file.filename << std::endl;
+                    exit_code = SGF_LOAD_FILE_FAILED;
                 }
-                std::cout << "Updated JSON: " << json_data << std::endl;
-
-                std::string updated_data = boost::json::serialize(json_data);
-
-                saved_game_file.UpdateSubfile(output_file, internal_file, updated_data);
             }
             break;
         case COMMAND_DUMP:
             {
                 std::cout << "Dump sub-file contents" << std::endl;
                 std::string file_contents;
+                std::string_view file_view;
+                bool binary = false;
                 saved_game_format_file::SavedGameFormatFile::path_listing file_list;
-                saved_game_file.DumpSubfile(internal_file, file_contents);
-                std::cout << "File Contents Size: " << file_contents.size() << std::endl;
-                if (!read_key.length()) {
+                if (!read_range.empty()) {
+                    int64_t range_offset = 0;
+                    int64_t range_length = 0;
+                    size_t separator = read_range.find(':');
+                    try {
+                        range_offset = std::stoll(read_range.substr(0, separator));
+                        range_length = (separator == std::string::npos) ? INT64_MAX : std::stoll(read_range.substr(separator + 1));
+                    } catch (const std::exception&) {
+                        std::cerr << "Invalid range " << read_range << std::endl;
+                        return SGF_INVALID_PARAMETER;
+                    }
+                    if (range_offset < 0 || range_length < 0) {
+                        std::cerr << "Invalid range " << read_range << std::endl;
+                        return SGF_INVALID_PARAMETER;
+                    }
+                    std::cout << "Range: " << range_offset << ":" << range_length << std::endl;
                     std::cout << "---------------------------------------------------------------" << std::endl;
                     std::cout << "Begin File Contents " << std::endl;
                     std::cout << "---------------------------------------------------------------" << std::endl;
-                    std::cout << file_contents << std::endl;
+                    if (journal.HasPending(internal_file)) {
+                        saved_game_file.DumpSubfile(internal_file, file_contents);
+                        if (!journal.Overlay(internal_file, file_contents)) {
+                            break;
+                        }
+                        if (static_cast<size_t>(range_offset) < file_contents.size()) {
+                            std::cout << std::string_view(file_contents).substr(range_offset, range_length);
+                        }
+                    } else {
+                        saved_game_file.ReadSubfileRange(
+                            internal_file, range_offset, range_length,
+                            [](const char* buffer, size_t buffer_size) {
+                                std::cout.write(buffer, buffer_size);
+                                return static_cast<bool>(std::cout);
+                            }
+                        );
+                    }
+                    std::cout << std::endl;
+                    std::cout << "---------------------------------------------------------------" << std::endl;
+                    std::cout << "End File Contents " << std::endl;
+                    std::cout << "---------------------------------------------------------------" << std::endl;
+                } else if (!read_key.length()) {
+                    // stored members of a mapped file are read in place,
+                    // everything else is streamed straight to the output
+                    auto begin_contents = [](int64_t entry_size) {
+                        std::cout << "File Contents Size: " << entry_size << std::endl;
+                        std::cout << "---------------------------------------------------------------" << std::endl;
+                        std::cout << "Begin File Contents " << std::endl;
+                        std::cout << "---------------------------------------------------------------" << std::endl;
+                    };
+                    if (journal.HasPending(internal_file)) {
+                        saved_game_file.DumpSubfile(internal_file, file_contents);
+                        if (!journal.Overlay(internal_file, file_contents)) {
+                            break;
+                        }
+                        begin_contents(file_contents.size());
+                        std::cout << file_contents;
+                    } else if (saved_game_file.ViewSubfile(internal_file, file_view) && !saved_game_format_file::binary_json::IsEncoded(file_view)) {
+                        begin_contents(file_view.size());
+                        std::cout << file_view;
+                    } else if (file_view.empty() && !saved_game_file.IsBinarySubfile(internal_file, binary)) {
+                        break;
+                    } else if (!file_view.empty() || binary) {
+                        // binary members are shown as JSON
+                        saved_game_file.DumpSubfile(internal_file, file_contents);
+                        begin_contents(file_contents.size());
+                        std::cout << file_contents;
+                    } else {
+                        // decoding overlaps writing the output
+                        saved_game_file.PipeSubfile(
+                            internal_file,
+                            begin_contents,
+                            [](const char* buffer, size_t buffer_size) {
+                                std::cout.write(buffer, buffer_size);
+                                return static_cast<bool>(std::cout);
+                            }
+                        );
+                    }
+                    std::cout << std::endl;
                     std::cout << "---------------------------------------------------------------" << std::endl;
                     std::cout << "End File Contents " << std::endl;
                     std::cout << "---------------------------------------------------------------" << std::endl;
                 } else {
-                    boost::system::error_code json_parser_error;
-                    boost::json::value json_data = boost::json::parse(file_contents.c_str(), json_parser_error);
-                    if (json_parser_error) {
-                        std::cerr << "Error parsing JSON content: " << json_parser_error.message() << std::endl;
+                    if (!journal.HasPending(internal_file)
+                        && !saved_game_file.ViewSubfile(internal_file, file_view)
+                        && !saved_game_file.IsBinarySubfile(internal_file, binary)) {
                         break;
                     }
-                    try {
-                        boost::json::object& jd_obj = json_data.as_object();
-                        std::cout << "Parsed JSON data" << std::endl;
-                        std::cout << "Key " << read_key << " = " << jd_obj[read_key] << std::endl;
-                    } catch (const std::exception& e) {
-                        std::cerr << "[DUMP] JSON Decode Error: " << e.what() << std::endl;
+                    if (binary) {
+                        // the stored bytes; DumpSubfile would hand back JSON
+                        saved_game_file.StreamSubfile(
+                            internal_file,
+                            [&file_contents](const char* buffer, size_t buffer_size) {
+                                file_contents.append(buffer, buffer_size);
+                                return true;
+                            }
+                        );
+                        file_view = file_contents;
+                    }
+                    if (saved_game_format_file::binary_json::IsEncoded(file_view)) {
+                        std::cout << "File Contents Size: " << file_view.size() << std::endl;
+
+                        // hops over item headers; no text is scanned at all
+                        std::string_view item;
+                        std::string key_value;
+                        if (!saved_game_format_file::binary_json::Find(file_view, read_key, item)
+                            || !saved_game_format_file::binary_json::ToJson(item, key_value)) {
+                            std::cerr << "[DUMP] Unable to locate key " << read_key << std::endl;
+                            break;
+                        }
+                        std::cout << "Key " << read_key << " = " << key_value << std::endl;
+                        break;
+                    }
+                    if (journal.HasPending(internal_file) || file_view.empty()) {
+                        saved_game_file.DumpSubfile(internal_file, file_contents);
+                        if (!journal.Overlay(internal_file, file_contents)) {
+                            break;
+                        }
+                        file_view = file_contents;
+                    }
+                    std::cout << "File Contents Size: " << file_view.size() << std::endl;
+
+                    if (saved_game_format_file::EngineTextIndex::Recognize(file_view)) {
+                        // only the line breaks and variable names are read
+                        // before the lookup
+                        saved_game_format_file::EngineTextIndex text_index;
+                        std::string key_value;
+                        if (!text_index.Build(file_view) || !text_index.Find(file_view, read_key, key_value)) {
+                            std::cerr << "[DUMP] Unable to locate key " << read_key << std::endl;
+                            break;
+                        }
+                        std::cout << "Key " << read_key << " = " << key_value << std::endl;
+                        break;
+                    }
+
+                    // scanned only as far as the value, without building a DOM
+                    std::string_view key_value;
+                    if (!saved_game_format_file::json_pointer::Find(file_view, read_key, key_value)) {
+                        std::cerr << "[DUMP] Unable to locate key " << read_key << std::endl;
+                        break;
                     }
+                    std::cout << "Key " << read_key << " = " << key_value << std::endl;
+                }
+            }
+            break;
+        case COMMAND_COMPACT:
+            {
+                std::cout << "Compact archive" << std::endl;
+                std::cout << "Dead Bytes: " << saved_game_file.DeadBytes() << std::endl;
+                // writing the journaled edits out leaves no dead bytes either
+                bool compacted = exports_journal
+                    ? journal.Export(saved_game_file, {}, output_file)
+                    : saved_game_file.Compact(output_file);
+                if (!compacted) {
+                    std::cerr << "Unable to compact " << saved_game_file.filename << std::endl;
+                    exit_code = SGF_LOAD_FILE_FAILED;
+                }
+            }
+            break;
+        case COMMAND_VERIFY:
+            {
+                std::cout << "Verify members" << std::endl;
+                std::cout << "CRC-32: " << saved_game_format_file::checksum::Crc32Implementation() << std::endl;
+                saved_game_format_file::VerifyOptions verify_options;
+                verify_options.check_contents = check_contents;
+                verify_options.threads = saved_game_file.save_settings.threads;
+                saved_game_format_file::VerifyStats verify_stats;
+                auto verify_started = std::chrono::steady_clock::now();
+                // one line per member as it is checked: status, size, CRC, name
+                bool verified = saved_game_format_file::VerifySave(
+                    saved_game_file, verify_options,
+                    [](const saved_game_format_file::MemberCheck& check) {
+                        char crc[9] = "-";
+                        if (check.has_crc) {
+                            snprintf(crc, sizeof(crc), "%08x", check.crc32);
+                        }
+                        std::cout << "\t" << (check.success ? "OK" : "FAILED") << "\t" << check.size << "\t" << crc
+                            << "\t" << check.subfile << "\t" << check.status << std::endl;
+                    },
+                    verify_stats
+                );
+                double verify_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - verify_started).count();
+                std::cout << "Members: " << verify_stats.members << std::endl;
+                std::cout << "Failed: " << verify_stats.failed << std::endl;
+                std::cout << "Member Bytes: " << verify_stats.bytes << std::endl;
+                std::cout << "Seconds: " << verify_seconds << std::endl;
+                if (!verified) {
+                    std::cerr << saved_game_file.filename << " failed verification" << std::endl;
+                    exit_code = SGF_LOAD_FILE_FAILED;
+                }
+            }
+            break;
+        case COMMAND_RECOMPRESS:
+            {
+                // --format, --codec, --level, --encoding and --frame_size
+                // apply to every member
+                std::cout << "Recompress archive" << std::endl;
+                saved_game_file.atomic_save = true;
+                saved_game_file.save_settings.recompress = true;
+                bool recompressed = exports_journal
+                    ? journal.Export(saved_game_file, {}, output_file)
+                    : saved_game_file.UpdateSubfiles(output_file, saved_game_format_file::SavedGameFormatFile::replacement_map());
+                if (!recompressed) {
+                    std::cerr << "Unable to recompress " << saved_game_file.filename << std::endl;
+                    exit_code = SGF_LOAD_FILE_FAILED;
+                }
+            }
+            break;
+        case COMMAND_BATCH:
+            {
+                std::cout << "Apply edit script" << std::endl;
+                std::string script;
+                if (!read_edit_script(batch_file, script)) {
+                    return SGF_INVALID_PARAMETER;
+                }
+
+                std::vector<saved_game_format_file::KeyEdit> edits;
+                if (!saved_game_format_file::ParseEditScript(script, edits)) {
+                    return SGF_INVALID_PARAMETER;
+                }
+                std::cout << "Edit Count: " << edits.size() << std::endl;
+                bool applied = exports_journal
+                    ? journal.Export(saved_game_file, edits, output_file)
+                    : saved_game_format_file::ApplyKeyEdits(saved_game_file, edits, output_file);
+                if (!applied) {
+                    std::cerr << "Edit script was not applied" << std::endl;
+                    exit_code = SGF_LOAD_FILE_FAILED;
+                }
+            }
+            break;
+        case COMMAND_CHECKPOINT:
+            {
+                std::cout << "Checkpoint journal" << std::endl;
+                std::cout << "Journaled Edits: " << journal.Pending().size() << std::endl;
+                if (!journal.Checkpoint(saved_game_file)) {
+                    std::cerr << "Unable to checkpoint " << journal.filename << std::endl;
+                    exit_code = SGF_LOAD_FILE_FAILED;
+                }
+            }
+            break;
+        case COMMAND_STORE:
+            {
+                std::cout << "Store snapshot" << std::endl;
+                if (store_directory.empty() || snapshot_name.empty()) {
+                    std::cerr << "The store command needs --store and --snapshot" << std::endl;
+                    return SGF_INVALID_PARAMETER;
+                }
+                saved_game_format_file::SaveStore store(store_directory);
+                saved_game_format_file::StoreStats store_stats;
+                if (!store.Open() || !store.Put(saved_game_file, &journal, snapshot_name, store_stats)) {
+                    std::cerr << "Unable to store " << saved_game_file.filename << std::endl;
+                    exit_code = SGF_LOAD_FILE_FAILED;
+                    break;
+                }
+                std::cout << "Member Count: " << store_stats.members << std::endl;
+                std::cout << "Chunk Count: " << store_stats.chunks << " (" << store_stats.new_chunks << " new)" << std::endl;
+                std::cout << "Member Bytes: " << store_stats.bytes << " (" << store_stats.new_bytes << " new)" << std::endl;
+                std::cout << "Stored Bytes: " << store_stats.stored_bytes << std::endl;
+            }
+            break;
+        case COMMAND_DIFF:
+            {
+                std::cout << "Diff against target" << std::endl;
+                if (target_file.empty() || patch_file.empty()) {
+                    std::cerr << "The diff command needs --target and --patch" << std::endl;
+                    return SGF_INVALID_PARAMETER;
+                }
+                saved_game_format_file::SavedGameFormatFile target_save(target_file);
+                target_save.memory_mapped = saved_game_file.memory_mapped;
+                saved_game_format_file::EditJournal target_journal(target_file);
+                if (!target_save.Validate() || !target_journal.Load()) {
+                    std::cerr << "Unable to load " << target_file << std::endl;
+                    return SGF_LOAD_FILE_FAILED;
+                }
 
+                std::string patch;
+                saved_game_format_file::DeltaStats delta_stats;
+                if (!saved_game_format_file::DiffSaves(saved_game_file, &journal, target_save, &target_journal, patch, delta_stats)) {
+                    std::cerr << "Unable to diff " << saved_game_file.filename << " and " << target_file << std::endl;
+                    exit_code = SGF_LOAD_FILE_FAILED;
+                    break;
+                }
+                saved_game_format_file::AtomicFile output;
+                FILE* patch_output = output.Open(patch_file);
+                if (patch_output == nullptr
+                    || fwrite(patch.data(), 1, patch.size(), patch_output) != patch.size()
+                    || !output.Commit()) {
+                    std::cerr << "Unable to write " << patch_file << std::endl;
+                    exit_code = SGF_LOAD_FILE_FAILED;
+                    break;
+                }
+                std::cout << "Unchanged Members: " << delta_stats.unchanged << std::endl;
+                std::cout << "Changed Members: " << delta_stats.changed << std::endl;
+                std::cout << "Added Members: " << delta_stats.added << std::endl;
+                std::cout << "Removed Members: " << delta_stats.removed << std::endl;
+                std::cout << "Member Bytes: " << delta_stats.member_bytes << std::endl;
+                std::cout << "Patch Bytes: " << delta_stats.patch_bytes << std::endl;
+            }
+            break;
+        case COMMAND_QUERY:
+            {
+                std::cout << "Query members" << std::endl;
+                if (read_key.empty()) {
+                    std::cerr << "Missing key to query" << std::endl;
+                    return SGF_INVALID_PARAMETER;
+                }
+                saved_game_format_file::SaveQuery query;
+                query.key = read_key;
+                if (vm.count("match_value")) {
+                    query.value_json = saved_game_format_file::json_pointer::Quote(match_value);
+                }
+                query.subfile_prefix = internal_file;
+                query.threads = saved_game_file.save_settings.threads;
+                saved_game_format_file::QueryStats query_stats;
+                // matches are printed as they are found: member, key, value
+                bool success = saved_game_format_file::QuerySave(
+                    saved_game_file, query, &journal,
+                    [](const saved_game_format_file::QueryMatch& match) {
+                        std::cout << match.subfile << "\t" << match.key << "\t" << match.value_json << std::endl;
+                    },
+                    query_stats
+                );
+                std::cout << "Members Searched: " << query_stats.members << std::endl;
+                std::cout << "Matching Members: " << query_stats.matched_members << std::endl;
+                std::cout << "Matches: " << query_stats.matches << std::endl;
+                if (!success) {
+                    std::cerr << "Query did not complete" << std::endl;
+                    exit_code = SGF_LOAD_FILE_FAILED;
                 }
             }
             break;
+        case COMMAND_PATCH:
+            {
+                std::cout << "Apply patch" << std::endl;
+                std::ifstream patch_stream(patch_file, std::ios::binary);
+                if (!patch_stream) {
+                    std::cerr << "Unable to open patch " << patch_file << std::endl;
+                    return SGF_INVALID_PARAMETER;
+                }
+                std::string patch((std::istreambuf_iterator<char>(patch_stream)), std::istreambuf_iterator<char>());
+                saved_game_format_file::DeltaStats delta_stats;
+                // the journaled edits go into the output first, which is
+                // then patched where it lies
+                saved_game_format_file::SavedGameFormatFile exported(output_file);
+                exported.memory_mapped = saved_game_file.memory_mapped;
+                exported.atomic_save = saved_game_file.atomic_save;
+                exported.save_settings = saved_game_file.save_settings;
+                exported.verify_on_save = saved_game_file.verify_on_save;
+                if (exports_journal && !journal.Export(saved_game_file, {}, output_file)) {
+                    std::cerr << "Patch was not applied" << std::endl;
+                    exit_code = SGF_LOAD_FILE_FAILED;
+                    break;
+                }
+                bool patched = exports_journal
+                    ? saved_game_format_file::PatchSave(exported, patch, "", delta_stats)
+                    : saved_game_format_file::PatchSave(saved_game_file, patch, output_file, delta_stats);
+                if (!patched) {
+                    std::cerr << "Patch was not applied" << std::endl;
+                    exit_code = SGF_LOAD_FILE_FAILED;
+                    break;
+                }
+                std::cout << "Changed Members: " << delta_stats.changed << std::endl;
+                std::cout << "Added Members: " << delta_stats.added << std::endl;
+                std::cout << "Removed Members: " << delta_stats.removed << std::endl;
+            }
+            break;
         default:
             std::cout << "Unknown Operation" << std::endl;
             break;
     };
+    SGF_STATS_STOP(command_timer);
+
+    // one line, last, so it can be cut out of the rest of the output
+    if (stats_format == stJson) {
+        std::cout << saved_game_format_file::stats::Json() << std::endl;
+    }
 
-    return SGF_OKAY;
+    return exit_code;
 }
@@ -17,6 +17,39 @@ std::ostream& operator<< (std::ostream& out, ProgramCommand pc) {
         case COMMAND_DUMP:
             out<<pcDump;
             break;
+        case COMMAND_COMPACT:
+            out<<pcCompact;
+            break;
+        case COMMAND_BATCH:
+            out<<pcBatch;
+            break;
+        case COMMAND_SERVE:
+            out<<pcServe;
+            break;
+        case COMMAND_CHECKPOINT:
+            out<<pcCheckpoint;
+            break;
+        case COMMAND_STORE:
+            out<<pcStore;
+            break;
+        case COMMAND_RESTORE:
+            out<<pcRestore;
+            break;
+        case COMMAND_DIFF:
+            out<<pcDiff;
+            break;
+        case COMMAND_PATCH:
+            out<<pcPatch;
+            break;
+        case COMMAND_QUERY:
+            out<<pcQuery;
+            break;
+        case COMMAND_RECOMPRESS:
+            out<<pcRecompress;
+            break;
+        case COMMAND_VERIFY:
+            out<<pcVerify;
+            break;
         default:
             out<<"UNKONWN";
             break;
@@ -36,6 +69,177 @@ std::istream& operator>> (std::istream &in, ProgramCommand &command) {
         command = COMMAND_DUMP;
     } else if (token == pcList) {
         command = COMMAND_LIST;
+    } else if (token == pcCompact) {
+        command = COMMAND_COMPACT;
+    } else if (token == pcBatch) {
+        command = COMMAND_BATCH;
+    } else if (token == pcServe) {
+        command = COMMAND_SERVE;
+    } else if (token == pcCheckpoint) {
+        command = COMMAND_CHECKPOINT;
+    } else if (token == pcStore) {
+        command = COMMAND_STORE;
+    } else if (token == pcRestore) {
+        command = COMMAND_RESTORE;
+    } else if (token == pcDiff) {
+        command = COMMAND_DIFF;
+    } else if (token == pcPatch) {
+        command = COMMAND_PATCH;
+    } else if (token == pcQuery) {
+        command = COMMAND_QUERY;
+    } else if (token == pcRecompress) {
+        command = COMMAND_RECOMPRESS;
+    } else if (token == pcVerify) {
+        command = COMMAND_VERIFY;
+    } else {
+        throw boost::program_options::validation_error(
+            boost::program_options::validation_error::invalid_option_value,
+            "Invalid Argument"
+        );
+    }
+
+    return in;
+}
+
+std::ostream& saved_game_format_file::operator<< (std::ostream& out, SaveFormat format) {
+    switch (format) {
+        case saved_game_format_file::SAVE_FORMAT_AUTO:
+            out<<sfAuto;
+            break;
+        case saved_game_format_file::SAVE_FORMAT_ZIP:
+            out<<sfZip;
+            break;
+        case saved_game_format_file::SAVE_FORMAT_GNUTAR:
+            out<<sfGnutar;
+            break;
+        case saved_game_format_file::SAVE_FORMAT_PAX:
+            out<<sfPax;
+            break;
+        case saved_game_format_file::SAVE_FORMAT_USTAR:
+            out<<sfUstar;
+            break;
+        case saved_game_format_file::SAVE_FORMAT_CPIO:
+            out<<sfCpio;
+            break;
+        default:
+            out<<"UNKONWN";
+            break;
+    };
+    return out;
+}
+
+std::istream& saved_game_format_file::operator>> (std::istream &in, SaveFormat &format) {
+    std::string token;
+    in >> token;
+    boost::to_lower(token);
+    if (token == sfAuto) {
+        format = saved_game_format_file::SAVE_FORMAT_AUTO;
+    } else if (token == sfZip) {
+        format = saved_game_format_file::SAVE_FORMAT_ZIP;
+    } else if (token == sfGnutar) {
+        format = saved_game_format_file::SAVE_FORMAT_GNUTAR;
+    } else if (token == sfPax) {
+        format = saved_game_format_file::SAVE_FORMAT_PAX;
+    } else if (token == sfUstar) {
+        format = saved_game_format_file::SAVE_FORMAT_USTAR;
+    } else if (token == sfCpio) {
+        format = saved_game_format_file::SAVE_FORMAT_CPIO;
+    } else {
+        throw boost::program_options::validation_error(
+            boost::program_options::validation_error::invalid_option_value,
+            "Invalid Argument"
+        );
+    }
+
+    return in;
+}
+
+std::ostream& saved_game_format_file::operator<< (std::ostream& out, SaveCodec codec) {
+    switch (codec) {
+        case saved_game_format_file::SAVE_CODEC_AUTO:
+            out<<scAuto;
+            break;
+        case saved_game_format_file::SAVE_CODEC_NONE:
+            out<<scNone;
+            break;
+        case saved_game_format_file::SAVE_CODEC_GZIP:
+            out<<scGzip;
+            break;
+        case saved_game_format_file::SAVE_CODEC_BZIP2:
+            out<<scBzip2;
+            break;
+        case saved_game_format_file::SAVE_CODEC_XZ:
+            out<<scXz;
+            break;
+        case saved_game_format_file::SAVE_CODEC_ZSTD:
+            out<<scZstd;
+            break;
+        case saved_game_format_file::SAVE_CODEC_LZ4:
+            out<<scLz4;
+            break;
+        default:
+            out<<"UNKONWN";
+            break;
+    };
+    return out;
+}
+
+std::istream& saved_game_format_file::operator>> (std::istream &in, SaveCodec &codec) {
+    std::string token;
+    in >> token;
+    boost::to_lower(token);
+    if (token == scAuto) {
+        codec = saved_game_format_file::SAVE_CODEC_AUTO;
+    } else if (token == scNone) {
+        codec = saved_game_format_file::SAVE_CODEC_NONE;
+    } else if (token == scGzip || token == scDeflate) {
+        codec = saved_game_format_file::SAVE_CODEC_GZIP;
+    } else if (token == scBzip2) {
+        codec = saved_game_format_file::SAVE_CODEC_BZIP2;
+    } else if (token == scXz) {
+        codec = saved_game_format_file::SAVE_CODEC_XZ;
+    } else if (token == scZstd) {
+        codec = saved_game_format_file::SAVE_CODEC_ZSTD;
+    } else if (token == scLz4) {
+        codec = saved_game_format_file::SAVE_CODEC_LZ4;
+    } else {
+        throw boost::program_options::validation_error(
+            boost::program_options::validation_error::invalid_option_value,
+            "Invalid Argument"
+        );
+    }
+
+    return in;
+}
+
+std::ostream& saved_game_format_file::operator<< (std::ostream& out, MemberEncoding encoding) {
+    switch (encoding) {
+        case saved_game_format_file::MEMBER_ENCODING_AUTO:
+            out<<seAuto;
+            break;
+        case saved_game_format_file::MEMBER_ENCODING_JSON:
+            out<<seJson;
+            break;
+        case saved_game_format_file::MEMBER_ENCODING_CBOR:
+            out<<seCbor;
+            break;
+        default:
+            out<<"UNKONWN";
+            break;
+    };
+    return out;
+}
+
+std::istream& saved_game_format_file::operator>> (std::istream &in, MemberEncoding &encoding) {
+    std::string token;
+    in >> token;
+    boost::to_lower(token);
+    if (token == seAuto) {
+        encoding = saved_game_format_file::MEMBER_ENCODING_AUTO;
+    } else if (token == seJson) {
+        encoding = saved_game_format_file::MEMBER_ENCODING_JSON;
+    } else if (token == seCbor) {
+        encoding = saved_game_format_file::MEMBER_ENCODING_CBOR;
     } else {
         throw boost::program_options::validation_error(
             boost::program_options::validation_error::invalid_option_value,
@@ -4,19 +4,79 @@
 #include <string>
 #include <iostream>
 
+#include "save_settings.h"
+
 const std::string pcAdd("add");
+const std::string pcBatch("batch");
+const std::string pcCheckpoint("checkpoint");
+const std::string pcCompact("compact");
+const std::string pcDiff("diff");
 const std::string pcDump("dump");
 const std::string pcList("list");
+const std::string pcPatch("patch");
+const std::string pcQuery("query");
+const std::string pcRecompress("recompress");
+// edit script op only
+const std::string pcRemove("remove");
+const std::string pcRestore("restore");
+const std::string pcServe("serve");
+const std::string pcStore("store");
 const std::string pcUpdate("update");
+const std::string pcVerify("verify");
+
+const std::string sfAuto("auto");
+const std::string sfZip("zip");
+const std::string sfGnutar("gnutar");
+const std::string sfPax("pax");
+const std::string sfUstar("ustar");
+const std::string sfCpio("cpio");
+
+const std::string scAuto("auto");
+const std::string scNone("none");
+const std::string scGzip("gzip");
+const std::string scDeflate("deflate");
+const std::string scBzip2("bzip2");
+const std::string scXz("xz");
+const std::string scZstd("zstd");
+const std::string scLz4("lz4");
+
+const std::string seAuto("auto");
+const std::string seJson("json");
+const std::string seCbor("cbor");
+
+// --stats report formats
+const std::string stNone("none");
+const std::string stJson("json");
 
 enum ProgramCommand {
     COMMAND_LIST=0,
     COMMAND_ADD,
     COMMAND_DUMP,
     COMMAND_UPDATE,
+    COMMAND_COMPACT,
+    COMMAND_BATCH,
+    COMMAND_SERVE,
+    COMMAND_CHECKPOINT,
+    COMMAND_STORE,
+    COMMAND_RESTORE,
+    COMMAND_DIFF,
+    COMMAND_PATCH,
+    COMMAND_QUERY,
+    COMMAND_RECOMPRESS,
+    COMMAND_VERIFY,
 };
 
 std::ostream& operator<< (std::ostream& out, ProgramCommand pc);
 std::istream& operator>> (std::istream &in, ProgramCommand &command);
 
+namespace saved_game_format_file {
+    // found by argument dependent lookup from boost::program_options
+    std::ostream& operator<< (std::ostream& out, SaveFormat format);
+    std::istream& operator>> (std::istream &in, SaveFormat &format);
+    std::ostream& operator<< (std::ostream& out, SaveCodec codec);
+    std::istream& operator>> (std::istream &in, SaveCodec &codec);
+    std::ostream& operator<< (std::ostream& out, MemberEncoding encoding);
+    std::istream& operator>> (std::istream &in, MemberEncoding &encoding);
+}
+
 #endif //SAVED_GAME_FORMAT_MAIN_OPTIONS_H__
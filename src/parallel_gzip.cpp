@@ -0,0 +1,143 @@
+#include <cerrno>
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+#include <zlib.h>
+
+#include "checksum.h"
+#include "parallel_gzip.h"
+
+using namespace saved_game_format_file;
+
+namespace {
+
+    // input handed to each task; large enough that the sync markers
+    // between blocks cost next to nothing
+    const size_t BLOCK_SIZE = 128 * 1024;
+    // deflate can refer back at most this far
+    const size_t DICTIONARY_SIZE = 32 * 1024;
+    // blocks in flight per worker before the writer waits
+    const size_t BLOCKS_PER_WORKER = 2;
+
+    const unsigned char GZIP_HEADER[10] = {
+        0x1f, 0x8b,             // magic
+        8,                      // deflate
+        0,                      // no flags
+        0, 0, 0, 0,             // no modification time
+        0,                      // no extra flags
+        3,                      // Unix
+    };
+
+    void append_u32(std::string& buffer, uint32_t value) {
+        for (int i = 0; i < 4; ++i) {
+            buffer.push_back(static_cast<char>((value >> (8 * i)) & 0xff));
+        }
+    }
+
+}
+
+bool ParallelGzip::Write(const void* buffer, size_t length) {
+    const char* input = static_cast<const char*>(buffer);
+    while (length > 0 && !failed) {
+        if (!current) {
+            current = std::make_shared<std::string>();
+            current->reserve(BLOCK_SIZE);
+        }
+        size_t take = std::min(length, BLOCK_SIZE - current->size());
+        current->append(input, take);
+        input += take;
+        length -= take;
+        total_in += take;
+        if (current->size() == BLOCK_SIZE) {
+            submit(false);
+            if (!drain(BLOCKS_PER_WORKER * pool.Size())) {
+                return false;
+            }
+        }
+    }
+    return !failed;
+}
+
+bool ParallelGzip::Finish() {
+    // the final block carries the end of stream marker, even if it is empty
+    submit(true);
+    if (!drain(0)) {
+        return false;
+    }
+    std::string trailer;
+    append_u32(trailer, crc);
+    append_u32(trailer, static_cast<uint32_t>(total_in & 0xffffffff));
+    return write(trailer.data(), trailer.size());
+}
+
+void ParallelGzip::submit(bool last) {
+    std::shared_ptr<const std::string> block = current ? current : std::make_shared<std::string>();
+    std::shared_ptr<const std::string> dictionary = previous;
+    int block_level = level;
+    pending.push_back(pool.Submit([block, dictionary, block_level, last]() {
+        block_result result;
+        result.length = block->size();
+        result.crc32 = checksum::Crc32(0, block->data(), block->size());
+
+        z_stream deflater;
+        memset(&deflater, 0, sizeof(deflater));
+        if (deflateInit2(&deflater, block_level, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+            return result;
+        }
+        if (dictionary && !dictionary->empty()) {
+            size_t dictionary_size = std::min(dictionary->size(), DICTIONARY_SIZE);
+            deflateSetDictionary(
+                &deflater,
+                reinterpret_cast<const Bytef*>(dictionary->data() + dictionary->size() - dictionary_size),
+                static_cast<uInt>(dictionary_size)
+            );
+        }
+        // room for the sync marker on top of the worst case
+        result.data.resize(deflateBound(&deflater, static_cast<uLong>(block->size())) + 16);
+        deflater.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(block->data()));
+        deflater.avail_in = static_cast<uInt>(block->size());
+        deflater.next_out = reinterpret_cast<Bytef*>(&result.data[0]);
+        deflater.avail_out = static_cast<uInt>(result.data.size());
+        int zerr = deflate(&deflater, last ? Z_FINISH : Z_SYNC_FLUSH);
+        result.data.resize(deflater.total_out);
+        deflateEnd(&deflater);
+        result.success = last ? (zerr == Z_STREAM_END) : (zerr == Z_OK && deflater.avail_in == 0);
+        return result;
+    }));
+    previous = block;
+    current.reset();
+}
+
+bool ParallelGzip::drain(size_t keep) {
+    while (pending.size() > keep) {
+        block_result result = pending.front().get();
+        pending.pop_front();
+        if (!result.success) {
+            std::cerr << "Error deflating gzip block" << std::endl;
+            failed = true;
+        }
+        if (failed) {
+            continue;
+        }
+        crc = crc32_combine(crc, result.crc32, static_cast<z_off_t>(result.length));
+        if (!write(result.data.data(), result.data.size())) {
+            failed = true;
+        }
+    }
+    return !failed;
+}
+
+bool ParallelGzip::write(const void* buffer, size_t length) {
+    if (!started) {
+        started = true;
+        if (!write(GZIP_HEADER, sizeof(GZIP_HEADER))) {
+            return false;
+        }
+    }
+    if (length != 0 && fwrite(buffer, 1, length, output) != length) {
+        std::cerr << "unable to write gzip data, errno " << errno << std::endl;
+        return false;
+    }
+    return true;
+}
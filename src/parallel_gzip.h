@@ -0,0 +1,59 @@
+#ifndef SAVED_GAME_FORMAT_PARALLEL_GZIP_H__
+#define SAVED_GAME_FORMAT_PARALLEL_GZIP_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <future>
+#include <memory>
+#include <string>
+
+#include "thread_pool.h"
+
+namespace saved_game_format_file {
+
+    // Writes a single gzip member, compressing fixed size blocks of the
+    // input on a thread pool the way pigz does: each block is deflated on
+    // its own, primed with the 32 KiB before it so the ratio barely suffers,
+    // and ended on a byte boundary so the pieces can simply be concatenated.
+    // The CRCs of the blocks are combined for the trailer.
+    class ParallelGzip {
+        public:
+            ParallelGzip(FILE* _output, int _level, ThreadPool& _pool) : output(_output), level(_level), pool(_pool) {}
+
+            bool Write(const void* buffer, size_t length);
+            // compress what is left and write the gzip trailer
+            bool Finish();
+
+            // uncompressed bytes taken so far
+            inline uint64_t Size() const { return total_in; }
+
+        private:
+            struct block_result {
+                bool success{false};
+                std::string data{};
+                uint32_t crc32{0};
+                size_t length{0};
+            };
+
+            void submit(bool last);
+            bool drain(size_t keep);
+            bool write(const void* buffer, size_t length);
+
+            FILE* output;
+            int level;
+            ThreadPool& pool;
+
+            bool started{false};
+            bool failed{false};
+            std::shared_ptr<std::string> current{};
+            std::shared_ptr<const std::string> previous{};
+            std::deque<std::future<block_result>> pending{};
+            uint32_t crc{0};
+            uint64_t total_in{0};
+    };
+
+}
+
+#endif //SAVED_GAME_FORMAT_PARALLEL_GZIP_H__
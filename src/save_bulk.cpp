@@ -0,0 +1,333 @@
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <set>
+
+#include <boost/algorithm/string.hpp>
+#include <boost/filesystem.hpp>
+
+#include "binary_json.h"
+#include "edit_journal.h"
+#include "engine_text.h"
+#include "json_pointer.h"
+#include "save_bulk.h"
+#include "save_verify.h"
+#include "sgf_file.h"
+#include "work_stealing.h"
+
+using namespace saved_game_format_file;
+
+namespace {
+
+    const std::string JOURNAL_SUFFIX(".journal");
+
+    // Bytes held by the saves in progress. Acquire waits until the new
+    // amount fits, or until nothing else is held, so one oversized save
+    // still gets to run on its own.
+    class memory_budget {
+        public:
+            explicit memory_budget(int64_t _limit) : limit(_limit) {}
+
+            void Acquire(int64_t amount) {
+                std::unique_lock<std::mutex> guard(lock);
+                released.wait(guard, [this, amount]() { return held == 0 || held + amount <= limit; });
+                held += amount;
+            }
+
+            void Release(int64_t amount) {
+                {
+                    std::lock_guard<std::mutex> guard(lock);
+                    held -= amount;
+                }
+                released.notify_all();
+            }
+
+        private:
+            int64_t limit{0};
+            int64_t held{0};
+            std::mutex lock{};
+            std::condition_variable released{};
+    };
+
+    // holds its share of the budget until the save is done with
+    class budget_hold {
+        public:
+            budget_hold(memory_budget& _budget, int64_t _amount) : budget(_budget), amount(_amount) {
+                budget.Acquire(amount);
+            }
+            ~budget_hold() { budget.Release(amount); }
+
+            budget_hold(const budget_hold&) = delete;
+            budget_hold& operator=(const budget_hold&) = delete;
+
+        private:
+            memory_budget& budget;
+            int64_t amount{0};
+    };
+
+    // decoded bytes of a member, 0 if it isn't there
+    int64_t member_size(const SavedGameFormatFile& save, const std::string& subfile_name) {
+        const ArchiveEntry* entry = save.GetIndex().Find(subfile_name);
+        return (entry == nullptr) ? 0 : entry->uncompressed_size;
+    }
+
+    // Memory the operation needs beyond the archive itself: the members it
+    // reads, twice over for edits (the member and its scratch copy)
+    int64_t working_set(const SavedGameFormatFile& save, const BulkJob& job) {
+        int64_t needed = 0;
+        switch (job.operation) {
+            case BULK_DUMP:
+                needed = member_size(save, job.subfile);
+                break;
+            case BULK_EDIT:
+                {
+                    std::set<std::string> members;
+                    for (const auto& edit : job.edits) {
+                        if (members.insert(edit.subfile).second) {
+                            needed += 2 * member_size(save, edit.subfile);
+                        }
+                    }
+                }
+                break;
+            case BULK_RECOMPRESS:
+            case BULK_VERIFY:
+                // members are decoded one at a time
+                for (const auto& entry : save.GetIndex().Entries()) {
+                    needed = std::max(needed, entry.uncompressed_size);
+                }
+                break;
+            default:
+                break;
+        }
+        return needed;
+    }
+
+    // one key of a member, which may be binary, engine text or JSON text
+    bool read_key(SavedGameFormatFile& save, const EditJournal& journal, const BulkJob& job, std::string& value_json) {
+        std::string contents;
+        if (journal.HasPending(job.subfile)) {
+            // edits apply to the JSON text
+            save.DumpSubfile(job.subfile, contents);
+            if (!journal.Overlay(job.subfile, contents)) {
+                return false;
+            }
+        } else {
+            // as stored; binary members are searched without decoding
+            bool read = save.StreamSubfile(job.subfile, [&contents](const char* buffer, size_t buffer_size) {
+                contents.append(buffer, buffer_size);
+                return true;
+            });
+            if (!read) {
+                return false;
+            }
+        }
+
+        if (binary_json::IsEncoded(contents)) {
+            std::string_view item;
+            return binary_json::Find(contents, job.key, item) && binary_json::ToJson(item, value_json);
+        }
+        if (EngineTextIndex::Recognize(contents)) {
+            EngineTextIndex index;
+            return index.Build(contents) && index.Find(contents, job.key, value_json);
+        }
+        std::string_view found;
+        if (!json_pointer::Find(contents, job.key, found)) {
+            return false;
+        }
+        value_json.assign(found);
+        return true;
+    }
+
+    void process_save(const std::string& filename, const BulkJob& job, memory_budget& budget, BulkResult& result) {
+        SavedGameFormatFile save(filename);
+        save.memory_mapped = job.memory_mapped;
+        // an in-place update with nothing to replace writes nothing
+        save.atomic_save = job.atomic_save || job.operation == BULK_RECOMPRESS;
+        save.save_settings = job.save_settings;
+        save.verify_on_save = job.verify_on_save;
+        // the pool already keeps every core busy
+        save.save_settings.threads = 1;
+
+        boost::system::error_code fs_error;
+        uintmax_t file_size = boost::filesystem::file_size(filename, fs_error);
+        if (fs_error || !save.Validate()) {
+            result.error = "unable to open";
+            return;
+        }
+        result.bytes = static_cast<int64_t>(file_size);
+
+        EditJournal journal(filename);
+        if (!journal.Load()) {
+            result.error = "unable to read " + journal.filename;
+            return;
+        }
+        // anything that writes the save folds pending edits in first
+        bool writes_file = job.operation == BULK_EDIT || job.operation == BULK_RECOMPRESS;
+        if (writes_file && !journal.Empty() && !journal.Checkpoint(save)) {
+            result.error = "unable to checkpoint " + journal.filename;
+            return;
+        }
+        if (!save.BuildIndex()) {
+            result.error = "unable to index";
+            return;
+        }
+
+        budget_hold hold(budget, result.bytes + working_set(save, job));
+        switch (job.operation) {
+            case BULK_LIST:
+                for (const auto& entry : save.GetIndex().Entries()) {
+                    result.output.append(filename).append("\t").append(entry.name).append("\n");
+                }
+                result.success = true;
+                break;
+            case BULK_DUMP:
+                {
+                    if (save.GetIndex().Find(job.subfile) == nullptr && !journal.HasPending(job.subfile)) {
+                        result.error = "no member " + job.subfile;
+                        break;
+                    }
+                    if (!job.key.empty()) {
+                        std::string value_json;
+                        if (!read_key(save, journal, job, value_json)) {
+                            result.error = "unable to locate key " + job.key;
+                            break;
+                        }
+                        result.output.append(filename).append("\t").append(job.key).append("\t").append(value_json).append("\n");
+                        result.success = true;
+                        break;
+                    }
+                    std::string contents;
+                    save.DumpSubfile(job.subfile, contents);
+                    if (!journal.Overlay(job.subfile, contents)) {
+                        result.error = "unable to apply " + journal.filename;
+                        break;
+                    }
+                    result.output.append(filename).append("\t").append(job.subfile).append("\t").append(std::to_string(contents.size())).append("\n");
+                    result.output.append(contents).append("\n");
+                    result.success = true;
+                }
+                break;
+            case BULK_EDIT:
+                if (!ApplyKeyEdits(save, job.edits, "")) {
+                    result.error = "edits were not applied";
+                    break;
+                }
+                result.output.append(filename).append("\t").append(std::to_string(job.edits.size())).append(" edit(s)\n");
+                result.success = true;
+                break;
+            case BULK_RECOMPRESS:
+                {
+                    if (!save.UpdateSubfiles("", SavedGameFormatFile::replacement_map())) {
+                        result.error = "unable to rewrite";
+                        break;
+                    }
+                    uintmax_t new_size = boost::filesystem::file_size(filename, fs_error);
+                    result.output.append(filename).append("\t").append(std::to_string(file_size)).append(" -> ");
+                    result.output.append(fs_error ? std::string("?") : std::to_string(new_size)).append(" bytes\n");
+                    result.success = true;
+                }
+                break;
+            case BULK_VERIFY:
+                {
+                    VerifyOptions options;
+                    options.check_contents = job.check_contents;
+                    options.threads = 1;
+                    VerifyStats verify_stats;
+                    result.success = VerifySave(save, options, [&](const MemberCheck& check) {
+                        if (!check.success) {
+                            result.output.append(filename).append("\t").append(check.subfile).append("\t").append(check.status).append("\n");
+                        }
+                    }, verify_stats);
+                    if (!result.success) {
+                        result.error = std::to_string(verify_stats.failed) + " damaged member(s)";
+                        break;
+                    }
+                    result.output.append(filename).append("\t").append(std::to_string(verify_stats.members)).append(" member(s) ok\n");
+                }
+                break;
+        }
+    }
+
+}
+
+bool saved_game_format_file::CollectSaves(const std::string& source, std::vector<std::string>& files) {
+    files.clear();
+    boost::system::error_code fs_error;
+    if (boost::filesystem::is_directory(source, fs_error)) {
+        boost::filesystem::recursive_directory_iterator entries(source, fs_error);
+        for (; !fs_error && entries != boost::filesystem::recursive_directory_iterator(); entries.increment(fs_error)) {
+            if (!boost::filesystem::is_regular_file(entries->status())) {
+                continue;
+            }
+            // journals belong to their saves; dot files are temporary
+            // copies being written (see atomic_file.h)
+            std::string name = entries->path().filename().string();
+            if (boost::algorithm::ends_with(name, JOURNAL_SUFFIX) || boost::algorithm::starts_with(name, ".")) {
+                continue;
+            }
+            files.push_back(entries->path().string());
+        }
+        if (fs_error) {
+            std::cerr << "Unable to read directory " << source << ": " << fs_error.message() << std::endl;
+            return false;
+        }
+        std::sort(files.begin(), files.end());
+        return true;
+    }
+
+    std::ifstream list_file;
+    if (source != "-") {
+        list_file.open(source);
+        if (!list_file) {
+            std::cerr << "Unable to open file list " << source << std::endl;
+            return false;
+        }
+    }
+    std::istream& list = (source == "-") ? std::cin : list_file;
+    std::string line;
+    while (std::getline(list, line)) {
+        boost::algorithm::trim(line);
+        if (!line.empty()) {
+            files.push_back(line);
+        }
+    }
+    return true;
+}
+
+bool saved_game_format_file::RunBulk(const std::vector<std::string>& files, const BulkJob& job, const bulk_sink& on_result, BulkStats& stats) {
+    stats = BulkStats();
+    auto started = std::chrono::steady_clock::now();
+    memory_budget budget(job.memory_limit);
+    std::mutex report_lock;
+
+    WorkStealingPool pool(job.threads);
+    pool.Run(files.size(), [&](size_t index, size_t) {
+        BulkResult result;
+        result.filename = files[index];
+        try {
+            process_save(result.filename, job, budget, result);
+        } catch (const std::exception& e) {
+            result.success = false;
+            result.error = e.what();
+        }
+
+        std::lock_guard<std::mutex> guard(report_lock);
+        ++stats.saves;
+        stats.bytes += result.bytes;
+        if (result.success) {
+            ++stats.succeeded;
+        } else {
+            ++stats.failed;
+            stats.failures.push_back(result.filename + ": " + result.error);
+        }
+        on_result(result);
+    });
+
+    stats.steals = pool.Steals();
+    stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+    return stats.failed == 0;
+}
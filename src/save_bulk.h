@@ -0,0 +1,93 @@
+#ifndef SAVED_GAME_FORMAT_SAVE_BULK_H__
+#define SAVED_GAME_FORMAT_SAVE_BULK_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "batch_edit.h"
+#include "save_settings.h"
+
+namespace saved_game_format_file {
+
+    enum BulkOperation {
+        // member names
+        BULK_LIST=0,
+        // a member, or one key of it
+        BULK_DUMP,
+        // apply key edits and save
+        BULK_EDIT,
+        // rewrite the save with new settings
+        BULK_RECOMPRESS,
+        // check every member (see save_verify.h)
+        BULK_VERIFY,
+    };
+
+    // One operation run over many saves
+    struct BulkJob {
+        BulkOperation operation{BULK_LIST};
+        // BULK_DUMP: the member, and the key to read from it; without a
+        // key the whole member is dumped
+        std::string subfile{};
+        std::string key{};
+        // BULK_EDIT: applied to every save, in order
+        std::vector<KeyEdit> edits{};
+        // for the saves written; compression runs on the save's own
+        // worker, so threads is ignored
+        SaveSettings save_settings{};
+        bool memory_mapped{false};
+        bool atomic_save{true};
+        // see SavedGameFormatFile::verify_on_save
+        bool verify_on_save{false};
+        // BULK_VERIFY: parse the members too
+        bool check_contents{false};
+        // saves processed at once; 0 uses every hardware thread
+        size_t threads{0};
+        // Archive and member bytes held by the saves in progress. A worker
+        // waits for room before starting a save; a save larger than the
+        // limit runs once nothing else is in flight.
+        int64_t memory_limit{512 * 1024 * 1024};
+    };
+
+    struct BulkResult {
+        std::string filename{};
+        bool success{false};
+        // why the save failed
+        std::string error{};
+        // what the operation printed for this save
+        std::string output{};
+        // archive bytes on disk
+        int64_t bytes{0};
+    };
+
+    struct BulkStats {
+        size_t saves{0};
+        size_t succeeded{0};
+        size_t failed{0};
+        int64_t bytes{0};
+        double seconds{0.0};
+        // shares of the list that moved between workers
+        size_t steals{0};
+        std::vector<std::string> failures{};
+    };
+
+    // called on one thread at a time, as each save finishes
+    typedef std::function<void(const BulkResult& result)> bulk_sink;
+
+    // The saves to process: every regular file below a directory, in name
+    // order, or one path per line of a list file ("-" reads stdin)
+    bool CollectSaves(const std::string& source, std::vector<std::string>& files);
+
+    // Run the job over every save on a work-stealing pool (see
+    // work_stealing.h). Each save is opened, processed and closed on one
+    // worker, and its journal (see edit_journal.h) is honoured the way a
+    // single run would: dumps see pending edits, writes fold them in
+    // first. A save that fails, or throws, is reported and skipped; the
+    // others carry on. Returns false if any save failed.
+    bool RunBulk(const std::vector<std::string>& files, const BulkJob& job, const bulk_sink& on_result, BulkStats& stats);
+
+}
+
+#endif //SAVED_GAME_FORMAT_SAVE_BULK_H__
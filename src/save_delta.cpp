@@ -0,0 +1,471 @@
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <map>
+#include <set>
+#include <unordered_map>
+
+#include <zlib.h>
+
+#include "save_delta.h"
+#include "sha256.h"
+#include "stats.h"
+
+using namespace saved_game_format_file;
+
+namespace {
+
+    const std::string PATCH_MAGIC("SGFPATCH");
+    const unsigned char PATCH_VERSION = 1;
+
+    // patch records
+    const char RECORD_REMOVE = 'D';
+    // the member's whole contents
+    const char RECORD_ADD = 'A';
+    const char RECORD_DELTA = 'P';
+
+    // deflate expands data by at most about 1032 to 1, so a patch body
+    // claiming more than that is damaged
+    const uint64_t MAX_INFLATE_RATIO = 1032;
+
+    // delta instructions
+    const unsigned char OP_COPY = 0;
+    const unsigned char OP_INSERT = 1;
+
+    // rolling hash multiplier; any odd constant with well mixed bits
+    const uint64_t HASH_BASE = 0x100000001b3ULL;
+
+    // about sqrt(base size), like rsync: small blocks find more matches,
+    // large ones keep the table small
+    size_t delta_block_size(size_t base_size) {
+        size_t block = 16;
+        while (block * block < base_size && block < 4096) {
+            block <<= 1;
+        }
+        return block;
+    }
+
+    uint64_t block_hash(const unsigned char* data, size_t length) {
+        uint64_t hash = 0;
+        for (size_t i = 0; i < length; ++i) {
+            hash = hash * HASH_BASE + data[i];
+        }
+        return hash;
+    }
+
+    void put_varint(std::string& out, uint64_t value) {
+        while (value >= 0x80) {
+            out.push_back(static_cast<char>((value & 0x7f) | 0x80));
+            value >>= 7;
+        }
+        out.push_back(static_cast<char>(value));
+    }
+
+    bool get_varint(std::string_view& in, uint64_t& value) {
+        value = 0;
+        for (int shift = 0; shift < 64 && !in.empty(); shift += 7) {
+            unsigned char byte = static_cast<unsigned char>(in.front());
+            in.remove_prefix(1);
+            value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+            if (!(byte & 0x80)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool get_bytes(std::string_view& in, size_t length, std::string_view& bytes) {
+        if (in.size() < length) {
+            return false;
+        }
+        bytes = in.substr(0, length);
+        in.remove_prefix(length);
+        return true;
+    }
+
+    void put_insert(std::string& delta, std::string_view literal) {
+        if (literal.empty()) {
+            return;
+        }
+        delta.push_back(static_cast<char>(OP_INSERT));
+        put_varint(delta, literal.size());
+        delta.append(literal);
+    }
+
+    // copies are mostly in order, so the offset is stored relative to the
+    // end of the previous one
+    void put_copy(std::string& delta, size_t offset, size_t length, size_t& previous_end) {
+        int64_t step = static_cast<int64_t>(offset) - static_cast<int64_t>(previous_end);
+        delta.push_back(static_cast<char>(OP_COPY));
+        put_varint(delta, (static_cast<uint64_t>(step) << 1) ^ static_cast<uint64_t>(step >> 63));
+        put_varint(delta, length);
+        previous_end = offset + length;
+    }
+
+    // The named members as stored, with any pending edits from the
+    // journal, in one pass over the save; on_member may take the contents
+    bool read_members(SavedGameFormatFile& saved_game_file, const EditJournal* journal, const std::set<std::string>& names, const archive_stream::member_handler& on_member) {
+        if (names.empty()) {
+            return true;
+        }
+        size_t reached = 0;
+        bool read = saved_game_file.ReadSubfiles(
+            [&names](const ArchiveEntry& entry) {
+                return names.count(entry.name) != 0;
+            },
+            [&](const ArchiveEntry& entry, std::string& contents) {
+                ++reached;
+                if (journal != nullptr && !journal->OverlayStored(entry.name, contents)) {
+                    std::cerr << "unable to apply " << journal->filename << " to " << entry.name << std::endl;
+                    return false;
+                }
+                return on_member(entry, contents);
+            }
+        );
+        if (!read || reached != names.size()) {
+            std::cerr << "unable to read the members of " << saved_game_file.filename << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    inline bool is_directory(const std::string& name) {
+        return !name.empty() && name.back() == '/';
+    }
+
+    void put_name(std::string& body, char kind, const std::string& name) {
+        body.push_back(kind);
+        put_varint(body, name.size());
+        body.append(name);
+    }
+
+}
+
+void saved_game_format_file::EncodeDelta(std::string_view base, std::string_view target, std::string& delta) {
+    delta.clear();
+    const unsigned char* base_bytes = reinterpret_cast<const unsigned char*>(base.data());
+    const unsigned char* target_bytes = reinterpret_cast<const unsigned char*>(target.data());
+    size_t block = delta_block_size(base.size());
+
+    // the first block with each hash is enough; matches are grown anyway
+    std::unordered_map<uint64_t, size_t> blocks;
+    blocks.reserve(base.size() / block + 1);
+    for (size_t offset = 0; offset + block <= base.size(); offset += block) {
+        blocks.emplace(block_hash(base_bytes + offset, block), offset);
+    }
+
+    // weight of the byte leaving the window
+    uint64_t leaving_weight = 1;
+    for (size_t i = 1; i < block; ++i) {
+        leaving_weight *= HASH_BASE;
+    }
+
+    size_t literal_start = 0;
+    size_t previous_end = 0;
+    size_t position = 0;
+    uint64_t hash = (target.size() >= block) ? block_hash(target_bytes, block) : 0;
+    while (!blocks.empty() && position + block <= target.size()) {
+        auto match = blocks.find(hash);
+        if (match != blocks.end() && memcmp(base_bytes + match->second, target_bytes + position, block) == 0) {
+            size_t base_start = match->second;
+            size_t target_start = position;
+            while (target_start > literal_start && base_start > 0 && base_bytes[base_start - 1] == target_bytes[target_start - 1]) {
+                --base_start;
+                --target_start;
+            }
+            size_t base_end = match->second + block;
+            size_t target_end = position + block;
+            while (target_end < target.size() && base_end < base.size() && base_bytes[base_end] == target_bytes[target_end]) {
+                ++base_end;
+                ++target_end;
+            }
+            put_insert(delta, target.substr(literal_start, target_start - literal_start));
+            put_copy(delta, base_start, target_end - target_start, previous_end);
+            position = literal_start = target_end;
+            if (position + block <= target.size()) {
+                hash = block_hash(target_bytes + position, block);
+            }
+            continue;
+        }
+        if (position + block < target.size()) {
+            hash = (hash - target_bytes[position] * leaving_weight) * HASH_BASE + target_bytes[position + block];
+        }
+        ++position;
+    }
+    put_insert(delta, target.substr(literal_start));
+}
+
+bool saved_game_format_file::ApplyDelta(std::string_view base, std::string_view delta, std::string& target) {
+    target.clear();
+    size_t previous_end = 0;
+    while (!delta.empty()) {
+        unsigned char op = static_cast<unsigned char>(delta.front());
+        delta.remove_prefix(1);
+        uint64_t first = 0;
+        uint64_t length = 0;
+        std::string_view literal;
+        if (op == OP_INSERT) {
+            if (!get_varint(delta, length) || !get_bytes(delta, length, literal)) {
+                return false;
+            }
+            target.append(literal);
+        } else if (op == OP_COPY) {
+            if (!get_varint(delta, first) || !get_varint(delta, length)) {
+                return false;
+            }
+            int64_t step = static_cast<int64_t>(first >> 1) ^ -static_cast<int64_t>(first & 1);
+            int64_t offset = static_cast<int64_t>(previous_end) + step;
+            if (offset < 0 || static_cast<uint64_t>(offset) > base.size() || length > base.size() - offset) {
+                return false;
+            }
+            target.append(base.substr(offset, length));
+            previous_end = offset + length;
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool saved_game_format_file::DiffSaves(SavedGameFormatFile& base, const EditJournal* base_journal, SavedGameFormatFile& target, const EditJournal* target_journal, std::string& patch, DeltaStats& stats) {
+    if (!base.BuildIndex() || !target.BuildIndex()) {
+        std::cerr << "unable to index " << base.filename << " or " << target.filename << std::endl;
+        return false;
+    }
+    const EntryIndex& base_index = base.GetIndex();
+    const EntryIndex& target_index = target.GetIndex();
+
+    stats = DeltaStats();
+    // members the directories can't vouch for are compared by content
+    std::set<std::string> compared;
+    std::set<std::string> base_compared;
+    for (const auto& entry : target_index.Entries()) {
+        if (target_index.Find(entry.name)->sequence != entry.sequence || is_directory(entry.name)) {
+            continue;
+        }
+        const ArchiveEntry* base_entry = base_index.Find(entry.name);
+        bool edited = (base_journal != nullptr && base_journal->HasPending(entry.name))
+            || (target_journal != nullptr && target_journal->HasPending(entry.name));
+        // the central directory says enough without reading either copy
+        if (base_entry != nullptr && !edited && base_entry->has_crc && entry.has_crc
+            && base_entry->crc32 == entry.crc32 && base_entry->uncompressed_size == entry.uncompressed_size) {
+            ++stats.unchanged;
+            continue;
+        }
+        compared.insert(entry.name);
+        if (base_entry != nullptr) {
+            base_compared.insert(entry.name);
+        }
+    }
+
+    // one pass over each save: base's copies are held until the target's
+    // copy arrives, in target order, and dropped once compared
+    std::map<std::string, std::string> base_members;
+    bool read = read_members(base, base_journal, base_compared, [&base_members](const ArchiveEntry& entry, std::string& contents) {
+        base_members[entry.name].swap(contents);
+        return true;
+    });
+    if (!read) {
+        return false;
+    }
+
+    std::string body;
+    std::string delta;
+    read = read_members(target, target_journal, compared, [&](const ArchiveEntry& entry, std::string& target_contents) {
+        auto base_member = base_members.find(entry.name);
+        if (base_member != base_members.end()) {
+            std::string base_contents;
+            base_contents.swap(base_member->second);
+            base_members.erase(base_member);
+            if (base_contents == target_contents) {
+                ++stats.unchanged;
+                return true;
+            }
+            EncodeDelta(base_contents, target_contents, delta);
+            // a delta has to beat sending the member as it is
+            if (delta.size() + 2 * 32 < target_contents.size()) {
+                put_name(body, RECORD_DELTA, entry.name);
+                Sha256::digest base_digest = Sha256::Hash(base_contents.data(), base_contents.size());
+                Sha256::digest target_digest = Sha256::Hash(target_contents.data(), target_contents.size());
+                body.append(reinterpret_cast<const char*>(base_digest.data()), base_digest.size());
+                body.append(reinterpret_cast<const char*>(target_digest.data()), target_digest.size());
+                put_varint(body, target_contents.size());
+                put_varint(body, delta.size());
+                body.append(delta);
+                ++stats.changed;
+                stats.member_bytes += target_contents.size();
+                return true;
+            }
+        }
+        put_name(body, RECORD_ADD, entry.name);
+        put_varint(body, target_contents.size());
+        body.append(target_contents);
+        ++stats.added;
+        stats.member_bytes += target_contents.size();
+        return true;
+    });
+    if (!read) {
+        return false;
+    }
+    for (const auto& entry : base_index.Entries()) {
+        if (base_index.Find(entry.name)->sequence != entry.sequence || is_directory(entry.name)) {
+            continue;
+        }
+        if (target_index.Find(entry.name) == nullptr) {
+            put_name(body, RECORD_REMOVE, entry.name);
+            ++stats.removed;
+        }
+    }
+
+    // header, then the records deflated; literals are mostly text
+    patch = PATCH_MAGIC;
+    patch.push_back(static_cast<char>(PATCH_VERSION));
+    put_varint(patch, body.size());
+    size_t header_size = patch.size();
+    {
+        SGF_STATS_TIMER(TIMER_COMPRESS);
+        uLongf compressed_size = compressBound(static_cast<uLong>(body.size()));
+        patch.resize(header_size + compressed_size);
+        if (compress2(reinterpret_cast<Bytef*>(&patch[header_size]), &compressed_size,
+                reinterpret_cast<const Bytef*>(body.data()), static_cast<uLong>(body.size()),
+                Z_DEFAULT_COMPRESSION) != Z_OK) {
+            std::cerr << "unable to compress patch" << std::endl;
+            return false;
+        }
+        patch.resize(header_size + compressed_size);
+    }
+    stats.patch_bytes = patch.size();
+    return true;
+}
+
+bool saved_game_format_file::PatchSave(SavedGameFormatFile& base, std::string_view patch, const std::string& output_file, DeltaStats& stats) {
+    stats = DeltaStats();
+    stats.patch_bytes = patch.size();
+    uint64_t body_size = 0;
+    if (patch.substr(0, PATCH_MAGIC.size()) != PATCH_MAGIC || patch.size() <= PATCH_MAGIC.size()) {
+        std::cerr << "not a save patch" << std::endl;
+        return false;
+    }
+    patch.remove_prefix(PATCH_MAGIC.size());
+    if (static_cast<unsigned char>(patch.front()) != PATCH_VERSION) {
+        std::cerr << "unsupported patch version " << static_cast<int>(static_cast<unsigned char>(patch.front())) << std::endl;
+        return false;
+    }
+    patch.remove_prefix(1);
+    // checked before anything is allocated for it
+    if (!get_varint(patch, body_size) || body_size > patch.size() * MAX_INFLATE_RATIO) {
+        std::cerr << "damaged patch header" << std::endl;
+        return false;
+    }
+    std::string body(body_size, '\0');
+    {
+        SGF_STATS_TIMER(TIMER_DECOMPRESS);
+        uLongf size = static_cast<uLongf>(body_size);
+        if (uncompress(reinterpret_cast<Bytef*>(&body[0]), &size,
+                reinterpret_cast<const Bytef*>(patch.data()), static_cast<uLong>(patch.size())) != Z_OK
+            || size != body_size) {
+            std::cerr << "unable to inflate patch" << std::endl;
+            return false;
+        }
+    }
+
+    if (!base.BuildIndex()) {
+        std::cerr << "unable to index file " << base.filename << std::endl;
+        return false;
+    }
+
+    // replacements point into these until the save is written
+    std::deque<std::string> members;
+    SavedGameFormatFile::replacement_map replacements;
+    SavedGameFormatFile::removal_set removals;
+    // deltas wait for their base member, which is read with the others
+    struct pending_delta {
+        std::string_view base_digest{};
+        std::string_view target_digest{};
+        uint64_t size{0};
+        std::string_view bytes{};
+    };
+    std::map<std::string, pending_delta> deltas;
+    std::set<std::string> delta_names;
+    std::string_view records(body);
+    while (!records.empty()) {
+        char kind = records.front();
+        records.remove_prefix(1);
+        uint64_t name_size = 0;
+        std::string_view name_bytes;
+        if (!get_varint(records, name_size) || !get_bytes(records, name_size, name_bytes)) {
+            std::cerr << "damaged patch record" << std::endl;
+            return false;
+        }
+        std::string name(name_bytes);
+
+        if (kind == RECORD_REMOVE) {
+            removals.insert(name);
+            ++stats.removed;
+            continue;
+        }
+        uint64_t size = 0;
+        std::string_view bytes;
+        if (kind == RECORD_ADD) {
+            if (!get_varint(records, size) || !get_bytes(records, size, bytes)) {
+                std::cerr << "damaged patch record for " << name << std::endl;
+                return false;
+            }
+            replacements[name] = bytes;
+            ++stats.added;
+            stats.member_bytes += size;
+            continue;
+        }
+        if (kind != RECORD_DELTA) {
+            std::cerr << "unknown patch record " << kind << std::endl;
+            return false;
+        }
+
+        pending_delta delta;
+        uint64_t delta_size = 0;
+        if (!get_bytes(records, 32, delta.base_digest) || !get_bytes(records, 32, delta.target_digest)
+            || !get_varint(records, delta.size) || !get_varint(records, delta_size) || !get_bytes(records, delta_size, delta.bytes)) {
+            std::cerr << "damaged patch record for " << name << std::endl;
+            return false;
+        }
+        if (base.GetIndex().Find(name) == nullptr) {
+            std::cerr << "the patch changes " << name << ", which " << base.filename << " does not have" << std::endl;
+            return false;
+        }
+        deltas[name] = delta;
+        delta_names.insert(name);
+    }
+
+    // one pass over base for every member a delta starts from
+    bool read = read_members(base, nullptr, delta_names, [&](const ArchiveEntry& entry, std::string& base_contents) {
+        const pending_delta& delta = deltas[entry.name];
+        Sha256::digest digest = Sha256::Hash(base_contents.data(), base_contents.size());
+        if (delta.base_digest != std::string_view(reinterpret_cast<const char*>(digest.data()), digest.size())) {
+            std::cerr << "the patch was made against a different " << entry.name << std::endl;
+            return false;
+        }
+        members.emplace_back();
+        std::string& contents = members.back();
+        bool success = ApplyDelta(base_contents, delta.bytes, contents) && contents.size() == delta.size;
+        digest = Sha256::Hash(contents.data(), contents.size());
+        if (!success || delta.target_digest != std::string_view(reinterpret_cast<const char*>(digest.data()), digest.size())) {
+            std::cerr << "the patch for " << entry.name << " does not reproduce it" << std::endl;
+            return false;
+        }
+        replacements[entry.name] = contents;
+        ++stats.changed;
+        stats.member_bytes += delta.size;
+        return true;
+    });
+    if (!read) {
+        return false;
+    }
+
+    for (const auto& name : removals) {
+        if (base.GetIndex().Find(name) == nullptr) {
+            std::cerr << "the patch removes " << name << ", which " << base.filename << " does not have" << std::endl;
+            return false;
+        }
+    }
+    return base.UpdateSubfiles(output_file, replacements, removals);
+}
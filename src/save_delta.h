@@ -0,0 +1,49 @@
+#ifndef SAVED_GAME_FORMAT_SAVE_DELTA_H__
+#define SAVED_GAME_FORMAT_SAVE_DELTA_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#include "edit_journal.h"
+#include "sgf_file.h"
+
+namespace saved_game_format_file {
+
+    // What a patch holds
+    struct DeltaStats {
+        size_t unchanged{0};
+        // members sent as a delta against the base's copy
+        size_t changed{0};
+        // members sent whole: new ones, and changed ones no delta helped
+        size_t added{0};
+        size_t removed{0};
+        // bytes of the changed and added members, and of the patch itself
+        int64_t member_bytes{0};
+        int64_t patch_bytes{0};
+    };
+
+    // Copy/insert instructions that turn base into target. Matches are
+    // found rsync style: base is hashed in fixed blocks and a rolling hash
+    // over target looks them up, then each match is grown byte by byte in
+    // both directions, so an edit costs about its own size.
+    void EncodeDelta(std::string_view base, std::string_view target, std::string& delta);
+    bool ApplyDelta(std::string_view base, std::string_view delta, std::string& target);
+
+    // Compare two saves member by member and describe how to turn base
+    // into target. ZIP members whose sizes and CRCs match are taken as
+    // unchanged without being read; anything else is compared by content.
+    // With journals, each save's pending edits are compared too, and
+    // neither save is rewritten.
+    bool DiffSaves(SavedGameFormatFile& base, const EditJournal* base_journal, SavedGameFormatFile& target, const EditJournal* target_journal, std::string& patch, DeltaStats& stats);
+    // Rebuild the target save from base and a DiffSaves patch, in base's
+    // container unless base's save_settings say otherwise. Each delta is
+    // checked against SHA-256 digests of the member it expects and the one
+    // it should produce, so a patch for another base is refused. New
+    // members are written after the existing ones.
+    bool PatchSave(SavedGameFormatFile& base, std::string_view patch, const std::string& output_file, DeltaStats& stats);
+
+}
+
+#endif //SAVED_GAME_FORMAT_SAVE_DELTA_H__
@@ -0,0 +1,144 @@
+#include <cstdio>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include <archive.h>
+#include <archive_entry.h>
+
+#include "save_generator.h"
+#include "sgf_file.h"
+
+using namespace saved_game_format_file;
+
+namespace {
+
+    const std::string GENERATED_ROOT("save");
+
+    // system names and commodity-ish words, so the data member compresses
+    // about as well as a real one rather than like noise
+    const std::vector<std::string> WORDS{
+        "Base_Sol/Sol", "Proxima_Centauri", "Alpha_Centauri", "Liberty", "Saltillo",
+        "Chinook", "Base_Vega/Alpha_Lyrae", "Layton", "Downey", "McAllen",
+        "Wilmington", "Poteau", "Gibsonburg", "Corsicana", "Meredith", "Manassas",
+        "Newmarket", "Stymphalus", "Lincoln", "Chattanooga", "Darwin", "Monrovia",
+        "upgrades/Armor", "upgrades/Capacitors/Standard", "upgrades/Jump_Drives",
+        "upgrades/Reactors/Standard", "upgrades/Sensors/Common", "mission", "data",
+    };
+
+    std::string generate_data(std::mt19937& random, size_t size) {
+        std::uniform_int_distribution<size_t> word(0, WORDS.size() - 1);
+        std::uniform_int_distribution<int> number(0, 99999);
+        std::string data;
+        data.reserve(size + 64);
+        size_t line = 0;
+        while (data.size() < size) {
+            data += std::to_string(line++ % 16);
+            data += ' ';
+            data += WORDS[word(random)];
+            data += " data ";
+            for (int i = 0; i < 8 && data.size() < size; ++i) {
+                data += WORDS[word(random)];
+                data += std::to_string(number(random) % 32);
+                data += ' ';
+            }
+            data += std::to_string(number(random));
+            data += '\n';
+        }
+        data.resize(size);
+        return data;
+    }
+
+    // one ship object in an array, with string values like example2's
+    std::string generate_ship(std::mt19937& random, size_t ship, size_t keys) {
+        std::uniform_int_distribution<int> number(0, 20000);
+        std::uniform_int_distribution<size_t> word(0, WORDS.size() - 1);
+        std::string json = "[{";
+        for (size_t key = 0; key < keys; ++key) {
+            if (key) {
+                json += ',';
+            }
+            // example2's keys are sorted; keep the well known ones present
+            if (key == 0) {
+                json += "\"Can_Lock\":\"1\"";
+                continue;
+            }
+            if (key == 1) {
+                json += "\"Name\":\"Ship_" + std::to_string(ship) + "\"";
+                continue;
+            }
+            json += "\"Key_" + std::to_string(key) + "\":\"";
+            switch (key % 3) {
+                case 0:
+                    json += std::to_string(number(random)) + ".00/" + std::to_string(number(random)) + ".00";
+                    break;
+                case 1:
+                    json += std::to_string(number(random) % 2);
+                    break;
+                default:
+                    json += "{" + WORDS[word(random)] + ";" + std::to_string(number(random)) + ".000000;1;false}";
+                    break;
+            }
+            json += '"';
+        }
+        json += "}]";
+        return json;
+    }
+
+    bool write_member(struct archive* archive_output, const std::string& name, const std::string& data) {
+        struct archive_entry* entry = archive_entry_new();
+        archive_entry_set_pathname(entry, name.c_str());
+        archive_entry_set_filetype(entry, AE_IFREG);
+        archive_entry_set_perm(entry, 0644);
+        archive_entry_set_mtime(entry, 0, 0);
+        archive_entry_set_size(entry, data.size());
+        bool success = archive_write_header(archive_output, entry) == ARCHIVE_OK
+            && archive_write_data(archive_output, data.data(), data.size()) == static_cast<la_ssize_t>(data.size());
+        archive_entry_free(entry);
+        if (!success) {
+            std::cerr << "unable to write generated member " << name << ": " << archive_error_string(archive_output) << std::endl;
+        }
+        return success;
+    }
+
+}
+
+std::string saved_game_format_file::GeneratedDataMember() {
+    return GENERATED_ROOT + "/data";
+}
+
+std::string saved_game_format_file::GeneratedShipMember(size_t ship) {
+    return GENERATED_ROOT + "/ships/Ship_" + std::to_string(ship) + ".begin.json";
+}
+
+bool saved_game_format_file::GenerateSave(const std::string& filename, const SaveCorpusSpec& spec) {
+    std::mt19937 random(spec.seed);
+    std::string base_file = filename + ".base.tar";
+
+    struct archive* archive_output = archive_write_new();
+    archive_write_set_format_gnutar(archive_output);
+    if (archive_write_open_filename(archive_output, base_file.c_str()) != ARCHIVE_OK) {
+        std::cerr << "unable to create " << base_file << ": " << archive_error_string(archive_output) << std::endl;
+        archive_write_free(archive_output);
+        return false;
+    }
+    bool success = write_member(archive_output, GeneratedDataMember(), generate_data(random, spec.data_size));
+    for (size_t ship = 0; success && ship < spec.ship_count; ++ship) {
+        success = write_member(archive_output, GeneratedShipMember(ship), generate_ship(random, ship, spec.ship_keys));
+    }
+    success = (archive_write_close(archive_output) == ARCHIVE_OK) && success;
+    archive_write_free(archive_output);
+
+    // the regular save path does the conversion; auto settings keep the
+    // uncompressed tar
+    if (success) {
+        SavedGameFormatFile base(base_file);
+        base.save_settings = spec.save_settings;
+        success = base.UpdateSubfiles(filename, SavedGameFormatFile::replacement_map());
+    }
+    remove(base_file.c_str());
+    if (!success) {
+        std::cerr << "unable to generate " << filename << std::endl;
+    }
+    return success;
+}
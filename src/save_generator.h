@@ -0,0 +1,35 @@
+#ifndef SAVED_GAME_FORMAT_SAVE_GENERATOR_H__
+#define SAVED_GAME_FORMAT_SAVE_GENERATOR_H__
+
+#include <cstddef>
+#include <string>
+
+#include "save_settings.h"
+
+namespace saved_game_format_file {
+
+    // Shape of a synthetic save, modelled on example2: one large text
+    // `data` member and a directory of small JSON ship members
+    struct SaveCorpusSpec {
+        // container and compression of the generated file
+        SaveSettings save_settings{};
+        size_t data_size{1024 * 1024};
+        size_t ship_count{16};
+        // keys per ship object; example2's ship has about 120
+        size_t ship_keys{120};
+        // same seed, same bytes
+        unsigned int seed{1};
+    };
+
+    std::string GeneratedDataMember();
+    std::string GeneratedShipMember(size_t ship);
+
+    // Write a save to filename. The members are assembled into a plain tar
+    // next to it, which is then saved through SavedGameFormatFile with the
+    // spec's settings, so every format and codec the tool can write can be
+    // generated.
+    bool GenerateSave(const std::string& filename, const SaveCorpusSpec& spec);
+
+}
+
+#endif //SAVED_GAME_FORMAT_SAVE_GENERATOR_H__
@@ -0,0 +1,174 @@
+#include <chrono>
+#include <deque>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+#include <boost/algorithm/string.hpp>
+
+#include "binary_json.h"
+#include "engine_text.h"
+#include "json_pointer.h"
+#include "save_query.h"
+#include "thread_pool.h"
+
+using namespace saved_game_format_file;
+
+namespace {
+
+    // members read ahead of the searchers, per thread; bounds the memory
+    // held by a slow search
+    const size_t MEMBERS_PER_THREAD = 2;
+
+    const size_t SELF_DESCRIBE_SIZE = 3;
+
+    struct member_result {
+        bool success{true};
+        std::vector<QueryMatch> matches{};
+    };
+
+    // Values are compared in the binary encoding, where whitespace and
+    // escapes are gone
+    bool encode_value(std::string_view value_json, std::string& encoded) {
+        if (!binary_json::FromJson(value_json, encoded)) {
+            return false;
+        }
+        encoded.erase(0, SELF_DESCRIBE_SIZE);
+        return true;
+    }
+
+    // the engine's save text renders its values as JSON, compared the
+    // same way as text members
+    member_result search_text(const std::string& subfile_name, const std::string& contents, const SaveQuery& query, const std::string& expected) {
+        member_result result;
+        EngineTextIndex index;
+        EngineTextIndex::match_list found;
+        result.success = index.Build(contents) && index.FindAll(contents, query.key, found);
+
+        std::string encoded;
+        for (auto& value : found) {
+            if (!expected.empty() && (!encode_value(value.second, encoded) || encoded != expected)) {
+                continue;
+            }
+            QueryMatch match;
+            match.subfile = subfile_name;
+            match.key.swap(value.first);
+            match.value_json.swap(value.second);
+            result.matches.push_back(match);
+        }
+        return result;
+    }
+
+    member_result search_member(const std::string& subfile_name, const std::string& contents, const SaveQuery& query, const std::string& expected) {
+        if (EngineTextIndex::Recognize(contents)) {
+            return search_text(subfile_name, contents, query, expected);
+        }
+        member_result result;
+        json_pointer::match_list found;
+        bool binary = binary_json::IsEncoded(contents);
+        if (binary) {
+            result.success = binary_json::FindAll(contents, query.key, found);
+        } else {
+            result.success = json_pointer::FindAll(contents, query.key, found);
+        }
+
+        std::string encoded;
+        for (const auto& value : found) {
+            if (!expected.empty()) {
+                if (binary) {
+                    if (value.second != expected) {
+                        continue;
+                    }
+                } else if (!encode_value(value.second, encoded) || encoded != expected) {
+                    continue;
+                }
+            }
+            QueryMatch match;
+            match.subfile = subfile_name;
+            match.key = value.first;
+            if (!binary) {
+                match.value_json = value.second;
+            } else if (!binary_json::ToJson(value.second, match.value_json)) {
+                result.success = false;
+                continue;
+            }
+            result.matches.push_back(match);
+        }
+        return result;
+    }
+
+}
+
+bool saved_game_format_file::QuerySave(SavedGameFormatFile& saved_game_file, const SaveQuery& query, const EditJournal* journal, const match_sink& on_match, QueryStats& stats) {
+    stats = QueryStats();
+    std::string expected;
+    if (!query.value_json.empty() && !encode_value(query.value_json, expected)) {
+        std::cerr << "Invalid query value " << query.value_json << std::endl;
+        return false;
+    }
+    std::vector<std::string> tokens;
+    if (!json_pointer::Parse(query.key, tokens)) {
+        std::cerr << "Invalid JSON pointer " << query.key << std::endl;
+        return false;
+    }
+
+    ThreadPool pool(query.threads);
+    std::deque<std::future<member_result>> pending;
+    bool success = true;
+    // hand over finished members in order, waiting for the oldest ones
+    // until no more than keep are still out
+    auto drain = [&](size_t keep) {
+        while (pending.size() > keep
+            || (!pending.empty() && pending.front().wait_for(std::chrono::seconds(0)) == std::future_status::ready)) {
+            member_result result = pending.front().get();
+            pending.pop_front();
+            success = success && result.success;
+            if (!result.matches.empty()) {
+                ++stats.matched_members;
+            }
+            for (const auto& match : result.matches) {
+                ++stats.matches;
+                on_match(match);
+            }
+        }
+    };
+
+    bool read = saved_game_file.ReadSubfiles(
+        [&query](const ArchiveEntry& entry) {
+            bool directory = !entry.name.empty() && entry.name.back() == '/';
+            return !directory && boost::algorithm::starts_with(entry.name, query.subfile_prefix);
+        },
+        [&](const ArchiveEntry& entry, std::string& data) {
+            auto contents = std::make_shared<std::string>();
+            contents->swap(data);
+            if (journal != nullptr && journal->HasPending(entry.name)) {
+                // edits apply to the JSON text
+                if (binary_json::IsEncoded(*contents)) {
+                    std::string json;
+                    if (!binary_json::ToJson(*contents, json)) {
+                        return false;
+                    }
+                    contents->swap(json);
+                }
+                if (!journal->Overlay(entry.name, *contents)) {
+                    return false;
+                }
+            }
+            ++stats.members;
+            stats.bytes += contents->size();
+
+            std::string subfile_name = entry.name;
+            pending.push_back(pool.Submit([subfile_name, contents, &query, &expected]() {
+                return search_member(subfile_name, *contents, query, expected);
+            }));
+            drain(MEMBERS_PER_THREAD * pool.Size());
+            return true;
+        }
+    );
+    drain(0);
+    if (!read) {
+        std::cerr << "Unable to read " << saved_game_file.filename << std::endl;
+    }
+    return read && success;
+}
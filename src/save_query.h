@@ -0,0 +1,55 @@
+#ifndef SAVED_GAME_FORMAT_SAVE_QUERY_H__
+#define SAVED_GAME_FORMAT_SAVE_QUERY_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+
+#include "edit_journal.h"
+#include "sgf_file.h"
+
+namespace saved_game_format_file {
+
+    // What to look for in every member of a save
+    struct SaveQuery {
+        // JSON pointer; a "*" token matches each member of an object or
+        // element of an array, so "/*/Can_Cloak" checks every ship
+        std::string key{};
+        // JSON the value must equal, compared without regard to whitespace
+        // or string escapes; empty only asks for the key to exist
+        std::string value_json{};
+        // only members whose names start with this
+        std::string subfile_prefix{};
+        // searching threads; 0 uses every hardware thread
+        size_t threads{0};
+    };
+
+    struct QueryMatch {
+        std::string subfile{};
+        // concrete pointer of the value, wildcards filled in
+        std::string key{};
+        std::string value_json{};
+    };
+
+    struct QueryStats {
+        size_t members{0};
+        size_t matched_members{0};
+        size_t matches{0};
+        int64_t bytes{0};
+    };
+
+    typedef std::function<void(const QueryMatch& match)> match_sink;
+
+    // Search every member in one pass over the save. Members are read on
+    // the calling thread and searched on a pool of threads, while matches
+    // are handed to on_match on the calling thread in archive order as
+    // soon as they are known. Members that aren't JSON just don't match;
+    // binary ones are searched without decoding, and the engine's save
+    // text through its index. With a journal, its pending edits are
+    // searched too.
+    bool QuerySave(SavedGameFormatFile& saved_game_file, const SaveQuery& query, const EditJournal* journal, const match_sink& on_match, QueryStats& stats);
+
+}
+
+#endif //SAVED_GAME_FORMAT_SAVE_QUERY_H__
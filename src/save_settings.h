@@ -0,0 +1,66 @@
+#ifndef SAVED_GAME_FORMAT_SAVE_SETTINGS_H__
+#define SAVED_GAME_FORMAT_SAVE_SETTINGS_H__
+
+#include <cstddef>
+
+namespace saved_game_format_file {
+
+    // Container written when a save is rewritten
+    enum SaveFormat {
+        // keep the input's container
+        SAVE_FORMAT_AUTO=0,
+        SAVE_FORMAT_ZIP,
+        SAVE_FORMAT_GNUTAR,
+        SAVE_FORMAT_PAX,
+        SAVE_FORMAT_USTAR,
+        SAVE_FORMAT_CPIO,
+    };
+
+    // Compression used when a save is rewritten. For ZIP containers this is
+    // the per-member method (none = stored, gzip = deflate); for everything
+    // else it is the filter applied to the whole stream.
+    enum SaveCodec {
+        // keep the input's compression
+        SAVE_CODEC_AUTO=0,
+        SAVE_CODEC_NONE,
+        SAVE_CODEC_GZIP,
+        SAVE_CODEC_BZIP2,
+        SAVE_CODEC_XZ,
+        SAVE_CODEC_ZSTD,
+        SAVE_CODEC_LZ4,
+    };
+
+    // How JSON members are stored when a save is written
+    enum MemberEncoding {
+        // members keep their current encoding; edits of binary members
+        // are encoded again
+        MEMBER_ENCODING_AUTO=0,
+        // store every member as JSON text
+        MEMBER_ENCODING_JSON,
+        // store .json members as CBOR (see binary_json.h)
+        MEMBER_ENCODING_CBOR,
+    };
+
+    // leave the codec at its own default level
+    const int SAVE_LEVEL_DEFAULT = -1;
+
+    struct SaveSettings {
+        SaveFormat format{SAVE_FORMAT_AUTO};
+        SaveCodec codec{SAVE_CODEC_AUTO};
+        int level{SAVE_LEVEL_DEFAULT};
+        // compression threads; 0 uses every hardware thread, 1 compresses
+        // on the calling thread only
+        unsigned int threads{0};
+        // ZIP only: deflate members in independently decodable frames of
+        // this many bytes, so ranges can be read without inflating from
+        // the start; 0 writes plain single-stream members
+        size_t frame_size{0};
+        // ZIP only: put unchanged members through the compressor too,
+        // instead of copying their compressed bytes, so a new level applies
+        bool recompress{false};
+        MemberEncoding encoding{MEMBER_ENCODING_AUTO};
+    };
+
+}
+
+#endif //SAVED_GAME_FORMAT_SAVE_SETTINGS_H__
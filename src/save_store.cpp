@@ -0,0 +1,629 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <boost/filesystem.hpp>
+
+#include <archive.h>
+#include <archive_entry.h>
+#include <zlib.h>
+
+#include "atomic_file.h"
+#include "save_store.h"
+#include "stats.h"
+
+using namespace saved_game_format_file;
+
+namespace {
+
+    const std::string MANIFEST_MAGIC("sgf-manifest 1");
+    const std::string MANIFEST_SUFFIX(".manifest");
+
+    // chunk sizes; the average has to be a power of two
+    const size_t MIN_CHUNK = 2 * 1024;
+    const size_t AVERAGE_CHUNK = 8 * 1024;
+    const size_t MAX_CHUNK = 64 * 1024;
+    const int AVERAGE_BITS = 13;
+
+    // digest, pack offset, stored size, size; little endian
+    const size_t INDEX_RECORD_SIZE = 32 + 8 + 4 + 4;
+
+    // Fixed pseudo-random table for the gear hash. It must never change:
+    // different boundaries would stop new snapshots sharing old chunks.
+    const uint64_t* gear_table() {
+        static uint64_t table[256];
+        static bool filled = [] {
+            uint64_t state = 0x5347465f53544f52ULL;
+            for (auto& value : table) {
+                // splitmix64
+                uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+                z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+                z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+                value = z ^ (z >> 31);
+            }
+            return true;
+        }();
+        (void)filled;
+        return table;
+    }
+
+    // Length of the chunk at the start of data. The hash shifts one bit per
+    // byte, so its top bits only depend on the last 64 bytes; a boundary is
+    // where they are all zero. Below the average size the test is two bits
+    // stricter and above it two bits looser, which keeps chunk sizes close
+    // to the average (FastCDC's normalised chunking).
+    size_t next_chunk(std::string_view data) {
+        if (data.size() <= MIN_CHUNK) {
+            return data.size();
+        }
+        const uint64_t* gear = gear_table();
+        const uint64_t strict_mask = ~0ULL << (64 - (AVERAGE_BITS + 2));
+        const uint64_t loose_mask = ~0ULL << (64 - (AVERAGE_BITS - 2));
+        size_t limit = std::min(data.size(), MAX_CHUNK);
+        size_t normal = std::min(limit, AVERAGE_CHUNK);
+        const unsigned char* bytes = reinterpret_cast<const unsigned char*>(data.data());
+        uint64_t hash = 0;
+        size_t position = MIN_CHUNK;
+        for (; position < normal; ++position) {
+            hash = (hash << 1) + gear[bytes[position]];
+            if (!(hash & strict_mask)) {
+                return position + 1;
+            }
+        }
+        for (; position < limit; ++position) {
+            hash = (hash << 1) + gear[bytes[position]];
+            if (!(hash & loose_mask)) {
+                return position + 1;
+            }
+        }
+        return limit;
+    }
+
+    void put_little_endian(std::string& out, uint64_t value, int bytes) {
+        for (int i = 0; i < bytes; ++i) {
+            out.push_back(static_cast<char>((value >> (i * 8)) & 0xff));
+        }
+    }
+
+    uint64_t get_little_endian(const unsigned char* in, int bytes) {
+        uint64_t value = 0;
+        for (int i = bytes - 1; i >= 0; --i) {
+            value = (value << 8) | in[i];
+        }
+        return value;
+    }
+
+    bool parse_digest(const std::string& hex, Sha256::digest& digest) {
+        if (hex.size() != digest.size() * 2) {
+            return false;
+        }
+        for (size_t i = 0; i < digest.size(); ++i) {
+            unsigned int byte = 0;
+            for (int nibble = 0; nibble < 2; ++nibble) {
+                char c = hex[i * 2 + nibble];
+                byte <<= 4;
+                if (c >= '0' && c <= '9') {
+                    byte |= static_cast<unsigned int>(c - '0');
+                } else if (c >= 'a' && c <= 'f') {
+                    byte |= static_cast<unsigned int>(c - 'a' + 10);
+                } else {
+                    return false;
+                }
+            }
+            digest[i] = static_cast<unsigned char>(byte);
+        }
+        return true;
+    }
+
+    inline std::string digest_key(const Sha256::digest& digest) {
+        return std::string(reinterpret_cast<const char*>(digest.data()), digest.size());
+    }
+
+    // snapshot names become file names
+    bool valid_snapshot_name(const std::string& snapshot) {
+        return !snapshot.empty() && snapshot[0] != '.'
+            && snapshot.find_first_of("/\n") == std::string::npos;
+    }
+
+    bool write_all(int descriptor, std::string_view data) {
+        size_t written = 0;
+        while (written < data.size()) {
+            ssize_t count = write(descriptor, data.data() + written, data.size() - written);
+            if (count < 0 && errno == EINTR) {
+                continue;
+            }
+            if (count <= 0) {
+                return false;
+            }
+            written += static_cast<size_t>(count);
+        }
+        return true;
+    }
+
+    bool read_all(int descriptor, char* buffer, size_t size, int64_t offset) {
+        size_t done = 0;
+        while (done < size) {
+            ssize_t count = pread(descriptor, buffer + done, size - done, static_cast<off_t>(offset + done));
+            if (count < 0 && errno == EINTR) {
+                continue;
+            }
+            if (count <= 0) {
+                return false;
+            }
+            done += static_cast<size_t>(count);
+        }
+        return true;
+    }
+
+    // flock held for the life of the object
+    class store_lock {
+        public:
+            store_lock(const std::string& path) {
+                descriptor = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+                while (descriptor >= 0 && flock(descriptor, LOCK_EX) != 0) {
+                    if (errno != EINTR) {
+                        close(descriptor);
+                        descriptor = -1;
+                    }
+                }
+            }
+            ~store_lock() {
+                if (descriptor >= 0) {
+                    close(descriptor);
+                }
+            }
+            inline bool Locked() const { return descriptor >= 0; }
+
+        private:
+            int descriptor{-1};
+    };
+
+}
+
+std::string SaveStore::do_path(const std::string& name) const {
+    return directory + "/" + name;
+}
+
+std::string SaveStore::do_manifest_path(const std::string& snapshot) const {
+    return directory + "/snapshots/" + snapshot + MANIFEST_SUFFIX;
+}
+
+bool SaveStore::Open() {
+    boost::system::error_code error;
+    boost::filesystem::create_directories(do_path("snapshots"), error);
+    if (error) {
+        std::cerr << "unable to create store " << directory << ": " << error.message() << std::endl;
+        return false;
+    }
+    chunks.clear();
+    indexed_bytes = 0;
+    return do_load_index(false);
+}
+
+bool SaveStore::do_load_index(bool repair) {
+    std::string index_path = do_path("index");
+    int descriptor = open(index_path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (descriptor < 0) {
+        // a new store
+        return errno == ENOENT;
+    }
+    struct stat index_stat;
+    if (fstat(descriptor, &index_stat) != 0) {
+        std::cerr << "unable to stat " << index_path << ", errno " << errno << std::endl;
+        close(descriptor);
+        return false;
+    }
+    int64_t complete = index_stat.st_size - (index_stat.st_size % INDEX_RECORD_SIZE);
+    std::string records(static_cast<size_t>(std::max<int64_t>(complete - indexed_bytes, 0)), '\0');
+    bool success = read_all(descriptor, &records[0], records.size(), indexed_bytes);
+    close(descriptor);
+    if (!success) {
+        std::cerr << "unable to read " << index_path << ", errno " << errno << std::endl;
+        return false;
+    }
+
+    const unsigned char* record = reinterpret_cast<const unsigned char*>(records.data());
+    for (size_t i = 0; i < records.size(); i += INDEX_RECORD_SIZE, record += INDEX_RECORD_SIZE) {
+        chunk_location location;
+        location.offset = static_cast<int64_t>(get_little_endian(record + 32, 8));
+        location.stored_size = static_cast<uint32_t>(get_little_endian(record + 40, 4));
+        location.size = static_cast<uint32_t>(get_little_endian(record + 44, 4));
+        chunks.emplace(std::string(reinterpret_cast<const char*>(record), 32), location);
+    }
+    indexed_bytes = std::max(indexed_bytes, complete);
+
+    // an append cut short by a crash; its chunk was never used
+    if (repair && complete != index_stat.st_size) {
+        std::cerr << "dropping " << (index_stat.st_size - complete) << " bytes of an incomplete record from " << index_path << std::endl;
+        if (truncate(index_path.c_str(), static_cast<off_t>(complete)) != 0) {
+            std::cerr << "unable to truncate " << index_path << ", errno " << errno << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+bool SaveStore::Put(SavedGameFormatFile& saved_game_file, const EditJournal* journal, const std::string& snapshot, StoreStats& stats) {
+    if (!valid_snapshot_name(snapshot)) {
+        std::cerr << "invalid snapshot name " << snapshot << std::endl;
+        return false;
+    }
+    if (!saved_game_file.BuildIndex()) {
+        std::cerr << "unable to index file " << saved_game_file.filename << std::endl;
+        return false;
+    }
+    const EntryIndex& index = saved_game_file.GetIndex();
+
+    store_lock lock(do_path("lock"));
+    if (!lock.Locked()) {
+        std::cerr << "unable to lock store " << directory << ", errno " << errno << std::endl;
+        return false;
+    }
+    // other writers may have added chunks since Open
+    if (!do_load_index(true)) {
+        return false;
+    }
+
+    std::string pack_path = do_path("pack");
+    int pack = open(pack_path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0666);
+    struct stat pack_stat;
+    if (pack < 0 || fstat(pack, &pack_stat) != 0) {
+        std::cerr << "unable to open " << pack_path << ", errno " << errno << std::endl;
+        if (pack >= 0) {
+            close(pack);
+        }
+        return false;
+    }
+    // anything past the last indexed chunk is left from an interrupted
+    // writer; new chunks simply go after it
+    int64_t pack_offset = pack_stat.st_size;
+
+    std::ostringstream manifest_text;
+    manifest_text << MANIFEST_MAGIC << "\n"
+        << "format " << index.format_code << " " << index.filter_code << "\n"
+        << "created " << time(nullptr) << "\n";
+
+    stats = StoreStats();
+    std::string index_records;
+    std::string compressed;
+    bool success = true;
+    // one pass over the save; each member is chunked as it arrives, in
+    // archive order, and let go before the next one is read
+    bool read = saved_game_file.ReadSubfiles(
+        [](const ArchiveEntry&) {
+            return true;
+        },
+        [&](const ArchiveEntry& entry, std::string& contents) {
+            if (entry.name.find('\n') != std::string::npos) {
+                std::cerr << "unable to store member " << entry.name << ", its name holds a newline" << std::endl;
+                success = false;
+                return false;
+            }
+            ++stats.members;
+            if (!entry.name.empty() && entry.name.back() == '/') {
+                manifest_text << "directory " << entry.name << "\n";
+                return true;
+            }
+            if (journal != nullptr && !journal->OverlayStored(entry.name, contents)) {
+                std::cerr << "unable to apply " << journal->filename << " to " << entry.name << std::endl;
+                success = false;
+                return false;
+            }
+
+            std::ostringstream chunk_lines;
+            size_t chunk_count = 0;
+            std::string_view remaining(contents);
+            while (!remaining.empty()) {
+                std::string_view chunk = remaining.substr(0, next_chunk(remaining));
+                remaining.remove_prefix(chunk.size());
+                Sha256::digest digest = Sha256::Hash(chunk.data(), chunk.size());
+                chunk_lines << Sha256::Hex(digest) << " " << chunk.size() << "\n";
+                ++chunk_count;
+                ++stats.chunks;
+
+                std::string key = digest_key(digest);
+                if (chunks.count(key)) {
+                    continue;
+                }
+
+                // deflate only pays for itself on chunks that shrink
+                std::string_view stored = chunk;
+                {
+                    SGF_STATS_TIMER(TIMER_COMPRESS);
+                    uLongf compressed_size = compressBound(static_cast<uLong>(chunk.size()));
+                    compressed.resize(compressed_size);
+                    if (compress2(reinterpret_cast<Bytef*>(&compressed[0]), &compressed_size,
+                            reinterpret_cast<const Bytef*>(chunk.data()), static_cast<uLong>(chunk.size()),
+                            Z_DEFAULT_COMPRESSION) == Z_OK
+                        && compressed_size < chunk.size()) {
+                        stored = std::string_view(compressed.data(), compressed_size);
+                    }
+                }
+                {
+                    SGF_STATS_TIMER(TIMER_WRITE);
+                    if (!write_all(pack, stored)) {
+                        std::cerr << "unable to write " << pack_path << ", errno " << errno << std::endl;
+                        success = false;
+                        break;
+                    }
+                }
+
+                chunk_location location;
+                location.offset = pack_offset;
+                location.stored_size = static_cast<uint32_t>(stored.size());
+                location.size = static_cast<uint32_t>(chunk.size());
+                chunks.emplace(key, location);
+                index_records.append(key);
+                put_little_endian(index_records, static_cast<uint64_t>(location.offset), 8);
+                put_little_endian(index_records, location.stored_size, 4);
+                put_little_endian(index_records, location.size, 4);
+
+                pack_offset += stored.size();
+                ++stats.new_chunks;
+                stats.new_bytes += chunk.size();
+                stats.stored_bytes += stored.size();
+            }
+            if (!success) {
+                return false;
+            }
+            stats.bytes += contents.size();
+            manifest_text << "member " << contents.size() << " " << chunk_count << " " << entry.name << "\n"
+                << chunk_lines.str();
+            return true;
+        }
+    );
+    if (!read && success) {
+        std::cerr << "unable to read " << saved_game_file.filename << std::endl;
+        success = false;
+    }
+    SGF_STATS_ADD(COUNTER_BYTES_OUT, stats.stored_bytes);
+
+    // the chunks have to be on disk before anything points at them
+    if (success && fsync(pack) != 0) {
+        std::cerr << "unable to sync " << pack_path << ", errno " << errno << std::endl;
+        success = false;
+    }
+    close(pack);
+
+    if (success && !index_records.empty()) {
+        std::string index_path = do_path("index");
+        int index_file = open(index_path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0666);
+        success = index_file >= 0 && write_all(index_file, index_records) && fsync(index_file) == 0;
+        if (!success) {
+            std::cerr << "unable to append to " << index_path << ", errno " << errno << std::endl;
+        }
+        if (index_file >= 0) {
+            close(index_file);
+        }
+        success = success && SyncParentDirectory(index_path);
+        if (success) {
+            indexed_bytes += index_records.size();
+        }
+    }
+
+    if (success) {
+        std::string manifest_path = do_manifest_path(snapshot);
+        AtomicFile output;
+        FILE* manifest_file = output.Open(manifest_path);
+        std::string text = manifest_text.str();
+        success = manifest_file != nullptr
+            && fwrite(text.data(), 1, text.size(), manifest_file) == text.size()
+            && output.Commit();
+        if (!success) {
+            std::cerr << "unable to write " << manifest_path << std::endl;
+        }
+    }
+
+    if (!success) {
+        // chunks added above may not have made it into the index; forget
+        // them and read the index again next time
+        chunks.clear();
+        indexed_bytes = 0;
+        std::cerr << "snapshot " << snapshot << " was not stored" << std::endl;
+    }
+    return success;
+}
+
+bool SaveStore::do_read_manifest(const std::string& snapshot, manifest& contents) const {
+    std::string manifest_path = do_manifest_path(snapshot);
+    std::ifstream manifest_stream(manifest_path);
+    if (!manifest_stream) {
+        std::cerr << "no snapshot " << snapshot << " in store " << directory << std::endl;
+        return false;
+    }
+
+    std::string line;
+    if (!std::getline(manifest_stream, line) || line != MANIFEST_MAGIC) {
+        std::cerr << manifest_path << " is not a snapshot manifest" << std::endl;
+        return false;
+    }
+    contents = manifest();
+    size_t chunks_left = 0;
+    while (std::getline(manifest_stream, line)) {
+        std::istringstream fields(line);
+        if (chunks_left) {
+            manifest_chunk chunk;
+            std::string hex;
+            if (!(fields >> hex >> chunk.size) || !parse_digest(hex, chunk.digest)) {
+                break;
+            }
+            contents.members.back().chunks.push_back(chunk);
+            --chunks_left;
+            continue;
+        }
+
+        std::string kind;
+        fields >> kind;
+        if (kind == "format") {
+            fields >> contents.format_code >> contents.filter_code;
+        } else if (kind == "created") {
+            fields >> contents.created;
+        } else if (kind == "directory" || kind == "member") {
+            manifest_member member;
+            member.directory = (kind == "directory");
+            if (!member.directory) {
+                fields >> member.size >> chunks_left;
+            }
+            // the name is the rest of the line and may hold spaces
+            fields.get();
+            std::getline(fields, member.name);
+            contents.members.push_back(member);
+        }
+        if (!fields && !fields.eof()) {
+            break;
+        }
+    }
+    if (chunks_left || !manifest_stream.eof()) {
+        std::cerr << manifest_path << " is damaged" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool SaveStore::do_read_chunk(int pack, const manifest_chunk& chunk, std::string& data) const {
+    auto location = chunks.find(digest_key(chunk.digest));
+    if (location == chunks.end() || location->second.size != chunk.size) {
+        std::cerr << "store " << directory << " is missing chunk " << Sha256::Hex(chunk.digest) << std::endl;
+        return false;
+    }
+    std::string stored(location->second.stored_size, '\0');
+    if (!read_all(pack, &stored[0], stored.size(), location->second.offset)) {
+        std::cerr << "unable to read chunk " << Sha256::Hex(chunk.digest) << ", errno " << errno << std::endl;
+        return false;
+    }
+    SGF_STATS_ADD(COUNTER_BYTES_IN, stored.size());
+
+    if (location->second.stored_size == location->second.size) {
+        data.swap(stored);
+    } else {
+        SGF_STATS_TIMER(TIMER_DECOMPRESS);
+        data.resize(location->second.size);
+        uLongf size = location->second.size;
+        if (uncompress(reinterpret_cast<Bytef*>(&data[0]), &size,
+                reinterpret_cast<const Bytef*>(stored.data()), static_cast<uLong>(stored.size())) != Z_OK
+            || size != location->second.size) {
+            std::cerr << "unable to inflate chunk " << Sha256::Hex(chunk.digest) << std::endl;
+            return false;
+        }
+    }
+    // a chunk is only as good as its name
+    if (Sha256::Hash(data.data(), data.size()) != chunk.digest) {
+        std::cerr << "chunk " << Sha256::Hex(chunk.digest) << " is damaged" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool SaveStore::Get(const std::string& snapshot, const std::string& output_file) {
+    manifest contents;
+    if (!valid_snapshot_name(snapshot) || !do_read_manifest(snapshot, contents)) {
+        return false;
+    }
+    // the manifest may use chunks indexed after Open
+    if (!do_load_index(false)) {
+        return false;
+    }
+
+    std::string pack_path = do_path("pack");
+    int pack = open(pack_path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (pack < 0) {
+        std::cerr << "unable to open " << pack_path << ", errno " << errno << std::endl;
+        return false;
+    }
+
+    AtomicFile output;
+    FILE* data_output = output.Open(output_file);
+    if (data_output == nullptr) {
+        std::cerr << "unable to open file " << output_file << std::endl;
+        close(pack);
+        return false;
+    }
+
+    // the container and compression the save was stored from
+    struct archive* archive_output = archive_write_new();
+    bool success = archive_write_set_format(archive_output, contents.format_code) == ARCHIVE_OK
+        && archive_write_add_filter(archive_output, contents.filter_code) == ARCHIVE_OK;
+    if (!success) {
+        std::cerr << "Error selecting output format: " << archive_error_string(archive_output) << std::endl;
+    } else {
+        if (contents.filter_code != ARCHIVE_FILTER_NONE) {
+            archive_write_set_bytes_in_last_block(archive_output, 1);
+        }
+        success = archive_write_open_FILE(archive_output, data_output) == ARCHIVE_OK;
+        if (!success) {
+            std::cerr << "Error opening output archive: " << archive_error_string(archive_output) << std::endl;
+        }
+    }
+
+    std::string data;
+    for (const auto& member : contents.members) {
+        if (!success) {
+            break;
+        }
+        struct archive_entry* entry = archive_entry_new();
+        archive_entry_set_pathname(entry, member.name.c_str());
+        archive_entry_set_filetype(entry, member.directory ? AE_IFDIR : AE_IFREG);
+        archive_entry_set_perm(entry, member.directory ? 0755 : 0644);
+        archive_entry_set_mtime(entry, contents.created, 0);
+        archive_entry_set_size(entry, member.size);
+        if (archive_write_header(archive_output, entry) < ARCHIVE_WARN) {
+            std::cerr << "Write Header Error: " << archive_error_string(archive_output) << std::endl;
+            success = false;
+        }
+        archive_entry_free(entry);
+
+        for (const auto& chunk : member.chunks) {
+            if (!success || !do_read_chunk(pack, chunk, data)) {
+                success = false;
+                break;
+            }
+            SGF_STATS_TIMER(TIMER_WRITE);
+            if (archive_write_data(archive_output, data.data(), data.size()) != static_cast<la_ssize_t>(data.size())) {
+                std::cerr << "Update File Data Error: " << archive_error_string(archive_output) << std::endl;
+                success = false;
+            }
+        }
+    }
+    if (archive_write_close(archive_output) != ARCHIVE_OK && success) {
+        std::cerr << "Error finishing output archive: " << archive_error_string(archive_output) << std::endl;
+        success = false;
+    }
+    archive_write_free(archive_output);
+    close(pack);
+
+    if (!success) {
+        std::cerr << "Error writing " << output_file << ", left unchanged" << std::endl;
+        output.Abort();
+        return false;
+    }
+    SGF_STATS_ADD(COUNTER_BYTES_OUT, ftello(output.File()));
+    return output.Commit();
+}
+
+bool SaveStore::ListSnapshots(std::vector<std::string>& snapshots) const {
+    boost::system::error_code error;
+    boost::filesystem::directory_iterator entries(do_path("snapshots"), error);
+    if (error) {
+        std::cerr << "unable to list snapshots in " << directory << ": " << error.message() << std::endl;
+        return false;
+    }
+    for (; entries != boost::filesystem::directory_iterator(); entries.increment(error)) {
+        std::string name = entries->path().filename().string();
+        // skips AtomicFile's temporaries as well
+        if (name.size() > MANIFEST_SUFFIX.size() && name[0] != '.'
+            && name.compare(name.size() - MANIFEST_SUFFIX.size(), std::string::npos, MANIFEST_SUFFIX) == 0) {
+            snapshots.push_back(name.substr(0, name.size() - MANIFEST_SUFFIX.size()));
+        }
+    }
+    std::sort(snapshots.begin(), snapshots.end());
+    return true;
+}
@@ -0,0 +1,113 @@
+#ifndef SAVED_GAME_FORMAT_SAVE_STORE_H__
+#define SAVED_GAME_FORMAT_SAVE_STORE_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "edit_journal.h"
+#include "sgf_file.h"
+#include "sha256.h"
+
+namespace saved_game_format_file {
+
+    // What storing one snapshot cost
+    struct StoreStats {
+        size_t members{0};
+        size_t chunks{0};
+        // chunks the store did not hold yet
+        size_t new_chunks{0};
+        // member bytes in the snapshot, and the part of them that was new
+        int64_t bytes{0};
+        int64_t new_bytes{0};
+        // bytes appended to the pack after compression
+        int64_t stored_bytes{0};
+    };
+
+    // Content-addressed store of save snapshots.
+    //
+    // Members are cut into chunks at content-defined boundaries (a rolling
+    // gear hash, so an edit only moves the boundaries next to it), and every
+    // chunk is kept once in a shared pack file under its SHA-256. A snapshot
+    // is a manifest listing each member's chunks; storing a save that mostly
+    // matches an earlier one only appends the chunks that changed.
+    //
+    // Layout of the store directory:
+    //   pack                  chunks back to back, deflated when that helps
+    //   index                 fixed size records: digest, pack offset, sizes
+    //   snapshots/<name>.manifest
+    //
+    // The pack and index only ever grow. The pack is synced before the index
+    // records that point into it, and the index before the manifest that
+    // uses them is renamed into place, so a crash leaves at worst unused
+    // bytes at the end of the pack or a torn index record, which the next
+    // writer trims. Writers take an exclusive lock on <store>/lock; readers
+    // only see complete records and need no lock.
+    class SaveStore {
+        public:
+            SaveStore() {}
+            SaveStore(const std::string& _directory) : directory(_directory) {}
+
+            // Create the store's layout if needed and read the chunk index
+            bool Open();
+            // Record every live member of the save as snapshot; an existing
+            // snapshot of the same name is replaced. With a journal, the
+            // members are recorded with its pending edits applied.
+            bool Put(SavedGameFormatFile& saved_game_file, const EditJournal* journal, const std::string& snapshot, StoreStats& stats);
+            // Rebuild the snapshot as an archive in its original container
+            // and compression, written atomically to output_file
+            bool Get(const std::string& snapshot, const std::string& output_file);
+            bool ListSnapshots(std::vector<std::string>& snapshots) const;
+
+            inline size_t ChunkCount() const { return chunks.size(); }
+
+            std::string directory{};
+
+        protected:
+            struct chunk_location {
+                int64_t offset{0};
+                uint32_t stored_size{0};
+                uint32_t size{0};
+            };
+
+            struct manifest_chunk {
+                Sha256::digest digest{};
+                uint32_t size{0};
+            };
+
+            struct manifest_member {
+                std::string name{};
+                bool directory{false};
+                int64_t size{0};
+                std::vector<manifest_chunk> chunks{};
+            };
+
+            struct manifest {
+                int format_code{0};
+                int filter_code{0};
+                int64_t created{0};
+                std::vector<manifest_member> members{};
+            };
+
+            // Read index records written since the last call. Only a writer
+            // holding the lock may repair a torn record at the end.
+            bool do_load_index(bool repair);
+            bool do_read_manifest(const std::string& snapshot, manifest& contents) const;
+            bool do_read_chunk(int pack, const manifest_chunk& chunk, std::string& data) const;
+
+            std::string do_path(const std::string& name) const;
+            std::string do_manifest_path(const std::string& snapshot) const;
+
+        private:
+            // digest bytes -> where the chunk lives
+            std::unordered_map<std::string, chunk_location> chunks{};
+            // bytes of the index already read
+            int64_t indexed_bytes{0};
+    };
+
+}
+
+#endif //SAVED_GAME_FORMAT_SAVE_STORE_H__
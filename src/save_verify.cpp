@@ -0,0 +1,219 @@
+#include <chrono>
+#include <deque>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+#include <boost/algorithm/string.hpp>
+
+#include "archive_reader.h"
+#include "archive_stream.h"
+#include "binary_json.h"
+#include "engine_text.h"
+#include "save_verify.h"
+#include "thread_pool.h"
+#include "zip_file.h"
+
+using namespace saved_game_format_file;
+
+namespace {
+
+    // members decoded ahead of the caller, per thread; bounds the memory
+    // held when contents are checked
+    const size_t MEMBERS_PER_THREAD = 2;
+
+    const std::string JSON_SUFFIX(".json");
+
+    MemberCheck describe(const ArchiveEntry& entry) {
+        MemberCheck check;
+        check.subfile = entry.name;
+        check.size = entry.uncompressed_size;
+        check.crc32 = entry.crc32;
+        check.has_crc = entry.has_crc;
+        return check;
+    }
+
+    // Parse what the member holds; the status says what was checked
+    bool check_contents(const std::string& subfile_name, std::string_view data, std::string& status) {
+        if (binary_json::IsEncoded(data)) {
+            std::string json;
+            if (!binary_json::ToJson(data, json)) {
+                status = "invalid CBOR";
+                return false;
+            }
+            status = "ok, CBOR parsed";
+            return true;
+        }
+        if (EngineTextIndex::Recognize(data)) {
+            EngineTextIndex index;
+            if (!index.Build(data)) {
+                status = "invalid engine text";
+                return false;
+            }
+            status = "ok, engine text indexed";
+            return true;
+        }
+        if (boost::algorithm::ends_with(subfile_name, JSON_SUFFIX)) {
+            // the encoder is the strictest parser at hand
+            std::string encoded;
+            if (!binary_json::FromJson(data, encoded)) {
+                status = "invalid JSON";
+                return false;
+            }
+            status = "ok, JSON parsed";
+            return true;
+        }
+        status = "ok";
+        return true;
+    }
+
+    // decode one ZIP member in full; ReadEntryData checks the size and CRC
+    MemberCheck check_zip_member(const ArchiveReader& reader, const ArchiveReader::Snapshot& current, const ArchiveEntry& entry, bool contents) {
+        MemberCheck check = describe(entry);
+        DescriptorByteSource file_source(current.descriptor);
+        MemoryByteSource memory_source(current.mapping.Data(), current.mapping.Size());
+        ByteSource& source = current.mapping.IsOpen() ? static_cast<ByteSource&>(memory_source) : file_source;
+
+        std::string data;
+        int64_t produced = 0;
+        auto sink = [&data, &produced, contents](const char* buffer, size_t buffer_size) {
+            produced += static_cast<int64_t>(buffer_size);
+            if (contents) {
+                data.append(buffer, buffer_size);
+            }
+            return true;
+        };
+        bool decoded = false;
+        if (zip_file::CanReadEntry(entry)) {
+            decoded = zip_file::ReadEntryData(source, entry, sink);
+        } else {
+            // other methods go through libarchive, which checks the CRC
+            decoded = reader.StreamSubfile(entry.name, [](int64_t) {}, sink);
+        }
+        if (!decoded) {
+            // the whole member came out, so only the CRC can be wrong
+            check.status = (produced == entry.uncompressed_size && produced != 0) ? "CRC mismatch" : "damaged or truncated";
+            return check;
+        }
+        check.success = contents ? check_contents(entry.name, data, check.status) : true;
+        if (!contents) {
+            check.status = "ok";
+        }
+        return check;
+    }
+
+}
+
+bool saved_game_format_file::VerifySave(SavedGameFormatFile& saved_game_file, const VerifyOptions& options, const check_sink& on_check, VerifyStats& stats) {
+    stats = VerifyStats();
+    // indexed from its own descriptor, so the index and the data always
+    // come from the same file
+    ArchiveReader reader(saved_game_file.filename, saved_game_file.memory_mapped);
+    if (!reader.Refresh()) {
+        std::cerr << "Unable to read " << saved_game_file.filename << std::endl;
+        return false;
+    }
+    auto current = reader.Current();
+    const EntryIndex& index = current->index;
+
+    // live members only: shadowed duplicates are not part of the save
+    std::vector<const ArchiveEntry*> members;
+    for (const auto& entry : index.Entries()) {
+        bool directory = !entry.name.empty() && entry.name.back() == '/';
+        if (!directory && index.Find(entry.name)->sequence == entry.sequence) {
+            members.push_back(&entry);
+        }
+    }
+
+    ThreadPool pool(options.threads);
+    std::deque<std::future<MemberCheck>> pending;
+    bool success = true;
+    // hand over finished members in order, waiting for the oldest ones
+    // until no more than keep are still out
+    auto drain = [&](size_t keep) {
+        while (pending.size() > keep
+            || (!pending.empty() && pending.front().wait_for(std::chrono::seconds(0)) == std::future_status::ready)) {
+            MemberCheck check = pending.front().get();
+            pending.pop_front();
+            ++stats.members;
+            if (check.success) {
+                stats.bytes += check.size;
+            } else {
+                ++stats.failed;
+                success = false;
+            }
+            if (on_check) {
+                on_check(check);
+            }
+        }
+    };
+
+    if (index.kind == ARCHIVE_KIND_ZIP) {
+        // every member can be reached on its own, so all of them are
+        // decoded at once
+        for (const ArchiveEntry* entry : members) {
+            pending.push_back(pool.Submit([&reader, current, entry, &options]() {
+                return check_zip_member(reader, *current, *entry, options.check_contents);
+            }));
+            drain(MEMBERS_PER_THREAD * pool.Size());
+        }
+        drain(0);
+        return success;
+    }
+
+    // one decompressed stream: the members come out in order on this
+    // thread and only their contents are checked on the pool
+    DescriptorByteSource file_source(current->descriptor);
+    MemoryByteSource memory_source(current->mapping.Data(), current->mapping.Size());
+    ByteSource& source = current->mapping.IsOpen() ? static_cast<ByteSource&>(memory_source) : file_source;
+    struct archive* archive_file = archive_stream::Open(source);
+    size_t reached = 0;
+    bool read = false;
+    if (archive_file != nullptr) {
+        read = archive_stream::ReadMembers(
+            archive_file, index,
+            [&members, &reached](const ArchiveEntry& entry) {
+                return reached < members.size() && members[reached]->sequence == entry.sequence;
+            },
+            [&](const ArchiveEntry& entry, std::string& data) {
+                ++reached;
+                MemberCheck check = describe(entry);
+                if (static_cast<int64_t>(data.size()) != entry.uncompressed_size) {
+                    check.status = "wrong size";
+                    std::promise<MemberCheck> ready;
+                    ready.set_value(check);
+                    pending.push_back(ready.get_future());
+                } else if (!options.check_contents) {
+                    check.success = true;
+                    check.status = "ok";
+                    std::promise<MemberCheck> ready;
+                    ready.set_value(check);
+                    pending.push_back(ready.get_future());
+                } else {
+                    auto contents = std::make_shared<std::string>();
+                    contents->swap(data);
+                    pending.push_back(pool.Submit([check, contents]() mutable {
+                        check.success = check_contents(check.subfile, *contents, check.status);
+                        return check;
+                    }));
+                }
+                drain(MEMBERS_PER_THREAD * pool.Size());
+                return true;
+            }
+        );
+        archive_read_free(archive_file);
+    }
+    drain(0);
+
+    // the member being read when the stream broke, and everything after it
+    for (size_t i = reached; i < members.size(); ++i) {
+        MemberCheck check = describe(*members[i]);
+        check.status = (i == reached && !read) ? "damaged or truncated" : "not reached";
+        std::promise<MemberCheck> ready;
+        ready.set_value(check);
+        pending.push_back(ready.get_future());
+    }
+    drain(0);
+    return read && success;
+}
@@ -0,0 +1,53 @@
+#ifndef SAVED_GAME_FORMAT_SAVE_VERIFY_H__
+#define SAVED_GAME_FORMAT_SAVE_VERIFY_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+
+#include "sgf_file.h"
+
+namespace saved_game_format_file {
+
+    struct VerifyOptions {
+        // Also parse what the members hold: .json members as JSON, binary
+        // ones as CBOR (see binary_json.h) and the engine's save text
+        // through its index (see engine_text.h)
+        bool check_contents{false};
+        // checking threads; 0 uses every hardware thread
+        size_t threads{0};
+    };
+
+    struct MemberCheck {
+        std::string subfile{};
+        bool success{false};
+        // decoded size, and the CRC from the archive where it has one
+        int64_t size{0};
+        uint32_t crc32{0};
+        bool has_crc{false};
+        // what was checked, or what failed
+        std::string status{};
+    };
+
+    struct VerifyStats {
+        size_t members{0};
+        size_t failed{0};
+        int64_t bytes{0};
+    };
+
+    typedef std::function<void(const MemberCheck& check)> check_sink;
+
+    // Decode every live member in full and check its size, and its CRC-32
+    // where the archive records one (ZIP), with checksum::Crc32. ZIP
+    // members are decoded on a pool of threads, straight from the mapping
+    // if the save is memory mapped; stream archives (tar.*) are decoded
+    // in one pass, their members checked on the pool. Results reach
+    // on_check on the calling thread in archive order. Members past a
+    // damaged point of a stream archive can't be reached and fail too.
+    // Returns true if every member passed.
+    bool VerifySave(SavedGameFormatFile& saved_game_file, const VerifyOptions& options, const check_sink& on_check, VerifyStats& stats);
+
+}
+
+#endif //SAVED_GAME_FORMAT_SAVE_VERIFY_H__
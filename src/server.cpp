@@ -0,0 +1,410 @@
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "batch_edit.h"
+#include "binary_json.h"
+#include "engine_text.h"
+#include "json_pointer.h"
+#include "options.h"
+#include "server.h"
+#include "stats.h"
+#include "thread_pool.h"
+
+using namespace saved_game_format_file;
+
+namespace {
+
+    const std::string rqStats("stats");
+    const std::string rqShutdown("shutdown");
+
+    // requests are lines; anything longer is not a request
+    const size_t MAX_REQUEST_SIZE = 16 * 1024 * 1024;
+
+    std::string ok(std::string_view payload) {
+        std::string response = "OK " + std::to_string(payload.size()) + "\n";
+        response.append(payload);
+        return response;
+    }
+
+    std::string error(const std::string& message) {
+        return "ERR " + message + "\n";
+    }
+
+    std::vector<std::string> split_fields(const std::string& request) {
+        std::vector<std::string> fields;
+        size_t start = 0;
+        while (true) {
+            size_t tab = request.find('\t', start);
+            fields.push_back(request.substr(start, tab == std::string::npos ? std::string::npos : tab - start));
+            if (tab == std::string::npos) {
+                break;
+            }
+            start = tab + 1;
+        }
+        return fields;
+    }
+
+    bool send_all(int client, const std::string& data) {
+        size_t sent = 0;
+        while (sent < data.size()) {
+            ssize_t written = send(client, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+            if (written < 0 && errno == EINTR) {
+                continue;
+            }
+            if (written <= 0) {
+                return false;
+            }
+            sent += static_cast<size_t>(written);
+        }
+        return true;
+    }
+
+}
+
+bool SaveServer::Run(const std::string& socket_path) {
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (socket_path.empty() || socket_path.size() >= sizeof(address.sun_path)) {
+        std::cerr << "invalid socket path " << socket_path << std::endl;
+        return false;
+    }
+    memcpy(address.sun_path, socket_path.c_str(), socket_path.size());
+
+    listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0) {
+        std::cerr << "unable to create socket, errno " << errno << std::endl;
+        return false;
+    }
+    // a stale socket from an earlier run would block the bind
+    unlink(socket_path.c_str());
+    if (bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0
+        || listen(listener, SOMAXCONN) != 0) {
+        std::cerr << "unable to listen on " << socket_path << ", errno " << errno << std::endl;
+        close(listener);
+        return false;
+    }
+    std::cout << "Listening on " << socket_path << std::endl;
+
+    std::thread checkpointer;
+    if (journal) {
+        checkpointer = std::thread([this]() { checkpoint_loop(); });
+    }
+
+    // finished clients hand their thread to the next one, so a long run
+    // doesn't pile up threads
+    std::unique_ptr<ThreadPool> workers(new ThreadPool(max_clients));
+    while (!stopping) {
+        int client = accept(listener, nullptr, nullptr);
+        if (client < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (!stopping) {
+                std::cerr << "unable to accept connection, errno " << errno << std::endl;
+            }
+            break;
+        }
+        {
+            std::lock_guard<std::mutex> guard(clients_lock);
+            clients.insert(client);
+        }
+        workers->Submit([this, client]() { serve_client(client); });
+    }
+
+    // wake any client still blocked in recv so its thread can finish
+    {
+        std::lock_guard<std::mutex> guard(clients_lock);
+        for (int client : clients) {
+            shutdown(client, SHUT_RDWR);
+        }
+    }
+    // clients still waiting for a thread see stopping and leave at once
+    workers.reset();
+    if (checkpointer.joinable()) {
+        {
+            std::lock_guard<std::mutex> guard(checkpoint_lock);
+            stopping = true;
+        }
+        checkpoint_wake.notify_all();
+        checkpointer.join();
+    }
+    close(listener);
+    unlink(socket_path.c_str());
+    return true;
+}
+
+void SaveServer::serve_client(int client) {
+    std::string pending;
+    char buffer[64 * 1024];
+    bool open = true;
+    while (open && !stopping) {
+        size_t line_end = pending.find('\n');
+        if (line_end == std::string::npos) {
+            if (pending.size() > MAX_REQUEST_SIZE) {
+                send_all(client, error("request too long"));
+                break;
+            }
+            ssize_t received = recv(client, buffer, sizeof(buffer), 0);
+            if (received < 0 && errno == EINTR) {
+                continue;
+            }
+            if (received <= 0) {
+                break;
+            }
+            pending.append(buffer, static_cast<size_t>(received));
+            continue;
+        }
+
+        std::string request = pending.substr(0, line_end);
+        pending.erase(0, line_end + 1);
+        if (!request.empty() && request.back() == '\r') {
+            request.pop_back();
+        }
+        open = send_all(client, Handle(request));
+    }
+    if (stopping) {
+        // unblock accept; Run tidies up the rest
+        shutdown(listener, SHUT_RDWR);
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(clients_lock);
+        clients.erase(client);
+    }
+    close(client);
+}
+
+bool SaveServer::load_journal(ArchiveCache::OpenArchive& archive, const std::string& filename) {
+    if (!archive.journal_loaded) {
+        if (!archive.journal.Load()) {
+            return false;
+        }
+        archive.journal_loaded = true;
+    }
+    if (archive.journal.Empty()) {
+        return true;
+    }
+    if (!journal) {
+        // left behind by a journaling run; fold it in before saving anything
+        // else, or replacing the save would make it look stale
+        bool success = archive.journal.Checkpoint(archive.file);
+        archive.reader.Refresh();
+        cache.Invalidate(filename);
+        return success;
+    }
+    std::lock_guard<std::mutex> guard(checkpoint_lock);
+    journaled.insert(filename);
+    return true;
+}
+
+bool SaveServer::checkpoint(const std::string& filename) {
+    auto archive = cache.Archive(filename);
+    bool success = false;
+    {
+        std::lock_guard<std::mutex> guard(archive->lock);
+        success = load_journal(*archive, filename);
+        if (success && !archive->journal.Empty()) {
+            success = archive->journal.Checkpoint(archive->file);
+            archive->reader.Refresh();
+        }
+    }
+    cache.Invalidate(filename);
+    return success;
+}
+
+void SaveServer::checkpoint_loop() {
+    bool finishing = false;
+    while (!finishing) {
+        std::set<std::string> due;
+        {
+            std::unique_lock<std::mutex> guard(checkpoint_lock);
+            checkpoint_wake.wait_for(guard, std::chrono::seconds(checkpoint_interval), [this]() { return stopping.load(); });
+            // one last pass so nothing is left only in journals
+            finishing = stopping;
+            due.swap(journaled);
+        }
+        for (const auto& filename : due) {
+            if (!checkpoint(filename)) {
+                std::cerr << "unable to checkpoint " << filename << ", will retry" << std::endl;
+                std::lock_guard<std::mutex> guard(checkpoint_lock);
+                journaled.insert(filename);
+            }
+        }
+    }
+}
+
+std::string SaveServer::Handle(const std::string& request) {
+    std::vector<std::string> fields = split_fields(request);
+    const std::string& command = fields[0];
+
+    if (command == rqStats) {
+        std::string stats = "bytes " + std::to_string(cache.Bytes())
+            + "\nhits " + std::to_string(cache.Hits())
+            + "\nmisses " + std::to_string(cache.Misses())
+            + "\nphases " + stats::Json() + "\n";
+        return ok(stats);
+    }
+    if (command == rqShutdown) {
+        // the listener is closed once this response is on its way
+        stopping = true;
+        return ok("");
+    }
+    if (fields.size() < 2 || fields[1].empty()) {
+        return error("missing file");
+    }
+    const std::string& filename = fields[1];
+
+    if (command == pcList) {
+        auto archive = cache.Archive(filename);
+        ArchiveReader::path_listing file_list;
+        if (!archive->reader.EnsureCurrent()) {
+            return error("unable to index " + filename);
+        }
+        archive->reader.ListFiles(file_list);
+        std::string listing;
+        for (const auto& file_name : file_list) {
+            listing.append(file_name);
+            listing.push_back('\n');
+        }
+        return ok(listing);
+    }
+    if (command == pcCompact) {
+        auto archive = cache.Archive(filename);
+        bool success = false;
+        {
+            std::lock_guard<std::mutex> guard(archive->lock);
+            // compacting replaces the save, so pending edits go in first
+            success = load_journal(*archive, filename)
+                && archive->journal.Checkpoint(archive->file)
+                && archive->file.Compact("");
+            archive->reader.Refresh();
+        }
+        cache.Invalidate(filename);
+        return success ? ok("") : error("unable to compact " + filename);
+    }
+    if (command == pcCheckpoint) {
+        return checkpoint(filename) ? ok("") : error("unable to checkpoint " + filename);
+    }
+
+    if (fields.size() < 3 || fields[2].empty()) {
+        return error("missing subfile");
+    }
+    const std::string& subfile_name = fields[2];
+
+    if (command == pcDump) {
+        auto data = cache.Member(filename, subfile_name);
+        if (!data) {
+            return error("unable to read " + subfile_name);
+        }
+        bool has_key = fields.size() >= 4 && !fields[3].empty();
+        if (binary_json::IsEncoded(*data)) {
+            bool pending = false;
+            if (journal) {
+                auto archive = cache.Archive(filename);
+                std::lock_guard<std::mutex> guard(archive->lock);
+                if (!load_journal(*archive, filename)) {
+                    return error("unable to read journal of " + filename);
+                }
+                pending = archive->journal.HasPending(subfile_name);
+            }
+            // a key is read straight from the encoding; journaled edits
+            // apply to the JSON text, so those members go through it
+            std::string_view item = *data;
+            if (has_key && !pending && !binary_json::Find(*data, fields[3], item)) {
+                return error("unable to locate key " + fields[3]);
+            }
+            auto decoded = std::make_shared<std::string>();
+            if (!binary_json::ToJson(item, *decoded)) {
+                return error("unable to decode " + subfile_name);
+            }
+            if (has_key && !pending) {
+                return ok(*decoded);
+            }
+            data = decoded;
+        }
+        if (journal) {
+            // the cache holds the save as written; journaled edits go on top
+            auto archive = cache.Archive(filename);
+            std::lock_guard<std::mutex> guard(archive->lock);
+            if (!load_journal(*archive, filename)) {
+                return error("unable to read journal of " + filename);
+            }
+            if (archive->journal.HasPending(subfile_name)) {
+                auto overlaid = std::make_shared<std::string>(*data);
+                if (!archive->journal.Overlay(subfile_name, *overlaid)) {
+                    return error("unable to apply journal to " + subfile_name);
+                }
+                data = overlaid;
+            }
+        }
+        if (!has_key) {
+            return ok(*data);
+        }
+        if (EngineTextIndex::Recognize(*data)) {
+            EngineTextIndex text_index;
+            std::string value_json;
+            if (!text_index.Build(*data) || !text_index.Find(*data, fields[3], value_json)) {
+                return error("unable to locate key " + fields[3]);
+            }
+            return ok(value_json);
+        }
+        std::string_view key_value;
+        if (!json_pointer::Find(*data, fields[3], key_value)) {
+            return error("unable to locate key " + fields[3]);
+        }
+        return ok(key_value);
+    }
+
+    if (command == pcUpdate || command == pcAdd) {
+        if (fields.size() < 5 || fields[3].empty()) {
+            return error("missing key or value");
+        }
+        // read, splice and write under the archive's lock so concurrent
+        // edits of the same save can't lose each other's changes
+        auto archive = cache.Archive(filename);
+        bool success = false;
+        {
+            std::lock_guard<std::mutex> guard(archive->lock);
+            std::string file_contents;
+            std::string scratch;
+            KeyEdit edit;
+            edit.subfile = subfile_name;
+            edit.op = (command == pcAdd) ? KEY_EDIT_ADD : KEY_EDIT_UPDATE;
+            edit.key = fields[3];
+            edit.value_json = fields[4];
+            // may checkpoint a leftover journal, so before reading
+            success = load_journal(*archive, filename);
+            archive->file.DumpSubfile(subfile_name, file_contents);
+            success = success
+                && archive->journal.Overlay(subfile_name, file_contents)
+                && ApplyKeyEdit(file_contents, scratch, edit);
+            if (success && journal) {
+                // the edit applies; keep it in the journal until the next
+                // checkpoint, the save itself is untouched
+                success = archive->journal.Append(edit);
+                if (success) {
+                    std::lock_guard<std::mutex> checkpoint_guard(checkpoint_lock);
+                    journaled.insert(filename);
+                }
+                return success ? ok("") : error("unable to journal " + fields[3] + " in " + subfile_name);
+            }
+            success = success && archive->file.UpdateSubfile("", subfile_name, file_contents);
+            // publish the saved index to readers
+            archive->reader.Refresh();
+        }
+        cache.Invalidate(filename);
+        return success ? ok("") : error("unable to update " + fields[3] + " in " + subfile_name);
+    }
+
+    return error("unknown command " + command);
+}
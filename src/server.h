@@ -0,0 +1,78 @@
+#ifndef SAVED_GAME_FORMAT_SERVER_H__
+#define SAVED_GAME_FORMAT_SERVER_H__
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <set>
+#include <string>
+
+#include "archive_cache.h"
+
+namespace saved_game_format_file {
+
+    // Answers requests on a local UNIX socket out of an ArchiveCache, so a
+    // client hitting the same saves over and over skips the process start,
+    // the archive scan and the decompression.
+    //
+    // Reads of a save run concurrently; writes to it are serialised.
+    //
+    // One request per line, fields separated by tabs:
+    //     list    <file>
+    //     dump    <file> <subfile> [<key>]
+    //     update  <file> <subfile> <key> <json value>
+    //     add     <file> <subfile> <key> <json value>
+    //     compact <file>
+    //     checkpoint <file>
+    //     stats
+    //     shutdown
+    // stats reports the cache's counters and a "phases" line with the
+    // per-phase timings as JSON. Keys are plain top-level keys or JSON pointers. Every request gets
+    // either "OK <length>\n" followed by length bytes of payload, or
+    // "ERR <message>\n". Updates replace the save atomically.
+    //
+    // With journal set, updates are appended to the save's EditJournal and
+    // answered once synced; dumps see them straight away. A background
+    // thread checkpoints journaled saves every checkpoint_interval seconds
+    // and once more on shutdown.
+    class SaveServer {
+        public:
+            SaveServer(ArchiveCache& _cache) : cache(_cache) {}
+
+            // Serve until a shutdown request arrives; each client is served
+            // on a thread of a fixed pool
+            bool Run(const std::string& socket_path);
+
+            // Handle a single request line and return the full response
+            std::string Handle(const std::string& request);
+
+            // journal updates instead of saving each one
+            bool journal{false};
+            unsigned int checkpoint_interval{30};
+            // clients served at once; further connections are accepted and
+            // wait for a thread. 0 uses every hardware thread
+            size_t max_clients{64};
+
+        private:
+            void serve_client(int client);
+            // with the archive locked: read its journal the first time
+            bool load_journal(ArchiveCache::OpenArchive& archive, const std::string& filename);
+            bool checkpoint(const std::string& filename);
+            void checkpoint_loop();
+
+            ArchiveCache& cache;
+            std::atomic<bool> stopping{false};
+            int listener{-1};
+            std::mutex clients_lock{};
+            std::set<int> clients{};
+
+            // saves with journaled edits waiting for a checkpoint
+            std::mutex checkpoint_lock{};
+            std::condition_variable checkpoint_wake{};
+            std::set<std::string> journaled{};
+    };
+
+}
+
+#endif //SAVED_GAME_FORMAT_SERVER_H__
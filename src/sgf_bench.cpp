@@ -0,0 +1,310 @@
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+#include <boost/filesystem.hpp>
+
+#include "batch_edit.h"
+#include "json_pointer.h"
+#include "options.h"
+#include "save_generator.h"
+#include "sgf_file.h"
+
+// Throughput and latency of the common operations over generated saves,
+// one corpus per container and codec:
+//
+//     sgf-bench [--sgf_corpora=zip:gzip,gnutar:zstd,...] [--sgf_ships=N]
+//               [--sgf_data_size=BYTES] [--sgf_dir=PATH] [benchmark flags]
+//
+// Corpora are generated into sgf_dir (a temporary directory by default,
+// removed afterwards). Every other flag goes to Google Benchmark, e.g.
+// --benchmark_filter=Update or --benchmark_repetitions=10 for spread.
+
+using namespace saved_game_format_file;
+
+namespace {
+
+    const std::string DEFAULT_CORPORA("zip:none,zip:gzip,gnutar:gzip,gnutar:bzip2,gnutar:xz,gnutar:zstd,gnutar:lz4");
+    const std::string POINT_KEY("/0/Can_Lock");
+
+    struct corpus {
+        std::string name{};
+        std::string path{};
+        // scratch copy for the write benchmarks
+        std::string work_path{};
+        SaveCorpusSpec spec{};
+    };
+
+    // the library reports progress on stdout; keep it out of the results
+    class null_buffer : public std::streambuf {
+        protected:
+            int overflow(int c) override { return c; }
+    };
+
+    bool take_flag(const char* argument, const char* flag, std::string& value) {
+        size_t length = strlen(flag);
+        if (strncmp(argument, flag, length) != 0 || argument[length] != '=') {
+            return false;
+        }
+        value = argument + length + 1;
+        return true;
+    }
+
+    bool parse_corpora(const std::string& list, const SaveCorpusSpec& shape, std::vector<corpus>& corpora) {
+        std::stringstream items(list);
+        std::string item;
+        while (std::getline(items, item, ',')) {
+            size_t colon = item.find(':');
+            corpus next;
+            next.name = item;
+            next.spec = shape;
+            try {
+                std::istringstream format(item.substr(0, colon));
+                format >> next.spec.save_settings.format;
+                if (colon != std::string::npos) {
+                    std::istringstream codec(item.substr(colon + 1));
+                    codec >> next.spec.save_settings.codec;
+                }
+            } catch (const std::exception&) {
+                std::cerr << "unknown corpus " << item << ", expected <format>:<codec>" << std::endl;
+                return false;
+            }
+            corpora.push_back(next);
+        }
+        return !corpora.empty();
+    }
+
+    bool reset_work_copy(const corpus& save) {
+        boost::system::error_code fs_error;
+        boost::filesystem::copy_file(save.path, save.work_path, boost::filesystem::copy_options::overwrite_existing, fs_error);
+        if (fs_error) {
+            std::cerr << "unable to copy " << save.path << ": " << fs_error.message() << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    std::string read_member(SavedGameFormatFile& saved_game_file, const std::string& subfile_name) {
+        std::string contents;
+        saved_game_file.StreamSubfile(
+            subfile_name,
+            [&contents](int64_t entry_size) {
+                if (entry_size > 0) {
+                    contents.reserve(static_cast<size_t>(entry_size));
+                }
+            },
+            [&contents](const char* buffer, size_t buffer_size) {
+                contents.append(buffer, buffer_size);
+                return true;
+            }
+        );
+        return contents;
+    }
+
+    // opening and indexing from cold, as a one-shot command does
+    void bench_list(benchmark::State& state, const corpus* save) {
+        size_t entries = 0;
+        for (auto _ : state) {
+            SavedGameFormatFile saved_game_file(save->path);
+            SavedGameFormatFile::path_listing listing;
+            saved_game_file.ListFiles(listing);
+            entries = listing.size();
+            benchmark::DoNotOptimize(entries);
+        }
+        state.SetItemsProcessed(state.iterations() * entries);
+    }
+
+    // one key out of one ship, on an already indexed file
+    void bench_point_read(benchmark::State& state, const corpus* save) {
+        SavedGameFormatFile saved_game_file(save->path);
+        saved_game_file.BuildIndex();
+        std::string subfile_name = GeneratedShipMember(save->spec.ship_count / 2);
+        for (auto _ : state) {
+            std::string contents = read_member(saved_game_file, subfile_name);
+            std::string_view value;
+            if (!json_pointer::Find(contents, POINT_KEY, value)) {
+                state.SkipWithError("key not found");
+                break;
+            }
+            benchmark::DoNotOptimize(value);
+        }
+    }
+
+    // every member, decoded and discarded
+    void bench_full_dump(benchmark::State& state, const corpus* save) {
+        SavedGameFormatFile saved_game_file(save->path);
+        SavedGameFormatFile::path_listing listing;
+        saved_game_file.ListFiles(listing);
+        int64_t bytes = 0;
+        for (auto _ : state) {
+            bytes = 0;
+            for (const auto& subfile_name : listing) {
+                saved_game_file.StreamSubfile(subfile_name, [&bytes](const char*, size_t buffer_size) {
+                    bytes += static_cast<int64_t>(buffer_size);
+                    return true;
+                });
+            }
+        }
+        state.SetBytesProcessed(state.iterations() * bytes);
+    }
+
+    // the update command: read a ship, set a key, save
+    void bench_update_key(benchmark::State& state, const corpus* save) {
+        std::string subfile_name = GeneratedShipMember(0);
+        size_t round = 0;
+        for (auto _ : state) {
+            state.PauseTiming();
+            bool ready = reset_work_copy(*save);
+            state.ResumeTiming();
+            if (!ready) {
+                state.SkipWithError("unable to copy corpus");
+                break;
+            }
+
+            SavedGameFormatFile saved_game_file(save->work_path);
+            saved_game_file.save_settings = save->spec.save_settings;
+            std::string contents = read_member(saved_game_file, subfile_name);
+            std::string updated;
+            if (!json_pointer::Set(contents, POINT_KEY, json_pointer::Quote(std::to_string(round++)), false, updated)
+                || !saved_game_file.UpdateSubfile("", subfile_name, updated)) {
+                state.SkipWithError("update failed");
+                break;
+            }
+        }
+    }
+
+    // the batch command: one edit per ship, one save
+    void bench_batch_update(benchmark::State& state, const corpus* save) {
+        std::vector<KeyEdit> edits;
+        for (size_t ship = 0; ship < save->spec.ship_count; ++ship) {
+            KeyEdit edit;
+            edit.subfile = GeneratedShipMember(ship);
+            edit.op = KEY_EDIT_ADD;
+            edit.key = "/0/Bench_Round";
+            edits.push_back(edit);
+        }
+        size_t round = 0;
+        for (auto _ : state) {
+            state.PauseTiming();
+            bool ready = reset_work_copy(*save);
+            for (auto& edit : edits) {
+                edit.value_json = std::to_string(round);
+            }
+            ++round;
+            state.ResumeTiming();
+            if (!ready) {
+                state.SkipWithError("unable to copy corpus");
+                break;
+            }
+
+            SavedGameFormatFile saved_game_file(save->work_path);
+            saved_game_file.save_settings = save->spec.save_settings;
+            if (!ApplyKeyEdits(saved_game_file, edits, "")) {
+                state.SkipWithError("batch failed");
+                break;
+            }
+        }
+        state.SetItemsProcessed(state.iterations() * edits.size());
+    }
+
+    double maximum(const std::vector<double>& values) {
+        return values.empty() ? 0.0 : *std::max_element(values.begin(), values.end());
+    }
+
+}
+
+int main(int argc, char** argv) {
+    std::string corpora_list = DEFAULT_CORPORA;
+    std::string corpus_dir;
+    std::string report_format = "console";
+    SaveCorpusSpec shape;
+
+    // our flags are taken out before Google Benchmark sees the rest
+    std::vector<char*> remaining;
+    for (int i = 0; i < argc; ++i) {
+        std::string value;
+        if (i > 0 && take_flag(argv[i], "--sgf_corpora", value)) {
+            corpora_list = value;
+        } else if (i > 0 && take_flag(argv[i], "--sgf_ships", value)) {
+            shape.ship_count = std::max<size_t>(1, std::stoul(value));
+        } else if (i > 0 && take_flag(argv[i], "--sgf_data_size", value)) {
+            shape.data_size = std::stoul(value);
+        } else if (i > 0 && take_flag(argv[i], "--sgf_dir", value)) {
+            corpus_dir = value;
+        } else {
+            if (i > 0) {
+                take_flag(argv[i], "--benchmark_format", report_format);
+            }
+            remaining.push_back(argv[i]);
+        }
+    }
+    int remaining_count = static_cast<int>(remaining.size());
+    benchmark::Initialize(&remaining_count, remaining.data());
+    if (benchmark::ReportUnrecognizedArguments(remaining_count, remaining.data())) {
+        return 1;
+    }
+
+    std::vector<corpus> corpora;
+    if (!parse_corpora(corpora_list, shape, corpora)) {
+        return 1;
+    }
+
+    bool remove_dir = corpus_dir.empty();
+    if (remove_dir) {
+        corpus_dir = (boost::filesystem::temp_directory_path() / boost::filesystem::unique_path("sgf-bench-%%%%%%%%")).string();
+    }
+    boost::filesystem::create_directories(corpus_dir);
+
+    for (auto& save : corpora) {
+        std::string file_name = save.name;
+        std::replace(file_name.begin(), file_name.end(), ':', '.');
+        save.path = corpus_dir + "/" + file_name + ".sav";
+        save.work_path = corpus_dir + "/" + file_name + ".work.sav";
+        std::cerr << "generating " << save.path << std::endl;
+        if (!GenerateSave(save.path, save.spec)) {
+            return 1;
+        }
+    }
+
+    for (const auto& save : corpora) {
+        const corpus* argument = &save;
+        benchmark::RegisterBenchmark(("List/" + save.name).c_str(), bench_list, argument);
+        benchmark::RegisterBenchmark(("PointRead/" + save.name).c_str(), bench_point_read, argument);
+        benchmark::RegisterBenchmark(("FullDump/" + save.name).c_str(), bench_full_dump, argument)
+            ->Unit(benchmark::kMillisecond);
+        // saves use the compression thread pool, so wall time is what counts
+        benchmark::RegisterBenchmark(("UpdateKey/" + save.name).c_str(), bench_update_key, argument)
+            ->Unit(benchmark::kMillisecond)->UseRealTime()->ComputeStatistics("max", maximum);
+        benchmark::RegisterBenchmark(("BatchUpdate/" + save.name).c_str(), bench_batch_update, argument)
+            ->Unit(benchmark::kMillisecond)->UseRealTime()->ComputeStatistics("max", maximum);
+    }
+
+    // silence the library's progress messages without losing the report
+    std::ostream report_stream(std::cout.rdbuf());
+    null_buffer discard;
+    std::cout.rdbuf(&discard);
+    std::unique_ptr<benchmark::BenchmarkReporter> reporter;
+    if (report_format == "json") {
+        reporter.reset(new benchmark::JSONReporter());
+    } else {
+        reporter.reset(new benchmark::ConsoleReporter());
+    }
+    reporter->SetOutputStream(&report_stream);
+    reporter->SetErrorStream(&std::cerr);
+    benchmark::RunSpecifiedBenchmarks(reporter.get());
+    benchmark::Shutdown();
+    std::cout.rdbuf(report_stream.rdbuf());
+
+    if (remove_dir) {
+        boost::system::error_code fs_error;
+        boost::filesystem::remove_all(corpus_dir, fs_error);
+    }
+    return 0;
+}
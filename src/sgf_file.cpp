@@ -1,9 +1,22 @@
+#include <algorithm>
 #include <cerrno>
+#include <cstdint>
 #include <cstddef>
 #include <cstdio>
 #include <exception>
 #include <fstream>
+#include <future>
 #include <iostream>
+#include <memory>
+#include <set>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include <boost/algorithm/string.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/program_options/errors.hpp>
@@ -11,10 +24,172 @@
 #include <archive.h>
 #include <archive_entry.h>
 
+#include "archive_stream.h"
+#include "atomic_file.h"
+#include "binary_json.h"
+#include "block_ring.h"
+#include "parallel_gzip.h"
+#include "save_verify.h"
 #include "sgf_file.h"
+#include "stats.h"
+#include "thread_pool.h"
+#include "zip_file.h"
 
 using namespace saved_game_format_file;
 
+namespace {
+
+    // members smaller than this are decoded before a thread could start
+    const int64_t PIPELINE_MIN_SIZE = 1024 * 1024;
+    // decoded data held between the decoder and a pipelined sink
+    const size_t PIPELINE_BUFFERS = 4;
+    const size_t PIPELINE_BUFFER_SIZE = 256 * 1024;
+
+    // nanoseconds, so two writes within a second still differ
+    int64_t modification_time(const struct stat& file_stat) {
+        return static_cast<int64_t>(file_stat.st_mtim.tv_sec) * 1000000000 + file_stat.st_mtim.tv_nsec;
+    }
+
+    int format_code(SaveFormat format) {
+        switch (format) {
+            case SAVE_FORMAT_ZIP:
+                return ARCHIVE_FORMAT_ZIP;
+            case SAVE_FORMAT_GNUTAR:
+                return ARCHIVE_FORMAT_TAR_GNUTAR;
+            case SAVE_FORMAT_PAX:
+                return ARCHIVE_FORMAT_TAR_PAX_INTERCHANGE;
+            case SAVE_FORMAT_USTAR:
+                return ARCHIVE_FORMAT_TAR_USTAR;
+            case SAVE_FORMAT_CPIO:
+                return ARCHIVE_FORMAT_CPIO_POSIX;
+            default:
+                return ARCHIVE_FORMAT_TAR_GNUTAR;
+        }
+    }
+
+    // A member of a ZIP rewrite: copied as-is, or compressed (possibly on
+    // another thread) and then written in archive order
+    struct planned_entry {
+        // live entry being carried over or replaced; null for a new member
+        const ArchiveEntry* entry{nullptr};
+        const std::string* name{nullptr};
+        // new contents, if any
+        const std::string_view* replacement{nullptr};
+        // compress rather than copy
+        bool compress{false};
+        zip_file::WriteOptions write_options{};
+        zip_file::CompressedEntry compressed{};
+        std::future<bool> job{};
+    };
+
+    bool compress_planned(ByteSource& source, planned_entry& planned) {
+        SGF_STATS_TIMER(TIMER_COMPRESS);
+        if (planned.replacement != nullptr) {
+            std::string_view data = *planned.replacement;
+            return zip_file::CompressEntry(*planned.name, data.data(), data.size(), planned.write_options, planned.compressed);
+        }
+        // a different codec was asked for; this member has to be recoded
+        std::string contents;
+        contents.reserve(static_cast<size_t>(planned.entry->uncompressed_size));
+        return zip_file::ReadEntryData(
+            source, *planned.entry,
+            [&contents](const char* buffer, size_t buffer_size) {
+                contents.append(buffer, buffer_size);
+                return true;
+            }
+        ) && zip_file::CompressEntry(*planned.name, contents.data(), contents.size(), planned.write_options, planned.compressed);
+    }
+
+    // Write the planned entries in order, one central record per entry.
+    // Members are compressed on a pool a bounded distance ahead of the
+    // writer; the pool only lives inside this call, so every job is done
+    // by the time the plan can go away.
+    bool write_plan(zip_file::ZipWriter& writer, ByteSource& source, std::vector<planned_entry>& plan, unsigned int threads, std::vector<std::string>& records) {
+        size_t compress_jobs = 0;
+        for (const auto& planned : plan) {
+            compress_jobs += planned.compress ? 1 : 0;
+        }
+        std::unique_ptr<ThreadPool> pool;
+        if (compress_jobs > 1 && threads != 1) {
+            pool.reset(new ThreadPool(threads));
+        }
+        size_t window = pool ? 2 * pool->Size() : 0;
+        size_t submitted = 0;
+
+        bool success = true;
+        for (size_t i = 0; success && i < plan.size(); ++i) {
+            for (; pool && submitted < plan.size() && submitted <= i + window; ++submitted) {
+                planned_entry& ahead = plan[submitted];
+                if (ahead.compress) {
+                    ahead.job = pool->Submit([&source, &ahead]() { return compress_planned(source, ahead); });
+                }
+            }
+
+            planned_entry& planned = plan[i];
+            std::string record;
+            if (planned.compress) {
+                success = planned.job.valid() ? planned.job.get() : compress_planned(source, planned);
+                SGF_STATS_TIMER(TIMER_WRITE);
+                success = success && writer.WriteCompressed(*planned.name, planned.compressed, planned.entry, record);
+                // written; don't hold on to the compressed copy
+                planned.compressed.data = std::vector<unsigned char>();
+            } else {
+                SGF_STATS_TIMER(TIMER_WRITE);
+                success = writer.CopyEntry(source, *planned.entry, record);
+            }
+            records.push_back(record);
+        }
+        return success;
+    }
+
+    // libarchive client callbacks feeding a ParallelGzip
+    la_ssize_t parallel_gzip_write(struct archive*, void* client_data, const void* buffer, size_t length) {
+        ParallelGzip* gzip = static_cast<ParallelGzip*>(client_data);
+        return gzip->Write(buffer, length) ? static_cast<la_ssize_t>(length) : -1;
+    }
+
+    int parallel_gzip_close(struct archive*, void* client_data) {
+        ParallelGzip* gzip = static_cast<ParallelGzip*>(client_data);
+        return gzip->Finish() ? ARCHIVE_OK : ARCHIVE_FATAL;
+    }
+
+    int filter_code(SaveCodec codec) {
+        switch (codec) {
+            case SAVE_CODEC_GZIP:
+                return ARCHIVE_FILTER_GZIP;
+            case SAVE_CODEC_BZIP2:
+                return ARCHIVE_FILTER_BZIP2;
+            case SAVE_CODEC_XZ:
+                return ARCHIVE_FILTER_XZ;
+            case SAVE_CODEC_ZSTD:
+                return ARCHIVE_FILTER_ZSTD;
+            case SAVE_CODEC_LZ4:
+                return ARCHIVE_FILTER_LZ4;
+            default:
+                return ARCHIVE_FILTER_NONE;
+        }
+    }
+
+    // header and data of one member; libarchive reports short writes and
+    // filter failures through either call
+    bool write_archive_member(struct archive* archive_output, struct archive_entry* entry, std::string_view data) {
+        SGF_STATS_TIMER(TIMER_WRITE);
+        int aerr = archive_write_header(archive_output, entry);
+        if (aerr < ARCHIVE_WARN) {
+            std::cerr << "Write Header Error: " << archive_error_string(archive_output) << std::endl;
+            return false;
+        }
+        la_ssize_t data_written = archive_write_data(archive_output, data.data(), data.size());
+        if (data_written != static_cast<la_ssize_t>(data.size())) {
+            std::cerr << "Only " << data_written << " bytes of " << data.size() << " bytes were actually written" << std::endl;
+            std::cerr << "Update File Data Error: " << archive_error_string(archive_output) << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+}
+
 std::ostream& operator<<(std::ostream& out, const saved_game_format_file::SavedGameFormatFile& sgff) {
     out << sgff.filename;
     return out;
@@ -38,6 +213,7 @@ bool SavedGameFormatFile::Validate() {
 }
 
 FILE* SavedGameFormatFile::do_open_file(std::string _filename, bool write) {
+    SGF_STATS_TIMER(TIMER_OPEN);
     const char* permissions = "r+b";
     if (write) {
         permissions = "w+b";
@@ -49,111 +225,749 @@ FILE* SavedGameFormatFile::do_open_file(std::string _filename, bool write) {
         return nullptr;
     }
 
-    int ferr = fseeko(data_file, 0, SEEK_END);
-    if (ferr != 0) {
-        std::cerr << "unable to set file pointer, errno " << errno << std::endl;
+    return data_file;
+}
+
+struct archive* SavedGameFormatFile::do_open_archive(FILE* data_file) {
+    struct archive* archive_file = archive_read_new();
+    archive_read_support_filter_all(archive_file);
+    archive_read_support_format_all(archive_file);
+
+    int aerr = ARCHIVE_OK;
+    if (data_file == nullptr && mapping.IsOpen()) {
+        aerr = archive_read_open_memory(archive_file, mapping.Data(), mapping.Size());
     } else {
-        off_t file_length = ftello(data_file);
-        std::cerr << "file is " << file_length << " bytes long" << std::endl;
+        aerr = archive_read_open_FILE(archive_file, data_file);
     }
+    if (aerr != ARCHIVE_OK) {
+        std::cerr << "Error opening archive: " << archive_error_string(archive_file) << std::endl;
+        archive_read_free(archive_file);
+        return nullptr;
+    }
+    return archive_file;
+}
 
-    return data_file;
+bool SavedGameFormatFile::BuildIndex() {
+    SGF_STATS_TIMER(TIMER_INDEX);
+    invalidate_index();
+
+    // stamped from the descriptor that is indexed, so the stamp describes
+    // exactly what was read
+    struct stat file_stat;
+    FILE* data_file = nullptr;
+    bool is_zip = false;
+    if (memory_mapped) {
+        // the mapping lives as long as the index built from it
+        int descriptor = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+        bool mapped = descriptor >= 0 && fstat(descriptor, &file_stat) == 0 && mapping.Open(descriptor);
+        if (descriptor >= 0) {
+            close(descriptor);
+        }
+        if (!mapped) {
+            std::cerr << "unable to map file " << filename << std::endl;
+            return false;
+        }
+        MemoryByteSource source(mapping.Data(), mapping.Size());
+        is_zip = zip_file::ReadCentralDirectory(source, index);
+    } else {
+        data_file = do_open_file(filename, false);
+        if (data_file == nullptr) {
+            std::cerr << "unable to open file " << filename << std::endl;
+            return false;
+        }
+        if (fstat(fileno(data_file), &file_stat) != 0) {
+            std::cerr << "unable to stat file " << filename << ", errno " << errno << std::endl;
+            fclose(data_file);
+            return false;
+        }
+        FileByteSource source(data_file);
+        is_zip = zip_file::ReadCentralDirectory(source, index);
+    }
+    if (is_zip) {
+        index.format_code = ARCHIVE_FORMAT_ZIP;
+        index.filter_code = ARCHIVE_FILTER_NONE;
+    }
+
+    // ZIP archives carry their own index at the end of the file
+    if (!is_zip) {
+        if (data_file != nullptr && fseeko(data_file, 0, SEEK_SET) != 0) {
+            std::cerr << "unable to reset file pointer, errno " << errno << std::endl;
+            fclose(data_file);
+            return false;
+        }
+
+        struct archive* archive_file = do_open_archive(data_file);
+        if (archive_file == nullptr) {
+            if (data_file != nullptr) {
+                fclose(data_file);
+            }
+            return false;
+        }
+
+        // everything else is a stream; one pass over the headers records
+        // the entries, the member data past its first bytes is skipped by
+        // libarchive
+        if (!archive_stream::Index(archive_file, index)) {
+            archive_read_free(archive_file);
+            if (data_file != nullptr) {
+                fclose(data_file);
+            }
+            invalidate_index();
+            return false;
+        }
+
+        int aerr = archive_read_free(archive_file);
+        if (aerr != ARCHIVE_OK) {
+            std::cerr << "Error closing archive: " << archive_error_string(archive_file) << std::endl;
+        }
+    }
+    if (data_file != nullptr) {
+        fclose(data_file);
+    }
+
+    indexed_filename = filename;
+    indexed_size = static_cast<int64_t>(file_stat.st_size);
+    indexed_mtime = modification_time(file_stat);
+    indexed_inode = static_cast<uint64_t>(file_stat.st_ino);
+    return true;
+}
+
+bool SavedGameFormatFile::ensure_index() {
+    if (index.kind != ARCHIVE_KIND_UNKNOWN && indexed_filename == filename && mapping.IsOpen() == memory_mapped) {
+        // a cheap stat catches the file being rewritten or replaced behind
+        // our back, even within the same second
+        struct stat file_stat;
+        if (stat(filename.c_str(), &file_stat) == 0
+            && static_cast<int64_t>(file_stat.st_size) == indexed_size
+            && modification_time(file_stat) == indexed_mtime
+            && static_cast<uint64_t>(file_stat.st_ino) == indexed_inode) {
+            return true;
+        }
+    }
+    return BuildIndex();
+}
+
+bool SavedGameFormatFile::do_verify_before_save() {
+    if (!verify_on_save) {
+        return true;
+    }
+    VerifyOptions options;
+    options.threads = save_settings.threads;
+    VerifyStats verify_stats;
+    bool verified = VerifySave(*this, options, [this](const MemberCheck& check) {
+        if (!check.success) {
+            std::cerr << check.subfile << " in " << filename << ": " << check.status << std::endl;
+        }
+    }, verify_stats);
+    if (!verified) {
+        std::cerr << filename << " has " << verify_stats.failed << " damaged member(s), not saving" << std::endl;
+    }
+    return verified;
+}
+
+void SavedGameFormatFile::invalidate_index() {
+    index.Clear();
+    mapping.Close();
+    indexed_filename.clear();
+    indexed_size = -1;
+    indexed_mtime = 0;
+    indexed_inode = 0;
 }
 
 void SavedGameFormatFile::ListFiles(path_listing& listing) {
-    FILE* data_file = do_open_file(filename, false);
-    if (data_file == nullptr) {
-        std::cerr << "unable to open file " << filename << std::endl;
+    SGF_STATS_TIMER(TIMER_LIST);
+    if (!ensure_index()) {
+        std::cerr << "unable to index file " << filename << std::endl;
         return;
     }
 
-    int ferr = fseeko(data_file, 0, SEEK_SET);
-    if (ferr != 0) {
-        std::cerr << "unable to reset file pointer, errno " << errno << std::endl;
-        return;
+    for (const auto& entry : index.Entries()) {
+        listing.push_back(entry.name);
     }
 
-    struct archive* archive_file = archive_read_new();
-    archive_read_support_filter_all(archive_file);
-    archive_read_support_format_all(archive_file);
+    return;
+}
 
-    int aerr = archive_read_open_FILE(archive_file, data_file);
-    if (aerr != ARCHIVE_OK) {
-        std::cerr << "Error opening archive: " << archive_error_string(archive_file) << std::endl;
+void SavedGameFormatFile::DumpSubfile(const std::string& subfile_name, std::string& data) {
+    SGF_STATS_TIMER(TIMER_DUMP);
+    size_t initial_size = data.size();
+    if (!do_read_member(subfile_name, data)) {
         return;
     }
+    std::string_view member = std::string_view(data).substr(initial_size);
+    if (binary_json::IsEncoded(member)) {
+        std::string json;
+        if (!binary_json::ToJson(member, json)) {
+            std::cerr << "unable to decode " << subfile_name << " in " << filename << std::endl;
+            data.resize(initial_size);
+            return;
+        }
+        data.resize(initial_size);
+        data.append(json);
+    }
+}
 
-    struct archive_entry* current_archive_entry = nullptr;
-    while (archive_read_next_header(archive_file, &current_archive_entry) == ARCHIVE_OK) {
-        auto entry_path = archive_entry_pathname(current_archive_entry);
-        std::string value(entry_path);
-        listing.push_back(value);
+bool SavedGameFormatFile::IsBinarySubfile(const std::string& subfile_name, bool& binary) {
+    binary = false;
+    if (!ensure_index()) {
+        std::cerr << "unable to index file " << filename << std::endl;
+        return false;
     }
-    aerr = archive_read_free(archive_file);
+    const ArchiveEntry* entry = index.Find(subfile_name);
+    if (entry == nullptr) {
+        std::cerr << "unable to locate " << subfile_name << " in " << filename << std::endl;
+        return false;
+    }
+    // reaching a stream member means decoding everything ahead of it
+    if (index.kind == ARCHIVE_KIND_STREAM) {
+        binary = entry->binary;
+        return true;
+    }
+
+    std::string prefix;
+    bool read = ReadSubfileRange(subfile_name, 0, 3, [&prefix](const char* buffer, size_t buffer_size) {
+        prefix.append(buffer, buffer_size);
+        return true;
+    });
+    binary = read && binary_json::IsEncoded(prefix);
+    return read;
+}
+
+bool SavedGameFormatFile::do_read_member(const std::string& subfile_name, std::string& data) {
+    size_t initial_size = data.size();
+    bool success = StreamSubfile(
+        subfile_name,
+        [&data](int64_t entry_size) {
+            data.reserve(data.size() + static_cast<size_t>(entry_size));
+        },
+        [&data](const char* buffer, size_t buffer_size) {
+            data.append(buffer, buffer_size);
+            return true;
+        }
+    );
+    if (!success) {
+        // never hand back a partial member
+        data.resize(initial_size);
+    }
+    return success;
+}
+
+bool SavedGameFormatFile::StreamSubfile(const std::string& subfile_name, const data_sink& sink) {
+    return StreamSubfile(subfile_name, [](int64_t) {}, sink);
+}
+
+bool SavedGameFormatFile::StreamSubfile(const std::string& subfile_name, std::ostream& out) {
+    return StreamSubfile(
+        subfile_name,
+        [&out](const char* buffer, size_t buffer_size) {
+            out.write(buffer, buffer_size);
+            return static_cast<bool>(out);
+        }
+    );
+}
+
+bool SavedGameFormatFile::StreamSubfile(const std::string& subfile_name, const size_hint& on_size, const data_sink& sink) {
+    if (!ensure_index()) {
+        std::cerr << "unable to index file " << filename << std::endl;
+        return false;
+    }
+
+    const ArchiveEntry* entry = index.Find(subfile_name);
+    if (entry == nullptr) {
+        std::cerr << "unable to locate " << subfile_name << " in " << filename << std::endl;
+        return false;
+    }
+
+    // includes the sink's own time
+    SGF_STATS_TIMER(TIMER_DECOMPRESS);
+    // ZIP members can be decoded in place without touching anything else
+    if (index.kind == ARCHIVE_KIND_ZIP && zip_file::CanReadEntry(*entry) && mapping.IsOpen()) {
+        on_size(entry->uncompressed_size);
+        MemoryByteSource source(mapping.Data(), mapping.Size());
+        if (!zip_file::ReadEntryData(source, *entry, sink)) {
+            std::cerr << "Error reading " << subfile_name << " from " << filename << std::endl;
+            return false;
+        }
+        SGF_STATS_ADD(COUNTER_BYTES_IN, entry->uncompressed_size);
+        return true;
+    }
+
+    FILE* data_file = nullptr;
+    if (!mapping.IsOpen()) {
+        data_file = do_open_file(filename, false);
+        if (data_file == nullptr) {
+            std::cerr << "unable to open file " << filename << std::endl;
+            return false;
+        }
+
+        if (index.kind == ARCHIVE_KIND_ZIP && zip_file::CanReadEntry(*entry)) {
+            on_size(entry->uncompressed_size);
+            FileByteSource source(data_file);
+            bool success = zip_file::ReadEntryData(source, *entry, sink);
+            if (!success) {
+                std::cerr << "Error reading " << subfile_name << " from " << filename << std::endl;
+            } else {
+                SGF_STATS_ADD(COUNTER_BYTES_IN, entry->uncompressed_size);
+            }
+            fclose(data_file);
+            return success;
+        }
+
+        int ferr = fseeko(data_file, 0, SEEK_SET);
+        if (ferr != 0) {
+            std::cerr << "unable to reset file pointer, errno " << errno << std::endl;
+            fclose(data_file);
+            return false;
+        }
+    }
+
+    struct archive* archive_file = do_open_archive(data_file);
+    if (archive_file == nullptr) {
+        if (data_file != nullptr) {
+            fclose(data_file);
+        }
+        return false;
+    }
+    bool success = archive_stream::ReadMember(archive_file, *entry, on_size, sink);
+    if (!success) {
+        std::cerr << "Error reading " << subfile_name << " from " << filename << std::endl;
+    } else {
+        SGF_STATS_ADD(COUNTER_BYTES_IN, entry->uncompressed_size);
+    }
+    int aerr = archive_read_free(archive_file);
     if (aerr != ARCHIVE_OK) {
         std::cerr << "Error closing archive: " << archive_error_string(archive_file) << std::endl;
-        return;
+        success = false;
+    }
+    if (data_file != nullptr) {
+        fclose(data_file);
     }
-    fclose(data_file);
 
-    return;
+    return success;
 }
 
-void SavedGameFormatFile::DumpSubfile(const std::string& subfile_name, std::string& data) {
-    FILE* data_file = do_open_file(filename, false);
-    if (data_file == nullptr) {
-        std::cerr << "unable to open file " << filename << std::endl;
-        return;
+bool SavedGameFormatFile::PipeSubfile(const std::string& subfile_name, const size_hint& on_size, const data_sink& sink) {
+    if (!ensure_index()) {
+        std::cerr << "unable to index file " << filename << std::endl;
+        return false;
+    }
+    const ArchiveEntry* entry = index.Find(subfile_name);
+    // stored ZIP members have nothing to decode
+    if (entry == nullptr || entry->uncompressed_size < PIPELINE_MIN_SIZE
+        || (index.kind == ARCHIVE_KIND_ZIP && entry->method == zip_file::METHOD_STORED)) {
+        return StreamSubfile(subfile_name, on_size, sink);
     }
 
-    int ferr = fseeko(data_file, 0, SEEK_SET);
-    if (ferr != 0) {
-        std::cerr << "unable to reset file pointer, errno " << errno << std::endl;
+    do_prefetch(*entry);
+    // the decoder has this object to itself until it closes the ring; the
+    // calling thread only runs the sink
+    BlockRing ring(PIPELINE_BUFFERS, PIPELINE_BUFFER_SIZE);
+    std::thread decoder([this, &subfile_name, &ring]() {
+        bool success = StreamSubfile(
+            subfile_name,
+            [&ring](int64_t entry_size) { ring.Announce(entry_size); },
+            [&ring](const char* buffer, size_t buffer_size) { return ring.Write(buffer, buffer_size); }
+        );
+        ring.Close(success);
+    });
+    bool success = ring.Drain(on_size, sink);
+    decoder.join();
+    return success;
+}
+
+void SavedGameFormatFile::do_prefetch(const ArchiveEntry& entry) {
+    // ZIP members are one contiguous run of the file; a stream archive
+    // is read from the start up to the member
+    int64_t begin = 0;
+    int64_t length = 0;
+    if (index.kind == ARCHIVE_KIND_ZIP) {
+        // the local header is 30 bytes, the name and at most 64K of extras
+        begin = entry.offset;
+        length = entry.compressed_size + 30 + static_cast<int64_t>(entry.name.size()) + UINT16_MAX;
+    }
+    if (mapping.IsOpen()) {
+        size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        size_t first = static_cast<size_t>(begin) / page * page;
+        size_t last = (length == 0) ? mapping.Size() : std::min(mapping.Size(), static_cast<size_t>(begin + length));
+        if (first < last) {
+            madvise(const_cast<unsigned char*>(mapping.Data()) + first, last - first, MADV_WILLNEED);
+        }
         return;
     }
+    // readahead is per file, so any descriptor will do
+    int descriptor = open(filename.c_str(), O_RDONLY);
+    if (descriptor >= 0) {
+        posix_fadvise(descriptor, begin, length, POSIX_FADV_WILLNEED);
+        close(descriptor);
+    }
+}
 
-    struct archive* archive_file = archive_read_new();
-    archive_read_support_filter_all(archive_file);
-    archive_read_support_format_all(archive_file);
+bool SavedGameFormatFile::ReadSubfiles(const archive_stream::member_filter& wanted, const archive_stream::member_handler& on_member) {
+    if (!ensure_index()) {
+        std::cerr << "unable to index file " << filename << std::endl;
+        return false;
+    }
+    // shadowed duplicates are not part of the save
+    auto live = [this, &wanted](const ArchiveEntry& entry) {
+        return index.Find(entry.name)->sequence == entry.sequence && wanted(entry);
+    };
 
-    int aerr = archive_read_open_FILE(archive_file, data_file);
-    if (aerr != ARCHIVE_OK) {
-        std::cerr << "Error opening archive: " << archive_error_string(archive_file) << std::endl;
-        return;
+    if (index.kind == ARCHIVE_KIND_ZIP) {
+        // members are found through the central directory anyway
+        std::string data;
+        for (const auto& entry : index.Entries()) {
+            if (!live(entry)) {
+                continue;
+            }
+            data.clear();
+            if (!do_read_member(entry.name, data) || !on_member(entry, data)) {
+                return false;
+            }
+        }
+        return true;
     }
 
-    struct archive_entry* current_archive_entry = nullptr;
-    while (archive_read_next_header(archive_file, &current_archive_entry) == ARCHIVE_OK) {
-        auto entry_path = archive_entry_pathname(current_archive_entry);
-        std::string value(entry_path);
+    SGF_STATS_TIMER(TIMER_DECOMPRESS);
+    FILE* data_file = nullptr;
+    if (!mapping.IsOpen()) {
+        data_file = do_open_file(filename, false);
+        if (data_file == nullptr) {
+            std::cerr << "unable to open file " << filename << std::endl;
+            return false;
+        }
+    }
+    bool success = false;
+    struct archive* archive_file = do_open_archive(data_file);
+    if (archive_file != nullptr) {
+        success = archive_stream::ReadMembers(archive_file, index, live, on_member);
+        archive_read_free(archive_file);
+    }
+    if (data_file != nullptr) {
+        fclose(data_file);
+    }
+    return success;
+}
 
-        if (value == subfile_name) {
-            const void* buffer = nullptr;
-            size_t buffer_size = 0;
-            la_int64_t archive_offset = 0;
+bool SavedGameFormatFile::ReadSubfileRange(const std::string& subfile_name, int64_t offset, int64_t length, const data_sink& sink) {
+    if (!ensure_index()) {
+        std::cerr << "unable to index file " << filename << std::endl;
+        return false;
+    }
 
-            aerr = archive_read_data_block(archive_file, &buffer, &buffer_size, &archive_offset);
-            if (aerr == ARCHIVE_EOF) {
-                break;
+    const ArchiveEntry* entry = index.Find(subfile_name);
+    if (entry == nullptr) {
+        std::cerr << "unable to locate " << subfile_name << " in " << filename << std::endl;
+        return false;
+    }
+
+    SGF_STATS_TIMER(TIMER_DECOMPRESS);
+    FILE* data_file = nullptr;
+    if (!mapping.IsOpen()) {
+        data_file = do_open_file(filename, false);
+        if (data_file == nullptr) {
+            std::cerr << "unable to open file " << filename << std::endl;
+            return false;
+        }
+    }
+    bool success = false;
+    if (index.kind == ARCHIVE_KIND_ZIP && zip_file::CanReadEntry(*entry)) {
+        FileByteSource file_source(data_file);
+        MemoryByteSource memory_source(mapping.Data(), mapping.Size());
+        ByteSource& source = mapping.IsOpen() ? static_cast<ByteSource&>(memory_source) : file_source;
+        success = zip_file::ReadEntryRange(source, *entry, offset, length, sink);
+    } else if (data_file == nullptr || fseeko(data_file, 0, SEEK_SET) == 0) {
+        // a stream archive has to be decoded up to the range, but stops
+        // as soon as the range is complete
+        struct archive* archive_file = do_open_archive(data_file);
+        if (archive_file != nullptr) {
+            int64_t position = 0;
+            int64_t range_end = offset + length;
+            bool complete = (length <= 0);
+            success = complete || archive_stream::ReadMember(
+                archive_file, *entry, [](int64_t) {},
+                [&](const char* buffer, size_t buffer_size) {
+                    int64_t from = std::max(offset, position);
+                    int64_t to = std::min<int64_t>(range_end, position + buffer_size);
+                    if (from < to && !sink(buffer + (from - position), static_cast<size_t>(to - from))) {
+                        return false;
+                    }
+                    position += buffer_size;
+                    complete = position >= range_end;
+                    return !complete;
+                }
+            );
+            success = success || complete;
+            archive_read_free(archive_file);
+        }
+    }
+    if (data_file != nullptr) {
+        fclose(data_file);
+    }
+    if (!success) {
+        std::cerr << "Error reading " << subfile_name << " from " << filename << std::endl;
+    }
+    return success;
+}
+
+bool SavedGameFormatFile::ViewSubfile(const std::string& subfile_name, std::string_view& view) {
+    if (!memory_mapped) {
+        return false;
+    }
+    if (!ensure_index()) {
+        std::cerr << "unable to index file " << filename << std::endl;
+        return false;
+    }
+
+    const ArchiveEntry* entry = index.Find(subfile_name);
+    if (entry == nullptr || index.kind != ARCHIVE_KIND_ZIP || entry->method != zip_file::METHOD_STORED || !zip_file::CanReadEntry(*entry)) {
+        return false;
+    }
+
+    MemoryByteSource source(mapping.Data(), mapping.Size());
+    int64_t data_offset = 0;
+    if (!zip_file::LocateEntryData(source, *entry, data_offset)) {
+        return false;
+    }
+    const unsigned char* entry_data = source.View(data_offset, static_cast<size_t>(entry->uncompressed_size));
+    if (entry_data == nullptr) {
+        std::cerr << "ZIP entry " << subfile_name << " extends past the end of " << filename << std::endl;
+        return false;
+    }
+
+    view = std::string_view(reinterpret_cast<const char*>(entry_data), static_cast<size_t>(entry->uncompressed_size));
+    SGF_STATS_ADD(COUNTER_BYTES_IN, view.size());
+    return true;
+}
+
+bool SavedGameFormatFile::UpdateSubfile(const std::string& output_file, const std::string& subfile_name, const std::string& data) {
+    replacement_map replacements;
+    replacements[subfile_name] = data;
+    return UpdateSubfiles(output_file, replacements);
+}
+
+bool SavedGameFormatFile::UpdateSubfiles(const std::string& output_file, const replacement_map& replacements) {
+    return UpdateSubfiles(output_file, replacements, removal_set());
+}
+
+bool SavedGameFormatFile::UpdateSubfiles(const std::string& output_file, const replacement_map& replacements, const removal_set& removals) {
+    SGF_STATS_TIMER(TIMER_UPDATE);
+    if (!ensure_index()) {
+        std::cerr << "unable to index file " << filename << std::endl;
+        return false;
+    }
+
+    // re-encoded members, kept alive until the archive is written
+    std::deque<std::string> encoded;
+    replacement_map stored_replacements(replacements);
+    if (!do_encode_members(stored_replacements, removals, encoded)) {
+        return false;
+    }
+
+    bool in_place = output_file.empty() || output_file == filename;
+    if (in_place && !atomic_save && removals.empty()) {
+        return UpdateSubfilesInPlace(stored_replacements);
+    }
+    if (!do_verify_before_save()) {
+        return false;
+    }
+
+    // saving over the input writes a complete new copy and renames it into
+    // place; unchanged ZIP members are copied without recompressing
+    return do_rewrite(in_place ? filename : output_file, stored_replacements, removals);
+}
+
+bool SavedGameFormatFile::do_encode_members(replacement_map& replacements, const removal_set& removals, std::deque<std::string>& storage) {
+    MemberEncoding encoding = save_settings.encoding;
+    // the encoding a member should end up in
+    auto wants_binary = [this, encoding](const std::string& subfile_name, bool& binary) {
+        if (encoding != MEMBER_ENCODING_AUTO) {
+            binary = encoding == MEMBER_ENCODING_CBOR && boost::algorithm::ends_with(subfile_name, ".json");
+            return true;
+        }
+        // existing members keep their encoding, new ones stay as given
+        if (index.Find(subfile_name) == nullptr) {
+            binary = false;
+            return true;
+        }
+        return IsBinarySubfile(subfile_name, binary);
+    };
+    auto convert = [this, &storage](const std::string& subfile_name, std::string_view contents, bool binary, std::string_view& converted) {
+        storage.emplace_back();
+        bool success = binary ? binary_json::FromJson(contents, storage.back()) : binary_json::ToJson(contents, storage.back());
+        if (!success) {
+            storage.pop_back();
+            if (binary) {
+                // still saved, just not encoded
+                std::cerr << "keeping " << subfile_name << " as text, it is not valid JSON" << std::endl;
+                return true;
             }
-            if (aerr < ARCHIVE_OK) {
-                std::cerr << "Error reading archive chunk: " << archive_error_string(archive_file) << std::endl;
-                break;
+            std::cerr << "unable to decode " << subfile_name << " in " << filename << std::endl;
+            return false;
+        }
+        converted = storage.back();
+        return true;
+    };
+
+    for (auto& replacement : replacements) {
+        bool binary = binary_json::IsEncoded(replacement.second);
+        // already encoded data is taken as the caller meant it
+        if (binary && encoding == MEMBER_ENCODING_AUTO) {
+            continue;
+        }
+        bool wanted = false;
+        if (!wants_binary(replacement.first, wanted)) {
+            return false;
+        }
+        if (wanted != binary && !convert(replacement.first, replacement.second, !binary, replacement.second)) {
+            return false;
+        }
+    }
+    if (encoding == MEMBER_ENCODING_AUTO) {
+        return true;
+    }
+
+    // members the update doesn't touch only change if their encoding does;
+    // binary ones are always .json members, so nothing else is looked at
+    bool wanted = encoding == MEMBER_ENCODING_CBOR;
+    std::set<std::string> changing;
+    for (const auto& entry : index.Entries()) {
+        const std::string& subfile_name = entry.name;
+        if (!boost::algorithm::ends_with(subfile_name, ".json")
+            || replacements.count(subfile_name) != 0 || removals.count(subfile_name) != 0) {
+            continue;
+        }
+        bool binary = false;
+        if (!IsBinarySubfile(subfile_name, binary)) {
+            return false;
+        }
+        if (wanted != binary) {
+            changing.insert(subfile_name);
+        }
+    }
+    if (changing.empty()) {
+        return true;
+    }
+
+    // one pass over the archive for all of them
+    return ReadSubfiles(
+        [&changing](const ArchiveEntry& entry) {
+            return changing.count(entry.name) != 0;
+        },
+        [&replacements, &convert, wanted](const ArchiveEntry& entry, std::string& data) {
+            std::string_view converted;
+            if (!convert(entry.name, data, wanted, converted)) {
+                return false;
+            }
+            if (!converted.empty()) {
+                replacements[entry.name] = converted;
             }
-            data += (char*)buffer;
+            return true;
         }
+    );
+}
+
+bool SavedGameFormatFile::do_rewrite(const std::string& output_file, const replacement_map& replacements, const removal_set& removals) {
+    // ZIP members are compressed independently, so only the updated ones
+    // need to go through the compressor
+    if (index.kind == ARCHIVE_KIND_ZIP && (save_settings.format == SAVE_FORMAT_AUTO || save_settings.format == SAVE_FORMAT_ZIP)) {
+        return do_rewrite_zip(output_file, replacements, removals);
     }
-    aerr = archive_read_free(archive_file);
+    if (save_settings.format == SAVE_FORMAT_ZIP && save_settings.frame_size != 0) {
+        // libarchive can't frame members; convert first, then let the ZIP
+        // path recompress the converted members in frames
+        if (!do_rewrite_stream(output_file, replacements, removals)) {
+            return false;
+        }
+        SavedGameFormatFile converted(output_file);
+        converted.save_settings = save_settings;
+        // members were already encoded on the way in
+        converted.save_settings.encoding = MEMBER_ENCODING_AUTO;
+        return converted.UpdateSubfiles("", replacement_map());
+    }
+    return do_rewrite_stream(output_file, replacements, removals);
+}
+
+bool SavedGameFormatFile::do_configure_writer(struct archive* archive_output, bool& external_gzip) {
+    external_gzip = false;
+    int aerr = ARCHIVE_OK;
+    int output_format = format_code(save_settings.format);
+    if (save_settings.format == SAVE_FORMAT_AUTO) {
+        output_format = index.format_code;
+    }
+    aerr = archive_write_set_format(archive_output, output_format);
     if (aerr != ARCHIVE_OK) {
-        std::cerr << "Error closing archive: " << archive_error_string(archive_file) << std::endl;
-        return;
+        if (save_settings.format != SAVE_FORMAT_AUTO) {
+            std::cerr << "Error selecting output format: " << archive_error_string(archive_output) << std::endl;
+            return false;
+        }
+        // not every readable format can be written; this was the only
+        // output format before the input's settings were reused
+        std::cerr << "unable to write " << filename << "'s format, saving as bzip2 compressed gnutar" << std::endl;
+        output_format = ARCHIVE_FORMAT_TAR_GNUTAR;
+        archive_write_set_format_gnutar(archive_output);
+        archive_write_add_filter_bzip2(archive_output);
+        archive_write_set_bytes_in_last_block(archive_output, 1);
+        return true;
     }
-    fclose(data_file);
 
-    return;
+    std::string level = std::to_string(save_settings.level);
+    if (output_format == ARCHIVE_FORMAT_ZIP) {
+        // ZIP compresses per member rather than with a filter
+        const char* compression = "deflate";
+        if (save_settings.codec == SAVE_CODEC_NONE) {
+            compression = "store";
+        } else if (save_settings.codec != SAVE_CODEC_AUTO && save_settings.codec != SAVE_CODEC_GZIP) {
+            std::cerr << "ZIP members can only be stored or deflated" << std::endl;
+            return false;
+        }
+        archive_write_set_format_option(archive_output, "zip", "compression", compression);
+        if (save_settings.level != SAVE_LEVEL_DEFAULT) {
+            archive_write_set_format_option(archive_output, "zip", "compression-level", level.c_str());
+        }
+        return true;
+    }
+
+    int output_filter = filter_code(save_settings.codec);
+    if (save_settings.codec == SAVE_CODEC_AUTO) {
+        // a ZIP input has no stream filter; deflate's sibling is closest
+        output_filter = (index.kind == ARCHIVE_KIND_ZIP) ? ARCHIVE_FILTER_GZIP : index.filter_code;
+    }
+    size_t threads = (save_settings.threads == 0) ? ThreadPool::DefaultSize() : save_settings.threads;
+    if (output_filter == ARCHIVE_FILTER_GZIP && threads > 1) {
+        // libarchive's gzip filter is single threaded; the caller compresses
+        // the tar stream in blocks instead
+        external_gzip = true;
+        archive_write_set_bytes_in_last_block(archive_output, 1);
+        return true;
+    }
+    aerr = archive_write_add_filter(archive_output, output_filter);
+    if (aerr != ARCHIVE_OK) {
+        std::cerr << "Error selecting output compression: " << archive_error_string(archive_output) << std::endl;
+        return false;
+    }
+    if ((output_filter == ARCHIVE_FILTER_ZSTD || output_filter == ARCHIVE_FILTER_XZ) && threads > 1) {
+        // both libraries can split the stream over threads themselves;
+        // older libarchive builds without the option just stay serial
+        std::string thread_count = std::to_string(threads);
+        archive_write_set_filter_option(archive_output, nullptr, "threads", thread_count.c_str());
+    }
+    if (save_settings.level != SAVE_LEVEL_DEFAULT && output_filter != ARCHIVE_FILTER_NONE) {
+        aerr = archive_write_set_filter_option(archive_output, nullptr, "compression-level", level.c_str());
+        if (aerr != ARCHIVE_OK) {
+            std::cerr << "Error setting compression level " << level << ": " << archive_error_string(archive_output) << std::endl;
+            return false;
+        }
+    }
+    // don't pad the compressed stream out to a full tar block
+    if (output_filter != ARCHIVE_FILTER_NONE) {
+        archive_write_set_bytes_in_last_block(archive_output, 1);
+    }
+    return true;
 }
 
-bool SavedGameFormatFile::UpdateSubfile(const std::string& output_file, const std::string& subfile_name, const std::string& data) {
+bool SavedGameFormatFile::do_rewrite_stream(const std::string& output_file, const replacement_map& replacements, const removal_set& removals) {
+    // tar and friends are compressed as one stream; every member has to be
+    // decoded and encoded again
     FILE* data_file = do_open_file(filename, false);
     if (data_file == nullptr) {
         std::cerr << "unable to open file " << filename << std::endl;
@@ -163,18 +977,17 @@ bool SavedGameFormatFile::UpdateSubfile(const std::string& output_file, const st
     int ferr = fseeko(data_file, 0, SEEK_SET);
     if (ferr != 0) {
         std::cerr << "unable to reset file pointer, errno " << errno << std::endl;
+        fclose(data_file);
         return false;
     }
 
-    FILE* data_output = do_open_file(output_file, true);
+    // written beside the target and renamed over it once complete, so a
+    // failed or interrupted save leaves the previous file as it was
+    AtomicFile output;
+    FILE* data_output = output.Open(output_file);
     if (data_output == nullptr) {
         std::cerr << "unable to open file " << output_file << std::endl;
-        return false;
-    }
-
-    ferr = fseeko(data_output, 0, SEEK_SET);
-    if (ferr != 0) {
-        std::cerr << "unable to reset file pointer, errno " << errno << std::endl;
+        fclose(data_file);
         return false;
     }
 
@@ -182,42 +995,75 @@ bool SavedGameFormatFile::UpdateSubfile(const std::string& output_file, const st
     archive_read_support_filter_all(archive_file);
     archive_read_support_format_all(archive_file);
 
+    // reuse the input's container and compression unless told otherwise
     struct archive* archive_output = archive_write_new();
-    // we can't copy over the settings from the input file
-    // so we have to set on for the output
-    archive_write_add_filter_bzip2(archive_output);
-    archive_write_set_format_gnutar(archive_output);
+    bool external_gzip = false;
+    if (!do_configure_writer(archive_output, external_gzip)) {
+        archive_write_free(archive_output);
+        archive_read_free(archive_file);
+        fclose(data_file);
+        return false;
+    }
 
     int aerr = archive_read_open_FILE(archive_file, data_file);
     if (aerr != ARCHIVE_OK) {
         std::cerr << "Error opening input archive: " << archive_error_string(archive_file) << std::endl;
+        archive_write_free(archive_output);
+        archive_read_free(archive_file);
+        fclose(data_file);
         return false;
     }
 
-    aerr = archive_write_open_FILE(archive_output, data_output);
-    if (aerr != ARCHIVE_OK) {
-        std::cerr << "Error opening output archive: " << archive_error_string(archive_file) << std::endl;
-        return false;
+    std::unique_ptr<ThreadPool> pool;
+    std::unique_ptr<ParallelGzip> gzip;
+    if (external_gzip) {
+        pool.reset(new ThreadPool(save_settings.threads));
+        // SAVE_LEVEL_DEFAULT is zlib's own default level
+        gzip.reset(new ParallelGzip(data_output, save_settings.level, *pool));
+        aerr = archive_write_open(archive_output, gzip.get(), nullptr, parallel_gzip_write, parallel_gzip_close);
+    } else {
+        aerr = archive_write_open_FILE(archive_output, data_output);
+    }
+    bool success = (aerr == ARCHIVE_OK);
+    if (!success) {
+        std::cerr << "Error opening output archive: " << archive_error_string(archive_output) << std::endl;
     }
 
+    std::set<std::string> replaced;
     struct archive_entry* current_archive_entry = nullptr;
-    while (archive_read_next_header(archive_file, &current_archive_entry) == ARCHIVE_OK) {
+    while (success) {
+        aerr = archive_read_next_header(archive_file, &current_archive_entry);
+        if (aerr == ARCHIVE_EOF) {
+            break;
+        }
+        if (aerr < ARCHIVE_WARN) {
+            std::cerr << "Error reading archive header: " << archive_error_string(archive_file) << std::endl;
+            success = false;
+            break;
+        }
         auto entry_path = archive_entry_pathname(current_archive_entry);
         std::string value(entry_path);
+        if (removals.count(value)) {
+            // the next header skips its data
+            continue;
+        }
 
-
-        if (value == subfile_name) {
+        auto replacement = replacements.find(value);
+        if (replacement != replacements.end()) {
+            std::string_view data = replacement->second;
+            replaced.insert(value);
             auto entry = archive_entry_clone(current_archive_entry);
             archive_entry_set_size(entry, data.size());
-
-            la_ssize_t data_written = archive_write_data(archive_output, data.c_str(), data.size());
-            if (data_written != data.size()) {
-                std::cerr << "Only " << data_written << " bytes of " << data.size() << " bytes were actually written" << std::endl;
-                std::cerr << "Update File Data Error: " << archive_error_string(archive_output) << std::endl;
-            }
+            success = write_archive_member(archive_output, entry, data);
+            archive_entry_free(entry);
         } else {
             // read the data for the file
-            archive_write_header(archive_output, current_archive_entry);
+            aerr = archive_write_header(archive_output, current_archive_entry);
+            if (aerr < ARCHIVE_WARN) {
+                std::cerr << "Write Header Error: " << archive_error_string(archive_output) << std::endl;
+                success = false;
+                break;
+            }
             while (true) {
                 const void* buffer = nullptr;
                 size_t buffer_size = 0;
@@ -229,25 +1075,363 @@ bool SavedGameFormatFile::UpdateSubfile(const std::string& output_file, const st
                 }
                 if (aerr < ARCHIVE_OK) {
                     std::cerr << "Error reading archive chunk: " << archive_error_string(archive_file) << std::endl;
+                    success = false;
                     break;
                 }
 
-                //la_ssize_t data_written = archive_write_data_block(archive_output, buffer, buffer_size, archive_offset);
+                SGF_STATS_TIMER(TIMER_WRITE);
                 la_ssize_t data_written = archive_write_data(archive_output, buffer, buffer_size);
-                if (data_written != buffer_size) {
+                if (data_written != static_cast<la_ssize_t>(buffer_size)) {
                     std::cerr << "Only " << data_written << " bytes of " << buffer_size << " bytes were actually written" << std::endl;
                     std::cerr << "Write Existing File Data Error: " << archive_error_string(archive_output) << std::endl;
+                    success = false;
+                    break;
                 }
             }
         }
     }
+    // members that did not exist yet go at the end
+    for (const auto& replacement : replacements) {
+        if (!success) {
+            break;
+        }
+        if (replaced.count(replacement.first)) {
+            continue;
+        }
+        std::string_view data = replacement.second;
+        struct archive_entry* entry = archive_entry_new();
+        archive_entry_set_pathname(entry, replacement.first.c_str());
+        archive_entry_set_filetype(entry, AE_IFREG);
+        archive_entry_set_perm(entry, 0644);
+        archive_entry_set_mtime(entry, time(nullptr), 0);
+        archive_entry_set_size(entry, data.size());
+        success = write_archive_member(archive_output, entry, data);
+        archive_entry_free(entry);
+    }
+
+    // closing flushes the compressor and the final blocks; a failure here
+    // means the output is truncated
+    {
+        SGF_STATS_TIMER(TIMER_WRITE);
+        aerr = archive_write_close(archive_output);
+    }
+    if (success && aerr != ARCHIVE_OK) {
+        std::cerr << "Error finishing output archive: " << archive_error_string(archive_output) << std::endl;
+        success = false;
+    }
+    archive_write_free(archive_output);
     aerr = archive_read_free(archive_file);
     if (aerr != ARCHIVE_OK) {
         std::cerr << "Error closing archive: " << archive_error_string(archive_file) << std::endl;
+        success = false;
+    }
+    fclose(data_file);
+
+    if (!success) {
+        std::cerr << "Error writing " << output_file << ", left unchanged" << std::endl;
+        output.Abort();
+        return false;
+    }
+    SGF_STATS_ADD(COUNTER_BYTES_OUT, ftello(output.File()));
+    if (output_file == filename) {
+        invalidate_index();
+    }
+    return output.Commit();
+}
+
+bool SavedGameFormatFile::UpdateSubfileInPlace(const std::string& subfile_name, const std::string& data) {
+    replacement_map replacements;
+    replacements[subfile_name] = data;
+    return UpdateSubfilesInPlace(replacements);
+}
+
+bool SavedGameFormatFile::UpdateSubfilesInPlace(const replacement_map& replacements) {
+    if (!ensure_index()) {
+        std::cerr << "unable to index file " << filename << std::endl;
+        return false;
+    }
+    if (index.kind != ARCHIVE_KIND_ZIP) {
+        std::cerr << "only ZIP archives can be updated in place; use --output to write a new file" << std::endl;
+        return false;
+    }
+    if (index.zip64 || index.base_offset != 0) {
+        std::cerr << "ZIP64 and self-extracting archives cannot be updated in place" << std::endl;
+        return false;
+    }
+    if (!do_verify_before_save()) {
+        return false;
+    }
+
+    // the mapping and index go stale as soon as the file is written to
+    EntryIndex current(index);
+    invalidate_index();
+
+    FILE* data_file = do_open_file(filename, false);
+    if (data_file == nullptr) {
+        std::cerr << "unable to open file " << filename << std::endl;
         return false;
     }
+    FileByteSource source(data_file);
+
+    // replaced members in archive order, then the new ones
+    std::vector<planned_entry> plan;
+    std::map<std::string, size_t> planned_index;
+    bool success = true;
+    for (const auto& replacement : replacements) {
+        planned_entry planned;
+        planned.entry = current.Find(replacement.first);
+        planned.name = &replacement.first;
+        planned.replacement = &replacement.second;
+        planned.compress = true;
+        success = success && zip_write_options(planned.entry, planned.write_options);
+        plan.push_back(std::move(planned));
+    }
+    std::stable_sort(
+        plan.begin(), plan.end(),
+        [](const planned_entry& left, const planned_entry& right) {
+            size_t left_order = left.entry ? left.entry->sequence : SIZE_MAX;
+            size_t right_order = right.entry ? right.entry->sequence : SIZE_MAX;
+            return left_order < right_order;
+        }
+    );
+    for (size_t i = 0; i < plan.size(); ++i) {
+        planned_index[*plan[i].name] = i;
+    }
+
+    // new data goes where the central directory was, unless a member being
+    // replaced is the last one and can simply be overwritten
+    int64_t write_offset = current.directory_offset;
+    for (const auto& planned : plan) {
+        const ArchiveEntry* previous = planned.entry;
+        if (previous == nullptr) {
+            continue;
+        }
+        int64_t span = 0;
+        if (zip_file::EntrySpan(source, *previous, span) && previous->offset + span == current.directory_offset) {
+            write_offset = previous->offset;
+        }
+    }
+
+    zip_file::ZipWriter writer(data_file, write_offset);
+    std::vector<std::string> new_records;
+    success = success && write_plan(writer, source, plan, save_settings.threads, new_records);
+
+    std::vector<std::string> records;
+    for (const auto& entry : current.Entries()) {
+        if (!success) {
+            break;
+        }
+        auto planned = planned_index.find(entry.name);
+        if (planned != planned_index.end()) {
+            // the replacement takes the place of the live entry
+            if (entry.sequence == plan[planned->second].entry->sequence) {
+                records.push_back(new_records[planned->second]);
+            }
+            continue;
+        }
+        std::string record;
+        success = writer.KeepEntry(entry, record);
+        records.push_back(record);
+    }
+    for (size_t i = 0; success && i < plan.size(); ++i) {
+        if (plan[i].entry == nullptr) {
+            records.push_back(new_records[i]);
+        }
+    }
+    success = success && writer.Finish(records, current.comment);
+
+    if (success && ftruncate(fileno(data_file), writer.Offset()) != 0) {
+        std::cerr << "unable to truncate " << filename << ", errno " << errno << std::endl;
+        success = false;
+    }
+    if (success && (fflush(data_file) != 0 || fsync(fileno(data_file)) != 0)) {
+        std::cerr << "unable to sync " << filename << ", errno " << errno << std::endl;
+        success = false;
+    }
     fclose(data_file);
-    fclose(data_output);
+    if (!success) {
+        std::cerr << "Error updating " << replacements.size() << " member(s) in " << filename << std::endl;
+        return false;
+    }
+
+    SGF_STATS_ADD(COUNTER_BYTES_OUT, writer.Offset() - write_offset);
+    // replaced members leave dead space behind; reclaim it eventually
+    int64_t dead_bytes = DeadBytes();
+    if (dead_bytes > static_cast<int64_t>(compact_threshold * writer.Offset())) {
+        std::cerr << "compacting " << filename << ": " << dead_bytes << " of " << writer.Offset() << " bytes are unused" << std::endl;
+        return Compact("");
+    }
 
     return true;
 }
+
+int64_t SavedGameFormatFile::DeadBytes() {
+    if (!ensure_index() || index.kind != ARCHIVE_KIND_ZIP) {
+        return 0;
+    }
+
+    FILE* data_file = nullptr;
+    if (!mapping.IsOpen()) {
+        data_file = do_open_file(filename, false);
+        if (data_file == nullptr) {
+            std::cerr << "unable to open file " << filename << std::endl;
+            return 0;
+        }
+    }
+    FileByteSource file_source(data_file);
+    MemoryByteSource memory_source(mapping.Data(), mapping.Size());
+    ByteSource& source = mapping.IsOpen() ? static_cast<ByteSource&>(memory_source) : file_source;
+
+    // measured from the local headers, whose extra fields needn't match
+    // the central directory's
+    int64_t live_bytes = 0;
+    bool measured = true;
+    for (const auto& entry : index.Entries()) {
+        // shadowed duplicates are dead too
+        if (index.Find(entry.name)->sequence != entry.sequence) {
+            continue;
+        }
+        int64_t span = 0;
+        measured = zip_file::EntrySpan(source, entry, span);
+        if (!measured) {
+            break;
+        }
+        live_bytes += span;
+    }
+    if (data_file != nullptr) {
+        fclose(data_file);
+    }
+    // nothing is reclaimed from an archive that can't be measured
+    if (!measured) {
+        return 0;
+    }
+    return std::max<int64_t>(0, index.directory_offset - index.base_offset - live_bytes);
+}
+
+bool SavedGameFormatFile::Compact(const std::string& output_file) {
+    if (!ensure_index()) {
+        std::cerr << "unable to index file " << filename << std::endl;
+        return false;
+    }
+    if (index.kind != ARCHIVE_KIND_ZIP) {
+        std::cerr << "only ZIP archives can be compacted" << std::endl;
+        return false;
+    }
+    if (!do_verify_before_save()) {
+        return false;
+    }
+
+    return do_rewrite_zip(output_file, replacement_map(), removal_set());
+}
+
+bool SavedGameFormatFile::do_rewrite_zip(const std::string& output_file, const replacement_map& replacements, const removal_set& removals) {
+    bool in_place = output_file.empty() || output_file == filename;
+    std::string target_file = in_place ? filename : output_file;
+
+    FILE* data_file = nullptr;
+    if (!mapping.IsOpen()) {
+        data_file = do_open_file(filename, false);
+        if (data_file == nullptr) {
+            std::cerr << "unable to open file " << filename << std::endl;
+            return false;
+        }
+    }
+    AtomicFile output;
+    FILE* data_output = output.Open(target_file);
+    if (data_output == nullptr) {
+        std::cerr << "unable to open file " << target_file << std::endl;
+        if (data_file != nullptr) {
+            fclose(data_file);
+        }
+        return false;
+    }
+
+    FileByteSource file_source(data_file);
+    MemoryByteSource memory_source(mapping.Data(), mapping.Size());
+    ByteSource& source = mapping.IsOpen() ? static_cast<ByteSource&>(memory_source) : file_source;
+
+    // unchanged live members are copied compressed, exactly as they are;
+    // only replacements go through the compressor
+    std::vector<planned_entry> plan;
+    std::set<std::string> replaced;
+    bool success = true;
+    for (const auto& entry : index.Entries()) {
+        if (index.Find(entry.name)->sequence != entry.sequence || removals.count(entry.name)) {
+            continue;
+        }
+        planned_entry planned;
+        planned.entry = &entry;
+        planned.name = &entry.name;
+        success = zip_write_options(&entry, planned.write_options);
+        if (!success) {
+            break;
+        }
+        auto replacement = replacements.find(entry.name);
+        if (replacement != replacements.end()) {
+            planned.replacement = &replacement->second;
+            planned.compress = true;
+            replaced.insert(entry.name);
+        } else {
+            // members are also recoded to gain (not lose) frames
+            zip_file::FrameIndex frames;
+            bool framed = zip_file::ReadFrameIndex(entry, frames);
+            bool reframe = entry.method == zip_file::METHOD_DEFLATE && planned.write_options.frame_size != 0 && !framed;
+            planned.compress = (entry.method != planned.write_options.method || reframe || save_settings.recompress) && zip_file::CanReadEntry(entry);
+        }
+        plan.push_back(std::move(planned));
+    }
+    for (const auto& replacement : replacements) {
+        if (!success || replaced.count(replacement.first)) {
+            continue;
+        }
+        planned_entry planned;
+        planned.name = &replacement.first;
+        planned.replacement = &replacement.second;
+        planned.compress = true;
+        success = zip_write_options(nullptr, planned.write_options);
+        plan.push_back(std::move(planned));
+    }
+
+    zip_file::ZipWriter writer(data_output, 0);
+    std::vector<std::string> records;
+    success = success && write_plan(writer, source, plan, save_settings.threads, records);
+    success = success && writer.Finish(records, index.comment);
+
+    if (data_file != nullptr) {
+        fclose(data_file);
+    }
+    if (!success) {
+        std::cerr << "Error writing " << target_file << ", left unchanged" << std::endl;
+        output.Abort();
+        return false;
+    }
+
+    SGF_STATS_ADD(COUNTER_BYTES_OUT, writer.Offset());
+    if (in_place) {
+        invalidate_index();
+    }
+    return output.Commit();
+}
+
+bool SavedGameFormatFile::zip_write_options(const ArchiveEntry* previous, zip_file::WriteOptions& options) {
+    options.level = save_settings.level;
+    options.frame_size = save_settings.frame_size;
+    switch (save_settings.codec) {
+        case SAVE_CODEC_AUTO:
+            // keep whatever the member was stored with
+            options.method = zip_file::METHOD_DEFLATE;
+            if (previous != nullptr && previous->method == zip_file::METHOD_STORED) {
+                options.method = zip_file::METHOD_STORED;
+            }
+            return true;
+        case SAVE_CODEC_NONE:
+            options.method = zip_file::METHOD_STORED;
+            return true;
+        case SAVE_CODEC_GZIP:
+            options.method = zip_file::METHOD_DEFLATE;
+            return true;
+        default:
+            std::cerr << "ZIP members can only be stored or deflated" << std::endl;
+            return false;
+    }
+}
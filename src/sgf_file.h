@@ -1,13 +1,24 @@
 #ifndef SAVED_GAME_FORMAT_SGF_FILE_H__
 #define SAVED_GAME_FORMAT_SGF_FILE_H__
 
+#include <ctime>
 #include <deque>
 #include <fstream>
+#include <functional>
 #include <iostream>
+#include <map>
+#include <set>
 #include <string>
+#include <string_view>
 
 #include <archive.h>
 
+#include "archive_stream.h"
+#include "byte_source.h"
+#include "entry_index.h"
+#include "save_settings.h"
+#include "zip_file.h"
+
 namespace saved_game_format_file {
 
     class SavedGameFormatFile {
@@ -16,6 +27,13 @@ namespace saved_game_format_file {
             friend std::istream& operator<<(std::istream& in, SavedGameFormatFile& sgff);
 
             typedef std::deque<std::string> path_listing;
+            // member name -> new contents; the caller keeps the contents
+            // alive for the duration of the update, so they are never copied
+            typedef std::map<std::string, std::string_view> replacement_map;
+            // members left out of the new archive
+            typedef std::set<std::string> removal_set;
+            // told the member's uncompressed size before any data arrives
+            typedef std::function<void(int64_t entry_size)> size_hint;
 
             SavedGameFormatFile() {}
             SavedGameFormatFile(std::string _default) : filename(_default) {}
@@ -23,16 +41,138 @@ namespace saved_game_format_file {
             inline std::string GetFilename() { return filename; }
             bool Validate();
 
+            // Build the entry index from the ZIP central directory, or from a
+            // single header pass over any other archive. ListFiles and
+            // DumpSubfile build it on demand and reuse it until the file
+            // changes on disk.
+            bool BuildIndex();
+            inline const EntryIndex& GetIndex() const { return index; }
+
             void ListFiles(path_listing& listing);
+            // Reserves the member's size up front and appends all of it to
+            // data; data is left untouched if the member cannot be read.
+            // Binary (CBOR) members are appended as JSON text.
             void DumpSubfile(const std::string& subfile_name, std::string& data);
+            // Whether the member is stored in binary_json's encoding. Stream
+            // archives record it in the index; only the first bytes of a ZIP
+            // member are read. Returns false if the member can't be read.
+            bool IsBinarySubfile(const std::string& subfile_name, bool& binary);
+            // Deliver the member block by block without materialising it.
+            // The sink may see data before a later size/CRC failure, which
+            // is reported by returning false.
+            bool StreamSubfile(const std::string& subfile_name, const data_sink& sink);
+            bool StreamSubfile(const std::string& subfile_name, const size_hint& on_size, const data_sink& sink);
+            bool StreamSubfile(const std::string& subfile_name, std::ostream& out);
+            // StreamSubfile with the member decoded on a thread of its own
+            // into a small ring of buffers, while the sink still runs on
+            // the calling thread. Worth it when the sink does real work per
+            // block, like writing output: the two overlap, and the file is
+            // prefetched ahead of the decoder. Small and stored members are
+            // just streamed.
+            bool PipeSubfile(const std::string& subfile_name, const size_hint& on_size, const data_sink& sink);
+            // Every live member that passes the filter, whole and in archive
+            // order, from a single pass over the file (stream archives are
+            // decompressed once, not once per member). Members arrive as
+            // stored, binary ones still encoded; on_member may take the data
+            // and returns false to stop.
+            bool ReadSubfiles(const archive_stream::member_filter& wanted, const archive_stream::member_handler& on_member);
+            // Deliver length bytes of the member from offset on, fewer if it
+            // ends first. Framed ZIP members (see SaveSettings::frame_size)
+            // are decoded from the frame holding offset and stored ones are
+            // read in place; anything else is decoded from the start of the
+            // member. Decoding stops at the end of the range either way, so
+            // the range is not CRC checked.
+            bool ReadSubfileRange(const std::string& subfile_name, int64_t offset, int64_t length, const data_sink& sink);
+            // Zero-copy access to a stored (uncompressed) ZIP member of a
+            // memory mapped file. Returns false if the member cannot be
+            // viewed in place; use DumpSubfile for those. The view is not
+            // CRC checked and is only valid until the file is re-indexed.
+            bool ViewSubfile(const std::string& subfile_name, std::string_view& view);
+            // Writes a new archive to output_file; with no output_file (or the
+            // input's own name) the input itself is replaced. Either way the
+            // archive is written under a temporary name, synced and renamed
+            // over the target, so a crash never leaves a partial save.
             bool UpdateSubfile(const std::string& output_file, const std::string& subfile_name, const std::string& data);
+            // Same as UpdateSubfile for several members at once, in a single
+            // pass over the archive. Members that don't exist yet are added.
+            // Replacements are given as JSON text or already encoded, and
+            // are stored as save_settings.encoding asks.
+            bool UpdateSubfiles(const std::string& output_file, const replacement_map& replacements);
+            // ... and leave the removals out; dropping members always writes
+            // a new copy, even without atomic_save
+            bool UpdateSubfiles(const std::string& output_file, const replacement_map& replacements, const removal_set& removals);
+            // ZIP archives only: write the member after the existing entries
+            // and rewrite just the central directory, leaving every other
+            // member's bytes untouched. Adds the member if it is missing.
+            // Compacts once the dead space passes compact_threshold. Cheaper
+            // than a full save, but the old central directory is overwritten,
+            // so a crash part way through can leave the archive unreadable.
+            bool UpdateSubfileInPlace(const std::string& subfile_name, const std::string& data);
+            bool UpdateSubfilesInPlace(const replacement_map& replacements);
+            // Rewrite a ZIP archive with only its live members, copying their
+            // compressed data as-is. Compacts in place if output_file is empty.
+            bool Compact(const std::string& output_file);
+            // Bytes of a ZIP archive's data area no longer referenced by the
+            // central directory (replaced members, shadowed duplicates)
+            int64_t DeadBytes();
 
             std::string filename{};
+            // map the file into memory instead of reading it through stdio
+            bool memory_mapped{false};
+            // fraction of a ZIP archive that may be dead space before an
+            // in-place update compacts it
+            double compact_threshold{0.5};
+            // saving over the input writes a new copy and renames it into
+            // place; when false, ZIP saves are updated in place instead
+            bool atomic_save{true};
+            // decode and check every member (see save_verify.h) before
+            // writing, and refuse to save a file with a damaged member
+            // rather than carry the damage into the new copy; unchanged
+            // ZIP members are otherwise copied without being decoded
+            bool verify_on_save{false};
+            // container and compression for rewritten saves; by default the
+            // input's own settings are reused
+            SaveSettings save_settings{};
 
         protected:
             FILE* do_open_file(std::string _filename, bool write);
+            // reads from the mapping when data_file is null and the file is mapped
+            struct archive* do_open_archive(FILE* data_file);
+            bool ensure_index();
+            // the verify_on_save check
+            bool do_verify_before_save();
+            void invalidate_index();
+            // ask the kernel to start reading what decoding the entry needs
+            void do_prefetch(const ArchiveEntry& entry);
+            // the member's stored bytes, encoded or not
+            bool do_read_member(const std::string& subfile_name, std::string& data);
+            // Point replacements at copies in the encoding save_settings
+            // asks for, kept in storage, and add any other members that
+            // have to change encoding
+            bool do_encode_members(replacement_map& replacements, const removal_set& removals, std::deque<std::string>& storage);
+            // Write a new archive with the replacements applied, choosing the
+            // cheapest path the output settings allow
+            bool do_rewrite(const std::string& output_file, const replacement_map& replacements, const removal_set& removals);
+            // re-encode every member through libarchive
+            bool do_rewrite_stream(const std::string& output_file, const replacement_map& replacements, const removal_set& removals);
+            // external_gzip is set when gzip was chosen but left to the
+            // caller to apply in parallel
+            bool do_configure_writer(struct archive* archive_output, bool& external_gzip);
+            bool zip_write_options(const ArchiveEntry* previous, zip_file::WriteOptions& options);
+            // Write a ZIP archive holding the live members with replacements
+            // applied; untouched members are copied without recompressing.
+            // An empty output_file rewrites the archive itself.
+            bool do_rewrite_zip(const std::string& output_file, const replacement_map& replacements, const removal_set& removals);
 
         private:
+            EntryIndex index{};
+            MappedFile mapping{};
+            std::string indexed_filename{};
+            // stamp of the indexed file: rewriting it changes the size or
+            // the modification time, renaming another over it the inode
+            int64_t indexed_size{-1};
+            int64_t indexed_mtime{0};
+            uint64_t indexed_inode{0};
     };
 
 }
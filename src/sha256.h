@@ -0,0 +1,36 @@
+#ifndef SAVED_GAME_FORMAT_SHA256_H__
+#define SAVED_GAME_FORMAT_SHA256_H__
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace saved_game_format_file {
+
+    // FIPS 180-4 SHA-256, for naming content in the save store
+    class Sha256 {
+        public:
+            typedef std::array<unsigned char, 32> digest;
+
+            Sha256() { Reset(); }
+
+            void Reset();
+            void Update(const void* data, size_t length);
+            digest Final();
+
+            static digest Hash(const void* data, size_t length);
+            static std::string Hex(const digest& value);
+
+        private:
+            void transform(const unsigned char* block);
+
+            uint32_t state[8];
+            unsigned char buffer[64];
+            size_t buffered{0};
+            uint64_t total{0};
+    };
+
+}
+
+#endif //SAVED_GAME_FORMAT_SHA256_H__
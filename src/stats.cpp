@@ -0,0 +1,71 @@
+#include <atomic>
+#include <sstream>
+
+#include "stats.h"
+
+using namespace saved_game_format_file;
+
+namespace {
+
+    const char* const TIMER_NAMES[stats::TIMER_COUNT] = {
+        "command", "list", "dump", "update",
+        "open", "index", "decompress", "parse", "serialize", "compress", "write",
+    };
+    const char* const COUNTER_NAMES[stats::COUNTER_COUNT] = {
+        "bytes_in", "bytes_out", "entries_skipped",
+    };
+
+    // relaxed: these are tallies, nothing is ordered by them
+    std::atomic<uint64_t> timer_calls[stats::TIMER_COUNT];
+    std::atomic<uint64_t> timer_nanoseconds[stats::TIMER_COUNT];
+    std::atomic<uint64_t> counters[stats::COUNTER_COUNT];
+
+}
+
+void stats::AddTime(Timer timer, std::chrono::steady_clock::duration elapsed) {
+    timer_calls[timer].fetch_add(1, std::memory_order_relaxed);
+    timer_nanoseconds[timer].fetch_add(
+        static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()),
+        std::memory_order_relaxed
+    );
+}
+
+void stats::Add(Counter counter, uint64_t amount) {
+    counters[counter].fetch_add(amount, std::memory_order_relaxed);
+}
+
+void stats::Reset() {
+    for (size_t i = 0; i < TIMER_COUNT; ++i) {
+        timer_calls[i].store(0, std::memory_order_relaxed);
+        timer_nanoseconds[i].store(0, std::memory_order_relaxed);
+    }
+    for (size_t i = 0; i < COUNTER_COUNT; ++i) {
+        counters[i].store(0, std::memory_order_relaxed);
+    }
+}
+
+std::string stats::Json() {
+    std::ostringstream json;
+#ifdef SGF_ENABLE_STATS
+    json << "{\"enabled\":true,\"timers\":{";
+#else
+    json << "{\"enabled\":false,\"timers\":{";
+#endif
+    // timers that never ran are left out
+    bool first = true;
+    for (size_t i = 0; i < TIMER_COUNT; ++i) {
+        uint64_t calls = timer_calls[i].load(std::memory_order_relaxed);
+        if (calls == 0) {
+            continue;
+        }
+        json << (first ? "" : ",") << "\"" << TIMER_NAMES[i] << "\":{\"calls\":" << calls
+            << ",\"seconds\":" << (timer_nanoseconds[i].load(std::memory_order_relaxed) / 1e9) << "}";
+        first = false;
+    }
+    json << "},\"counters\":{";
+    for (size_t i = 0; i < COUNTER_COUNT; ++i) {
+        json << (i ? "," : "") << "\"" << COUNTER_NAMES[i] << "\":" << counters[i].load(std::memory_order_relaxed);
+    }
+    json << "}}";
+    return json.str();
+}
@@ -0,0 +1,102 @@
+#ifndef SAVED_GAME_FORMAT_STATS_H__
+#define SAVED_GAME_FORMAT_STATS_H__
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+namespace saved_game_format_file {
+
+    // Process-wide timers and counters for the hot paths. They are recorded
+    // through the SGF_STATS_* macros below, which compile to nothing unless
+    // SGF_ENABLE_STATS is defined (the SGF_STATS CMake option), so a build
+    // without them pays nothing. Safe to record from any thread.
+    namespace stats {
+
+        enum Timer {
+            // whole operations
+            TIMER_COMMAND=0,
+            TIMER_LIST,
+            TIMER_DUMP,
+            TIMER_UPDATE,
+            // phases within them
+            TIMER_OPEN,
+            // reading the central directory or scanning stream headers
+            TIMER_INDEX,
+            TIMER_DECOMPRESS,
+            // locating keys and reading edit scripts
+            TIMER_PARSE,
+            // splicing new values into a member
+            TIMER_SERIALIZE,
+            // ZIP members compressed ahead of writing
+            TIMER_COMPRESS,
+            // archive output; stream codecs compress inside this phase
+            TIMER_WRITE,
+            TIMER_COUNT,
+        };
+
+        enum Counter {
+            // member bytes decoded out of saves
+            COUNTER_BYTES_IN=0,
+            // archive bytes written to saves
+            COUNTER_BYTES_OUT,
+            // stream archive entries passed over to reach a member
+            COUNTER_ENTRIES_SKIPPED,
+            COUNTER_COUNT,
+        };
+
+        void AddTime(Timer timer, std::chrono::steady_clock::duration elapsed);
+        void Add(Counter counter, uint64_t amount);
+        void Reset();
+
+        // {"enabled": ..., "timers": {"open": {"calls": n, "seconds": s}, ...},
+        //  "counters": {"bytes_in": n, ...}}
+        std::string Json();
+
+        // charges its lifetime, or the time until Stop, to a timer
+        class ScopedTimer {
+            public:
+                explicit ScopedTimer(Timer _timer) : timer(_timer), start(std::chrono::steady_clock::now()) {}
+                ~ScopedTimer() { Stop(); }
+
+                ScopedTimer(const ScopedTimer&) = delete;
+                ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+                inline void Stop() {
+                    if (running) {
+                        AddTime(timer, std::chrono::steady_clock::now() - start);
+                        running = false;
+                    }
+                }
+
+            private:
+                Timer timer;
+                std::chrono::steady_clock::time_point start;
+                bool running{true};
+        };
+
+    }
+
+}
+
+#define SGF_STATS_CONCAT_INNER(left, right) left##right
+#define SGF_STATS_CONCAT(left, right) SGF_STATS_CONCAT_INNER(left, right)
+
+#ifdef SGF_ENABLE_STATS
+// time the rest of the enclosing scope
+#define SGF_STATS_TIMER(timer) \
+    saved_game_format_file::stats::ScopedTimer SGF_STATS_CONCAT(sgf_stats_timer_, __LINE__)(saved_game_format_file::stats::timer)
+// time until SGF_STATS_STOP(name) or the end of the scope
+#define SGF_STATS_NAMED_TIMER(name, timer) \
+    saved_game_format_file::stats::ScopedTimer name(saved_game_format_file::stats::timer)
+#define SGF_STATS_STOP(name) name.Stop()
+#define SGF_STATS_ADD(counter, amount) \
+    saved_game_format_file::stats::Add(saved_game_format_file::stats::counter, static_cast<uint64_t>(amount))
+#else
+#define SGF_STATS_TIMER(timer) static_cast<void>(0)
+#define SGF_STATS_NAMED_TIMER(name, timer) static_cast<void>(0)
+#define SGF_STATS_STOP(name) static_cast<void>(0)
+#define SGF_STATS_ADD(counter, amount) static_cast<void>(0)
+#endif
+
+#endif //SAVED_GAME_FORMAT_STATS_H__
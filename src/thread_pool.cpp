@@ -0,0 +1,53 @@
+#include "thread_pool.h"
+
+using namespace saved_game_format_file;
+
+ThreadPool::ThreadPool(size_t _threads) {
+    size_t threads = (_threads == 0) ? DefaultSize() : _threads;
+    workers.reserve(threads);
+    for (size_t i = 0; i < threads; ++i) {
+        workers.emplace_back([this]() { run(); });
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+    }
+    ready.notify_all();
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+size_t ThreadPool::DefaultSize() {
+    size_t threads = std::thread::hardware_concurrency();
+    return (threads == 0) ? 1 : threads;
+}
+
+void ThreadPool::enqueue(std::function<void()> task) {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        tasks.push_back(std::move(task));
+    }
+    ready.notify_one();
+}
+
+void ThreadPool::run() {
+    while (true) {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            ready.wait(guard, [this]() { return stopping || !tasks.empty(); });
+            // queued work is still finished on shutdown so no future is
+            // left without a value
+            if (tasks.empty()) {
+                return;
+            }
+            task = std::move(tasks.front());
+            tasks.pop_front();
+        }
+        task();
+    }
+}
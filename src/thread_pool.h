@@ -0,0 +1,54 @@
+#ifndef SAVED_GAME_FORMAT_THREAD_POOL_H__
+#define SAVED_GAME_FORMAT_THREAD_POOL_H__
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace saved_game_format_file {
+
+    // Fixed set of worker threads draining a FIFO of tasks
+    class ThreadPool {
+        public:
+            // 0 threads means one per hardware thread
+            explicit ThreadPool(size_t _threads = 0);
+            ~ThreadPool();
+
+            ThreadPool(const ThreadPool&) = delete;
+            ThreadPool& operator=(const ThreadPool&) = delete;
+
+            template <typename Task>
+            std::future<typename std::invoke_result<Task>::type> Submit(Task&& task) {
+                typedef typename std::invoke_result<Task>::type result_type;
+                auto packaged = std::make_shared<std::packaged_task<result_type()>>(std::forward<Task>(task));
+                std::future<result_type> result = packaged->get_future();
+                enqueue([packaged]() { (*packaged)(); });
+                return result;
+            }
+
+            inline size_t Size() const { return workers.size(); }
+
+            // thread count to use for a requested value of 0
+            static size_t DefaultSize();
+
+        private:
+            void enqueue(std::function<void()> task);
+            void run();
+
+            std::vector<std::thread> workers{};
+            std::deque<std::function<void()>> tasks{};
+            std::mutex lock{};
+            std::condition_variable ready{};
+            bool stopping{false};
+    };
+
+}
+
+#endif //SAVED_GAME_FORMAT_THREAD_POOL_H__
@@ -0,0 +1,103 @@
+#include <thread>
+
+#include "thread_pool.h"
+#include "work_stealing.h"
+
+using namespace saved_game_format_file;
+
+WorkStealingPool::WorkStealingPool(size_t _threads) {
+    threads = (_threads == 0) ? ThreadPool::DefaultSize() : _threads;
+}
+
+void WorkStealingPool::Run(size_t count, const index_task& task) {
+    steals = 0;
+    size_t workers = (count < threads) ? count : threads;
+    if (workers == 0) {
+        return;
+    }
+    std::vector<share> fresh(workers);
+    shares.swap(fresh);
+    for (size_t i = 0; i < workers; ++i) {
+        shares[i].begin = count * i / workers;
+        shares[i].end = count * (i + 1) / workers;
+    }
+
+    std::vector<std::thread> running;
+    running.reserve(workers);
+    for (size_t i = 0; i < workers; ++i) {
+        running.emplace_back([this, i, &task]() { run(i, task); });
+    }
+    for (auto& worker : running) {
+        worker.join();
+    }
+    shares.clear();
+}
+
+void WorkStealingPool::run(size_t worker, const index_task& task) {
+    size_t index = 0;
+    while (true) {
+        if (take(worker, index)) {
+            task(index, worker);
+        } else if (!steal(worker)) {
+            // another thief may empty a fresh share before its owner gets
+            // to it, so only a failed steal ends the worker
+            return;
+        }
+    }
+}
+
+bool WorkStealingPool::take(size_t worker, size_t& index) {
+    share& own = shares[worker];
+    std::lock_guard<std::mutex> guard(own.lock);
+    if (own.begin == own.end) {
+        return false;
+    }
+    index = own.begin++;
+    return true;
+}
+
+bool WorkStealingPool::steal(size_t worker) {
+    // Work only ever moves between shares, so once every share is empty
+    // nothing new can turn up: whatever is left is already running.
+    // Retried while a steal loses a race to the victim or another thief.
+    while (true) {
+        size_t victim = shares.size();
+        size_t most = 0;
+        for (size_t i = 0; i < shares.size(); ++i) {
+            if (i == worker) {
+                continue;
+            }
+            std::lock_guard<std::mutex> guard(shares[i].lock);
+            size_t left = shares[i].end - shares[i].begin;
+            if (left > most) {
+                most = left;
+                victim = i;
+            }
+        }
+        if (victim == shares.size()) {
+            return false;
+        }
+
+        size_t begin = 0;
+        size_t end = 0;
+        {
+            std::lock_guard<std::mutex> guard(shares[victim].lock);
+            size_t left = shares[victim].end - shares[victim].begin;
+            if (left == 0) {
+                continue;
+            }
+            // the victim keeps the front half, the item it reaches next;
+            // a single item left is taken whole
+            begin = shares[victim].end - (left + 1) / 2;
+            end = shares[victim].end;
+            shares[victim].end = begin;
+        }
+        {
+            std::lock_guard<std::mutex> guard(shares[worker].lock);
+            shares[worker].begin = begin;
+            shares[worker].end = end;
+        }
+        ++steals;
+        return true;
+    }
+}
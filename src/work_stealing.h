@@ -0,0 +1,57 @@
+#ifndef SAVED_GAME_FORMAT_WORK_STEALING_H__
+#define SAVED_GAME_FORMAT_WORK_STEALING_H__
+
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+namespace saved_game_format_file {
+
+    // Runs a task for every index of a fixed range on a set of threads.
+    // Each worker starts with an equal contiguous share of the indices and
+    // works through it front to back without touching anyone else's. Once
+    // its share runs out, it steals the back half of the largest share
+    // left. A few slow items can't keep one thread busy while the rest
+    // sit idle, and neighbouring items (files of one directory) still
+    // mostly go to one thread.
+    class WorkStealingPool {
+        public:
+            // told the item and the worker (0 .. Size() - 1) running it
+            typedef std::function<void(size_t index, size_t worker)> index_task;
+
+            // 0 threads means one per hardware thread
+            explicit WorkStealingPool(size_t _threads = 0);
+
+            WorkStealingPool(const WorkStealingPool&) = delete;
+            WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+            // Returns once task has run for every index in [0, count). Tasks
+            // run on the pool's threads only.
+            void Run(size_t count, const index_task& task);
+
+            inline size_t Size() const { return threads; }
+            // shares taken from another worker by the last Run
+            inline size_t Steals() const { return steals; }
+
+        private:
+            // indices [begin, end) still to run
+            struct share {
+                std::mutex lock{};
+                size_t begin{0};
+                size_t end{0};
+            };
+
+            void run(size_t worker, const index_task& task);
+            bool take(size_t worker, size_t& index);
+            bool steal(size_t worker);
+
+            size_t threads{1};
+            std::vector<share> shares{};
+            std::atomic<size_t> steals{0};
+    };
+
+}
+
+#endif //SAVED_GAME_FORMAT_WORK_STEALING_H__
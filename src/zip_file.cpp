@@ -0,0 +1,820 @@
+#include <algorithm>
+#include <cstdint>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <vector>
+
+#include <zlib.h>
+
+#include "checksum.h"
+#include "zip_file.h"
+
+using namespace saved_game_format_file;
+
+namespace {
+
+    const uint32_t SIG_LOCAL_HEADER = 0x04034b50;
+    const uint32_t SIG_CENTRAL_HEADER = 0x02014b50;
+    const uint32_t SIG_END_OF_CENTRAL_DIR = 0x06054b50;
+    const uint32_t SIG_ZIP64_END_OF_CENTRAL_DIR = 0x06064b50;
+    const uint32_t SIG_ZIP64_LOCATOR = 0x07064b50;
+    const uint32_t SIG_DATA_DESCRIPTOR = 0x08074b50;
+
+    const size_t LOCAL_HEADER_SIZE = 30;
+    const size_t CENTRAL_HEADER_SIZE = 46;
+    const size_t END_OF_CENTRAL_DIR_SIZE = 22;
+    const size_t ZIP64_END_OF_CENTRAL_DIR_SIZE = 56;
+    const size_t ZIP64_LOCATOR_SIZE = 20;
+    const size_t MAX_COMMENT_SIZE = 0xFFFF;
+
+    const uint16_t ZIP64_EXTRA_ID = 0x0001;
+    // "SF"; from the range the spec leaves to third parties
+    const uint16_t FRAME_INDEX_EXTRA_ID = 0x4653;
+    const unsigned char FRAME_INDEX_VERSION = 1;
+    // keeps the frame index well inside an extra field's 64 KiB
+    const size_t MAX_FRAMES = 8192;
+    const uint16_t FLAG_ENCRYPTED = 0x0001;
+    const uint16_t FLAG_UTF8 = 0x0800;
+
+    // version 2.0 is enough for stored and deflated entries
+    const uint16_t VERSION_NEEDED = 20;
+    // created on UNIX, spec version 3.0
+    const uint16_t VERSION_MADE_BY = 0x031E;
+    // regular file, rw-r--r--
+    const uint32_t DEFAULT_EXTERNAL_ATTRIBUTES = 0100644u << 16;
+    const int64_t ZIP32_LIMIT = 0xFFFFFFFF;
+    const size_t ZIP32_ENTRY_LIMIT = 0xFFFF;
+
+    const size_t READ_CHUNK_SIZE = 64 * 1024;
+
+    inline uint16_t read_u16(const unsigned char* p) {
+        return static_cast<uint16_t>(p[0] | (p[1] << 8));
+    }
+
+    inline uint32_t read_u32(const unsigned char* p) {
+        return static_cast<uint32_t>(p[0])
+            | (static_cast<uint32_t>(p[1]) << 8)
+            | (static_cast<uint32_t>(p[2]) << 16)
+            | (static_cast<uint32_t>(p[3]) << 24);
+    }
+
+    inline uint64_t read_u64(const unsigned char* p) {
+        return static_cast<uint64_t>(read_u32(p))
+            | (static_cast<uint64_t>(read_u32(p + 4)) << 32);
+    }
+
+    inline void append_u16(std::string& out, uint16_t value) {
+        out.push_back(static_cast<char>(value & 0xFF));
+        out.push_back(static_cast<char>((value >> 8) & 0xFF));
+    }
+
+    inline void append_u32(std::string& out, uint32_t value) {
+        append_u16(out, static_cast<uint16_t>(value & 0xFFFF));
+        append_u16(out, static_cast<uint16_t>(value >> 16));
+    }
+
+    inline void patch_u32(std::string& out, size_t position, uint32_t value) {
+        out[position] = static_cast<char>(value & 0xFF);
+        out[position + 1] = static_cast<char>((value >> 8) & 0xFF);
+        out[position + 2] = static_cast<char>((value >> 16) & 0xFF);
+        out[position + 3] = static_cast<char>((value >> 24) & 0xFF);
+    }
+
+    // the frame index extra field, or nothing for an unframed member
+    std::string frame_index_extra(const zip_file::CompressedEntry& compressed) {
+        std::string extra;
+        if (compressed.method != zip_file::METHOD_DEFLATE || compressed.frames.frame_size == 0) {
+            return extra;
+        }
+        append_u16(extra, FRAME_INDEX_EXTRA_ID);
+        append_u16(extra, static_cast<uint16_t>(1 + 4 + 4 * compressed.frames.compressed_sizes.size()));
+        extra.push_back(static_cast<char>(FRAME_INDEX_VERSION));
+        append_u32(extra, compressed.frames.frame_size);
+        for (uint32_t frame : compressed.frames.compressed_sizes) {
+            append_u32(extra, frame);
+        }
+        return extra;
+    }
+
+    void dos_date_time(uint16_t& dos_date, uint16_t& dos_time) {
+        std::time_t now = std::time(nullptr);
+        struct tm local;
+        localtime_r(&now, &local);
+        dos_time = static_cast<uint16_t>((local.tm_hour << 11) | (local.tm_min << 5) | (local.tm_sec / 2));
+        dos_date = static_cast<uint16_t>(((local.tm_year - 80) << 9) | ((local.tm_mon + 1) << 5) | local.tm_mday);
+    }
+
+    // apply the ZIP64 extended information extra field; only the values
+    // that were saturated in the central record are present, in this order
+    void apply_zip64_extra(const unsigned char* extra, size_t extra_length, ArchiveEntry& entry, bool usize_saturated, bool csize_saturated, bool offset_saturated) {
+        size_t position = 0;
+        while (position + 4 <= extra_length) {
+            uint16_t id = read_u16(extra + position);
+            uint16_t size = read_u16(extra + position + 2);
+            const unsigned char* field = extra + position + 4;
+            if (position + 4 + size > extra_length) {
+                return;
+            }
+            if (id == ZIP64_EXTRA_ID) {
+                size_t field_position = 0;
+                if (usize_saturated && field_position + 8 <= size) {
+                    entry.uncompressed_size = static_cast<int64_t>(read_u64(field + field_position));
+                    field_position += 8;
+                }
+                if (csize_saturated && field_position + 8 <= size) {
+                    entry.compressed_size = static_cast<int64_t>(read_u64(field + field_position));
+                    field_position += 8;
+                }
+                if (offset_saturated && field_position + 8 <= size) {
+                    entry.offset = static_cast<int64_t>(read_u64(field + field_position));
+                    field_position += 8;
+                }
+                return;
+            }
+            position += 4 + size;
+        }
+    }
+
+}
+
+bool zip_file::ReadCentralDirectory(ByteSource& source, EntryIndex& index) {
+    index.Clear();
+
+    int64_t file_length = source.Size();
+    if (file_length < static_cast<int64_t>(END_OF_CENTRAL_DIR_SIZE)) {
+        return false;
+    }
+
+    // the EOCD record sits at the very end, followed only by the comment
+    int64_t tail_length = std::min<int64_t>(file_length, END_OF_CENTRAL_DIR_SIZE + MAX_COMMENT_SIZE);
+    int64_t tail_offset = file_length - tail_length;
+    std::vector<unsigned char> tail(static_cast<size_t>(tail_length));
+    if (!source.ReadAt(tail_offset, tail.data(), tail.size())) {
+        return false;
+    }
+
+    int64_t eocd_position = -1;
+    for (int64_t position = tail_length - END_OF_CENTRAL_DIR_SIZE; position >= 0; --position) {
+        const unsigned char* record = tail.data() + position;
+        if (read_u32(record) != SIG_END_OF_CENTRAL_DIR) {
+            continue;
+        }
+        uint16_t comment_length = read_u16(record + 20);
+        if (position + static_cast<int64_t>(END_OF_CENTRAL_DIR_SIZE) + comment_length <= tail_length) {
+            eocd_position = position;
+            break;
+        }
+    }
+    if (eocd_position < 0) {
+        return false;
+    }
+
+    const unsigned char* eocd = tail.data() + eocd_position;
+    uint16_t disk_number = read_u16(eocd + 4);
+    uint64_t total_entries = read_u16(eocd + 10);
+    uint64_t directory_size = read_u32(eocd + 12);
+    uint64_t directory_offset = read_u32(eocd + 16);
+    int64_t eocd_offset = tail_offset + eocd_position;
+    // bytes in front of the archive proper (e.g. self-extracting stubs)
+    int64_t base_offset = 0;
+    bool zip64 = false;
+    std::string comment(reinterpret_cast<const char*>(eocd + END_OF_CENTRAL_DIR_SIZE), read_u16(eocd + 20));
+
+    if (total_entries == 0xFFFF || directory_size == 0xFFFFFFFF || directory_offset == 0xFFFFFFFF) {
+        zip64 = true;
+        unsigned char locator[ZIP64_LOCATOR_SIZE];
+        if (eocd_offset < static_cast<int64_t>(ZIP64_LOCATOR_SIZE)
+            || !source.ReadAt(eocd_offset - ZIP64_LOCATOR_SIZE, locator, sizeof(locator))
+            || read_u32(locator) != SIG_ZIP64_LOCATOR) {
+            std::cerr << "ZIP64 archive is missing its end of central directory locator" << std::endl;
+            return false;
+        }
+        unsigned char eocd64[ZIP64_END_OF_CENTRAL_DIR_SIZE];
+        if (!source.ReadAt(static_cast<int64_t>(read_u64(locator + 8)), eocd64, sizeof(eocd64))
+            || read_u32(eocd64) != SIG_ZIP64_END_OF_CENTRAL_DIR) {
+            std::cerr << "ZIP64 end of central directory record is invalid" << std::endl;
+            return false;
+        }
+        disk_number = static_cast<uint16_t>(read_u32(eocd64 + 16));
+        total_entries = read_u64(eocd64 + 32);
+        directory_size = read_u64(eocd64 + 40);
+        directory_offset = read_u64(eocd64 + 48);
+    } else {
+        base_offset = eocd_offset - static_cast<int64_t>(directory_offset + directory_size);
+        if (base_offset < 0) {
+            return false;
+        }
+    }
+
+    if (disk_number != 0) {
+        std::cerr << "multi-disk ZIP archives are not supported" << std::endl;
+        return false;
+    }
+
+    std::vector<unsigned char> directory(static_cast<size_t>(directory_size));
+    if (!source.ReadAt(base_offset + static_cast<int64_t>(directory_offset), directory.data(), directory.size())) {
+        std::cerr << "unable to read the ZIP central directory" << std::endl;
+        return false;
+    }
+
+    size_t position = 0;
+    for (uint64_t entry_number = 0; entry_number < total_entries; ++entry_number) {
+        if (position + CENTRAL_HEADER_SIZE > directory.size()) {
+            std::cerr << "ZIP central directory is truncated" << std::endl;
+            index.Clear();
+            return false;
+        }
+        const unsigned char* record = directory.data() + position;
+        if (read_u32(record) != SIG_CENTRAL_HEADER) {
+            std::cerr << "ZIP central directory record " << entry_number << " is invalid" << std::endl;
+            index.Clear();
+            return false;
+        }
+        uint16_t name_length = read_u16(record + 28);
+        uint16_t extra_length = read_u16(record + 30);
+        uint16_t comment_length = read_u16(record + 32);
+        size_t record_length = CENTRAL_HEADER_SIZE + name_length + extra_length + comment_length;
+        if (position + record_length > directory.size()) {
+            std::cerr << "ZIP central directory is truncated" << std::endl;
+            index.Clear();
+            return false;
+        }
+
+        ArchiveEntry entry;
+        entry.flags = read_u16(record + 8);
+        entry.method = read_u16(record + 10);
+        entry.crc32 = read_u32(record + 16);
+        entry.has_crc = true;
+        uint32_t compressed_size = read_u32(record + 20);
+        uint32_t uncompressed_size = read_u32(record + 24);
+        uint32_t local_offset = read_u32(record + 42);
+        entry.compressed_size = compressed_size;
+        entry.uncompressed_size = uncompressed_size;
+        entry.offset = local_offset;
+        entry.name.assign(reinterpret_cast<const char*>(record + CENTRAL_HEADER_SIZE), name_length);
+        apply_zip64_extra(
+            record + CENTRAL_HEADER_SIZE + name_length, extra_length, entry,
+            uncompressed_size == 0xFFFFFFFF,
+            compressed_size == 0xFFFFFFFF,
+            local_offset == 0xFFFFFFFF
+        );
+        entry.offset += base_offset;
+        entry.central_record.assign(reinterpret_cast<const char*>(record), record_length);
+        if (uncompressed_size == 0xFFFFFFFF || compressed_size == 0xFFFFFFFF || local_offset == 0xFFFFFFFF) {
+            zip64 = true;
+        }
+        index.Add(entry);
+
+        position += record_length;
+    }
+
+    index.kind = ARCHIVE_KIND_ZIP;
+    index.directory_offset = base_offset + static_cast<int64_t>(directory_offset);
+    index.directory_size = static_cast<int64_t>(directory_size);
+    index.base_offset = base_offset;
+    index.zip64 = zip64;
+    index.comment = comment;
+    return true;
+}
+
+bool zip_file::CanReadEntry(const ArchiveEntry& entry) {
+    if (entry.flags & FLAG_ENCRYPTED) {
+        return false;
+    }
+    return entry.method == METHOD_STORED || entry.method == METHOD_DEFLATE;
+}
+
+bool zip_file::LocateEntryData(ByteSource& source, const ArchiveEntry& entry, int64_t& data_offset) {
+    unsigned char local_header[LOCAL_HEADER_SIZE];
+    if (!source.ReadAt(entry.offset, local_header, sizeof(local_header))
+        || read_u32(local_header) != SIG_LOCAL_HEADER) {
+        std::cerr << "ZIP local header for " << entry.name << " is invalid" << std::endl;
+        return false;
+    }
+    // the local extra field may differ from the central one
+    data_offset = entry.offset + LOCAL_HEADER_SIZE + read_u16(local_header + 26) + read_u16(local_header + 28);
+    return true;
+}
+
+bool zip_file::ReadEntryData(ByteSource& source, const ArchiveEntry& entry, const data_sink& sink) {
+    if (!CanReadEntry(entry)) {
+        return false;
+    }
+
+    int64_t data_offset = 0;
+    if (!LocateEntryData(source, entry, data_offset)) {
+        return false;
+    }
+
+    z_stream inflater;
+    memset(&inflater, 0, sizeof(inflater));
+    if (entry.method == METHOD_DEFLATE && inflateInit2(&inflater, -MAX_WBITS) != Z_OK) {
+        std::cerr << "unable to initialise inflate: " << (inflater.msg ? inflater.msg : "") << std::endl;
+        return false;
+    }
+
+    // memory backed sources are decoded in place; everything else is
+    // pulled through a bounce buffer a chunk at a time
+    const unsigned char* mapped_input = source.View(data_offset, static_cast<size_t>(entry.compressed_size));
+    std::vector<unsigned char> input;
+    if (mapped_input == nullptr) {
+        input.resize(READ_CHUNK_SIZE);
+    }
+    std::vector<unsigned char> output(READ_CHUNK_SIZE);
+    uint32_t crc = 0;
+    int64_t consumed = 0;
+    int64_t produced_total = 0;
+    bool success = true;
+    int zerr = Z_OK;
+    while (consumed < entry.compressed_size && zerr != Z_STREAM_END) {
+        size_t chunk = static_cast<size_t>(std::min<int64_t>(entry.compressed_size - consumed, READ_CHUNK_SIZE));
+        const unsigned char* chunk_data = nullptr;
+        if (mapped_input != nullptr) {
+            chunk_data = mapped_input + consumed;
+        } else {
+            if (!source.ReadAt(data_offset + consumed, input.data(), chunk)) {
+                std::cerr << "ZIP entry " << entry.name << " is truncated" << std::endl;
+                success = false;
+                break;
+            }
+            chunk_data = input.data();
+        }
+        consumed += chunk;
+
+        if (entry.method == METHOD_STORED) {
+            crc = checksum::Crc32(crc, chunk_data, chunk);
+            produced_total += chunk;
+            if (!sink(reinterpret_cast<const char*>(chunk_data), chunk)) {
+                success = false;
+                break;
+            }
+            continue;
+        }
+
+        inflater.next_in = const_cast<unsigned char*>(chunk_data);
+        inflater.avail_in = static_cast<uInt>(chunk);
+        do {
+            inflater.next_out = output.data();
+            inflater.avail_out = static_cast<uInt>(output.size());
+            zerr = inflate(&inflater, Z_NO_FLUSH);
+            if (zerr != Z_OK && zerr != Z_STREAM_END) {
+                std::cerr << "Error inflating " << entry.name << ": " << (inflater.msg ? inflater.msg : "") << std::endl;
+                success = false;
+                break;
+            }
+            size_t produced = output.size() - inflater.avail_out;
+            crc = checksum::Crc32(crc, output.data(), produced);
+            produced_total += produced;
+            if (produced != 0 && !sink(reinterpret_cast<const char*>(output.data()), produced)) {
+                success = false;
+                break;
+            }
+        } while (inflater.avail_out == 0 && zerr != Z_STREAM_END);
+        if (!success) {
+            break;
+        }
+    }
+    if (entry.method == METHOD_DEFLATE) {
+        inflateEnd(&inflater);
+    }
+
+    if (success && produced_total != entry.uncompressed_size) {
+        std::cerr << "ZIP entry " << entry.name << " decoded to " << produced_total
+            << " bytes, expected " << entry.uncompressed_size << std::endl;
+        success = false;
+    }
+    if (success && entry.has_crc && crc != entry.crc32) {
+        std::cerr << "ZIP entry " << entry.name << " failed its CRC check" << std::endl;
+        success = false;
+    }
+    return success;
+}
+
+bool zip_file::ReadFrameIndex(const ArchiveEntry& entry, FrameIndex& frames) {
+    frames = FrameIndex();
+    if (entry.method != METHOD_DEFLATE || entry.central_record.size() < CENTRAL_HEADER_SIZE) {
+        return false;
+    }
+    const unsigned char* record = reinterpret_cast<const unsigned char*>(entry.central_record.data());
+    size_t extra_start = CENTRAL_HEADER_SIZE + read_u16(record + 28);
+    size_t extra_end = extra_start + read_u16(record + 30);
+    if (extra_end > entry.central_record.size()) {
+        return false;
+    }
+    for (size_t position = extra_start; position + 4 <= extra_end; ) {
+        uint16_t id = read_u16(record + position);
+        uint16_t size = read_u16(record + position + 2);
+        const unsigned char* field = record + position + 4;
+        if (position + 4 + size > extra_end) {
+            return false;
+        }
+        if (id == FRAME_INDEX_EXTRA_ID) {
+            if (size < 5 || (size - 5) % 4 != 0 || field[0] != FRAME_INDEX_VERSION || read_u32(field + 1) == 0) {
+                return false;
+            }
+            frames.frame_size = read_u32(field + 1);
+            for (size_t frame = 5; frame < size; frame += 4) {
+                frames.compressed_sizes.push_back(read_u32(field + frame));
+            }
+            return true;
+        }
+        position += 4 + size;
+    }
+    return false;
+}
+
+bool zip_file::ReadEntryRange(ByteSource& source, const ArchiveEntry& entry, int64_t offset, int64_t length, const data_sink& sink) {
+    if (!CanReadEntry(entry) || offset < 0 || length < 0) {
+        return false;
+    }
+    if (offset >= entry.uncompressed_size || length == 0) {
+        return true;
+    }
+    length = std::min(length, entry.uncompressed_size - offset);
+
+    int64_t data_offset = 0;
+    if (!LocateEntryData(source, entry, data_offset)) {
+        return false;
+    }
+    std::vector<unsigned char> input(READ_CHUNK_SIZE);
+    if (entry.method == METHOD_STORED) {
+        for (int64_t position = 0; position < length; ) {
+            size_t chunk = static_cast<size_t>(std::min<int64_t>(length - position, READ_CHUNK_SIZE));
+            const unsigned char* chunk_data = source.View(data_offset + offset + position, chunk);
+            if (chunk_data == nullptr) {
+                if (!source.ReadAt(data_offset + offset + position, input.data(), chunk)) {
+                    std::cerr << "ZIP entry " << entry.name << " is truncated" << std::endl;
+                    return false;
+                }
+                chunk_data = input.data();
+            }
+            if (!sink(reinterpret_cast<const char*>(chunk_data), chunk)) {
+                return false;
+            }
+            position += chunk;
+        }
+        return true;
+    }
+
+    // a framed member is inflated from the frame holding offset; anything
+    // else has to be inflated from its start
+    int64_t input_start = 0;
+    int64_t output_position = 0;
+    FrameIndex frames;
+    if (ReadFrameIndex(entry, frames)) {
+        size_t frame = std::min<size_t>(static_cast<size_t>(offset / frames.frame_size), frames.compressed_sizes.size());
+        for (size_t i = 0; i < frame; ++i) {
+            input_start += frames.compressed_sizes[i];
+        }
+        output_position = static_cast<int64_t>(frame) * frames.frame_size;
+        if (input_start > entry.compressed_size) {
+            std::cerr << "ZIP entry " << entry.name << " has a damaged frame index" << std::endl;
+            return false;
+        }
+    }
+
+    z_stream inflater;
+    memset(&inflater, 0, sizeof(inflater));
+    if (inflateInit2(&inflater, -MAX_WBITS) != Z_OK) {
+        std::cerr << "unable to initialise inflate: " << (inflater.msg ? inflater.msg : "") << std::endl;
+        return false;
+    }
+    std::vector<unsigned char> output(READ_CHUNK_SIZE);
+    int64_t range_end = offset + length;
+    int64_t consumed = input_start;
+    bool success = true;
+    int zerr = Z_OK;
+    while (success && output_position < range_end && zerr != Z_STREAM_END) {
+        if (consumed >= entry.compressed_size) {
+            std::cerr << "ZIP entry " << entry.name << " is truncated" << std::endl;
+            success = false;
+            break;
+        }
+        size_t chunk = static_cast<size_t>(std::min<int64_t>(entry.compressed_size - consumed, READ_CHUNK_SIZE));
+        const unsigned char* chunk_data = source.View(data_offset + consumed, chunk);
+        if (chunk_data == nullptr) {
+            if (!source.ReadAt(data_offset + consumed, input.data(), chunk)) {
+                std::cerr << "ZIP entry " << entry.name << " is truncated" << std::endl;
+                success = false;
+                break;
+            }
+            chunk_data = input.data();
+        }
+        consumed += chunk;
+
+        inflater.next_in = const_cast<unsigned char*>(chunk_data);
+        inflater.avail_in = static_cast<uInt>(chunk);
+        do {
+            inflater.next_out = output.data();
+            inflater.avail_out = static_cast<uInt>(output.size());
+            zerr = inflate(&inflater, Z_NO_FLUSH);
+            if (zerr != Z_OK && zerr != Z_STREAM_END) {
+                std::cerr << "Error inflating " << entry.name << ": " << (inflater.msg ? inflater.msg : "") << std::endl;
+                success = false;
+                break;
+            }
+            // hand over the part of this block inside the range
+            int64_t produced = static_cast<int64_t>(output.size() - inflater.avail_out);
+            int64_t from = std::max(offset, output_position);
+            int64_t to = std::min(range_end, output_position + produced);
+            if (from < to && !sink(reinterpret_cast<const char*>(output.data() + (from - output_position)), static_cast<size_t>(to - from))) {
+                success = false;
+                break;
+            }
+            output_position += produced;
+        } while (inflater.avail_out == 0 && zerr != Z_STREAM_END && output_position < range_end);
+    }
+    inflateEnd(&inflater);
+
+    if (success && output_position < range_end) {
+        std::cerr << "ZIP entry " << entry.name << " ended before " << range_end << " bytes" << std::endl;
+        success = false;
+    }
+    return success;
+}
+
+bool zip_file::EntrySpan(ByteSource& source, const ArchiveEntry& entry, int64_t& span) {
+    int64_t data_offset = 0;
+    if (!LocateEntryData(source, entry, data_offset)) {
+        return false;
+    }
+    int64_t span_end = data_offset + entry.compressed_size;
+    if (entry.flags & FLAG_DATA_DESCRIPTOR) {
+        // the descriptor signature is optional
+        unsigned char signature[4];
+        if (!source.ReadAt(span_end, signature, sizeof(signature))) {
+            std::cerr << "ZIP entry " << entry.name << " is missing its data descriptor" << std::endl;
+            return false;
+        }
+        span_end += (read_u32(signature) == SIG_DATA_DESCRIPTOR) ? 16 : 12;
+    }
+    span = span_end - entry.offset;
+    return true;
+}
+
+bool zip_file::ZipWriter::write(const void* buffer, size_t length) {
+    if (!positioned) {
+        if (fseeko(output, offset, SEEK_SET) != 0) {
+            std::cerr << "unable to set file pointer, errno " << errno << std::endl;
+            return false;
+        }
+        positioned = true;
+    }
+    if (length != 0 && fwrite(buffer, 1, length, output) != length) {
+        std::cerr << "unable to write ZIP data, errno " << errno << std::endl;
+        return false;
+    }
+    offset += length;
+    return true;
+}
+
+bool zip_file::CompressEntry(const std::string& name, const char* data, size_t size, const WriteOptions& options, CompressedEntry& compressed) {
+    compressed.crc32 = checksum::Crc32(0, data, size);
+    compressed.uncompressed_size = size;
+    compressed.method = METHOD_STORED;
+    compressed.data.clear();
+    compressed.frames = FrameIndex();
+
+    if (options.method == METHOD_DEFLATE && options.level != 0 && size != 0) {
+        // a huge member gets fewer, larger frames rather than an index
+        // that doesn't fit
+        size_t frame_size = options.frame_size;
+        while (frame_size != 0 && (size + frame_size - 1) / frame_size > MAX_FRAMES) {
+            frame_size *= 2;
+        }
+
+        z_stream deflater;
+        memset(&deflater, 0, sizeof(deflater));
+        if (deflateInit2(&deflater, options.level, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+            std::cerr << "unable to initialise deflate: " << (deflater.msg ? deflater.msg : "") << std::endl;
+            return false;
+        }
+        // every flush adds a few bytes the bound doesn't know about
+        size_t frame_count = frame_size ? (size + frame_size - 1) / frame_size : 1;
+        compressed.data.resize(deflateBound(&deflater, static_cast<uLong>(size)) + 16 * frame_count);
+        int zerr = Z_OK;
+        for (size_t position = 0; position < size && zerr == Z_OK; ) {
+            size_t frame_end = frame_size ? std::min(size, position + frame_size) : size;
+            int flush = (frame_end == size) ? Z_FINISH : Z_FULL_FLUSH;
+            uLong frame_start = deflater.total_out;
+            deflater.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data + position));
+            deflater.avail_in = static_cast<uInt>(frame_end - position);
+            do {
+                if (deflater.total_out == compressed.data.size()) {
+                    compressed.data.resize(compressed.data.size() * 2);
+                }
+                deflater.next_out = compressed.data.data() + deflater.total_out;
+                deflater.avail_out = static_cast<uInt>(compressed.data.size() - deflater.total_out);
+                zerr = deflate(&deflater, flush);
+            } while (zerr == Z_OK && (flush == Z_FINISH || deflater.avail_out == 0));
+            // a flush that exactly filled the buffer has nothing left to do
+            if (flush == Z_FULL_FLUSH && zerr == Z_BUF_ERROR && deflater.avail_in == 0) {
+                zerr = Z_OK;
+            }
+            if (frame_size) {
+                compressed.frames.compressed_sizes.push_back(static_cast<uint32_t>(deflater.total_out - frame_start));
+            }
+            position = frame_end;
+        }
+        compressed.data.resize(deflater.total_out);
+        deflateEnd(&deflater);
+        if (zerr != Z_STREAM_END) {
+            std::cerr << "Error deflating " << name << std::endl;
+            return false;
+        }
+        // incompressible data is cheaper to read back stored, and stored
+        // data needs no frames to be read from the middle
+        if (compressed.data.size() < size) {
+            compressed.method = METHOD_DEFLATE;
+            compressed.frames.frame_size = static_cast<uint32_t>(frame_size);
+            return true;
+        }
+        compressed.frames = FrameIndex();
+    }
+    compressed.data.assign(data, data + size);
+    return true;
+}
+
+bool zip_file::ZipWriter::WriteEntry(const std::string& name, const char* data, size_t size, const WriteOptions& options, const ArchiveEntry* previous, std::string& central_record) {
+    if (static_cast<int64_t>(size) >= ZIP32_LIMIT) {
+        std::cerr << "ZIP entry " << name << " would need ZIP64, which is not supported for writing" << std::endl;
+        return false;
+    }
+    CompressedEntry compressed;
+    return CompressEntry(name, data, size, options, compressed)
+        && WriteCompressed(name, compressed, previous, central_record);
+}
+
+bool zip_file::ZipWriter::WriteCompressed(const std::string& name, const CompressedEntry& compressed, const ArchiveEntry* previous, std::string& central_record) {
+    size_t size = compressed.uncompressed_size;
+    if (static_cast<int64_t>(size) >= ZIP32_LIMIT || offset >= ZIP32_LIMIT) {
+        std::cerr << "ZIP entry " << name << " would need ZIP64, which is not supported for writing" << std::endl;
+        return false;
+    }
+    uint16_t method = compressed.method;
+    uLong crc = compressed.crc32;
+    const unsigned char* payload = compressed.data.data();
+    size_t payload_size = compressed.data.size();
+
+    uint16_t flags = 0;
+    for (unsigned char c : name) {
+        if (c & 0x80) {
+            flags |= FLAG_UTF8;
+            break;
+        }
+    }
+    uint16_t dos_date = 0;
+    uint16_t dos_time = 0;
+    dos_date_time(dos_date, dos_time);
+
+    int64_t local_offset = offset;
+    // kept in both headers, so both describe the same entry
+    std::string extra = frame_index_extra(compressed);
+    std::string header;
+    append_u32(header, SIG_LOCAL_HEADER);
+    append_u16(header, VERSION_NEEDED);
+    append_u16(header, flags);
+    append_u16(header, method);
+    append_u16(header, dos_time);
+    append_u16(header, dos_date);
+    append_u32(header, static_cast<uint32_t>(crc));
+    append_u32(header, static_cast<uint32_t>(payload_size));
+    append_u32(header, static_cast<uint32_t>(size));
+    append_u16(header, static_cast<uint16_t>(name.size()));
+    append_u16(header, static_cast<uint16_t>(extra.size()));
+    header += name;
+    header += extra;
+    if (!write(header.data(), header.size()) || !write(payload, payload_size)) {
+        return false;
+    }
+
+    // a replaced entry keeps its permissions and comment
+    uint16_t made_by = VERSION_MADE_BY;
+    uint16_t internal_attributes = 0;
+    uint32_t external_attributes = DEFAULT_EXTERNAL_ATTRIBUTES;
+    std::string entry_comment;
+    if (previous != nullptr && previous->central_record.size() >= CENTRAL_HEADER_SIZE) {
+        const unsigned char* record = reinterpret_cast<const unsigned char*>(previous->central_record.data());
+        made_by = read_u16(record + 4);
+        internal_attributes = read_u16(record + 36);
+        external_attributes = read_u32(record + 38);
+        size_t comment_start = CENTRAL_HEADER_SIZE + read_u16(record + 28) + read_u16(record + 30);
+        entry_comment = previous->central_record.substr(comment_start, read_u16(record + 32));
+    }
+
+    central_record.clear();
+    append_u32(central_record, SIG_CENTRAL_HEADER);
+    append_u16(central_record, made_by);
+    append_u16(central_record, VERSION_NEEDED);
+    append_u16(central_record, flags);
+    append_u16(central_record, method);
+    append_u16(central_record, dos_time);
+    append_u16(central_record, dos_date);
+    append_u32(central_record, static_cast<uint32_t>(crc));
+    append_u32(central_record, static_cast<uint32_t>(payload_size));
+    append_u32(central_record, static_cast<uint32_t>(size));
+    append_u16(central_record, static_cast<uint16_t>(name.size()));
+    append_u16(central_record, static_cast<uint16_t>(extra.size()));
+    append_u16(central_record, static_cast<uint16_t>(entry_comment.size()));
+    append_u16(central_record, 0);
+    append_u16(central_record, internal_attributes);
+    append_u32(central_record, external_attributes);
+    append_u32(central_record, static_cast<uint32_t>(local_offset));
+    central_record += name;
+    central_record += extra;
+    central_record += entry_comment;
+    return true;
+}
+
+bool zip_file::ZipWriter::CopyEntry(ByteSource& source, const ArchiveEntry& entry, std::string& central_record) {
+    if (entry.central_record.size() < CENTRAL_HEADER_SIZE) {
+        std::cerr << "ZIP entry " << entry.name << " has no central directory record" << std::endl;
+        return false;
+    }
+    if (entry.compressed_size >= ZIP32_LIMIT || offset >= ZIP32_LIMIT) {
+        std::cerr << "ZIP entry " << entry.name << " would need ZIP64, which is not supported for writing" << std::endl;
+        return false;
+    }
+
+    int64_t span = 0;
+    if (!EntrySpan(source, entry, span)) {
+        return false;
+    }
+    int64_t span_end = entry.offset + span;
+
+    int64_t local_offset = offset;
+    std::vector<unsigned char> buffer(READ_CHUNK_SIZE);
+    for (int64_t position = entry.offset; position < span_end; ) {
+        size_t chunk = static_cast<size_t>(std::min<int64_t>(span_end - position, buffer.size()));
+        const unsigned char* chunk_data = source.View(position, chunk);
+        if (chunk_data == nullptr) {
+            if (!source.ReadAt(position, buffer.data(), chunk)) {
+                std::cerr << "ZIP entry " << entry.name << " is truncated" << std::endl;
+                return false;
+            }
+            chunk_data = buffer.data();
+        }
+        if (!write(chunk_data, chunk)) {
+            return false;
+        }
+        position += chunk;
+    }
+
+    central_record = entry.central_record;
+    patch_u32(central_record, 42, static_cast<uint32_t>(local_offset));
+    return true;
+}
+
+bool zip_file::ZipWriter::KeepEntry(const ArchiveEntry& entry, std::string& central_record) {
+    if (entry.central_record.size() < CENTRAL_HEADER_SIZE) {
+        std::cerr << "ZIP entry " << entry.name << " has no central directory record" << std::endl;
+        return false;
+    }
+    if (entry.offset >= ZIP32_LIMIT) {
+        std::cerr << "ZIP entry " << entry.name << " would need ZIP64, which is not supported for writing" << std::endl;
+        return false;
+    }
+    central_record = entry.central_record;
+    patch_u32(central_record, 42, static_cast<uint32_t>(entry.offset));
+    return true;
+}
+
+bool zip_file::ZipWriter::Finish(const std::vector<std::string>& central_records, const std::string& comment) {
+    if (central_records.size() >= ZIP32_ENTRY_LIMIT) {
+        std::cerr << "ZIP archive would need ZIP64 for " << central_records.size() << " entries" << std::endl;
+        return false;
+    }
+
+    int64_t directory_offset = offset;
+    for (const auto& record : central_records) {
+        if (!write(record.data(), record.size())) {
+            return false;
+        }
+    }
+    int64_t directory_size = offset - directory_offset;
+    if (offset >= ZIP32_LIMIT) {
+        std::cerr << "ZIP archive would need ZIP64 for a central directory at " << directory_offset << std::endl;
+        return false;
+    }
+
+    std::string eocd;
+    append_u32(eocd, SIG_END_OF_CENTRAL_DIR);
+    append_u16(eocd, 0);
+    append_u16(eocd, 0);
+    append_u16(eocd, static_cast<uint16_t>(central_records.size()));
+    append_u16(eocd, static_cast<uint16_t>(central_records.size()));
+    append_u32(eocd, static_cast<uint32_t>(directory_size));
+    append_u32(eocd, static_cast<uint32_t>(directory_offset));
+    append_u16(eocd, static_cast<uint16_t>(std::min<size_t>(comment.size(), MAX_COMMENT_SIZE)));
+    eocd.append(comment, 0, MAX_COMMENT_SIZE);
+    if (!write(eocd.data(), eocd.size())) {
+        return false;
+    }
+    if (fflush(output) != 0) {
+        std::cerr << "unable to flush ZIP archive, errno " << errno << std::endl;
+        return false;
+    }
+    return true;
+}
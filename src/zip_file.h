@@ -0,0 +1,124 @@
+#ifndef SAVED_GAME_FORMAT_ZIP_FILE_H__
+#define SAVED_GAME_FORMAT_ZIP_FILE_H__
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "byte_source.h"
+#include "entry_index.h"
+
+namespace saved_game_format_file {
+
+    namespace zip_file {
+
+        // ZIP compression methods this module can decode itself
+        const uint16_t METHOD_STORED = 0;
+        const uint16_t METHOD_DEFLATE = 8;
+
+        // sizes and CRC follow the data instead of preceding it
+        const uint16_t FLAG_DATA_DESCRIPTOR = 0x0008;
+
+        // zlib's default trade-off between speed and size
+        const int DEFAULT_LEVEL = -1;
+
+        // A deflated member can be cut into frames: the deflater is fully
+        // flushed every frame_size uncompressed bytes, so each frame starts
+        // on a byte boundary with no references into the ones before it and
+        // can be inflated on its own. The member stays ordinary deflate for
+        // every other reader; the frame sizes go in an extra field.
+        struct FrameIndex {
+            // uncompressed bytes per frame; 0 for an unframed member
+            uint32_t frame_size{0};
+            // compressed bytes of each frame, in order
+            std::vector<uint32_t> compressed_sizes{};
+        };
+
+        struct WriteOptions {
+            // METHOD_STORED or METHOD_DEFLATE
+            uint16_t method{METHOD_DEFLATE};
+            int level{DEFAULT_LEVEL};
+            // frame deflated members; 0 writes a single deflate stream
+            size_t frame_size{0};
+        };
+
+        // A member's data as it will be written, with what the headers need
+        struct CompressedEntry {
+            uint16_t method{METHOD_STORED};
+            uint32_t crc32{0};
+            size_t uncompressed_size{0};
+            std::vector<unsigned char> data{};
+            FrameIndex frames{};
+        };
+
+        // Locate the End Of Central Directory record and load every
+        // central directory record into the index. Returns false if the
+        // file is not a ZIP archive; the index is left empty in that case.
+        bool ReadCentralDirectory(ByteSource& source, EntryIndex& index);
+
+        // Returns true if ReadEntryData is able to decode the entry
+        bool CanReadEntry(const ArchiveEntry& entry);
+
+        // Find where the entry's data starts, past its local header
+        bool LocateEntryData(ByteSource& source, const ArchiveEntry& entry, int64_t& data_offset);
+
+        // Seek straight to the entry's local header and decode only its
+        // data into the sink, verifying the size and CRC from the central
+        // directory once the whole entry has been delivered.
+        bool ReadEntryData(ByteSource& source, const ArchiveEntry& entry, const data_sink& sink);
+
+        // The entry's frame index; false if the member isn't framed
+        bool ReadFrameIndex(const ArchiveEntry& entry, FrameIndex& frames);
+
+        // Decode length bytes of the entry from offset on (fewer if the
+        // entry ends first). Stored and framed entries start right at the
+        // range, others are inflated from the beginning; either way nothing
+        // past the range is decoded. Not CRC checked, the entry is not read
+        // in full.
+        bool ReadEntryRange(ByteSource& source, const ArchiveEntry& entry, int64_t offset, int64_t length, const data_sink& sink);
+
+        // Deflate (or store, if that is no smaller) a member's data, in
+        // frames if the options ask for them. Touches
+        // no shared state, so members can be compressed on several threads
+        // and handed to a ZipWriter afterwards.
+        bool CompressEntry(const std::string& name, const char* data, size_t size, const WriteOptions& options, CompressedEntry& compressed);
+
+        // Bytes the entry occupies in the data area: local header, data and
+        // data descriptor, measured from the local header and the
+        // descriptor's optional signature
+        bool EntrySpan(ByteSource& source, const ArchiveEntry& entry, int64_t& span);
+
+        // Writes ZIP entries from a given offset onwards, followed by the
+        // central directory. The central records are handed back to the
+        // caller so it decides their order in the directory.
+        class ZipWriter {
+            public:
+                ZipWriter(FILE* _output, int64_t _offset) : output(_output), offset(_offset) {}
+
+                // compress (or store, if that is no larger) and write a new entry;
+                // previous supplies the attributes of an entry being replaced
+                bool WriteEntry(const std::string& name, const char* data, size_t size, const WriteOptions& options, const ArchiveEntry* previous, std::string& central_record);
+                // write an entry already prepared by CompressEntry
+                bool WriteCompressed(const std::string& name, const CompressedEntry& compressed, const ArchiveEntry* previous, std::string& central_record);
+                // copy the local header, compressed data and descriptor untouched
+                bool CopyEntry(ByteSource& source, const ArchiveEntry& entry, std::string& central_record);
+                // the entry stays where it already is in the output file
+                bool KeepEntry(const ArchiveEntry& entry, std::string& central_record);
+                bool Finish(const std::vector<std::string>& central_records, const std::string& comment);
+
+                // where the next write will go; the end of the archive after Finish
+                inline int64_t Offset() const { return offset; }
+
+            private:
+                bool write(const void* buffer, size_t length);
+
+                FILE* output;
+                int64_t offset;
+                bool positioned{false};
+        };
+
+    }
+
+}
+
+#endif //SAVED_GAME_FORMAT_ZIP_FILE_H__